@@ -0,0 +1,49 @@
+/*
+   cli_bench.h
+    - Controller link benchmark for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_BENCH_H
+#define CLI_BENCH_H
+
+#include <stdint.h>
+
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_MAX_ITERATIONS 1000000
+
+/* Measure latency distribution and sustained request rate of the link */
+/* Hardware must be already connected */
+int bench_link(int iterations);
+
+/* Channel change is ~100 ms long */
+#define BENCH_CHANNEL_CHANGE_DEFAULT_ITERATIONS 20
+#define BENCH_CHANNEL_CHANGE_MAX_ITERATIONS 100
+
+/* Latency of the Unicable channel change: command, frame on the line, completion event */
+/* msg is the ODU command, it's sent without the repeats. Out of range iterations mean the default count */
+int bench_channel_change(int iterations, uint8_t channel, const uint8_t *msg, uint8_t len);
+
+/* Every switch cycle is ~100 ms long with the power supply off and on */
+#define BENCH_SWITCH_DEFAULT_ITERATIONS 100
+#define BENCH_SWITCH_MAX_ITERATIONS 10000
+
+/* Latency of the outputs switch: command, ACK and the settled output, */
+/* for every voltage, tone and power supply transition. The state is restored after */
+int bench_switch(int iterations);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+   cli_events.h
+    - Device events monitor for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_EVENTS_H
+#define CLI_EVENTS_H
+
+#include "device_communicator.h"
+
+/* Print one decoded event to stdout */
+void print_event(const struct hardware_event *ev);
+
+/* Print device events to stdout until interrupted */
+/* Hardware must be already connected */
+int monitor_events(void);
+
+#endif
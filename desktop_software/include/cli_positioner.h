@@ -0,0 +1,42 @@
+/*
+   cli_positioner.h
+    - Dish positioner control for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_POSITIONER_H
+#define CLI_POSITIONER_H
+
+#include <stdint.h>
+
+struct positioner_params {
+	const char *cmd;	/* goto:NN, store:NN, usals:<lon>, angle:<deg>, drive:<east|west>[:n], halt, limit:<east|west|off> */
+	double site_lat;
+	double site_lon;
+	int site_set;
+	float speed;		/* deg/s, 0 - default model */
+	int no_wait;
+};
+
+/* Parse "<lat>:<lon>" site coordinates, N/S and E/W suffixes are allowed */
+int positioner_parse_site(const char *str, struct positioner_params *params);
+
+/* Run the positioner command and wait for the estimated arrival */
+/* Hardware must be already connected */
+int positioner_cmd(uint8_t channel, const struct positioner_params *params);
+
+#endif
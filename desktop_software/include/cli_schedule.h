@@ -0,0 +1,47 @@
+/*
+   cli_schedule.h
+    - Device timed commands for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_SCHEDULE_H
+#define CLI_SCHEDULE_H
+
+#include "device_communicator.h"
+
+#define SCHEDULE_DEFAULT_DELAY_MS 10.0f
+
+struct schedule_params {
+	struct hardware_schedule_entry entries[HW_SCHEDULE_MAX_ENTRIES];
+	int count;
+	float delay_ms;		/* First start, from now */
+	int runs;			/* Number of the runs, 1 - once */
+	float period_ms;	/* Runs are started with this period of the device time */
+};
+
+/* Parse comma separated <ms>:<ps|1|2>:<on|off|13|18|low|high> entries */
+/* Returns the number of the entries or -1 on error */
+int schedule_parse(const char *str, struct schedule_params *params);
+
+/* Parse <runs>:<period ms> */
+int schedule_parse_repeat(const char *str, struct schedule_params *params);
+
+/* Load and run the schedule, print the execution times */
+/* Hardware must be already connected */
+int schedule_run(const struct schedule_params *params);
+
+#endif
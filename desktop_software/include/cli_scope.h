@@ -0,0 +1,42 @@
+/*
+   cli_scope.h
+    - Dump of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_SCOPE_H
+#define CLI_SCOPE_H
+
+#include <stdint.h>
+
+#define SCOPE_DEFAULT_RATE 20000
+
+/* Envelope frames per second with the 'columns' */
+#define SCOPE_FRAME_RATE 25
+
+struct scope_params {
+	uint32_t rate;		/* Hz */
+	uint8_t channels;	/* HW_SCOPE_* */
+	float seconds;		/* 0 - until interrupted */
+	int format;			/* WATCH_FORMAT_* */
+	int columns;		/* 0 - every sample, otherwise min/max envelope of every frame */
+};
+
+/* Stream the output voltages to stdout, hardware must be already connected */
+int scope_dump(const struct scope_params *params);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+   cli_spectrum.h
+    - Ripple spectrum reports of the streamed output voltages
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_SPECTRUM_H
+#define CLI_SPECTRUM_H
+
+#include <stdint.h>
+
+/* One report per channel every interval */
+#define SPECTRUM_REPORT_INTERVAL_S 1
+
+struct spectrum_params {
+	uint8_t channels;		/* HW_SCOPE_* */
+	float seconds;			/* 0 - until interrupted */
+	int format;				/* WATCH_FORMAT_* */
+	float limit_mv;			/* Ripple RMS alert, 0 - none */
+	float degrade_ratio;	/* Alert on the ripple growth over the learned baseline, 0 - none */
+};
+
+/* Analyse the ripple of the streamed outputs and print the reports to stdout, alerts to stderr */
+/* Hardware must be already connected. Returns number of the alerts or -1 on error */
+int spectrum_run(const struct spectrum_params *params);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+   cli_watch.h
+    - Continuous hardware state streaming for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLI_WATCH_H
+#define CLI_WATCH_H
+
+/* Output formats */
+#define WATCH_FORMAT_CSV  0x1
+#define WATCH_FORMAT_JSON 0x2
+
+struct watch_params {
+	float rate;		/* Samples per second, 0 - as fast as possible */
+	int format;		/* WATCH_FORMAT_* */
+	int fields;		/* HW_STATE_FIELD_* mask */
+};
+
+/* Parse comma separated fields list ("ps,voltages,polarity,band" or "all") */
+/* Returns HW_STATE_FIELD_* mask or -1 on error */
+int watch_parse_fields(const char *str);
+
+/* Parse format name ("csv" or "json") */
+/* Returns WATCH_FORMAT_* or -1 on error */
+int watch_parse_format(const char *str);
+
+/* Stream the hardware state to stdout until interrupted */
+/* Hardware must be already connected */
+int watch_hw_state(const struct watch_params *params);
+
+#endif
@@ -36,6 +36,31 @@
 #define BAND_LOW  0x4
 #define BAND_HIGH 0x5
 
+/* Hardware state fields, used to read only a part of the state */
+#define HW_STATE_FIELD_PS		0x1
+#define HW_STATE_FIELD_VOLTAGES	0x2
+#define HW_STATE_FIELD_POLARITY	0x4
+#define HW_STATE_FIELD_BAND		0x8
+#define HW_STATE_FIELD_ALL		(HW_STATE_FIELD_PS | HW_STATE_FIELD_VOLTAGES \
+									| HW_STATE_FIELD_POLARITY | HW_STATE_FIELD_BAND)
+
+/* Measured 22KHz tone levels, requires the firmware tone detector, not a part of HW_STATE_FIELD_ALL */
+/* Read together with the voltages if both are requested */
+#define HW_STATE_FIELD_TONE		0x10
+
+/* Tone level can't be measured at the current ADC sample rate */
+#define HW_TONE_LEVEL_UNKNOWN	-1.0f
+
+/* Measured tone level of the present tone, V peak-to-peak of the output. Nominal is 0.65 V */
+#define HW_TONE_PRESENT_MIN_V	0.2f
+
+/* Firmware averaging window of the output voltages, log2 of the samples count */
+#define HW_ADC_AVG_WINDOW_MIN 4
+#define HW_ADC_AVG_WINDOW_MAX 12
+
+/* Failed state reads in a row tolerated by the pollers, the next one means the link is lost */
+#define HW_MAX_READ_FAILS 4
+
 /* Hardware state local storage */
 struct hardware_state {
 	int hw_connected:1;
@@ -46,24 +71,277 @@ struct hardware_state {
     int ch1_band_low:1;
     int ch2_polarity_vr:1;
     int ch2_band_low:1;
+    float ch1_tone_level;	/* V peak-to-peak of the 22KHz fundamental or HW_TONE_LEVEL_UNKNOWN */
+    float ch2_tone_level;
+};
+
+/* Output voltage statistics over the 204.8 ms window, V */
+struct voltage_stats {
+	float min;
+	float max;
+	float mean;
+	float rms;	/* RMS of the ripple, without the mean */
+};
+
+/* Firmware boot stages, ms from the firmware start to the end of the stage */
+#define HW_BOOT_STAGE_CLOCKS			0	/* HAL and system clock */
+#define HW_BOOT_STAGE_OUTPUTS			1	/* Outputs state restored */
+#define HW_BOOT_STAGE_USB_START			2	/* USB device started */
+#define HW_BOOT_STAGE_PERIPHERALS		3	/* DiSEqC, scheduler, ADC and the other modules */
+#define HW_BOOT_STAGE_READY				4	/* Commands are processed */
+#define HW_BOOT_STAGE_USB_CONFIGURED	5	/* Host has configured the device */
+#define HW_BOOT_STAGE_COUNT				6
+
+#define HW_BOOT_TIME_NOT_REACHED	-1.0f
+
+struct hardware_boot_times {
+	float stage_ms[HW_BOOT_STAGE_COUNT];	/* HW_BOOT_TIME_NOT_REACHED if not reached */
+	int saturated[HW_BOOT_STAGE_COUNT];		/* Later than the value, 655 ms */
+};
+
+/* Unsolicited device events */
+#define HW_EVENT_MAX_PAYLOAD 56
+
+#define HW_EVENT_FAULT 0x01
+#define HW_EVENT_DISEQC_TX_DONE 0x02
+#define HW_EVENT_DISEQC_RX 0x03
+#define HW_EVENT_UNICABLE_DONE 0x04
+#define HW_EVENT_SCHEDULE_EXEC 0x05
+#define HW_EVENT_SWITCH_DONE 0x06
+#define HW_EVENT_SCOPE_BLOCK 0x07
+
+struct hardware_event {
+	uint8_t id;		/* HW_EVENT_* */
+	uint8_t len;
+	uint8_t data[HW_EVENT_MAX_PAYLOAD];
+};
+
+/* Output fault, power supply is switched off by the device */
+#define HW_FAULT_UNDERVOLTAGE 0x01
+#define HW_FAULT_OVERVOLTAGE  0x02
+
+struct hardware_fault {
+	uint32_t timestamp_us;	/* Device time */
+	uint8_t channel;		/* LNB_CHANNEL_* */
+	uint8_t type;			/* HW_FAULT_* */
+	float voltage;			/* Output voltage at the moment of the fault */
+	uint8_t retry;			/* Hiccup retry number, 0 - the first fault */
+};
+
+/* DiSEqC message is transmitted, tone signal is restored */
+struct hardware_diseqc_done {
+	uint32_t timestamp_us;	/* Device time */
+	uint8_t channel;		/* LNB_CHANNEL_* */
+};
+
+#define HW_DISEQC_MAX_MSG_LEN 6
+
+/* Tone burst (mini DiSEqC) */
+#define HW_TONE_BURST_NONE	0x0
+#define HW_TONE_BURST_A		0x1
+#define HW_TONE_BURST_B		0x2
+
+/* DiSEqC receiver modes */
+#define HW_DISEQC_RX_MODE_OFF		0x0	/* Default, the tone detector is optional */
+#define HW_DISEQC_RX_MODE_REPLY		0x1	/* Replies to our messages */
+#define HW_DISEQC_RX_MODE_MONITOR	0x2	/* All messages on the bus, for example from the receiver */
+
+/* Received message flags */
+#define HW_DISEQC_RX_PARITY_ERROR	0x01
+#define HW_DISEQC_RX_INCOMPLETE		0x02
+#define HW_DISEQC_RX_REPLY			0x04
+#define HW_DISEQC_RX_OVERRUN		0x08
+
+#define HW_DISEQC_RX_MAX_MSG_LEN 8
+
+/* DiSEqC message captured on the channel line */
+struct hardware_diseqc_msg {
+	uint32_t timestamp_us;	/* Device time of the first bit */
+	uint8_t channel;		/* LNB_CHANNEL_* */
+	uint8_t flags;			/* HW_DISEQC_RX_* */
+	uint8_t len;
+	uint8_t data[HW_DISEQC_RX_MAX_MSG_LEN];
+};
+
+/* Unicable ODU command status */
+#define HW_UNICABLE_OK			0x00
+#define HW_UNICABLE_BUS_BUSY	0x01	/* Line was never free, nothing is sent */
+
+#define HW_UNICABLE_MAX_REPEATS 7
+
+/* Unicable ODU command is completed */
+struct hardware_unicable_done {
+	uint32_t timestamp_us;	/* Device time of the last frame end */
+	uint8_t channel;		/* LNB_CHANNEL_* */
+	uint8_t status;			/* HW_UNICABLE_* */
+	uint8_t sent;			/* Transmitted frames */
+	uint8_t backoffs;		/* Delays because of the busy line */
+};
+
+/* Scheduled outputs control */
+#define HW_SCHEDULE_PS			0x1	/* value - ENABLE/DISABLE */
+#define HW_SCHEDULE_POLARITY	0x2	/* value - POLARITY_* */
+#define HW_SCHEDULE_BAND		0x3	/* value - BAND_* */
+
+#define HW_SCHEDULE_MAX_ENTRIES 64
+
+struct hardware_schedule_entry {
+	uint32_t offset_us;		/* From the schedule start */
+	uint8_t type;			/* HW_SCHEDULE_* */
+	uint8_t channel;		/* LNB_CHANNEL_*, not used for PS */
+	uint8_t value;
+};
+
+/* Output voltage settle status */
+#define HW_SETTLE_OK		0x00
+#define HW_SETTLE_TIMEOUT	0x01	/* Not settled within 500 ms */
+
+/* Settle target of the channel output */
+#define HW_SWITCH_TARGET_OFF	0	/* Power supply is disabled */
+#define HW_SWITCH_TARGET_13V	13
+#define HW_SWITCH_TARGET_18V	18
+
+/* Output voltage is settled after the voltage or power supply change */
+struct hardware_switch_done {
+	uint32_t timestamp_us;	/* Device time of the change */
+	uint8_t channel;		/* LNB_CHANNEL_* */
+	uint8_t status;			/* HW_SETTLE_* */
+	uint8_t target;			/* HW_SWITCH_TARGET_* */
+	uint32_t settle_us;		/* From the change until the output is within the tolerance */
+	float voltage;			/* Last measured output voltage */
+};
+
+/* Scope mode channels mask */
+#define HW_SCOPE_CH1	0x1
+#define HW_SCOPE_CH2	0x2
+#define HW_SCOPE_BOTH	(HW_SCOPE_CH1 | HW_SCOPE_CH2)
+
+/* Sample rate limits, Hz. Max is what the USB link sustains with the both channels */
+#define HW_SCOPE_RATE_MIN 1000
+#define HW_SCOPE_RATE_MAX 50000
+
+#define HW_SCOPE_BLOCK_SAMPLES 16
+
+/* Raw ADC samples block, the sequence number gap means the lost blocks */
+struct hardware_scope_block {
+	uint16_t seq;
+	uint8_t channels;		/* HW_SCOPE_* */
+	uint32_t timestamp_us;	/* Device time of the last sample */
+	uint8_t count;			/* Samples per channel */
+	uint16_t samples[2][HW_SCOPE_BLOCK_SAMPLES];	/* 12 bit ADC codes, only the enabled channels */
+};
+
+/* Scheduled command is executed by the device */
+struct hardware_schedule_exec {
+	uint8_t index;			/* Entry number */
+	uint8_t type;			/* HW_SCHEDULE_* */
+	uint8_t channel;
+	uint8_t value;
+	uint32_t planned_us;	/* Device time */
+	uint32_t actual_us;		/* Device time */
 };
 
 /* Callback functions for the reader thread */
 typedef void (*on_device_data) (struct hardware_state *hw_state, void *user_data);
 typedef void (*comm_error_handler) (void *user_data);
 
-/* Connect to the hardware */
+/* Port name of the in-process device emulator, see device_emulator.h */
+#define HW_EMULATOR_PORT "emulator"
+
+/* Connect to the hardware, HW_EMULATOR_PORT - to the emulator */
 int hardware_connect(const char *sdev_path);
 /* Disconnect from the hardware and clean resources */
 int hardware_disconnect();
 
 /* Get the full state of the hardware */
 int hardware_read_full_state(struct hardware_state *hw_state);
+/* Set the power supply, polarity and band of both channels at once */
+int hardware_write_full_state(const struct hardware_state *hw_state);
+/* Get only the selected fields (HW_STATE_FIELD_*) of the hardware state */
+int hardware_read_state(struct hardware_state *hw_state, int fields);
+/* Get the firmware boot stages times since the last reset */
+int hardware_read_boot_times(struct hardware_boot_times *times);
+/* Get the output voltage ripple statistics of the channel */
+int hardware_read_voltage_stats(uint8_t channel, struct voltage_stats *stats);
 
 /* Hardware routines */
 int hardware_set_ps_state(uint8_t enabled);
 int hardware_set_channel_polarity(uint8_t channel, uint8_t polarity);
 int hardware_set_channel_band(uint8_t channel, uint8_t band);
+int hardware_set_adc_avg_window(uint8_t log2_samples);
+/* Outputs restored on boot, HW_RESTORE_* mask. Device saves them 2 s after the last change */
+int hardware_set_restore_mask(uint8_t mask);
+int hardware_get_restore_mask(uint8_t *mask);
+
+/* Output protection, thresholds are V of the output, 0 - disabled */
+int hardware_set_protection(float low, float high);
+/* Hiccup mode: retry after interval_ms (0 - disabled), max_retries 0 - unlimited */
+int hardware_set_protection_hiccup(int interval_ms, int max_retries);
+
+/* Output settle detection, target levels and tolerance are V of the output */
+/* Levels are the real outputs of the board, nominal 13 and 18 V by default */
+int hardware_set_settle_detection(float target_13v, float target_18v, float tolerance);
+/* Decode HW_EVENT_SWITCH_DONE */
+int hardware_parse_switch_done_event(const struct hardware_event *ev, struct hardware_switch_done *done);
+/* Wait for the settled output of the channel (0 - any channel), other events are dropped */
+int hardware_wait_switch_done(uint8_t channel, struct hardware_switch_done *done, int timeout_ms);
+
+/* Stream the raw ADC samples of the channels (HW_SCOPE_*), returns the actual rate or -errno */
+/* Device rate is 24 MHz divided by the integer, so it's the nearest achievable one */
+int hardware_scope_start(uint8_t channels, uint32_t rate_hz);
+/* Stop streaming, the device returns to the normal ADC rate */
+int hardware_scope_stop(void);
+/* Decode HW_EVENT_SCOPE_BLOCK */
+int hardware_parse_scope_block(const struct hardware_event *ev, struct hardware_scope_block *blk);
+/* Scale of the raw samples to V of the output, including the board voltage divider */
+float hardware_scope_volts_per_code(void);
+
+/* Wait for the device event, returns -EAGAIN or -ETIMEDOUT if there is no event */
+int hardware_wait_event(struct hardware_event *ev, int timeout_ms);
+/* Decode HW_EVENT_FAULT */
+int hardware_parse_fault_event(const struct hardware_event *ev, struct hardware_fault *fault);
+
+/* Send DiSEqC 1.x message (1 - 6 bytes), returns -EBUSY if the previous one is not finished */
+int hardware_diseqc_send(uint8_t channel, const uint8_t *msg, uint8_t len);
+/* Decode HW_EVENT_DISEQC_TX_DONE */
+int hardware_parse_diseqc_done_event(const struct hardware_event *ev, struct hardware_diseqc_done *done);
+/* Switch sequence timed by the device: polarity (0 - unchanged), 15 ms, optional message (len 0 - none), */
+/* 15 ms, HW_TONE_BURST_*, 15 ms, band. Completion is reported by HW_EVENT_DISEQC_TX_DONE */
+int hardware_diseqc_sequence(uint8_t channel, uint8_t polarity, const uint8_t *msg, uint8_t len,
+								uint8_t burst, uint8_t band);
+/* Enable the tone for the exact time, 0.1 ms resolution, up to 6.5 s */
+int hardware_tone_gate(uint8_t channel, int duration_us);
+/* Outputs restored by the device on boot from the state saved in its flash */
+/* Nothing is restored by default, so the power supply stays off after the reset */
+#define HW_RESTORE_PS				0x01
+#define HW_RESTORE_CH1_POLARITY		0x02
+#define HW_RESTORE_CH1_BAND			0x04
+#define HW_RESTORE_CH2_POLARITY		0x08
+#define HW_RESTORE_CH2_BAND			0x10
+#define HW_RESTORE_OUTPUTS			(HW_RESTORE_CH1_POLARITY | HW_RESTORE_CH1_BAND | HW_RESTORE_CH2_POLARITY | HW_RESTORE_CH2_BAND)
+#define HW_RESTORE_ALL				(HW_RESTORE_PS | HW_RESTORE_OUTPUTS)
+
+/* Select the DiSEqC receiver mode, HW_DISEQC_RX_MODE_* */
+int hardware_set_diseqc_rx_mode(uint8_t mode);
+/* Decode HW_EVENT_DISEQC_RX */
+int hardware_parse_diseqc_rx_event(const struct hardware_event *ev, struct hardware_diseqc_msg *msg);
+
+/* Send Unicable ODU command (1 - 6 bytes) when the line is free and repeat it */
+/* after the random delays. Completion is reported by HW_EVENT_UNICABLE_DONE */
+int hardware_unicable_send(uint8_t channel, const uint8_t *msg, uint8_t len, uint8_t repeats);
+/* Decode HW_EVENT_UNICABLE_DONE */
+int hardware_parse_unicable_done_event(const struct hardware_event *ev, struct hardware_unicable_done *done);
+
+/* Replace the device schedule, offsets must not decrease */
+int hardware_schedule_load(const struct hardware_schedule_entry *entries, int count);
+/* Start the loaded schedule after delay_us, every entry is reported by HW_EVENT_SCHEDULE_EXEC */
+int hardware_schedule_start(uint32_t delay_us);
+/* Start the loaded schedule at the device time, for example the previous start plus the period */
+int hardware_schedule_start_at(uint32_t device_time_us);
+/* Stop and drop the device schedule */
+int hardware_schedule_clear(void);
+/* Decode HW_EVENT_SCHEDULE_EXEC */
+int hardware_parse_schedule_event(const struct hardware_event *ev, struct hardware_schedule_exec *exec);
 
 /* Configure data and error cb functions */
 void hardware_set_reader_cb(on_device_data func, void *user_data);
@@ -76,4 +354,7 @@ int hardware_stop_reader_thread();
 /* Get readable error string */
 char *hardware_get_last_error_desc();
 
+/* CLOCK_MONOTONIC time, ns. Common time base of the timeouts and deadlines */
+uint64_t hardware_monotonic_ns();
+
 #endif
@@ -0,0 +1,31 @@
+/*
+   device_emulator.h
+    - In-process emulator of the LNB controller
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEVICE_EMULATOR_H
+#define DEVICE_EMULATOR_H
+
+/* Start the emulator thread, returns the host side descriptor of the link or -errno */
+/* The link is a socket pair, so the whole host stack is used as with the real device */
+int emulator_start(void);
+
+/* Stop the thread and close the link */
+void emulator_stop(void);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+   gui_scope.h
+    - Oscilloscope window of the streamed output voltages
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GUI_SCOPE_H
+#define GUI_SCOPE_H
+
+#include <gtk/gtk.h>
+
+/* Start streaming of the both channels and show the window, hardware must be connected */
+/* Toggle button is released when the window is closed. Returns 0 or -errno */
+int gui_scope_open(GtkWindow *parent, GtkToggleButton *button);
+
+/* Close the window and stop streaming, does nothing if it's not open */
+void gui_scope_close(void);
+
+#endif
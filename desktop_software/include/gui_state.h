@@ -39,6 +39,7 @@
 #define UI_STR_ERROR_CBOX "Couldn't get serial device path from the UI control"
 #define UI_STR_HW_COMM_FAIL "Couldn't communicate with hardware"
 #define UI_STR_READER_THREAD_FAIL "Unable to start reader thread"
+#define UI_STR_SCOPE_FAIL "Unable to start the voltage streaming, the firmware may not support it"
 
 /* lnb_controller UI elements */
 struct lnb_ctrl_gui {
@@ -59,6 +60,7 @@ struct lnb_ctrl_gui {
 	GtkWidget *ch2_polarity_sw_hl;
 	GtkWidget *ch2_band_sw_low;
 	GtkWidget *ch2_band_sw_high;
+	GtkWidget *scope_button;
 };
 
 #endif
@@ -0,0 +1,98 @@
+/*
+   positioner.h
+	- DiSEqC 1.2 and USALS dish positioner control
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef POSITIONER_H
+#define POSITIONER_H
+
+#include <stdint.h>
+
+#define POSITIONER_EAST 0x1
+#define POSITIONER_WEST 0x2
+
+/* Soft limits */
+#define POSITIONER_LIMIT_EAST 0x1
+#define POSITIONER_LIMIT_WEST 0x2
+#define POSITIONER_LIMITS_OFF 0x3
+
+/* Typical motor speed, deg/s */
+#define POSITIONER_DEFAULT_SPEED_13V 1.2f
+#define POSITIONER_DEFAULT_SPEED_18V 1.8f
+
+/* Typical mechanical range, deg from the south */
+#define POSITIONER_DEFAULT_MAX_ANGLE 75.0
+
+#define POSITIONER_MAX_STORED 256
+
+/* State of the positioner on the channel */
+/* Angles are degrees from the south, east is positive */
+struct positioner {
+	uint8_t channel;		/* LNB_CHANNEL_* */
+	double site_lat;		/* North is positive */
+	double site_lon;		/* East is positive */
+
+	/* Motor model */
+	float speed_13v;		/* deg/s */
+	float speed_18v;		/* deg/s */
+	float start_delay;		/* s, motor start and stop */
+	double max_angle;
+
+	/* Last known position */
+	int angle_known;
+	double angle;
+
+	/* Stored positions, known only if stored by us */
+	uint8_t stored_known[POSITIONER_MAX_STORED];
+	double stored_angle[POSITIONER_MAX_STORED];
+
+	/* Estimated arrival, monotonic ns */
+	uint64_t eta_ns;
+
+	/* Estimation for the unknown start or target position */
+	int eta_worst_case;
+};
+
+/* Default motor model, position is unknown */
+void positioner_init(struct positioner *pos, uint8_t channel, double site_lat, double site_lon);
+
+/* USALS motor angle for the satellite at sat_lon (east is positive) */
+double positioner_usals_angle(double site_lat, double site_lon, double sat_lon);
+
+/* Move to the satellite with USALS, site coordinates must be set */
+int hardware_positioner_goto_sat(struct positioner *pos, double sat_lon);
+/* Move to the angle (GotoX), 1/16 deg resolution */
+int hardware_positioner_goto_angle(struct positioner *pos, double angle);
+/* Move to the stored position, 0 - reference (0 deg) */
+int hardware_positioner_goto_nn(struct positioner *pos, uint8_t nn);
+/* Store the current position */
+int hardware_positioner_store_nn(struct positioner *pos, uint8_t nn);
+
+/* Drive POSITIONER_EAST/WEST: seconds 1 - 127, steps 1 - 128 (negative), 0 - until halt */
+int hardware_positioner_drive(struct positioner *pos, int direction, int amount);
+int hardware_positioner_halt(struct positioner *pos);
+
+/* Set the soft limit at the current position or disable limits, POSITIONER_LIMIT* */
+int hardware_positioner_set_limit(struct positioner *pos, int limit);
+
+/* Seconds left until the dish is expected to arrive, -1 - moving until halt */
+float hardware_positioner_eta(const struct positioner *pos);
+/* Sleep until the estimated arrival, returns -ETIMEDOUT if it's later than timeout_ms */
+int hardware_positioner_wait(const struct positioner *pos, int timeout_ms);
+
+#endif
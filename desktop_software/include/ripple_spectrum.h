@@ -0,0 +1,104 @@
+/*
+   ripple_spectrum.h
+    - Ripple spectrum analyser of the streamed output voltages
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RIPPLE_SPECTRUM_H
+#define RIPPLE_SPECTRUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scope_fft.h"
+
+#define RIPPLE_CHANNELS 2
+
+/* 4096 points: 12.2 Hz bins at 50 KHz */
+#define RIPPLE_FFT_LOG2 12
+
+#define RIPPLE_TONE_HZ 22000.0f
+
+/* Tone is close to the square wave, its harmonics are excluded from the ripple too */
+/* At 50 KHz they all fold to the 2 KHz grid, 25 harmonics cover it */
+#define RIPPLE_TONE_HARMONICS 25
+
+/* Strongest spectral components reported besides the tone */
+#define RIPPLE_PEAKS 3
+
+/* Reports with the output present, averaged to the baseline of the degradation alert */
+#define RIPPLE_BASELINE_REPORTS 5
+
+#define RIPPLE_DEFAULT_DEGRADE_RATIO 2.0f
+
+/* Alert bits of the report */
+#define RIPPLE_ALERT_LIMIT 0x01		/* Above the absolute limit */
+#define RIPPLE_ALERT_DEGRADED 0x02	/* Grown over the baseline */
+
+struct ripple_peak {
+	float freq_hz;
+	float amplitude_v;		/* Peak */
+};
+
+/* Report of one channel */
+struct ripple_report {
+	float mean_v;
+	float rms_v;			/* AC without the tone and its harmonics, from the spectrum */
+	float pp_v;				/* Peak to peak of the samples, with the tone */
+	float tone_freq_hz;		/* Where the 22KHz tone is seen, aliased above the Nyquist frequency */
+	float tone_v;			/* Amplitude of the tone fundamental, peak */
+	int peaks;
+	struct ripple_peak peak[RIPPLE_PEAKS];
+	float baseline_rms_v;	/* 0 - not learned yet */
+	int alert;				/* RIPPLE_ALERT_* */
+};
+
+/* Analyser of the both channels, owns its FFT and buffers, so the several may run in parallel */
+struct ripple_spectrum {
+	struct scope_fft fft;
+	uint32_t rate;
+	float limit_v;			/* 0 - no absolute limit */
+	float degrade_ratio;	/* 0 - no degradation alert */
+	size_t tone_bin[RIPPLE_TONE_HARMONICS];	/* Where the tone harmonics are seen, aliased */
+
+	float *frame[RIPPLE_CHANNELS];
+	float *power[RIPPLE_CHANNELS];
+	double *power_sum[RIPPLE_CHANNELS];
+	size_t fill;
+	int frames;
+
+	/* Time domain stats since the last report */
+	float min[RIPPLE_CHANNELS];
+	float max[RIPPLE_CHANNELS];
+	double sum[RIPPLE_CHANNELS];
+	uint64_t count;
+
+	float baseline_sum[RIPPLE_CHANNELS];
+	int baseline_reports[RIPPLE_CHANNELS];
+};
+
+/* Returns 0 or -errno */
+int ripple_spectrum_init(struct ripple_spectrum *rs, uint32_t rate, float limit_v, float degrade_ratio);
+
+void ripple_spectrum_free(struct ripple_spectrum *rs);
+
+/* Frames of the FFT size with 50% overlap are transformed as soon as they are filled */
+void ripple_spectrum_feed(struct ripple_spectrum *rs, const float *ch1, const float *ch2, size_t n);
+
+/* Welch average of the frames since the last report, returns 0 or -EAGAIN if there was no complete frame */
+int ripple_spectrum_report(struct ripple_spectrum *rs, struct ripple_report report[RIPPLE_CHANNELS]);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+   scope_dsp.h
+    - Vectorised kernels for the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCOPE_DSP_H
+#define SCOPE_DSP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Raw ADC codes to V, see hardware_scope_volts_per_code() */
+void scope_codes_to_volts(const uint16_t *codes, float *volts, size_t n, float scale);
+
+/* Min/max envelope of n samples in the columns, for example pixels of the screen */
+/* Column covers n / columns samples, if there are less samples than columns they are repeated */
+void scope_decimate_minmax(const float *in, size_t n, float *min, float *max, int columns);
+
+/* Radix-2 butterflies of the FFT stage, n >= 1 pairs: u' = u + v * w, v' = u - v * w */
+/* Split complex format: real and imaginary parts in the separate arrays */
+void scope_butterflies(float *ur, float *ui, float *vr, float *vi, const float *wr, const float *wi, size_t n);
+
+/* Instruction set of the kernels: "sse2", "neon" or "scalar" */
+const char *scope_dsp_kernels(void);
+
+#endif
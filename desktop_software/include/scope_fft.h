@@ -0,0 +1,52 @@
+/*
+   scope_fft.h
+    - Windowed FFT of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCOPE_FFT_H
+#define SCOPE_FFT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCOPE_FFT_LOG2_MIN 3
+#define SCOPE_FFT_LOG2_MAX 16
+
+/* Transform of the fixed size with the precomputed tables and work buffers */
+/* One per thread, the work buffers are not shared */
+struct scope_fft {
+	size_t size;
+	float *window;			/* Hann */
+	float window_power;		/* Sum of the squared window */
+	float *tw_re;			/* Twiddles of every stage one after another, size - 1 */
+	float *tw_im;
+	uint32_t *bitrev;
+	float *re;
+	float *im;
+};
+
+/* Allocate the tables of the 2^log2_size transform, returns 0 or -errno */
+int scope_fft_init(struct scope_fft *fft, int log2_size);
+
+void scope_fft_free(struct scope_fft *fft);
+
+/* Windowed power spectra of two real signals of the fft size, computed by one complex transform */
+/* Outputs are size / 2 + 1 bins, single-sided, V^2: the sum of the bins is the mean square of the signal */
+void scope_fft_power2(struct scope_fft *fft, const float *a, const float *b, float *pa, float *pb);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+   scope_ring.h
+    - Lock-free ring of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCOPE_RING_H
+#define SCOPE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* 2.6 s of the both channels at the max rate */
+#define SCOPE_RING_LEN_LOG2 17
+#define SCOPE_RING_LEN (1UL << SCOPE_RING_LEN_LOG2)
+
+#define SCOPE_RING_CHANNELS 2
+
+/* Single producer, the producer never waits: the oldest samples are overwritten */
+/* and the readers detect it by the position. Any number of readers is allowed */
+struct scope_ring {
+	float data[SCOPE_RING_CHANNELS][SCOPE_RING_LEN];
+	_Atomic uint64_t head;	/* Samples written since reset */
+};
+
+void scope_ring_reset(struct scope_ring *ring);
+
+/* Producer: append n samples of the both channels */
+void scope_ring_push(struct scope_ring *ring, const float *ch1, const float *ch2, size_t n);
+
+/* Samples written since reset */
+uint64_t scope_ring_head(struct scope_ring *ring);
+
+/* Sequential reader from the position *tail, up to max samples */
+/* Overwritten samples are skipped and added to *lost. Returns number of the copied samples */
+size_t scope_ring_read(struct scope_ring *ring, uint64_t *tail, float *ch1, float *ch2,
+						size_t max, uint64_t *lost);
+
+/* Last n samples, n is not more than a half of the ring. Returns number of the copied samples */
+size_t scope_ring_latest(struct scope_ring *ring, float *ch1, float *ch2, size_t n);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+   scope_stream.h
+    - Reception of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCOPE_STREAM_H
+#define SCOPE_STREAM_H
+
+#include <stdint.h>
+#include "scope_ring.h"
+
+struct scope_stream_stats {
+	uint8_t channels;		/* HW_SCOPE_* */
+	uint32_t rate;			/* Actual sample rate, Hz */
+	uint64_t blocks;		/* Received blocks */
+	uint64_t lost_blocks;	/* Sequence number gaps, lost by the device or the host event queue */
+};
+
+/* Start the device scope mode and the receiver thread, returns the actual rate or -errno */
+/* Samples of the channels are converted to V of the outputs and go to the ring, */
+/* disabled channel is zero. Hardware must be already connected */
+/* Receiver takes all the device events, other events are dropped while it's running */
+int scope_stream_start(uint8_t channels, uint32_t rate_hz);
+
+/* Stop the receiver and the device scope mode */
+int scope_stream_stop(void);
+
+int scope_stream_running(void);
+
+/* Ring of the received samples, valid until the next start */
+struct scope_ring *scope_stream_ring(void);
+
+void scope_stream_get_stats(struct scope_stream_stats *stats);
+
+#endif
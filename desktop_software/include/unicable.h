@@ -0,0 +1,66 @@
+/*
+   unicable.h
+    - Unicable (EN50494) and JESS (EN50607) single cable distribution commands
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNICABLE_H
+#define UNICABLE_H
+
+#include <stdint.h>
+#include "device_communicator.h"
+
+#define UNICABLE_EN50494 0x1	/* Unicable I, up to 8 user bands */
+#define UNICABLE_EN50607 0x2	/* JESS / Unicable II, up to 32 user bands */
+
+/* IF range of the tuner, MHz */
+#define UNICABLE_IF_MIN_MHZ 950.0
+#define UNICABLE_IF_MAX_MHZ 2150.0
+
+/* Bank bits of the committed switches, EN50607 has the option bit too */
+#define UNICABLE_BANK_HIGH_BAND		0x1
+#define UNICABLE_BANK_HORIZONTAL	0x2
+#define UNICABLE_BANK_POSITION_B	0x4
+#define UNICABLE_BANK_OPTION_B		0x8
+
+/* No PIN protection */
+#define UNICABLE_NO_PIN -1
+
+/* Repeats of the command, the device separates them by the random delays */
+#define UNICABLE_DEFAULT_REPEATS 1
+
+/* User band (SCR) of the receiver */
+struct unicable_config {
+	int standard;		/* UNICABLE_EN50494 or UNICABLE_EN50607 */
+	uint8_t ub;			/* User band number, from 0 */
+	double ub_freq_mhz;	/* User band center frequency, EN50494 only */
+	int pin;			/* 0 - 255 or UNICABLE_NO_PIN */
+};
+
+/* Build ODU_ChannelChange (EN50494) or ODU_Channel_change (EN50607) message */
+/* for the tuner IF frequency and the bank. Returns the message length or -EINVAL */
+int unicable_channel_change_msg(const struct unicable_config *cfg, double if_mhz, uint8_t bank,
+								uint8_t *msg);
+
+/* Send the channel change, the device avoids the busy line and repeats it */
+int hardware_unicable_channel_change(uint8_t channel, const struct unicable_config *cfg,
+										double if_mhz, uint8_t bank, uint8_t repeats);
+
+/* Wait for the completion of the command on the channel, other events are dropped */
+int hardware_unicable_wait(uint8_t channel, struct hardware_unicable_done *done, int timeout_ms);
+
+#endif
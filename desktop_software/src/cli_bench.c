@@ -0,0 +1,625 @@
+/*
+   cli_bench.c
+    - Controller link benchmark for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "cli_bench.h"
+#include "device_communicator.h"
+#include "unicable.h"
+
+/* Duration of the sustained rate test */
+#define BENCH_RATE_TEST_NS 2000000000ULL
+
+/* Device may wait up to ~2 s for the busy line */
+#define BENCH_CHANNEL_CHANGE_TIMEOUT_MS 3000
+
+/* Device reports the not settled output after 500 ms */
+#define BENCH_SWITCH_SETTLE_TIMEOUT_MS 2000
+
+/* Output must stay in the tolerance band for this time before the event */
+#define BENCH_SWITCH_HOLD_US 2000
+
+/* Histogram buckets are powers of 2 us */
+#define BENCH_HIST_BUCKETS 24
+#define BENCH_HIST_BAR_WIDTH 40
+
+/* Request and response are both 7 bytes long */
+#define BENCH_BYTES_PER_TRANSACTION (7 * 2)
+
+/* State of the hardware before the benchmark */
+/* Write tests are sending the same values back, so nothing is changed */
+static struct hardware_state initial_state;
+
+struct bench_test {
+	const char *name;
+	int (*run)(void);
+	int transactions; /* Number of the device transactions in one run */
+};
+
+/* Read tests */
+static int bench_read_ps(void)
+{
+	struct hardware_state hw_state;
+
+	return hardware_read_state(&hw_state, HW_STATE_FIELD_PS);
+}
+
+static int bench_read_polarity(void)
+{
+	struct hardware_state hw_state;
+
+	return hardware_read_state(&hw_state, HW_STATE_FIELD_POLARITY);
+}
+
+static int bench_read_band(void)
+{
+	struct hardware_state hw_state;
+
+	return hardware_read_state(&hw_state, HW_STATE_FIELD_BAND);
+}
+
+static int bench_read_voltages(void)
+{
+	struct hardware_state hw_state;
+
+	return hardware_read_state(&hw_state, HW_STATE_FIELD_VOLTAGES);
+}
+
+/* Voltages and tone levels, 4 requests are pipelined with a single write */
+static int bench_read_levels(void)
+{
+	struct hardware_state hw_state;
+
+	return hardware_read_state(&hw_state, HW_STATE_FIELD_VOLTAGES | HW_STATE_FIELD_TONE);
+}
+
+/* Write tests */
+static int bench_write_ps(void)
+{
+	return hardware_set_ps_state(initial_state.ps_enabled ? ENABLE : DISABLE);
+}
+
+static int bench_write_polarity(void)
+{
+	return hardware_set_channel_polarity(LNB_CHANNEL_1, initial_state.ch1_polarity_vr
+											? POLARITY_VERTICAL_RIGHT
+											: POLARITY_HORIZONTAL_LEFT);
+}
+
+static int bench_write_band(void)
+{
+	return hardware_set_channel_band(LNB_CHANNEL_1, initial_state.ch1_band_low
+											? BAND_LOW : BAND_HIGH);
+}
+
+/* Channel change test */
+static uint8_t cc_channel;
+static uint8_t cc_msg[HW_DISEQC_MAX_MSG_LEN];
+static uint8_t cc_len;
+static int cc_backoffs;
+
+static int bench_channel_change_run(void)
+{
+	struct hardware_unicable_done done;
+	int ret;
+
+	ret = hardware_unicable_send(cc_channel, cc_msg, cc_len, 0);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	ret = hardware_unicable_wait(cc_channel, &done, BENCH_CHANNEL_CHANGE_TIMEOUT_MS);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	cc_backoffs += done.backoffs;
+
+	return done.status == HW_UNICABLE_OK ? 0 : -1;
+}
+
+static const struct bench_test bench_tests[] = {
+	{ "read ps", bench_read_ps, 1 },
+	{ "read polarity", bench_read_polarity, 2 },
+	{ "read band", bench_read_band, 2 },
+	{ "read voltages", bench_read_voltages, 2 },
+	{ "write ps", bench_write_ps, 1 },
+	{ "write polarity", bench_write_polarity, 1 },
+	{ "write band", bench_write_band, 1 },
+	{ "read levels", bench_read_levels, 4 },
+};
+
+/* Index of the pipelined requests test above */
+#define BENCH_PIPELINED_TEST 7
+
+/* Switch transitions, every cycle returns the outputs to the start state: */
+/* power supply on, both channels 13V without the tone */
+static int switch_ch1_18v(void)
+{
+	return hardware_set_channel_polarity(LNB_CHANNEL_1, POLARITY_HORIZONTAL_LEFT);
+}
+
+static int switch_ch1_13v(void)
+{
+	return hardware_set_channel_polarity(LNB_CHANNEL_1, POLARITY_VERTICAL_RIGHT);
+}
+
+static int switch_ch2_18v(void)
+{
+	return hardware_set_channel_polarity(LNB_CHANNEL_2, POLARITY_HORIZONTAL_LEFT);
+}
+
+static int switch_ch2_13v(void)
+{
+	return hardware_set_channel_polarity(LNB_CHANNEL_2, POLARITY_VERTICAL_RIGHT);
+}
+
+static int switch_ch1_tone_on(void)
+{
+	return hardware_set_channel_band(LNB_CHANNEL_1, BAND_HIGH);
+}
+
+static int switch_ch1_tone_off(void)
+{
+	return hardware_set_channel_band(LNB_CHANNEL_1, BAND_LOW);
+}
+
+static int switch_ch2_tone_on(void)
+{
+	return hardware_set_channel_band(LNB_CHANNEL_2, BAND_HIGH);
+}
+
+static int switch_ch2_tone_off(void)
+{
+	return hardware_set_channel_band(LNB_CHANNEL_2, BAND_LOW);
+}
+
+static int switch_ps_off(void)
+{
+	return hardware_set_ps_state(DISABLE);
+}
+
+static int switch_ps_on(void)
+{
+	return hardware_set_ps_state(ENABLE);
+}
+
+struct switch_transition {
+	const char *name;
+	int (*run)(void);
+	int outputs;	/* Number of the switch complete events, tone has no settle detection */
+};
+
+static const struct switch_transition switch_transitions[] = {
+	{ "ch1 13V->18V", switch_ch1_18v, 1 },
+	{ "ch1 18V->13V", switch_ch1_13v, 1 },
+	{ "ch2 13V->18V", switch_ch2_18v, 1 },
+	{ "ch2 18V->13V", switch_ch2_13v, 1 },
+	{ "ch1 tone on", switch_ch1_tone_on, 0 },
+	{ "ch1 tone off", switch_ch1_tone_off, 0 },
+	{ "ch2 tone on", switch_ch2_tone_on, 0 },
+	{ "ch2 tone off", switch_ch2_tone_off, 0 },
+	{ "ps off", switch_ps_off, 2 },
+	{ "ps on", switch_ps_on, 2 },
+};
+
+#define SWITCH_TRANSITIONS_NUM (sizeof(switch_transitions) / sizeof(switch_transitions[0]))
+
+/* Samples of the one transition */
+struct switch_samples {
+	uint64_t *ack_ns;		/* Command to the device ACK */
+	uint64_t *ready_ns;		/* Command to the last switch complete event, or ACK for the tone */
+	uint64_t *settle_ns;	/* Settle time measured by the device */
+	uint64_t *lag_ns;		/* Event delivery after the hold time: firmware loop, USB and the host stack */
+	int count;
+	int errors;
+	int timeouts;
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of the sorted samples */
+static uint64_t percentile(const uint64_t *sorted, int count, int per_mille)
+{
+	int idx = (int) (((int64_t) count * per_mille + 999) / 1000) - 1;
+
+	if (idx < 0) {
+		idx = 0;
+	}
+
+	return sorted[idx];
+}
+
+static double to_us(uint64_t ns)
+{
+	return (double) ns / 1000.0;
+}
+
+/* Run the test and print the latency distribution */
+static int run_latency_test(const struct bench_test *test, uint64_t *samples, int iterations)
+{
+	uint64_t start_ns, sum_ns = 0;
+	int i, count = 0, errors = 0;
+
+	for (i = 0; i < iterations; ++i) {
+		start_ns = hardware_monotonic_ns();
+
+		if (test->run() != 0) {
+			errors++;
+			continue;
+		}
+
+		samples[count] = hardware_monotonic_ns() - start_ns;
+		sum_ns += samples[count];
+		count++;
+	}
+
+	if (!count) {
+		printf(" %-16s %8d %7d  no successful requests, error: %s\n",
+				test->name, count, errors, hardware_get_last_error_desc());
+		return -1;
+	}
+
+	qsort(samples, count, sizeof(uint64_t), cmp_u64);
+
+	printf(" %-16s %8d %7d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+			test->name, count, errors,
+			to_us(samples[0]),
+			to_us(sum_ns / count),
+			to_us(percentile(samples, count, 500)),
+			to_us(percentile(samples, count, 990)),
+			to_us(percentile(samples, count, 999)),
+			to_us(samples[count - 1]));
+
+	return 0;
+}
+
+/* Back-to-back requests during the fixed time */
+static void run_rate_test(const struct bench_test *test)
+{
+	uint64_t start_ns, elapsed_ns;
+	int count = 0, errors = 0;
+	double rate;
+
+	start_ns = hardware_monotonic_ns();
+
+	do {
+		if (test->run() != 0) {
+			errors++;
+		} else {
+			count++;
+		}
+
+		elapsed_ns = hardware_monotonic_ns() - start_ns;
+	} while (elapsed_ns < BENCH_RATE_TEST_NS);
+
+	rate = (double) count * test->transactions * 1000000000.0 / elapsed_ns;
+
+	printf(" %-16s %9.0f req/s %9.0f B/s %7d errors\n", test->name,
+			rate, rate * BENCH_BYTES_PER_TRANSACTION, errors);
+}
+
+int bench_link(int iterations)
+{
+	uint64_t *samples;
+	size_t i;
+
+	if (iterations <= 0 || iterations > BENCH_MAX_ITERATIONS) {
+		iterations = BENCH_DEFAULT_ITERATIONS;
+	}
+
+	if (hardware_read_full_state(&initial_state) != 0) {
+		printf("Couldn't read the full hardware state, error: %s\n", hardware_get_last_error_desc());
+		return -1;
+	}
+
+	samples = (uint64_t *) malloc(iterations * sizeof(uint64_t));
+
+	if (!samples) {
+		printf("Failed to allocate memory for the samples\n");
+		return -1;
+	}
+
+	printf("\nLatency, %d iterations per test (us):\n", iterations);
+	printf(" %-16s %8s %7s %9s %9s %9s %9s %9s %9s\n",
+			"test", "count", "errors", "min", "mean", "p50", "p99", "p999", "max");
+
+	for (i = 0; i < sizeof(bench_tests) / sizeof(bench_tests[0]); ++i) {
+		run_latency_test(&bench_tests[i], samples, iterations);
+	}
+
+	free(samples);
+
+	printf("\nSustained request rate, %llu s per test:\n", BENCH_RATE_TEST_NS / 1000000000ULL);
+
+	/* Single transaction tests show the pure link rate */
+	run_rate_test(&bench_tests[0]);
+	run_rate_test(&bench_tests[4]);
+
+	/* Firmware answers all the requests of one transfer with the aggregated responses */
+	printf("\nRaw throughput, pipelined requests, %llu s:\n", BENCH_RATE_TEST_NS / 1000000000ULL);
+	run_rate_test(&bench_tests[BENCH_PIPELINED_TEST]);
+	printf("\n");
+
+	return 0;
+}
+
+/* Issue the transition and wait for all the changed outputs */
+static void run_switch(const struct switch_transition *tr, struct switch_samples *smp)
+{
+	struct hardware_switch_done done;
+	uint64_t start_ns, ack_ns, ready_ns;
+	uint32_t settle_us = 0;
+	int timeout = 0;
+	int i;
+
+	start_ns = hardware_monotonic_ns();
+
+	if (tr->run() != 0) {
+		smp->errors++;
+		return;
+	}
+
+	ack_ns = ready_ns = hardware_monotonic_ns();
+
+	for (i = 0; i < tr->outputs; ++i) {
+		if (hardware_wait_switch_done(0, &done, BENCH_SWITCH_SETTLE_TIMEOUT_MS) != 0) {
+			smp->errors++;
+			return;
+		}
+
+		ready_ns = hardware_monotonic_ns();
+
+		if (done.status != HW_SETTLE_OK) {
+			timeout = 1;
+		}
+
+		if (done.settle_us > settle_us) {
+			settle_us = done.settle_us;
+		}
+	}
+
+	smp->ack_ns[smp->count] = ack_ns - start_ns;
+	smp->ready_ns[smp->count] = ready_ns - start_ns;
+	smp->settle_ns[smp->count] = (uint64_t) settle_us * 1000;
+	smp->lag_ns[smp->count] = 0;
+
+	if (tr->outputs && !timeout && ready_ns - start_ns > ((uint64_t) settle_us + BENCH_SWITCH_HOLD_US) * 1000) {
+		smp->lag_ns[smp->count] = ready_ns - start_ns - ((uint64_t) settle_us + BENCH_SWITCH_HOLD_US) * 1000;
+	}
+
+	smp->timeouts += timeout;
+	smp->count++;
+}
+
+/* Log2 histogram of the sorted samples */
+static void print_histogram(const char *name, const uint64_t *sorted, int count)
+{
+	int buckets[BENCH_HIST_BUCKETS] = { 0 };
+	int i, b, first = -1, last = 0, peak = 0;
+	uint64_t us;
+
+	for (i = 0; i < count; ++i) {
+		us = sorted[i] / 1000;
+
+		for (b = 0; b < BENCH_HIST_BUCKETS - 1 && us >= (1ULL << (b + 1)); ++b) {
+		}
+
+		buckets[b]++;
+	}
+
+	for (b = 0; b < BENCH_HIST_BUCKETS; ++b) {
+		if (buckets[b]) {
+			first = first < 0 ? b : first;
+			last = b;
+			peak = buckets[b] > peak ? buckets[b] : peak;
+		}
+	}
+
+	if (first < 0) {
+		return;
+	}
+
+	printf("\n %s, us:\n", name);
+
+	for (b = first; b <= last; ++b) {
+		printf("  %8llu - %-8llu %6d ", b ? 1ULL << b : 0ULL, (1ULL << (b + 1)) - 1, buckets[b]);
+
+		for (i = 0; i < (buckets[b] * BENCH_HIST_BAR_WIDTH + peak - 1) / peak; ++i) {
+			putchar('#');
+		}
+
+		putchar('\n');
+	}
+}
+
+static void print_switch_results(const struct switch_transition *tr, struct switch_samples *smp)
+{
+	if (!smp->count) {
+		printf(" %-14s %6d %6d  no successful switches, error: %s\n",
+				tr->name, smp->count, smp->errors, hardware_get_last_error_desc());
+		return;
+	}
+
+	qsort(smp->ack_ns, smp->count, sizeof(uint64_t), cmp_u64);
+	qsort(smp->ready_ns, smp->count, sizeof(uint64_t), cmp_u64);
+	qsort(smp->settle_ns, smp->count, sizeof(uint64_t), cmp_u64);
+	qsort(smp->lag_ns, smp->count, sizeof(uint64_t), cmp_u64);
+
+	printf(" %-14s %6d %6d %6d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+			tr->name, smp->count, smp->errors, smp->timeouts,
+			to_us(percentile(smp->ack_ns, smp->count, 500)),
+			to_us(percentile(smp->ack_ns, smp->count, 990)),
+			to_us(percentile(smp->ready_ns, smp->count, 500)),
+			to_us(percentile(smp->ready_ns, smp->count, 990)),
+			to_us(smp->ready_ns[smp->count - 1]),
+			to_us(percentile(smp->settle_ns, smp->count, 500)),
+			to_us(percentile(smp->lag_ns, smp->count, 500)),
+			to_us(percentile(smp->lag_ns, smp->count, 990)));
+}
+
+/* Wait for the outputs of the state change, the results are not interesting */
+static int switch_to_state(const struct hardware_state *hw_state)
+{
+	struct hardware_switch_done done;
+	int ret;
+
+	ret = hardware_write_full_state(hw_state);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	hardware_wait_switch_done(0, &done, BENCH_SWITCH_SETTLE_TIMEOUT_MS);
+	hardware_wait_switch_done(0, &done, BENCH_SWITCH_SETTLE_TIMEOUT_MS);
+
+	return 0;
+}
+
+int bench_switch(int iterations)
+{
+	struct switch_samples samples[SWITCH_TRANSITIONS_NUM];
+	struct hardware_state start_state = { 0 };
+	size_t t;
+	int i, ret = 0;
+
+	if (iterations <= 0 || iterations > BENCH_SWITCH_MAX_ITERATIONS) {
+		iterations = BENCH_SWITCH_DEFAULT_ITERATIONS;
+	}
+
+	if (hardware_read_full_state(&initial_state) != 0) {
+		printf("Couldn't read the full hardware state, error: %s\n", hardware_get_last_error_desc());
+		return -1;
+	}
+
+	memset(samples, 0, sizeof(samples));
+
+	for (t = 0; t < SWITCH_TRANSITIONS_NUM; ++t) {
+		samples[t].ack_ns = (uint64_t *) malloc(iterations * sizeof(uint64_t));
+		samples[t].ready_ns = (uint64_t *) malloc(iterations * sizeof(uint64_t));
+		samples[t].settle_ns = (uint64_t *) malloc(iterations * sizeof(uint64_t));
+		samples[t].lag_ns = (uint64_t *) malloc(iterations * sizeof(uint64_t));
+
+		if (!samples[t].ack_ns || !samples[t].ready_ns || !samples[t].settle_ns || !samples[t].lag_ns) {
+			printf("Failed to allocate memory for the samples\n");
+			ret = -1;
+			goto out;
+		}
+	}
+
+	start_state.ps_enabled = 1;
+	start_state.ch1_polarity_vr = 1;
+	start_state.ch1_band_low = 1;
+	start_state.ch2_polarity_vr = 1;
+	start_state.ch2_band_low = 1;
+
+	if (switch_to_state(&start_state) != 0) {
+		printf("Couldn't set the start state, error: %s\n", hardware_get_last_error_desc());
+		ret = -1;
+		goto out;
+	}
+
+	printf("Switching %d cycles of all the transitions...\n", iterations);
+	fflush(stdout);
+
+	for (i = 0; i < iterations; ++i) {
+		for (t = 0; t < SWITCH_TRANSITIONS_NUM; ++t) {
+			run_switch(&switch_transitions[t], &samples[t]);
+		}
+	}
+
+	printf("\nSwitch latency (us): ACK - command is accepted, ready - output is settled (ACK for the tone),\n"
+			"settle - measured by the device, lag - event delivery after the %d us hold\n", BENCH_SWITCH_HOLD_US);
+	printf(" %-14s %6s %6s %6s %9s %9s %9s %9s %9s %9s %9s %9s\n", "transition", "count", "errors", "tmout",
+			"ack p50", "ack p99", "rdy p50", "rdy p99", "rdy max", "settle", "lag p50", "lag p99");
+
+	for (t = 0; t < SWITCH_TRANSITIONS_NUM; ++t) {
+		print_switch_results(&switch_transitions[t], &samples[t]);
+	}
+
+	for (t = 0; t < SWITCH_TRANSITIONS_NUM; ++t) {
+		print_histogram(switch_transitions[t].name, samples[t].ready_ns, samples[t].count);
+	}
+
+	printf("\n");
+
+	/* Back to the state before the benchmark */
+	switch_to_state(&initial_state);
+
+out:
+	for (t = 0; t < SWITCH_TRANSITIONS_NUM; ++t) {
+		free(samples[t].ack_ns);
+		free(samples[t].ready_ns);
+		free(samples[t].settle_ns);
+		free(samples[t].lag_ns);
+	}
+
+	return ret;
+}
+
+int bench_channel_change(int iterations, uint8_t channel, const uint8_t *msg, uint8_t len)
+{
+	const struct bench_test test = { "channel change", bench_channel_change_run, 1 };
+	uint64_t *samples;
+	int ret;
+
+	if (iterations <= 0 || iterations > BENCH_CHANNEL_CHANGE_MAX_ITERATIONS) {
+		iterations = BENCH_CHANNEL_CHANGE_DEFAULT_ITERATIONS;
+	}
+
+	if (!len || len > HW_DISEQC_MAX_MSG_LEN) {
+		return -1;
+	}
+
+	samples = (uint64_t *) malloc(iterations * sizeof(uint64_t));
+
+	if (!samples) {
+		printf("Failed to allocate memory for the samples\n");
+		return -1;
+	}
+
+	cc_channel = channel;
+	memcpy(cc_msg, msg, len);
+	cc_len = len;
+	cc_backoffs = 0;
+
+	printf("Unicable channel change, %d iterations, command to the completion event (us):\n", iterations);
+	printf(" %-16s %8s %7s %9s %9s %9s %9s %9s %9s\n",
+			"test", "count", "errors", "min", "mean", "p50", "p99", "p999", "max");
+
+	ret = run_latency_test(&test, samples, iterations);
+
+	printf(" Backoffs on the busy line: %d\n\n", cc_backoffs);
+
+	free(samples);
+
+	return ret;
+}
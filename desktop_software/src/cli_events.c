@@ -0,0 +1,266 @@
+/*
+   cli_events.c
+    - Device events monitor for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+#include "cli_events.h"
+#include "device_communicator.h"
+
+/* Wait timeout, stop flag is checked with this period */
+#define EVENTS_POLL_TIMEOUT_MS 200
+
+static volatile sig_atomic_t monitor_running = 0;
+
+/* */
+static void monitor_stop_signal(int sig)
+{
+	monitor_running = 0;
+}
+
+static const char *fault_type_str(uint8_t type)
+{
+	switch (type) {
+		case HW_FAULT_UNDERVOLTAGE:
+			return "undervoltage";
+
+		case HW_FAULT_OVERVOLTAGE:
+			return "overvoltage";
+
+		default:
+			return "unknown";
+	}
+}
+
+static void print_fault_event(const struct hardware_event *ev)
+{
+	struct hardware_fault fault;
+
+	if (hardware_parse_fault_event(ev, &fault) != 0) {
+		printf("FAULT malformed event\n");
+		return;
+	}
+
+	printf("[%10u us] FAULT channel %d %s, %2.2f V, power supply is OFF",
+			fault.timestamp_us, fault.channel, fault_type_str(fault.type), fault.voltage);
+
+	if (fault.retry) {
+		printf(", retry %d", fault.retry);
+	}
+
+	printf("\n");
+}
+
+static void print_diseqc_done_event(const struct hardware_event *ev)
+{
+	struct hardware_diseqc_done done;
+
+	if (hardware_parse_diseqc_done_event(ev, &done) != 0) {
+		printf("DISEQC malformed event\n");
+		return;
+	}
+
+	printf("[%10u us] DISEQC channel %d transmission is completed\n", done.timestamp_us, done.channel);
+}
+
+static void print_diseqc_rx_event(const struct hardware_event *ev)
+{
+	struct hardware_diseqc_msg msg;
+	int i;
+
+	if (hardware_parse_diseqc_rx_event(ev, &msg) != 0) {
+		printf("DISEQC RX malformed event\n");
+		return;
+	}
+
+	printf("[%10u us] DISEQC %s channel %d:", msg.timestamp_us,
+			(msg.flags & HW_DISEQC_RX_REPLY) ? "REPLY" : "RX", msg.channel);
+
+	for (i = 0; i < msg.len; ++i) {
+		printf(" %02X", msg.data[i]);
+	}
+
+	if (msg.flags & HW_DISEQC_RX_PARITY_ERROR) {
+		printf(", parity error");
+	}
+
+	if (msg.flags & HW_DISEQC_RX_INCOMPLETE) {
+		printf(", incomplete");
+	}
+
+	if (msg.flags & HW_DISEQC_RX_OVERRUN) {
+		printf(", previous message is lost");
+	}
+
+	printf("\n");
+}
+
+static void print_unicable_done_event(const struct hardware_event *ev)
+{
+	struct hardware_unicable_done done;
+
+	if (hardware_parse_unicable_done_event(ev, &done) != 0) {
+		printf("UNICABLE malformed event\n");
+		return;
+	}
+
+	if (done.status == HW_UNICABLE_BUS_BUSY) {
+		printf("[%10u us] UNICABLE channel %d line is busy, command is not sent after %d backoffs\n",
+				done.timestamp_us, done.channel, done.backoffs);
+		return;
+	}
+
+	printf("[%10u us] UNICABLE channel %d command is completed, %d frames sent, %d backoffs\n",
+			done.timestamp_us, done.channel, done.sent, done.backoffs);
+}
+
+static void print_schedule_event(const struct hardware_event *ev)
+{
+	struct hardware_schedule_exec exec;
+
+	if (hardware_parse_schedule_event(ev, &exec) != 0) {
+		printf("SCHEDULE malformed event\n");
+		return;
+	}
+
+	printf("[%10u us] SCHEDULE entry %d is executed, error %+d us\n", exec.planned_us, exec.index,
+			(int32_t) (exec.actual_us - exec.planned_us));
+}
+
+static const char *switch_target_str(uint8_t target)
+{
+	switch (target) {
+		case HW_SWITCH_TARGET_13V:
+			return "13V";
+
+		case HW_SWITCH_TARGET_18V:
+			return "18V";
+
+		default:
+			return "OFF";
+	}
+}
+
+static void print_switch_done_event(const struct hardware_event *ev)
+{
+	struct hardware_switch_done done;
+
+	if (hardware_parse_switch_done_event(ev, &done) != 0) {
+		printf("SWITCH malformed event\n");
+		return;
+	}
+
+	if (done.status == HW_SETTLE_TIMEOUT) {
+		printf("[%10u us] SWITCH channel %d is not settled at %s in %.1f ms, output %.2f V\n",
+				done.timestamp_us, done.channel, switch_target_str(done.target), done.settle_us / 1000.0, done.voltage);
+		return;
+	}
+
+	printf("[%10u us] SWITCH channel %d is settled at %s in %.1f ms, output %.2f V\n",
+			done.timestamp_us, done.channel, switch_target_str(done.target), done.settle_us / 1000.0, done.voltage);
+}
+
+/* Events without the specific decoder */
+static void print_raw_event(const struct hardware_event *ev)
+{
+	int i;
+
+	printf("EVENT 0x%02X:", ev->id);
+
+	for (i = 0; i < ev->len; ++i) {
+		printf(" %02X", ev->data[i]);
+	}
+
+	printf("\n");
+}
+
+void print_event(const struct hardware_event *ev)
+{
+	switch (ev->id) {
+		case HW_EVENT_FAULT:
+			print_fault_event(ev);
+			break;
+
+		case HW_EVENT_DISEQC_TX_DONE:
+			print_diseqc_done_event(ev);
+			break;
+
+		case HW_EVENT_DISEQC_RX:
+			print_diseqc_rx_event(ev);
+			break;
+
+		case HW_EVENT_UNICABLE_DONE:
+			print_unicable_done_event(ev);
+			break;
+
+		case HW_EVENT_SCHEDULE_EXEC:
+			print_schedule_event(ev);
+			break;
+
+		case HW_EVENT_SWITCH_DONE:
+			print_switch_done_event(ev);
+			break;
+
+		default:
+			print_raw_event(ev);
+			break;
+	}
+
+	fflush(stdout);
+}
+
+int monitor_events(void)
+{
+	struct sigaction sa;
+	struct hardware_event ev;
+	int ret = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = monitor_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	monitor_running = 1;
+
+	fprintf(stderr, "Waiting for the device events, press Ctrl+C to stop\n");
+
+	while (monitor_running) {
+		ret = hardware_wait_event(&ev, EVENTS_POLL_TIMEOUT_MS);
+
+		if (ret == -ETIMEDOUT || ret == -EAGAIN || ret == -EINTR) {
+			ret = 0;
+			continue;
+		}
+
+		if (ret != 0) {
+			fprintf(stderr, "Couldn't read the device events, error: %s\n", hardware_get_last_error_desc());
+			break;
+		}
+
+		print_event(&ev);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	return ret;
+}
@@ -0,0 +1,244 @@
+/*
+   cli_positioner.c
+    - Dish positioner control for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include "cli_positioner.h"
+#include "positioner.h"
+#include "device_communicator.h"
+
+/* Longest move of the default model with some margin */
+#define POSITIONER_WAIT_TIMEOUT_MS 180000
+
+/* Stored positions, 0 is the reference and can't be overwritten */
+#define POSITIONER_MAX_NN 255
+
+/* Drive amount: seconds or negative steps */
+#define POSITIONER_DRIVE_MAX_SECONDS	127
+#define POSITIONER_DRIVE_MAX_STEPS		128
+
+/* Coordinate with the optional hemisphere suffix */
+/* neg is the suffix of the negative values: 'S' or 'W' */
+static int parse_coord(const char *str, char pos, char neg, double *val)
+{
+	char *end;
+
+	*val = strtod(str, &end);
+
+	if (end == str) {
+		return -1;
+	}
+
+	if (*end == neg || *end == neg + ('a' - 'A')) {
+		*val = -*val;
+		end++;
+	} else if (*end == pos || *end == pos + ('a' - 'A')) {
+		end++;
+	}
+
+	return (*end == '\0' || *end == ':') ? 0 : -1;
+}
+
+int positioner_parse_site(const char *str, struct positioner_params *params)
+{
+	const char *lon = strchr(str, ':');
+
+	if (!lon || parse_coord(str, 'N', 'S', &params->site_lat) != 0
+			|| parse_coord(lon + 1, 'E', 'W', &params->site_lon) != 0) {
+		return -1;
+	}
+
+	if (params->site_lat < -90.0 || params->site_lat > 90.0
+			|| params->site_lon < -180.0 || params->site_lon > 180.0) {
+		return -1;
+	}
+
+	params->site_set = 1;
+
+	return 0;
+}
+
+/* Whole decimal number within the range, the motor must not move on a typo */
+static int parse_int(const char *str, long min, long max, int *val)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(str, &end, 10);
+
+	if (end == str || *end != '\0' || errno == ERANGE || v < min || v > max) {
+		return -1;
+	}
+
+	*val = (int) v;
+
+	return 0;
+}
+
+/* Exact command name match */
+static int cmd_is(const char *cmd, size_t len, const char *name)
+{
+	return len == strlen(name) && !strncmp(cmd, name, len);
+}
+
+/* Wait for the estimated arrival of the dish */
+static void wait_arrival(const struct positioner *pos, const struct positioner_params *params)
+{
+	float eta = hardware_positioner_eta(pos);
+
+	if (eta < 0) {
+		printf("Moving until halt\n");
+		return;
+	}
+
+	printf("Estimated arrival in %.1f s%s\n", eta,
+			pos->eta_worst_case ? " (worst case, the dish position is unknown)" : "");
+
+	if (params->no_wait) {
+		return;
+	}
+
+	fflush(stdout);
+
+	if (hardware_positioner_wait(pos, POSITIONER_WAIT_TIMEOUT_MS) == 0) {
+		printf("Done\n");
+	}
+}
+
+int positioner_cmd(uint8_t channel, const struct positioner_params *params)
+{
+	struct positioner pos;
+	const char *arg = strchr(params->cmd, ':');
+	size_t name_len = arg ? (size_t) (arg - params->cmd) : strlen(params->cmd);
+	double val;
+	int nn;
+	int ret;
+
+	positioner_init(&pos, channel, params->site_lat, params->site_lon);
+
+	if (params->speed > 0) {
+		pos.speed_13v = pos.speed_18v = params->speed;
+	}
+
+	if (arg) {
+		arg++;
+	}
+
+	if (cmd_is(params->cmd, name_len, "usals") && arg) {
+		if (!params->site_set) {
+			printf("Site coordinates are required for USALS\n");
+			return -1;
+		}
+
+		if (parse_coord(arg, 'E', 'W', &val) != 0) {
+			printf("Invalid satellite longitude %s\n", arg);
+			return -1;
+		}
+
+		printf("Moving to %.1f%c, motor angle %.2f deg\n", val < 0 ? -val : val, val < 0 ? 'W' : 'E',
+				positioner_usals_angle(pos.site_lat, pos.site_lon, val));
+
+		ret = hardware_positioner_goto_sat(&pos, val);
+	} else if (cmd_is(params->cmd, name_len, "angle") && arg) {
+		if (parse_coord(arg, 'E', 'W', &val) != 0) {
+			printf("Invalid angle %s\n", arg);
+			return -1;
+		}
+
+		printf("Moving to %.2f deg\n", val);
+		ret = hardware_positioner_goto_angle(&pos, val);
+	} else if (cmd_is(params->cmd, name_len, "goto") && arg) {
+		if (parse_int(arg, 0, POSITIONER_MAX_NN, &nn) != 0) {
+			printf("Invalid stored position %s, must be 0 - %d\n", arg, POSITIONER_MAX_NN);
+			return -1;
+		}
+
+		printf("Moving to the stored position %d\n", nn);
+		ret = hardware_positioner_goto_nn(&pos, nn);
+	} else if (cmd_is(params->cmd, name_len, "store") && arg) {
+		if (parse_int(arg, 1, POSITIONER_MAX_NN, &nn) != 0) {
+			printf("Invalid stored position %s, must be 1 - %d\n", arg, POSITIONER_MAX_NN);
+			return -1;
+		}
+
+		printf("Storing the current position as %d\n", nn);
+		ret = hardware_positioner_store_nn(&pos, nn);
+	} else if (cmd_is(params->cmd, name_len, "drive") && arg) {
+		const char *amount = strchr(arg, ':');
+		size_t dir_len = amount ? (size_t) (amount - arg) : strlen(arg);
+		int dir = cmd_is(arg, dir_len, "east") ? POSITIONER_EAST
+					: (cmd_is(arg, dir_len, "west") ? POSITIONER_WEST : 0);
+		int drive_amount = 0;
+
+		if (!dir) {
+			printf("Invalid drive direction %s\n", arg);
+			return -1;
+		}
+
+		/* No amount is the drive until halt, explicit 0 is rejected as a typo */
+		if (amount && (parse_int(amount + 1, -POSITIONER_DRIVE_MAX_STEPS, POSITIONER_DRIVE_MAX_SECONDS,
+										&drive_amount) != 0 || !drive_amount)) {
+			printf("Invalid drive amount %s, must be 1 - %d seconds or -1 - -%d steps\n",
+					amount + 1, POSITIONER_DRIVE_MAX_SECONDS, POSITIONER_DRIVE_MAX_STEPS);
+			return -1;
+		}
+
+		printf("Driving %s\n", dir == POSITIONER_EAST ? "east" : "west");
+		ret = hardware_positioner_drive(&pos, dir, drive_amount);
+	} else if (cmd_is(params->cmd, name_len, "halt")) {
+		printf("Stopping the motor\n");
+		ret = hardware_positioner_halt(&pos);
+	} else if (cmd_is(params->cmd, name_len, "limit") && arg) {
+		if (!strcmp(arg, "east")) {
+			ret = hardware_positioner_set_limit(&pos, POSITIONER_LIMIT_EAST);
+		} else if (!strcmp(arg, "west")) {
+			ret = hardware_positioner_set_limit(&pos, POSITIONER_LIMIT_WEST);
+		} else if (!strcmp(arg, "off")) {
+			ret = hardware_positioner_set_limit(&pos, POSITIONER_LIMITS_OFF);
+		} else {
+			printf("Invalid limit %s\n", arg);
+			return -1;
+		}
+
+		printf("Setting limit %s\n", arg);
+	} else {
+		printf("Unknown positioner command %s\n", params->cmd);
+		return -1;
+	}
+
+	if (ret < 0) {
+		printf("Failed, error: %s\n", hardware_get_last_error_desc());
+		return ret;
+	}
+
+	/* Only the moves are waited */
+	if (cmd_is(params->cmd, name_len, "store") || cmd_is(params->cmd, name_len, "limit")
+			|| cmd_is(params->cmd, name_len, "halt")) {
+		return 0;
+	}
+
+	wait_arrival(&pos, params);
+
+	return 0;
+}
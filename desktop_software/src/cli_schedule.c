@@ -0,0 +1,236 @@
+/*
+   cli_schedule.c
+    - Device timed commands for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include "cli_schedule.h"
+#include "device_communicator.h"
+
+/* Event of the last entry is expected within this time after its planned execution */
+#define SCHEDULE_EVENT_TIMEOUT_MS 2000
+
+/* One <ms>:<target>:<value> entry */
+static int parse_entry(const char *str, struct hardware_schedule_entry *entry)
+{
+	char target[8], value[8];
+	double offset_ms;
+
+	if (sscanf(str, "%lf:%7[^:]:%7[^,]", &offset_ms, target, value) != 3 || offset_ms < 0) {
+		return -1;
+	}
+
+	entry->offset_us = (uint32_t) (offset_ms * 1000.0 + 0.5);
+
+	if (!strcmp(target, "ps")) {
+		entry->type = HW_SCHEDULE_PS;
+		entry->channel = 0;
+
+		if (!strcmp(value, "on")) {
+			entry->value = ENABLE;
+		} else if (!strcmp(value, "off")) {
+			entry->value = DISABLE;
+		} else {
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (!strcmp(target, "1") || !strcmp(target, "2")) {
+		entry->channel = (target[0] == '1' ? LNB_CHANNEL_1 : LNB_CHANNEL_2);
+	} else {
+		return -1;
+	}
+
+	if (!strcmp(value, "13") || !strcmp(value, "18")) {
+		entry->type = HW_SCHEDULE_POLARITY;
+		entry->value = (value[1] == '3' ? POLARITY_VERTICAL_RIGHT : POLARITY_HORIZONTAL_LEFT);
+	} else if (!strcmp(value, "low") || !strcmp(value, "high")) {
+		entry->type = HW_SCHEDULE_BAND;
+		entry->value = (value[0] == 'l' ? BAND_LOW : BAND_HIGH);
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+int schedule_parse(const char *str, struct schedule_params *params)
+{
+	const char *p = str;
+
+	params->count = 0;
+
+	while (*p) {
+		if (params->count >= HW_SCHEDULE_MAX_ENTRIES
+				|| parse_entry(p, &params->entries[params->count]) != 0) {
+			return -1;
+		}
+
+		/* Device executes the entries in order */
+		if (params->count
+				&& params->entries[params->count].offset_us < params->entries[params->count - 1].offset_us) {
+			return -1;
+		}
+
+		params->count++;
+
+		p = strchr(p, ',');
+
+		if (!p) {
+			break;
+		}
+
+		p++;
+	}
+
+	return params->count ? params->count : -1;
+}
+
+int schedule_parse_repeat(const char *str, struct schedule_params *params)
+{
+	if (sscanf(str, "%d:%f", &params->runs, &params->period_ms) != 2
+			|| params->runs < 1 || params->period_ms <= 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static const char *entry_str(const struct hardware_schedule_exec *exec, char *buf, size_t len)
+{
+	switch (exec->type) {
+		case HW_SCHEDULE_PS:
+			snprintf(buf, len, "power supply %s", exec->value == ENABLE ? "ON" : "OFF");
+			break;
+
+		case HW_SCHEDULE_POLARITY:
+			snprintf(buf, len, "channel %d %s", exec->channel,
+					exec->value == POLARITY_VERTICAL_RIGHT ? "13V" : "18V");
+			break;
+
+		default:
+			snprintf(buf, len, "channel %d %s band", exec->channel,
+					exec->value == BAND_LOW ? "low" : "high");
+			break;
+	}
+
+	return buf;
+}
+
+/* Wait for the events of all entries of one run, returns the device start time */
+static int wait_run(const struct schedule_params *params, int run, uint32_t *start_us, int32_t *max_err)
+{
+	struct hardware_schedule_exec exec;
+	struct hardware_event ev;
+	int reported = 0;
+	int waited_ms = 0;
+	int32_t err;
+	char buf[32];
+	int ret;
+
+	while (reported < params->count) {
+		ret = hardware_wait_event(&ev, 100);
+
+		if (ret == -ETIMEDOUT || ret == -EAGAIN || ret == -EINTR) {
+			waited_ms += 100;
+
+			/* Long schedules are reported progressively */
+			if (waited_ms > SCHEDULE_EVENT_TIMEOUT_MS + params->entries[params->count - 1].offset_us / 1000
+								+ (int) params->delay_ms + (int) params->period_ms) {
+				printf("Execution is not confirmed by the device, %d of %d entries are reported\n",
+						reported, params->count);
+				return -ETIMEDOUT;
+			}
+
+			continue;
+		}
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		if (hardware_parse_schedule_event(&ev, &exec) != 0) {
+			continue;
+		}
+
+		if (exec.index == 0) {
+			*start_us = exec.planned_us - params->entries[0].offset_us;
+		}
+
+		err = (int32_t) (exec.actual_us - exec.planned_us);
+
+		if (err > *max_err || -err > *max_err) {
+			*max_err = err < 0 ? -err : err;
+		}
+
+		printf("[%10u us] run %d #%-2d %-24s actual %10u us, error %+d us\n", exec.planned_us, run,
+				exec.index, entry_str(&exec, buf, sizeof(buf)), exec.actual_us, err);
+
+		reported++;
+	}
+
+	return 0;
+}
+
+int schedule_run(const struct schedule_params *params)
+{
+	uint32_t start_us = 0;
+	int32_t max_err = 0;
+	int run, ret;
+
+	ret = hardware_schedule_load(params->entries, params->count);
+
+	if (ret != 0) {
+		printf("Failed to load the schedule, error: %s\n", hardware_get_last_error_desc());
+		return ret;
+	}
+
+	printf("Schedule of %d entries is loaded\n", params->count);
+
+	for (run = 0; run < params->runs; ++run) {
+		if (run == 0) {
+			ret = hardware_schedule_start((uint32_t) (params->delay_ms * 1000.0f));
+		} else {
+			/* Device time, so the period doesn't depend on the host */
+			ret = hardware_schedule_start_at(start_us + (uint32_t) (params->period_ms * 1000.0f));
+		}
+
+		if (ret != 0) {
+			printf("Failed to start the schedule, error: %s\n", hardware_get_last_error_desc());
+			return ret;
+		}
+
+		fflush(stdout);
+
+		ret = wait_run(params, run + 1, &start_us, &max_err);
+
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	printf("Max execution error: %d us\n", max_err);
+
+	return 0;
+}
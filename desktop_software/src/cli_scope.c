@@ -0,0 +1,258 @@
+/*
+   cli_scope.c
+    - Dump of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include "cli_scope.h"
+#include "cli_watch.h"
+#include "scope_stream.h"
+#include "scope_dsp.h"
+#include "device_communicator.h"
+
+/* Samples taken from the ring at once */
+#define SCOPE_CHUNK_SAMPLES 8192
+
+/* Ring is checked with this period, it holds more than 2 s of samples */
+#define SCOPE_POLL_US 10000
+
+#define SCOPE_MAX_COLUMNS 4096
+
+static volatile sig_atomic_t dump_running = 0;
+
+static float chunk[SCOPE_RING_CHANNELS][SCOPE_CHUNK_SAMPLES];
+
+/* Envelope frame at the max rate */
+static float frame[SCOPE_RING_CHANNELS][HW_SCOPE_RATE_MAX / SCOPE_FRAME_RATE];
+static float env_min[SCOPE_MAX_COLUMNS];
+static float env_max[SCOPE_MAX_COLUMNS];
+
+static char out_buf[1 << 16];
+
+/* */
+static void dump_stop_signal(int sig)
+{
+	dump_running = 0;
+}
+
+static void print_header(const struct scope_params *params)
+{
+	int ch;
+
+	if (params->format != WATCH_FORMAT_CSV) {
+		return;
+	}
+
+	if (params->columns) {
+		printf("time_s,channel,min_v:max_v...\n");
+		return;
+	}
+
+	printf("time_s");
+
+	for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+		if (params->channels & (1 << ch)) {
+			printf(",ch%d_v", ch + 1);
+		}
+	}
+
+	printf("\n");
+}
+
+/* Every sample of the enabled channels */
+static void print_samples(const struct scope_params *params, uint32_t rate, uint64_t first, size_t n)
+{
+	size_t i;
+	int ch;
+
+	for (i = 0; i < n; ++i) {
+		if (params->format == WATCH_FORMAT_JSON) {
+			printf("{\"t\":%.6f", (double) (first + i) / rate);
+
+			for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+				if (params->channels & (1 << ch)) {
+					printf(",\"ch%d\":%.3f", ch + 1, chunk[ch][i]);
+				}
+			}
+
+			printf("}\n");
+		} else {
+			printf("%.6f", (double) (first + i) / rate);
+
+			for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+				if (params->channels & (1 << ch)) {
+					printf(",%.3f", chunk[ch][i]);
+				}
+			}
+
+			printf("\n");
+		}
+	}
+}
+
+/* Min/max envelope of the frame, one line per channel */
+static void print_envelope(const struct scope_params *params, double t, size_t n)
+{
+	int ch, c;
+
+	for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+		if (!(params->channels & (1 << ch))) {
+			continue;
+		}
+
+		scope_decimate_minmax(frame[ch], n, env_min, env_max, params->columns);
+
+		if (params->format == WATCH_FORMAT_JSON) {
+			printf("{\"t\":%.6f,\"ch\":%d,\"min\":[", t, ch + 1);
+
+			for (c = 0; c < params->columns; ++c) {
+				printf("%s%.3f", c ? "," : "", env_min[c]);
+			}
+
+			printf("],\"max\":[");
+
+			for (c = 0; c < params->columns; ++c) {
+				printf("%s%.3f", c ? "," : "", env_max[c]);
+			}
+
+			printf("]}\n");
+		} else {
+			printf("%.6f,%d", t, ch + 1);
+
+			for (c = 0; c < params->columns; ++c) {
+				printf(",%.3f:%.3f", env_min[c], env_max[c]);
+			}
+
+			printf("\n");
+		}
+	}
+}
+
+/* Append the chunk to the envelope frame, every completed frame is printed */
+static void frame_feed(const struct scope_params *params, uint32_t rate, uint64_t first, size_t n,
+						size_t frame_len, size_t *fill)
+{
+	size_t off = 0, take;
+	int ch;
+
+	while (off < n) {
+		take = frame_len - *fill;
+
+		if (take > n - off) {
+			take = n - off;
+		}
+
+		for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+			memcpy(&frame[ch][*fill], &chunk[ch][off], take * sizeof(float));
+		}
+
+		*fill += take;
+		off += take;
+
+		if (*fill == frame_len) {
+			print_envelope(params, (double) (first + off - frame_len) / rate, frame_len);
+			*fill = 0;
+		}
+	}
+}
+
+int scope_dump(const struct scope_params *params)
+{
+	struct sigaction sa;
+	struct scope_stream_stats stats;
+	struct scope_ring *ring = scope_stream_ring();
+	uint64_t tail = 0, lost = 0, limit = 0;
+	size_t n, frame_len = 0, frame_fill = 0;
+	int rate;
+
+	if (params->columns < 0 || params->columns > SCOPE_MAX_COLUMNS) {
+		fprintf(stderr, "Invalid number of the columns, max is %d\n", SCOPE_MAX_COLUMNS);
+		return -1;
+	}
+
+	rate = scope_stream_start(params->channels, params->rate);
+
+	if (rate < 0) {
+		fprintf(stderr, "Couldn't start the scope, error: %s\n", hardware_get_last_error_desc());
+		return -1;
+	}
+
+	if (params->seconds > 0) {
+		limit = (uint64_t) (params->seconds * rate);
+	}
+
+	frame_len = rate / SCOPE_FRAME_RATE;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+	fprintf(stderr, "Streaming at %d Hz, %s kernels, press Ctrl+C to stop\n", rate, scope_dsp_kernels());
+
+	print_header(params);
+
+	dump_running = 1;
+
+	while (dump_running && (!limit || tail < limit)) {
+		n = scope_ring_read(ring, &tail, chunk[0], chunk[1], SCOPE_CHUNK_SAMPLES, &lost);
+
+		if (!n) {
+			fflush(stdout);
+			usleep(SCOPE_POLL_US);
+			continue;
+		}
+
+		if (limit && tail > limit) {
+			n -= tail - limit;
+			tail = limit;
+		}
+
+		if (!params->columns) {
+			print_samples(params, rate, tail - n, n);
+		} else {
+			frame_feed(params, rate, tail - n, n, frame_len, &frame_fill);
+		}
+
+		if (ferror(stdout)) {
+			/* Reader is gone, nothing to do anymore */
+			break;
+		}
+	}
+
+	fflush(stdout);
+	scope_stream_stop();
+	scope_stream_get_stats(&stats);
+
+	fprintf(stderr, "Received %llu blocks, lost %llu by the link, %llu samples dropped by the slow output\n",
+			(unsigned long long) stats.blocks, (unsigned long long) stats.lost_blocks,
+			(unsigned long long) lost);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+/*
+   cli_spectrum.c
+    - Ripple spectrum reports of the streamed output voltages
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include "cli_spectrum.h"
+#include "cli_watch.h"
+#include "ripple_spectrum.h"
+#include "scope_stream.h"
+#include "scope_dsp.h"
+#include "device_communicator.h"
+
+#define SPECTRUM_CHUNK_SAMPLES 8192
+
+#define SPECTRUM_POLL_US 10000
+
+static volatile sig_atomic_t spectrum_running = 0;
+
+static float chunk[SCOPE_RING_CHANNELS][SPECTRUM_CHUNK_SAMPLES];
+
+/* */
+static void spectrum_stop_signal(int sig)
+{
+	spectrum_running = 0;
+}
+
+static const char *alert_name(int alert)
+{
+	if (alert & RIPPLE_ALERT_LIMIT) {
+		return "limit";
+	}
+
+	if (alert & RIPPLE_ALERT_DEGRADED) {
+		return "degraded";
+	}
+
+	return "none";
+}
+
+static void print_header(const struct spectrum_params *params)
+{
+	int i;
+
+	if (params->format != WATCH_FORMAT_CSV) {
+		return;
+	}
+
+	printf("time_s,channel,mean_v,rms_mv,pp_mv,tone_hz,tone_mv");
+
+	for (i = 0; i < RIPPLE_PEAKS; ++i) {
+		printf(",peak%d_hz,peak%d_mv", i + 1, i + 1);
+	}
+
+	printf(",baseline_mv,alert\n");
+}
+
+static void print_report(const struct spectrum_params *params, double t, int ch, const struct ripple_report *rep)
+{
+	int i;
+
+	if (params->format == WATCH_FORMAT_JSON) {
+		printf("{\"t\":%.3f,\"ch\":%d,\"mean\":%.3f,\"rms_mv\":%.2f,\"pp_mv\":%.2f,"
+				"\"tone\":{\"hz\":%.0f,\"mv\":%.2f},\"peaks\":[",
+				t, ch + 1, rep->mean_v, rep->rms_v * 1000, rep->pp_v * 1000, rep->tone_freq_hz, rep->tone_v * 1000);
+
+		for (i = 0; i < rep->peaks; ++i) {
+			printf("%s{\"hz\":%.0f,\"mv\":%.2f}", i ? "," : "", rep->peak[i].freq_hz, rep->peak[i].amplitude_v * 1000);
+		}
+
+		printf("],\"baseline_mv\":%.2f,\"alert\":\"%s\"}\n", rep->baseline_rms_v * 1000, alert_name(rep->alert));
+		return;
+	}
+
+	printf("%.3f,%d,%.3f,%.2f,%.2f,%.0f,%.2f", t, ch + 1, rep->mean_v, rep->rms_v * 1000, rep->pp_v * 1000,
+			rep->tone_freq_hz, rep->tone_v * 1000);
+
+	for (i = 0; i < RIPPLE_PEAKS; ++i) {
+		if (i < rep->peaks) {
+			printf(",%.0f,%.2f", rep->peak[i].freq_hz, rep->peak[i].amplitude_v * 1000);
+		} else {
+			printf(",,");
+		}
+	}
+
+	printf(",%.2f,%s\n", rep->baseline_rms_v * 1000, alert_name(rep->alert));
+}
+
+/* Alerts are shown on the change only, not every report */
+static int check_alert(double t, int ch, const struct ripple_report *rep, int *prev)
+{
+	int raised = rep->alert & ~*prev;
+
+	if (raised & RIPPLE_ALERT_LIMIT) {
+		fprintf(stderr, "%.3f: channel %d ripple %.2f mV RMS is above the limit\n", t, ch + 1, rep->rms_v * 1000);
+	}
+
+	if (raised & RIPPLE_ALERT_DEGRADED) {
+		fprintf(stderr, "%.3f: channel %d ripple %.2f mV RMS is %.1f times the baseline %.2f mV, the converter may be degrading\n",
+				t, ch + 1, rep->rms_v * 1000, rep->rms_v / rep->baseline_rms_v, rep->baseline_rms_v * 1000);
+	}
+
+	if (*prev && !rep->alert) {
+		fprintf(stderr, "%.3f: channel %d ripple is back to %.2f mV RMS\n", t, ch + 1, rep->rms_v * 1000);
+	}
+
+	*prev = rep->alert;
+
+	return raised ? 1 : 0;
+}
+
+int spectrum_run(const struct spectrum_params *params)
+{
+	struct sigaction sa;
+	struct ripple_spectrum rs;
+	struct ripple_report report[RIPPLE_CHANNELS];
+	struct scope_stream_stats stats;
+	struct scope_ring *ring = scope_stream_ring();
+	uint64_t tail = 0, lost = 0, limit = 0, interval, next_report;
+	int prev_alert[RIPPLE_CHANNELS] = { 0 };
+	int alerts = 0;
+	size_t n;
+	int rate, ch;
+
+	rate = scope_stream_start(params->channels, HW_SCOPE_RATE_MAX);
+
+	if (rate < 0) {
+		fprintf(stderr, "Couldn't start the scope, error: %s\n", hardware_get_last_error_desc());
+		return -1;
+	}
+
+	if (ripple_spectrum_init(&rs, rate, params->limit_mv / 1000, params->degrade_ratio) < 0) {
+		fprintf(stderr, "Couldn't allocate the analyser\n");
+		scope_stream_stop();
+		return -1;
+	}
+
+	if (params->seconds > 0) {
+		limit = (uint64_t) (params->seconds * rate);
+	}
+
+	interval = (uint64_t) rate * SPECTRUM_REPORT_INTERVAL_S;
+	next_report = interval;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = spectrum_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	fprintf(stderr, "Streaming at %d Hz, %zu points FFT, %s kernels, press Ctrl+C to stop\n",
+			rate, rs.fft.size, scope_dsp_kernels());
+
+	print_header(params);
+
+	spectrum_running = 1;
+
+	while (spectrum_running && (!limit || tail < limit)) {
+		/* Reports are aligned to the sample count, not to the wall clock */
+		n = scope_ring_read(ring, &tail, chunk[0], chunk[1],
+							next_report - tail < SPECTRUM_CHUNK_SAMPLES ? next_report - tail : SPECTRUM_CHUNK_SAMPLES, &lost);
+
+		if (!n) {
+			usleep(SPECTRUM_POLL_US);
+			continue;
+		}
+
+		ripple_spectrum_feed(&rs, chunk[0], chunk[1], n);
+
+		if (tail < next_report) {
+			continue;
+		}
+
+		/* Skipped samples of the overrun may move the tail over several intervals */
+		next_report = (tail / interval + 1) * interval;
+
+		if (ripple_spectrum_report(&rs, report) < 0) {
+			continue;
+		}
+
+		for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+			if (params->channels & (1 << ch)) {
+				print_report(params, (double) tail / rate, ch, &report[ch]);
+				alerts += check_alert((double) tail / rate, ch, &report[ch], &prev_alert[ch]);
+			}
+		}
+
+		fflush(stdout);
+	}
+
+	scope_stream_stop();
+	scope_stream_get_stats(&stats);
+	ripple_spectrum_free(&rs);
+
+	fprintf(stderr, "Received %llu blocks, lost %llu by the link, %llu samples dropped by the slow analysis, %d alerts\n",
+			(unsigned long long) stats.blocks, (unsigned long long) stats.lost_blocks,
+			(unsigned long long) lost, alerts);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	return alerts;
+}
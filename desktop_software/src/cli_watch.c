@@ -0,0 +1,404 @@
+/*
+   cli_watch.c
+    - Continuous hardware state streaming for the command line application
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "cli_watch.h"
+#include "device_communicator.h"
+
+/* Output is collected here and written with a single syscall */
+#define WATCH_OUT_BUF_SIZE 4096
+/* Longest possible output line, with some margin */
+#define WATCH_MAX_LINE_LEN 256
+/* Don't keep data in the buffer longer than this, even on high rates */
+#define WATCH_FLUSH_INTERVAL_NS 100000000ULL
+
+struct watch_out {
+	char data[WATCH_OUT_BUF_SIZE];
+	size_t len;
+	uint64_t last_flush_ns;
+};
+
+static struct watch_out out;
+static volatile sig_atomic_t watch_running = 0;
+
+/* */
+static void watch_stop_signal(int sig)
+{
+	watch_running = 0;
+}
+
+/* Write everything collected to stdout */
+static int out_flush(uint64_t now_ns)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < out.len) {
+		ret = write(STDOUT_FILENO, out.data + done, out.len - done);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -errno;
+		}
+
+		done += ret;
+	}
+
+	out.len = 0;
+	out.last_flush_ns = now_ns;
+
+	return 0;
+}
+
+/* Simple allocation-free formatters */
+static void out_str(const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(out.data + out.len, str, len);
+	out.len += len;
+}
+
+static void out_uint(uint64_t val)
+{
+	char tmp[20];
+	int i = 0;
+
+	do {
+		tmp[i++] = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+
+	while (i) {
+		out.data[out.len++] = tmp[--i];
+	}
+}
+
+/* Fixed point value with the requested number of decimals */
+static void out_fixed(int64_t val, int decimals)
+{
+	uint64_t div = 1;
+	uint64_t frac;
+	int i;
+
+	for (i = 0; i < decimals; ++i) {
+		div *= 10;
+	}
+
+	if (val < 0) {
+		out.data[out.len++] = '-';
+		val = -val;
+	}
+
+	out_uint(val / div);
+
+	if (!decimals) {
+		return;
+	}
+
+	out.data[out.len++] = '.';
+
+	frac = val % div;
+
+	while (div /= 10) {
+		out.data[out.len++] = '0' + (frac / div);
+		frac %= div;
+	}
+}
+
+/* Voltage in 10 mV units */
+static void out_voltage(float v)
+{
+	out_fixed((int64_t) (v * 100.0f + (v < 0 ? -0.5f : 0.5f)), 2);
+}
+
+/* Tone level, empty (null for json) if it can't be measured */
+static void out_tone(const struct watch_params *params, float v)
+{
+	if (v >= 0) {
+		out_voltage(v);
+	} else if (params->format == WATCH_FORMAT_JSON) {
+		out_str("null");
+	}
+}
+
+/* Field separator and name (json only) */
+static void out_key(const struct watch_params *params, const char *key, int *first)
+{
+	if (!*first) {
+		out.data[out.len++] = ',';
+	}
+
+	*first = 0;
+
+	if (params->format == WATCH_FORMAT_JSON) {
+		out.data[out.len++] = '"';
+		out_str(key);
+		out_str("\":");
+	}
+}
+
+/* Text value, quoted for json */
+static void out_text(const struct watch_params *params, const char *text)
+{
+	if (params->format == WATCH_FORMAT_JSON) {
+		out.data[out.len++] = '"';
+		out_str(text);
+		out.data[out.len++] = '"';
+	} else {
+		out_str(text);
+	}
+}
+
+/* CSV header line with the selected columns */
+static void out_csv_header(const struct watch_params *params)
+{
+	out_str("time");
+
+	if (params->fields & HW_STATE_FIELD_PS) {
+		out_str(",ps");
+	}
+
+	if (params->fields & HW_STATE_FIELD_VOLTAGES) {
+		out_str(",ch1_voltage,ch2_voltage");
+	}
+
+	if (params->fields & HW_STATE_FIELD_POLARITY) {
+		out_str(",ch1_polarity,ch2_polarity");
+	}
+
+	if (params->fields & HW_STATE_FIELD_BAND) {
+		out_str(",ch1_band,ch2_band");
+	}
+
+	if (params->fields & HW_STATE_FIELD_TONE) {
+		out_str(",ch1_tone,ch2_tone");
+	}
+
+	out.data[out.len++] = '\n';
+}
+
+/* Format one sample of the state */
+static void out_sample(const struct watch_params *params, uint64_t ts_ns,
+						const struct hardware_state *hw_state)
+{
+	int first = 1;
+
+	if (params->format == WATCH_FORMAT_JSON) {
+		out.data[out.len++] = '{';
+	}
+
+	/* Time since start in seconds, us resolution */
+	out_key(params, "time", &first);
+	out_fixed(ts_ns / 1000ULL, 6);
+
+	if (params->fields & HW_STATE_FIELD_PS) {
+		out_key(params, "ps", &first);
+		out.data[out.len++] = hw_state->ps_enabled ? '1' : '0';
+	}
+
+	if (params->fields & HW_STATE_FIELD_VOLTAGES) {
+		out_key(params, "ch1_voltage", &first);
+		out_voltage(hw_state->ch1_output_voltage);
+		out_key(params, "ch2_voltage", &first);
+		out_voltage(hw_state->ch2_output_voltage);
+	}
+
+	if (params->fields & HW_STATE_FIELD_POLARITY) {
+		out_key(params, "ch1_polarity", &first);
+		out_text(params, hw_state->ch1_polarity_vr ? "VR" : "HL");
+		out_key(params, "ch2_polarity", &first);
+		out_text(params, hw_state->ch2_polarity_vr ? "VR" : "HL");
+	}
+
+	if (params->fields & HW_STATE_FIELD_BAND) {
+		out_key(params, "ch1_band", &first);
+		out_text(params, hw_state->ch1_band_low ? "low" : "high");
+		out_key(params, "ch2_band", &first);
+		out_text(params, hw_state->ch2_band_low ? "low" : "high");
+	}
+
+	if (params->fields & HW_STATE_FIELD_TONE) {
+		out_key(params, "ch1_tone", &first);
+		out_tone(params, hw_state->ch1_tone_level);
+		out_key(params, "ch2_tone", &first);
+		out_tone(params, hw_state->ch2_tone_level);
+	}
+
+	if (params->format == WATCH_FORMAT_JSON) {
+		out.data[out.len++] = '}';
+	}
+
+	out.data[out.len++] = '\n';
+}
+
+/* Sleep until the absolute monotonic time */
+static void sleep_until(uint64_t deadline_ns)
+{
+	struct timespec ts;
+	uint64_t now_ns = hardware_monotonic_ns();
+
+	if (deadline_ns <= now_ns) {
+		return;
+	}
+
+	ts.tv_sec = (deadline_ns - now_ns) / 1000000000ULL;
+	ts.tv_nsec = (deadline_ns - now_ns) % 1000000000ULL;
+
+	/* Interrupted sleep is fine, loop checks the stop flag */
+	nanosleep(&ts, NULL);
+}
+
+int watch_parse_fields(const char *str)
+{
+	int fields = 0;
+	const char *end;
+	size_t len;
+
+	while (*str) {
+		end = strchr(str, ',');
+		len = end ? (size_t) (end - str) : strlen(str);
+
+		if (len == 3 && !strncmp(str, "all", len)) {
+			fields |= HW_STATE_FIELD_ALL;
+		} else if (len == 2 && !strncmp(str, "ps", len)) {
+			fields |= HW_STATE_FIELD_PS;
+		} else if (len == 8 && !strncmp(str, "voltages", len)) {
+			fields |= HW_STATE_FIELD_VOLTAGES;
+		} else if (len == 8 && !strncmp(str, "polarity", len)) {
+			fields |= HW_STATE_FIELD_POLARITY;
+		} else if (len == 4 && !strncmp(str, "band", len)) {
+			fields |= HW_STATE_FIELD_BAND;
+		} else if (len == 4 && !strncmp(str, "tone", len)) {
+			fields |= HW_STATE_FIELD_TONE;
+		} else {
+			return -1;
+		}
+
+		str += len;
+
+		if (*str == ',') {
+			str++;
+		}
+	}
+
+	return fields ? fields : -1;
+}
+
+int watch_parse_format(const char *str)
+{
+	if (!strcmp(str, "csv")) {
+		return WATCH_FORMAT_CSV;
+	}
+
+	if (!strcmp(str, "json")) {
+		return WATCH_FORMAT_JSON;
+	}
+
+	return -1;
+}
+
+/* Poll the hardware with the requested rate and print every sample */
+int watch_hw_state(const struct watch_params *params)
+{
+	struct sigaction sa;
+	struct hardware_state hw_state;
+	uint64_t start_ns, now_ns, next_ns;
+	uint64_t period_ns = 0;
+	int bad_cnt = 0;
+	int ret = 0;
+
+	memset(&hw_state, 0, sizeof(hw_state));
+
+	if (params->rate > 0) {
+		period_ns = (uint64_t) (1000000000.0 / params->rate);
+	}
+
+	/* Stop streaming on Ctrl+C or kill, hardware must be properly closed */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = watch_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* Closed pipe is handled with the write() error */
+	signal(SIGPIPE, SIG_IGN);
+
+	watch_running = 1;
+
+	out.len = 0;
+	start_ns = next_ns = out.last_flush_ns = hardware_monotonic_ns();
+
+	if (params->format == WATCH_FORMAT_CSV) {
+		out_csv_header(params);
+	}
+
+	while (watch_running) {
+		if (hardware_read_state(&hw_state, params->fields) != 0) {
+			if (bad_cnt++ >= HW_MAX_READ_FAILS) {
+				fprintf(stderr, "Couldn't read the hardware state, error: %s\n", hardware_get_last_error_desc());
+				ret = -1;
+				break;
+			}
+		} else {
+			bad_cnt = 0;
+			now_ns = hardware_monotonic_ns();
+
+			out_sample(params, now_ns - start_ns, &hw_state);
+
+			/* Flush when buffer is almost full or data is getting old */
+			/* On slow rates every sample goes out immediately */
+			if (out.len > WATCH_OUT_BUF_SIZE - WATCH_MAX_LINE_LEN
+					|| period_ns >= WATCH_FLUSH_INTERVAL_NS
+					|| now_ns - out.last_flush_ns >= WATCH_FLUSH_INTERVAL_NS) {
+				if (out_flush(now_ns) != 0) {
+					/* Reader is gone, nothing to do anymore */
+					break;
+				}
+			}
+		}
+
+		if (period_ns) {
+			next_ns += period_ns;
+			now_ns = hardware_monotonic_ns();
+
+			/* Can't keep up, don't try to catch up with a burst */
+			if (next_ns < now_ns) {
+				next_ns = now_ns;
+			}
+
+			sleep_until(next_ns);
+		}
+	}
+
+	out_flush(hardware_monotonic_ns());
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	return ret;
+}
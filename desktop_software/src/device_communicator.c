@@ -24,10 +24,12 @@
 #include <poll.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include "device_communicator.h"
 #include "usb_protocol_private.h"
 #include "crc8.h"
 #include "port_utils.h"
+#include "device_emulator.h"
 
 /* This is a default buad rate of the STM ACM implementation */
 /* At this moment there is no reason to change it */
@@ -36,7 +38,24 @@
 /* Division coefficient of the ADC voltage dividers */
 #define HARDWARE_ADC_VOLTAGE_DIVIDER_COEFF 6.58
 
-#define HARDWARE_ADC_VOLTAGE_AVG_COUNT 5
+/* Averaged voltages are in 0.1 mV units */
+#define HARDWARE_ADC_AVG_VOLTAGE_SCALE 10000.0f
+
+/* Raw 12 bit samples of the scope mode, 3.3 V reference */
+#define HARDWARE_ADC_VREF 3.3f
+#define HARDWARE_ADC_FULL_SCALE 4096.0f
+
+/* Hiccup retry interval resolution */
+#define HARDWARE_HICCUP_UNIT_MS 100
+
+/* Firmware tone gate duration unit */
+#define HARDWARE_TONE_GATE_UNIT_US 100
+
+/* Device events are kept until read by the user */
+#define HARDWARE_EVENT_QUEUE_LEN 32
+
+/* Max number of requests sent with a single write */
+#define HARDWARE_MAX_BATCH_LEN 8
 
 /* Poll timing */
 #define READ_POLL_RETRY_COUNT 6
@@ -50,6 +69,16 @@ static comm_error_handler on_error_cb_fun = NULL;
 static void *on_error_cb_user_data = NULL;
 
 static int serial_fd = 0;
+static int emulated = 0;
+
+/* Incoming data stream, may contain a few frames */
+static uint8_t rx_stream[512];
+static size_t rx_stream_len = 0;
+
+/* Device events received between the responses */
+static struct hardware_event event_queue[HARDWARE_EVENT_QUEUE_LEN];
+static int event_head = 0;
+static int event_tail = 0;
 
 /* Notifier thread */
 static volatile int run_reader_thread = 0;
@@ -59,8 +88,14 @@ static pthread_t reader_thread;
 /* Open hardware serial device */
 int hardware_connect(const char *sdev_path)
 {
+	emulated = !strcmp(sdev_path, HW_EMULATOR_PORT);
+
 	/* Open serial device in non-blocking mode */
-	serial_fd = open_serial_dev(sdev_path, STM_ACM_DEFAULT_BAUD_RATE, 1);
+	if (emulated) {
+		serial_fd = emulator_start();
+	} else {
+		serial_fd = open_serial_dev(sdev_path, STM_ACM_DEFAULT_BAUD_RATE, 1);
+	}
 
 	if (serial_fd < 0) {
 		return serial_fd;
@@ -68,6 +103,9 @@ int hardware_connect(const char *sdev_path)
 
 	pthread_mutex_init(&hw_lock, NULL);
 
+	rx_stream_len = 0;
+	event_head = event_tail = 0;
+
 	return 0;
 }
 
@@ -76,7 +114,10 @@ int hardware_disconnect()
 {
 	int ret = 0;
 
-	if (serial_fd) {
+	if (serial_fd > 0 && emulated) {
+		emulator_stop();
+		serial_fd = 0;
+	} else if (serial_fd) {
 		ret = close_serial_dev(serial_fd);
 		serial_fd = 0;
 	}
@@ -98,47 +139,155 @@ static void buld_generic_packet(uint8_t *pkt, uint8_t op, uint8_t cmd, uint8_t a
 	pkt[6] = crc8(pkt, USB_PACKET_LEN - 1);
 }
 
-/* Read data from the serial port in non-blocking manner */
-int read_answer_nb(int fd, void *buf, size_t count)
+/* Drop n bytes from the beginning of the stream buffer */
+static void stream_consume(size_t n)
+{
+	memmove(rx_stream, rx_stream + n, rx_stream_len - n);
+	rx_stream_len -= n;
+}
+
+/* Find the next complete frame in the stream buffer */
+/* Garbage and broken frames are skipped */
+/* Returns frame length or 0 if more data is required */
+static size_t stream_next_frame()
+{
+	size_t frame_len;
+
+	while (rx_stream_len) {
+		if (rx_stream[0] != DS_HEADER_MAGIC1
+				|| (rx_stream_len > 1 && rx_stream[1] != DS_HEADER_MAGIC2)) {
+			stream_consume(1);
+			continue;
+		}
+
+		if (rx_stream_len < DS_EXT_HEADER_LEN) {
+			return 0;
+		}
+
+		if (rx_stream[2] == DS_EVENT) {
+			if (rx_stream[4] > DS_EXT_MAX_PAYLOAD) {
+				stream_consume(1);
+				continue;
+			}
+
+			frame_len = DS_EXT_FRAME_LEN(rx_stream[4]);
+		} else {
+			frame_len = USB_PACKET_LEN;
+		}
+
+		if (rx_stream_len < frame_len) {
+			return 0;
+		}
+
+		if (rx_stream[frame_len - 1] != crc8(rx_stream, frame_len - 1)) {
+			stream_consume(1);
+			continue;
+		}
+
+		return frame_len;
+	}
+
+	return 0;
+}
+
+/* Save the event frame to the queue, the oldest event is lost on overflow */
+static void push_event(const uint8_t *frame)
+{
+	struct hardware_event *ev = &event_queue[event_head];
+
+	ev->id = frame[3];
+	ev->len = frame[4];
+	memcpy(ev->data, frame + DS_EXT_HEADER_LEN, ev->len);
+
+	event_head = (event_head + 1) % HARDWARE_EVENT_QUEUE_LEN;
+
+	if (event_head == event_tail) {
+		event_tail = (event_tail + 1) % HARDWARE_EVENT_QUEUE_LEN;
+	}
+}
+
+/* Wait for the new data and append it to the stream buffer */
+static int stream_fill(int fd, int timeout_ms)
 {
 	struct pollfd fds[1];
-	int ret; 
+	int ret;
 
 	fds[0].fd = fd;
 	fds[0].events = POLLIN;
 
-	/* Poll the serail device */
-	/* We really don't want to cover all the cases here */
-	for (int i = 0; i < READ_POLL_RETRY_COUNT; i++) {
-		ret = poll(fds, 1, READ_POLL_TIEMOUT_MS);
+	ret = poll(fds, 1, timeout_ms);
 
-		if (ret < 0) {
-			return errno;
-		}
+	if (ret < 0) {
+		return errno;
+	}
 
-		if (ret == 0) {
-			return ETIMEDOUT;
+	if (ret == 0) {
+		return ETIMEDOUT;
+	}
+
+	if (fds[0].revents != POLLIN) {
+		return EIO;
+	}
+
+	ret = read(fd, rx_stream + rx_stream_len, sizeof(rx_stream) - rx_stream_len);
+
+	if (ret <= 0) {
+		return (errno == EAGAIN) ? 0 : EIO;
+	}
+
+	rx_stream_len += ret;
+
+	return 0;
+}
+
+/* Handle all complete frames in the stream buffer */
+/* Events go to the queue, responses are copied to buf until count bytes are collected */
+static void stream_process(uint8_t *buf, size_t count, size_t *done)
+{
+	size_t frame_len;
+
+	while ((frame_len = stream_next_frame()) > 0) {
+		if (rx_stream[2] == DS_EVENT) {
+			push_event(rx_stream);
+		} else if (*done < count) {
+			memcpy(buf + *done, rx_stream, USB_PACKET_LEN);
+			*done += USB_PACKET_LEN;
 		}
 
-		if (fds[0].revents == POLLIN) {
-			ret = read(fd, buf, count);
+		stream_consume(frame_len);
 
-			if (ret != count) {
-				if (errno == EAGAIN) {
-					continue;
-				}
+		if (count && *done == count) {
+			return;
+		}
+	}
+}
 
-				return EIO;
-			}
+/* Read response frames from the serial port in non-blocking manner */
+/* Device events may come between the responses, they are saved to the event queue */
+/* count must be a multiple of the USB_PACKET_LEN */
+int read_answer_nb(int fd, void *buf, size_t count)
+{
+	size_t done = 0;
+	uint64_t deadline_ns = hardware_monotonic_ns()
+							+ READ_POLL_RETRY_COUNT * READ_POLL_TIEMOUT_MS * 1000000ULL;
+	int ret; 
 
-			return 0;
+	stream_process(buf, count, &done);
 
-		} else {
-			break;
+	/* Poll the serail device */
+	/* We really don't want to cover all the cases here */
+	/* Events may fill every read, so the wait is limited by the time, not by the reads count */
+	while (done < count && hardware_monotonic_ns() < deadline_ns) {
+		ret = stream_fill(fd, READ_POLL_TIEMOUT_MS);
+
+		if (ret != 0) {
+			return ret;
 		}
+
+		stream_process(buf, count, &done);
 	}
 
-	return EIO;
+	return (done == count) ? 0 : EIO;
 }
 
 /* Generic writer function */
@@ -178,22 +327,34 @@ static int write_to_the_device(uint8_t cmd, uint8_t a1, uint8_t a2)
 	return 0;
 }
 
-/* Generic reader function */
-static int read_from_the_device(uint8_t cmd, uint8_t *res1, uint8_t *res2)
+/* Extended writer function */
+/* Payload of any length up to DS_EXT_MAX_PAYLOAD, device NAK is returned as -EBUSY or -EINVAL */
+static int write_ext_to_the_device(uint8_t cmd, const uint8_t *payload, uint8_t len)
 {
 	int ret;
-	uint8_t packet[USB_PACKET_LEN];
+	uint8_t packet[DS_EXT_FRAME_LEN(DS_EXT_MAX_PAYLOAD)];
+	size_t packet_len = DS_EXT_FRAME_LEN(len);
 
 	if (serial_fd <= 0) {
-		errno = EIO;
+		return -EIO;
+	}
+
+	if (len > DS_EXT_MAX_PAYLOAD) {
+		errno = EINVAL;
 		return -errno;
 	}
 
-	buld_generic_packet(packet, DS_CMD_READ, cmd, 0, 0);
+	packet[0] = DS_HEADER_MAGIC1;
+	packet[1] = DS_HEADER_MAGIC2;
+	packet[2] = DS_CMD_WRITE_EXT;
+	packet[3] = cmd;
+	packet[4] = len;
+	memcpy(packet + DS_EXT_HEADER_LEN, payload, len);
+	packet[packet_len - 1] = crc8(packet, packet_len - 1);
 
 	pthread_mutex_lock(&hw_lock);
 
-	if (write(serial_fd, packet, USB_PACKET_LEN) != USB_PACKET_LEN) {
+	if (write(serial_fd, packet, packet_len) != (ssize_t) packet_len) {
 		pthread_mutex_unlock(&hw_lock);
 		return -errno;
 	}
@@ -201,29 +362,105 @@ static int read_from_the_device(uint8_t cmd, uint8_t *res1, uint8_t *res2)
 	ret = read_answer_nb(serial_fd, packet, USB_PACKET_LEN);
 
 	pthread_mutex_unlock(&hw_lock);
- 
+
 	if (ret != 0) {
 		errno = ret;
 		return -errno;
 	}
 
-	/* Let's verify what we got from the device */
-	if (packet[2] != DS_RESPONSE) {
+	if (packet[2] != DS_CMD_WRITE_EXT || packet[3] != cmd) {
 		errno = EPROTO;
 		return -errno;
 	}
 
-	if (packet[6] != crc8(packet, USB_PACKET_LEN - 1)) {
-		errno = EPROTO;
+	if (packet[4] == 0xFF && packet[5] == 0xFF) {
+		return 0;
+	}
+
+	errno = (packet[4] == DS_NAK_BUSY) ? EBUSY : (packet[4] == DS_NAK_INVALID ? EINVAL : EPROTO);
+	return -errno;
+}
+
+/* Generic batch reader function */
+/* All requests are sent with a single write, device responds in the same order */
+/* Request ARG1 is taken from args, may be NULL */
+/* Each result is a 16 bit value: ARG1 - high byte, ARG2 - low byte */
+static int read_batch_from_the_device(const uint8_t *cmds, const uint8_t *args,
+										uint16_t *results, int count)
+{
+	int i, ret;
+	uint8_t packets[USB_PACKET_LEN * HARDWARE_MAX_BATCH_LEN];
+	uint8_t *packet;
+	size_t len = count * USB_PACKET_LEN;
+
+	if (serial_fd <= 0) {
+		errno = EIO;
+		return -errno;
+	}
+
+	if (count <= 0 || count > HARDWARE_MAX_BATCH_LEN) {
+		errno = EINVAL;
 		return -errno;
 	}
 
+	for (i = 0; i < count; ++i) {
+		buld_generic_packet(packets + i * USB_PACKET_LEN, DS_CMD_READ, cmds[i], args ? args[i] : 0, 0);
+	}
+
+	pthread_mutex_lock(&hw_lock);
+
+	if (write(serial_fd, packets, len) != len) {
+		pthread_mutex_unlock(&hw_lock);
+		return -errno;
+	}
+
+	ret = read_answer_nb(serial_fd, packets, len);
+
+	pthread_mutex_unlock(&hw_lock);
+ 
+	if (ret != 0) {
+		errno = ret;
+		return -errno;
+	}
+
+	/* Let's verify what we got from the device */
+	for (i = 0; i < count; ++i) {
+		packet = packets + i * USB_PACKET_LEN;
+
+		if (packet[2] != DS_RESPONSE || packet[3] != cmds[i]) {
+			errno = EPROTO;
+			return -errno;
+		}
+
+		if (packet[6] != crc8(packet, USB_PACKET_LEN - 1)) {
+			errno = EPROTO;
+			return -errno;
+		}
+
+		results[i] = (packet[4] << 8) | packet[5];
+	}
+
+	return 0;
+}
+
+/* Generic reader function */
+static int read_from_the_device(uint8_t cmd, uint8_t *res1, uint8_t *res2)
+{
+	int ret;
+	uint16_t result;
+
+	ret = read_batch_from_the_device(&cmd, NULL, &result, 1);
+
+	if (ret != 0) {
+		return ret;
+	}
+
 	if (res1) {
-		*res1 = packet[4];
+		*res1 = result >> 8;
 	}
 
 	if (res2) {
-		*res2 = packet[5];
+		*res2 = result;
 	}
 
 	return 0;
@@ -246,62 +483,125 @@ static int read_ps_state(struct hardware_state *hw_state)
 	return 0;
 }
 
-/* Generic channel voltage reader */
-static int read_channel_out_real_voltage(uint8_t channel, float *result)
+/* Averaged ADC value to the channel output voltage */
+static float avg_voltage_to_output(uint16_t voltage_raw)
 {
-	int ret = 0;
-	uint8_t a1, a2;
-	uint16_t voltage_raw;
+	return ((float) voltage_raw) / HARDWARE_ADC_AVG_VOLTAGE_SCALE * HARDWARE_ADC_VOLTAGE_DIVIDER_COEFF;
+}
+
+/* Channel output voltage to the ADC input value */
+static uint16_t output_to_avg_voltage(float voltage)
+{
+	float raw = voltage / HARDWARE_ADC_VOLTAGE_DIVIDER_COEFF * HARDWARE_ADC_AVG_VOLTAGE_SCALE;
+
+	if (raw <= 0) {
+		return 0;
+	}
+
+	return (raw > 0xFFFF) ? 0xFFFF : (uint16_t) (raw + 0.5f);
+}
+
+/* Measured tone level to V peak-to-peak of the output */
+static float tone_level_to_output(uint16_t level_raw)
+{
+	return level_raw == DS_TONE_LEVEL_INVALID ? HW_TONE_LEVEL_UNKNOWN : avg_voltage_to_output(level_raw);
+}
+
+/* Read output voltages and/or measured tone levels of the both channels */
+/* Averaging and tone detection are done by the firmware, all values are requested at once */
+static int read_output_levels(struct hardware_state *hw_state, int fields)
+{
+	uint8_t cmds[4];
+	uint16_t results[4];
+	int count = 0;
+	int ret;
+
+	if (fields & HW_STATE_FIELD_VOLTAGES) {
+		cmds[count++] = DS_CMD_READ_AVG_VOLTAGE_CH1;
+		cmds[count++] = DS_CMD_READ_AVG_VOLTAGE_CH2;
+	}
 
-	ret = read_from_the_device(channel, &a1, &a2);
+	if (fields & HW_STATE_FIELD_TONE) {
+		cmds[count++] = DS_CMD_READ_TONE_LEVEL_CH1;
+		cmds[count++] = DS_CMD_READ_TONE_LEVEL_CH2;
+	}
+
+	ret = read_batch_from_the_device(cmds, NULL, results, count);
 
 	if (ret != 0) {
-		*result = 0.0;
+		hw_state->ch1_output_voltage = 0.0;
+		hw_state->ch2_output_voltage = 0.0;
+		hw_state->ch1_tone_level = HW_TONE_LEVEL_UNKNOWN;
+		hw_state->ch2_tone_level = HW_TONE_LEVEL_UNKNOWN;
 		return ret;
 	}
 
-	voltage_raw = a1 << 8;
-	voltage_raw |= a2;
+	count = 0;
 
-	*result = ((float) voltage_raw) / 1000;
-	*result *= HARDWARE_ADC_VOLTAGE_DIVIDER_COEFF;
+	if (fields & HW_STATE_FIELD_VOLTAGES) {
+		hw_state->ch1_output_voltage = avg_voltage_to_output(results[count++]);
+		hw_state->ch2_output_voltage = avg_voltage_to_output(results[count++]);
+	}
 
-	return ret;
+	if (fields & HW_STATE_FIELD_TONE) {
+		hw_state->ch1_tone_level = tone_level_to_output(results[count++]);
+		hw_state->ch2_tone_level = tone_level_to_output(results[count++]);
+	}
+
+	return 0;
 }
 
-/* Channel voltage reader with averaging */
-static int read_channel_out_real_voltage_avg(uint8_t channel, float *result)
+/* Read ripple statistics of the channel output voltage */
+/* All values are requested at once, MIN goes first to take a new window */
+int hardware_read_voltage_stats(uint8_t channel, struct voltage_stats *stats)
 {
-	int ret = 0;
-	uint8_t iter;
-	float sampled = 0;
-	float tmp = 0;
-
-	for (iter = 0; iter < HARDWARE_ADC_VOLTAGE_AVG_COUNT; ++iter) {
-		ret = read_channel_out_real_voltage(channel, &tmp);
+	static const uint8_t args[] = { DS_STATS_MIN, DS_STATS_MAX, DS_STATS_MEAN, DS_STATS_RMS };
+	uint8_t sel_chan = (channel == LNB_CHANNEL_1 ? DS_CMD_READ_STATS_CH1 : DS_CMD_READ_STATS_CH2);
+	uint8_t cmds[] = { sel_chan, sel_chan, sel_chan, sel_chan };
+	uint16_t results[4];
+	int ret;
 
-		if (ret != 0) {
-			break;
-		}
+	ret = read_batch_from_the_device(cmds, args, results, 4);
 
-		sampled += tmp;
+	if (ret != 0) {
+		return ret;
 	}
 
-	*result = sampled / HARDWARE_ADC_VOLTAGE_AVG_COUNT;
+	stats->min = avg_voltage_to_output(results[0]);
+	stats->max = avg_voltage_to_output(results[1]);
+	stats->mean = avg_voltage_to_output(results[2]);
+	stats->rms = avg_voltage_to_output(results[3]);
 
-	return ret;
+	return 0;
 }
 
-/* Read output voltage of the both channels */
-static int read_output_real_voltages(struct hardware_state *hw_state)
+/* Read the firmware boot stages times, all stages in one batch */
+int hardware_read_boot_times(struct hardware_boot_times *times)
 {
-	int ret = read_channel_out_real_voltage_avg(DS_CMD_READ_REAL_VOLTAGE_CH1, &hw_state->ch1_output_voltage);
+	uint8_t cmds[HW_BOOT_STAGE_COUNT];
+	uint8_t args[HW_BOOT_STAGE_COUNT];
+	uint16_t results[HW_BOOT_STAGE_COUNT];
+	int i, ret;
+
+	for (i = 0; i < HW_BOOT_STAGE_COUNT; ++i) {
+		cmds[i] = DS_CMD_READ_BOOT_TIME;
+		args[i] = DS_BOOT_STAGE_CLOCKS + i;
+	}
+
+	ret = read_batch_from_the_device(cmds, args, results, HW_BOOT_STAGE_COUNT);
 
 	if (ret != 0) {
 		return ret;
 	}
 
-	return read_channel_out_real_voltage_avg(DS_CMD_READ_REAL_VOLTAGE_CH2, &hw_state->ch2_output_voltage);
+	for (i = 0; i < HW_BOOT_STAGE_COUNT; ++i) {
+		times->saturated[i] = (results[i] == DS_BOOT_TIME_MAX);
+		times->stage_ms[i] = (results[i] == DS_BOOT_TIME_NOT_REACHED)
+								? HW_BOOT_TIME_NOT_REACHED
+								: results[i] * DS_BOOT_TIME_UNIT_US / 1000.0f;
+	}
+
+	return 0;
 }
 
 /* Read requested channel selected polarity (voltage mode) */
@@ -376,30 +676,62 @@ static int read_channels_band(struct hardware_state *hw_state)
 	return ret;
 }
 
-/* Read the full state of the hardware and fill-up structure */
-int hardware_read_full_state(struct hardware_state *hw_state)
+/* Read the selected fields of the hardware state */
+/* Fields which are not requested are left untouched */
+int hardware_read_state(struct hardware_state *hw_state, int fields)
 {
 	int ret = 0;
 
-	ret = read_ps_state(hw_state);
+	if (fields & HW_STATE_FIELD_PS) {
+		ret = read_ps_state(hw_state);
 
-	if (ret != 0) {
-		return ret;
+		if (ret != 0) {
+			return ret;
+		}
 	}
 
-	ret = read_output_real_voltages(hw_state);
+	if (fields & (HW_STATE_FIELD_VOLTAGES | HW_STATE_FIELD_TONE)) {
+		ret = read_output_levels(hw_state, fields);
 
-	if (ret != 0) {
-		return ret;
+		if (ret != 0) {
+			return ret;
+		}
 	}
 
-	ret = read_channels_polarity(hw_state);
+	if (fields & HW_STATE_FIELD_POLARITY) {
+		ret = read_channels_polarity(hw_state);
 
-	if (ret != 0) {
-		return ret;
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	if (fields & HW_STATE_FIELD_BAND) {
+		ret = read_channels_band(hw_state);
 	}
 
-	return read_channels_band(hw_state);
+	return ret;
+}
+
+/* Read the full state of the hardware and fill-up structure */
+int hardware_read_full_state(struct hardware_state *hw_state)
+{
+	return hardware_read_state(hw_state, HW_STATE_FIELD_ALL);
+}
+
+/* Write the power supply, polarity and band of both channels with one command */
+/* Device switches all the outputs together */
+int hardware_write_full_state(const struct hardware_state *hw_state)
+{
+	uint8_t payload[DS_APPLY_STATE_LEN];
+
+	payload[0] = hw_state->ps_enabled ? POWER_SUPPLY_ENABLED : POWER_SUPPLY_DISABLED;
+	payload[1] = hw_state->ch1_polarity_vr ? DS_OUT_VOLTAGE_MODE_13V : DS_OUT_VOLTAGE_MODE_18V;
+	payload[2] = hw_state->ch1_band_low ? DS_OUT_TONE_SIGNAL_DISABLED : DS_OUT_TONE_SIGNAL_ENABLED;
+	payload[3] = hw_state->ch2_polarity_vr ? DS_OUT_VOLTAGE_MODE_13V : DS_OUT_VOLTAGE_MODE_18V;
+	payload[4] = hw_state->ch2_band_low ? DS_OUT_TONE_SIGNAL_DISABLED : DS_OUT_TONE_SIGNAL_ENABLED;
+
+	return write_ext_to_the_device(DS_EXT_CMD_APPLY_STATE, payload, sizeof(payload));
 }
 
 /* Send commands to the hardware */
@@ -430,6 +762,578 @@ int hardware_set_channel_band(uint8_t channel, uint8_t band)
 	return write_to_the_device(sel_chan, sel_band, 0);
 }
 
+/* Set firmware averaging window of the output voltages, 2^log2_samples samples */
+int hardware_set_adc_avg_window(uint8_t log2_samples)
+{
+	return write_to_the_device(DS_CMD_ADC_AVG_WINDOW, log2_samples, 0);
+}
+
+/* Select the outputs restored by the device on boot */
+int hardware_set_restore_mask(uint8_t mask)
+{
+	if (mask & ~HW_RESTORE_ALL) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	return write_to_the_device(DS_CMD_STATE_RESTORE, mask, 0);
+}
+
+int hardware_get_restore_mask(uint8_t *mask)
+{
+	return read_from_the_device(DS_CMD_STATE_RESTORE, mask, NULL);
+}
+
+/* Configure output protection thresholds, V of the output, 0 - disabled */
+int hardware_set_protection(float low, float high)
+{
+	uint16_t low_raw = output_to_avg_voltage(low);
+	uint16_t high_raw = output_to_avg_voltage(high);
+	int ret;
+
+	ret = write_to_the_device(DS_CMD_PROTECTION_LOW, low_raw >> 8, low_raw);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	return write_to_the_device(DS_CMD_PROTECTION_HIGH, high_raw >> 8, high_raw);
+}
+
+/* Configure output settle detection, V of the output */
+int hardware_set_settle_detection(float target_13v, float target_18v, float tolerance)
+{
+	uint16_t target_13v_raw = output_to_avg_voltage(target_13v);
+	uint16_t target_18v_raw = output_to_avg_voltage(target_18v);
+	uint16_t tolerance_raw = output_to_avg_voltage(tolerance);
+	int ret;
+
+	if (target_13v <= 0 || target_18v <= 0 || tolerance <= 0) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	ret = write_to_the_device(DS_CMD_SETTLE_TARGET_13V, target_13v_raw >> 8, target_13v_raw);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	ret = write_to_the_device(DS_CMD_SETTLE_TARGET_18V, target_18v_raw >> 8, target_18v_raw);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	return write_to_the_device(DS_CMD_SETTLE_TOLERANCE, tolerance_raw >> 8, tolerance_raw);
+}
+
+/* Configure hiccup mode of the output protection */
+/* interval_ms 0 - disabled, max_retries 0 - unlimited */
+int hardware_set_protection_hiccup(int interval_ms, int max_retries)
+{
+	int interval = (interval_ms + HARDWARE_HICCUP_UNIT_MS - 1) / HARDWARE_HICCUP_UNIT_MS;
+
+	if (interval < 0 || interval > 0xFF || max_retries < 0 || max_retries > 0xFF) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	return write_to_the_device(DS_CMD_PROTECTION_HICCUP, interval, max_retries);
+}
+
+/* Wait for the device event */
+/* Events received during the other requests are returned first */
+int hardware_wait_event(struct hardware_event *ev, int timeout_ms)
+{
+	int ret = 0;
+	size_t done = 0;
+
+	if (serial_fd <= 0) {
+		errno = EIO;
+		return -errno;
+	}
+
+	pthread_mutex_lock(&hw_lock);
+
+	/* Events may be already received together with the last response */
+	stream_process(NULL, 0, &done);
+
+	if (event_head == event_tail) {
+		ret = stream_fill(serial_fd, timeout_ms);
+
+		if (ret == 0) {
+			/* Responses are not expected here, drop them */
+			stream_process(NULL, 0, &done);
+		}
+	}
+
+	if (event_head != event_tail) {
+		*ev = event_queue[event_tail];
+		event_tail = (event_tail + 1) % HARDWARE_EVENT_QUEUE_LEN;
+		ret = 0;
+	} else if (ret == 0) {
+		ret = EAGAIN;
+	}
+
+	pthread_mutex_unlock(&hw_lock);
+
+	if (ret != 0) {
+		errno = ret;
+		return -errno;
+	}
+
+	return 0;
+}
+
+/* Decode DS_EVENT_FAULT event */
+int hardware_parse_fault_event(const struct hardware_event *ev, struct hardware_fault *fault)
+{
+	if (ev->id != HW_EVENT_FAULT || ev->len < DS_EVENT_FAULT_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	fault->timestamp_us = ((uint32_t) ev->data[0] << 24) | (ev->data[1] << 16)
+							| (ev->data[2] << 8) | ev->data[3];
+	fault->channel = ev->data[4];
+	fault->type = ev->data[5];
+	fault->voltage = avg_voltage_to_output((ev->data[6] << 8) | ev->data[7]);
+	fault->retry = ev->data[8];
+
+	return 0;
+}
+
+/* Decode DS_EVENT_SWITCH_DONE event */
+int hardware_parse_switch_done_event(const struct hardware_event *ev, struct hardware_switch_done *done)
+{
+	if (ev->id != HW_EVENT_SWITCH_DONE || ev->len < DS_EVENT_SWITCH_DONE_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	done->channel = ev->data[0];
+	done->status = ev->data[1];
+
+	switch (ev->data[2]) {
+		case DS_OUT_VOLTAGE_MODE_13V:
+			done->target = HW_SWITCH_TARGET_13V;
+			break;
+
+		case DS_OUT_VOLTAGE_MODE_18V:
+			done->target = HW_SWITCH_TARGET_18V;
+			break;
+
+		default:
+			done->target = HW_SWITCH_TARGET_OFF;
+			break;
+	}
+
+	done->timestamp_us = ((uint32_t) ev->data[3] << 24) | (ev->data[4] << 16)
+							| (ev->data[5] << 8) | ev->data[6];
+	done->settle_us = ((uint32_t) ev->data[7] << 24) | (ev->data[8] << 16)
+							| (ev->data[9] << 8) | ev->data[10];
+	done->voltage = avg_voltage_to_output((ev->data[11] << 8) | ev->data[12]);
+
+	return 0;
+}
+
+/* Device reports the timeout after 500 ms, so timeout_ms is only for the lost events */
+int hardware_wait_switch_done(uint8_t channel, struct hardware_switch_done *done, int timeout_ms)
+{
+	struct hardware_event ev;
+	uint64_t deadline_ns = hardware_monotonic_ns() + (uint64_t) timeout_ms * 1000000ULL;
+	uint64_t now_ns;
+	int ret;
+
+	/* Other events don't shorten the wait, the deadline is fixed */
+	while ((now_ns = hardware_monotonic_ns()) < deadline_ns) {
+		ret = hardware_wait_event(&ev, (deadline_ns - now_ns + 999999ULL) / 1000000ULL);
+
+		if (ret == -ETIMEDOUT || ret == -EAGAIN || ret == -EINTR) {
+			continue;
+		}
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		if (ev.id == HW_EVENT_SWITCH_DONE && hardware_parse_switch_done_event(&ev, done) == 0
+				&& (!channel || done->channel == channel)) {
+			return 0;
+		}
+	}
+
+	errno = ETIMEDOUT;
+	return -errno;
+}
+
+/* Start the scope mode, rate is rounded like in the firmware */
+int hardware_scope_start(uint8_t channels, uint32_t rate_hz)
+{
+	uint8_t payload[5];
+	uint32_t period;
+	int ret;
+
+	if (!channels || (channels & ~HW_SCOPE_BOTH)
+			|| rate_hz < HW_SCOPE_RATE_MIN || rate_hz > HW_SCOPE_RATE_MAX) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	payload[0] = channels;
+	payload[1] = rate_hz >> 24;
+	payload[2] = rate_hz >> 16;
+	payload[3] = rate_hz >> 8;
+	payload[4] = rate_hz;
+
+	ret = write_ext_to_the_device(DS_EXT_CMD_SCOPE, payload, sizeof(payload));
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	period = (DS_SCOPE_TIMER_CLOCK_HZ + rate_hz / 2) / rate_hz;
+
+	return DS_SCOPE_TIMER_CLOCK_HZ / period;
+}
+
+int hardware_scope_stop(void)
+{
+	uint8_t payload[1] = { 0 };
+
+	return write_ext_to_the_device(DS_EXT_CMD_SCOPE, payload, sizeof(payload));
+}
+
+/* Output voltage of the one ADC code */
+float hardware_scope_volts_per_code(void)
+{
+	return HARDWARE_ADC_VREF / HARDWARE_ADC_FULL_SCALE * HARDWARE_ADC_VOLTAGE_DIVIDER_COEFF;
+}
+
+/* Decode DS_EVENT_SCOPE_BLOCK event, samples are packed by two in 3 bytes */
+int hardware_parse_scope_block(const struct hardware_event *ev, struct hardware_scope_block *blk)
+{
+	uint16_t values[2 * HW_SCOPE_BLOCK_SAMPLES];
+	const uint8_t *p = ev->data + DS_EVENT_SCOPE_HEADER_LEN;
+	int both, n, i;
+
+	if (ev->id != HW_EVENT_SCOPE_BLOCK || ev->len < DS_EVENT_SCOPE_HEADER_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	blk->seq = (ev->data[0] << 8) | ev->data[1];
+	blk->channels = ev->data[2];
+	blk->timestamp_us = ((uint32_t) ev->data[3] << 24) | (ev->data[4] << 16)
+							| (ev->data[5] << 8) | ev->data[6];
+
+	both = (blk->channels == HW_SCOPE_BOTH);
+	n = both ? 2 * HW_SCOPE_BLOCK_SAMPLES : HW_SCOPE_BLOCK_SAMPLES;
+
+	if (!blk->channels || (blk->channels & ~HW_SCOPE_BOTH)
+			|| ev->len < DS_EVENT_SCOPE_HEADER_LEN + n * 3 / 2) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	for (i = 0; i < n; i += 2, p += 3) {
+		values[i] = (p[0] << 4) | (p[1] >> 4);
+		values[i + 1] = ((p[1] & 0xF) << 8) | p[2];
+	}
+
+	blk->count = HW_SCOPE_BLOCK_SAMPLES;
+
+	for (i = 0; i < HW_SCOPE_BLOCK_SAMPLES; ++i) {
+		if (both) {
+			blk->samples[0][i] = values[2 * i];
+			blk->samples[1][i] = values[2 * i + 1];
+		} else {
+			blk->samples[blk->channels == HW_SCOPE_CH2][i] = values[i];
+		}
+	}
+
+	return 0;
+}
+
+/* Send DiSEqC 1.x message, completion is reported by HW_EVENT_DISEQC_TX_DONE */
+int hardware_diseqc_send(uint8_t channel, const uint8_t *msg, uint8_t len)
+{
+	uint8_t payload[1 + HW_DISEQC_MAX_MSG_LEN];
+
+	if (!len || len > HW_DISEQC_MAX_MSG_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	payload[0] = channel;
+	memcpy(payload + 1, msg, len);
+
+	return write_ext_to_the_device(DS_EXT_CMD_DISEQC_SEND, payload, len + 1);
+}
+
+/* Decode DS_EVENT_DISEQC_TX_DONE event */
+int hardware_parse_diseqc_done_event(const struct hardware_event *ev, struct hardware_diseqc_done *done)
+{
+	if (ev->id != HW_EVENT_DISEQC_TX_DONE || ev->len < DS_EVENT_DISEQC_TX_DONE_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	done->channel = ev->data[0];
+	done->timestamp_us = ((uint32_t) ev->data[1] << 24) | (ev->data[2] << 16)
+							| (ev->data[3] << 8) | ev->data[4];
+
+	return 0;
+}
+
+/* Run the whole switch sequence in the device */
+int hardware_diseqc_sequence(uint8_t channel, uint8_t polarity, const uint8_t *msg, uint8_t len,
+								uint8_t burst, uint8_t band)
+{
+	uint8_t payload[4 + HW_DISEQC_MAX_MSG_LEN];
+
+	if (len > HW_DISEQC_MAX_MSG_LEN || burst > HW_TONE_BURST_B) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	payload[0] = channel;
+
+	if (polarity) {
+		payload[1] = (polarity == POLARITY_VERTICAL_RIGHT ? DS_OUT_VOLTAGE_MODE_13V : DS_OUT_VOLTAGE_MODE_18V);
+	} else {
+		payload[1] = 0;
+	}
+
+	payload[2] = burst;
+	payload[3] = (band == BAND_LOW ? DS_OUT_TONE_SIGNAL_DISABLED : DS_OUT_TONE_SIGNAL_ENABLED);
+	memcpy(payload + 4, msg, len);
+
+	return write_ext_to_the_device(DS_EXT_CMD_DISEQC_SEQUENCE, payload, len + 4);
+}
+
+/* Timed tone, completion is reported by HW_EVENT_DISEQC_TX_DONE */
+int hardware_tone_gate(uint8_t channel, int duration_us)
+{
+	int duration = (duration_us + HARDWARE_TONE_GATE_UNIT_US / 2) / HARDWARE_TONE_GATE_UNIT_US;
+	uint8_t payload[3];
+
+	if (duration <= 0 || duration > 0xFFFF) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	payload[0] = channel;
+	payload[1] = duration >> 8;
+	payload[2] = duration;
+
+	return write_ext_to_the_device(DS_EXT_CMD_TONE_GATE, payload, sizeof(payload));
+}
+
+/* Select the DiSEqC receiver mode */
+int hardware_set_diseqc_rx_mode(uint8_t mode)
+{
+	return write_to_the_device(DS_CMD_DISEQC_RX_MODE, mode, 0);
+}
+
+/* Decode DS_EVENT_DISEQC_RX event */
+int hardware_parse_diseqc_rx_event(const struct hardware_event *ev, struct hardware_diseqc_msg *msg)
+{
+	if (ev->id != HW_EVENT_DISEQC_RX || ev->len <= DS_EVENT_DISEQC_RX_HEADER_LEN
+			|| ev->len > DS_EVENT_DISEQC_RX_HEADER_LEN + HW_DISEQC_RX_MAX_MSG_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	msg->timestamp_us = ((uint32_t) ev->data[0] << 24) | (ev->data[1] << 16)
+							| (ev->data[2] << 8) | ev->data[3];
+	msg->channel = ev->data[4];
+	msg->flags = ev->data[5];
+	msg->len = ev->len - DS_EVENT_DISEQC_RX_HEADER_LEN;
+	memcpy(msg->data, ev->data + DS_EVENT_DISEQC_RX_HEADER_LEN, msg->len);
+
+	return 0;
+}
+
+/* Unicable ODU command with the collision avoidance of the device */
+int hardware_unicable_send(uint8_t channel, const uint8_t *msg, uint8_t len, uint8_t repeats)
+{
+	uint8_t payload[2 + HW_DISEQC_MAX_MSG_LEN];
+
+	if (!len || len > HW_DISEQC_MAX_MSG_LEN || repeats > HW_UNICABLE_MAX_REPEATS) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	payload[0] = channel;
+	payload[1] = repeats;
+	memcpy(payload + 2, msg, len);
+
+	return write_ext_to_the_device(DS_EXT_CMD_UNICABLE, payload, len + 2);
+}
+
+/* Decode DS_EVENT_UNICABLE_DONE event */
+int hardware_parse_unicable_done_event(const struct hardware_event *ev, struct hardware_unicable_done *done)
+{
+	if (ev->id != HW_EVENT_UNICABLE_DONE || ev->len < DS_EVENT_UNICABLE_DONE_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	done->channel = ev->data[0];
+	done->timestamp_us = ((uint32_t) ev->data[1] << 24) | (ev->data[2] << 16)
+							| (ev->data[3] << 8) | ev->data[4];
+	done->status = ev->data[5];
+	done->sent = ev->data[6];
+	done->backoffs = ev->data[7];
+
+	return 0;
+}
+
+/* Schedule entry to the device write command */
+static int schedule_entry_encode(const struct hardware_schedule_entry *entry, uint8_t *cmd, uint8_t *arg)
+{
+	switch (entry->type) {
+		case HW_SCHEDULE_PS:
+			*cmd = POWER_SUPPLY_CONTROL;
+			*arg = (entry->value == ENABLE ? POWER_SUPPLY_ENABLED : POWER_SUPPLY_DISABLED);
+			return 0;
+
+		case HW_SCHEDULE_POLARITY:
+			*cmd = (entry->channel == LNB_CHANNEL_1 ? DS_CMD_TYPE_OUT_VOLTAGE_CH1 : DS_CMD_TYPE_OUT_VOLTAGE_CH2);
+			*arg = (entry->value == POLARITY_VERTICAL_RIGHT ? DS_OUT_VOLTAGE_MODE_13V : DS_OUT_VOLTAGE_MODE_18V);
+			return 0;
+
+		case HW_SCHEDULE_BAND:
+			*cmd = (entry->channel == LNB_CHANNEL_1 ? DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1 : DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2);
+			*arg = (entry->value == BAND_LOW ? DS_OUT_TONE_SIGNAL_DISABLED : DS_OUT_TONE_SIGNAL_ENABLED);
+			return 0;
+
+		default:
+			errno = EINVAL;
+			return -errno;
+	}
+}
+
+/* Device write command to the schedule entry */
+static void schedule_entry_decode(uint8_t cmd, uint8_t arg, struct hardware_schedule_exec *exec)
+{
+	exec->channel = 0;
+
+	switch (cmd) {
+		case POWER_SUPPLY_CONTROL:
+			exec->type = HW_SCHEDULE_PS;
+			exec->value = (arg == POWER_SUPPLY_ENABLED ? ENABLE : DISABLE);
+			break;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH1:
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH2:
+			exec->type = HW_SCHEDULE_POLARITY;
+			exec->channel = (cmd == DS_CMD_TYPE_OUT_VOLTAGE_CH1 ? LNB_CHANNEL_1 : LNB_CHANNEL_2);
+			exec->value = (arg == DS_OUT_VOLTAGE_MODE_13V ? POLARITY_VERTICAL_RIGHT : POLARITY_HORIZONTAL_LEFT);
+			break;
+
+		default:
+			exec->type = HW_SCHEDULE_BAND;
+			exec->channel = (cmd == DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1 ? LNB_CHANNEL_1 : LNB_CHANNEL_2);
+			exec->value = (arg == DS_OUT_TONE_SIGNAL_DISABLED ? BAND_LOW : BAND_HIGH);
+			break;
+	}
+}
+
+/* Clear the device schedule and load the entries, up to 9 per frame */
+int hardware_schedule_load(const struct hardware_schedule_entry *entries, int count)
+{
+	uint8_t payload[DS_EXT_MAX_PAYLOAD];
+	uint8_t len = 0;
+	int i, ret;
+
+	if (count <= 0 || count > HW_SCHEDULE_MAX_ENTRIES) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	ret = hardware_schedule_clear();
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	for (i = 0; i < count; ++i) {
+		payload[len] = entries[i].offset_us >> 24;
+		payload[len + 1] = entries[i].offset_us >> 16;
+		payload[len + 2] = entries[i].offset_us >> 8;
+		payload[len + 3] = entries[i].offset_us;
+
+		ret = schedule_entry_encode(&entries[i], &payload[len + 4], &payload[len + 5]);
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		len += DS_SCHEDULE_ENTRY_LEN;
+
+		if (len + DS_SCHEDULE_ENTRY_LEN > DS_EXT_MAX_PAYLOAD || i == count - 1) {
+			ret = write_ext_to_the_device(DS_EXT_CMD_SCHEDULE_LOAD, payload, len);
+
+			if (ret != 0) {
+				return ret;
+			}
+
+			len = 0;
+		}
+	}
+
+	return 0;
+}
+
+static int schedule_start(uint8_t mode, uint32_t time)
+{
+	uint8_t payload[5];
+
+	payload[0] = mode;
+	payload[1] = time >> 24;
+	payload[2] = time >> 16;
+	payload[3] = time >> 8;
+	payload[4] = time;
+
+	return write_ext_to_the_device(DS_EXT_CMD_SCHEDULE_START, payload, sizeof(payload));
+}
+
+int hardware_schedule_start(uint32_t delay_us)
+{
+	return schedule_start(DS_SCHEDULE_START_DELAY, delay_us);
+}
+
+int hardware_schedule_start_at(uint32_t device_time_us)
+{
+	return schedule_start(DS_SCHEDULE_START_ABSOLUTE, device_time_us);
+}
+
+int hardware_schedule_clear(void)
+{
+	return write_ext_to_the_device(DS_EXT_CMD_SCHEDULE_CLEAR, NULL, 0);
+}
+
+/* Decode DS_EVENT_SCHEDULE_EXEC event */
+int hardware_parse_schedule_event(const struct hardware_event *ev, struct hardware_schedule_exec *exec)
+{
+	if (ev->id != HW_EVENT_SCHEDULE_EXEC || ev->len < DS_EVENT_SCHEDULE_EXEC_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	exec->index = ev->data[0];
+	schedule_entry_decode(ev->data[1], ev->data[2], exec);
+	exec->planned_us = ((uint32_t) ev->data[3] << 24) | (ev->data[4] << 16)
+						| (ev->data[5] << 8) | ev->data[6];
+	exec->actual_us = ((uint32_t) ev->data[7] << 24) | (ev->data[8] << 16)
+						| (ev->data[9] << 8) | ev->data[10];
+
+	return 0;
+}
+
 /* Callback routines */
 void hardware_set_reader_cb(on_device_data func, void *user_data)
 {
@@ -454,7 +1358,7 @@ void *reader_thread_fn(void *arg)
 		if (on_data_cb_fun) {
 			if (hardware_read_full_state(&hw_state) != 0) {
 				/* Give it a chance */
-				if (bad_cnt++ > 3 && on_error_cb_fun) {
+				if (bad_cnt++ >= HW_MAX_READ_FAILS && on_error_cb_fun) {
 					on_error_cb_fun(on_error_cb_user_data);
 					return NULL;
 				}
@@ -496,3 +1400,11 @@ char *hardware_get_last_error_desc()
 	return strerror(errno);
 }
 
+uint64_t hardware_monotonic_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,935 @@
+/*
+   device_emulator.c
+    - In-process emulator of the LNB controller
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ The emulator speaks the firmware protocol on the other end of a socket pair.
+ Commands are answered immediately, so the measured latencies are the host stack
+ and the emulator thread wakeups only. Device timing is modelled:
+	- output is a first order step to the settle target level of the channel,
+	  the switch complete event comes after the band entry plus the 2 ms hold,
+	  rounded up to the 0.8 ms ADC blocks like in the firmware
+	- DiSEqC, tone gate and Unicable completions come after the line time
+	- scope blocks carry the same step with the 22 KHz tone and the ripple noise,
+	  blocks which are late by more than the firmware ring are dropped
+ The schedule and the DiSEqC replies are not emulated, the commands are rejected.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "device_emulator.h"
+#include "usb_protocol_private.h"
+#include "crc8.h"
+
+/* Firmware defaults, 0.1 mV of the ADC input */
+#define EMU_SETTLE_TARGET_13V	19757
+#define EMU_SETTLE_TARGET_18V	27356
+#define EMU_SETTLE_TOLERANCE	760
+#define EMU_ADC_AVG_WINDOW		8
+
+/* Output model, first order time constants, us */
+#define EMU_TAU_RISE_US		1000.0
+#define EMU_TAU_FALL_US		3000.0
+#define EMU_TAU_PS_OFF_US	15000.0
+
+/* Detector of the firmware: 0.8 ms blocks, 2 ms hold, 500 ms timeout */
+#define EMU_SETTLE_BLOCK_US		800
+#define EMU_SETTLE_HOLD_US		2000
+#define EMU_SETTLE_TIMEOUT_US	500000
+
+/* Ripple of the output, 0.1 mV */
+#define EMU_RIPPLE_RMS 20
+
+/* DiSEqC line timing, us */
+#define EMU_DISEQC_BIT_US		1500
+#define EMU_DISEQC_GAP_US		15000
+#define EMU_TONE_GATE_UNIT_US	100
+
+/* ADC sample period, us */
+#define EMU_ADC_SAMPLE_US 50
+
+/* Tone amplitude on the ADC input, 0.1 mV, and the frequency */
+#define EMU_TONE_AMPLITUDE	500
+#define EMU_TONE_HZ			22000.0
+
+/* Blocks ring of the firmware scope */
+#define EMU_SCOPE_RING_BLOCKS 8
+
+/* 12 bit ADC, 3.3 V reference, 0.1 mV */
+#define EMU_ADC_FULL_SCALE	33000
+#define EMU_ADC_MAX_CODE	4095
+
+#define EMU_PENDING_EVENTS 16
+
+/* Typical boot stages of the firmware, DS_BOOT_TIME_UNIT_US units */
+static const uint16_t emu_boot_time[DS_BOOT_STAGE_COUNT] = { 118, 131, 139, 212, 213, 11480 };
+
+#define NUM_CHANNELS 2
+
+/* Event to be sent at the device time */
+struct emu_event {
+	int used;
+	uint64_t due_us;
+	uint8_t id;
+	uint8_t len;
+	uint8_t data[DS_EXT_MAX_PAYLOAD];
+};
+
+/* Emulated device state */
+struct emu_device {
+	uint8_t ps_enabled;
+	uint8_t voltage[NUM_CHANNELS];	/* DS_OUT_VOLTAGE_MODE_* */
+	uint8_t tone[NUM_CHANNELS];
+	uint16_t level[NUM_CHANNELS];	/* Output after the last change, 0.1 mV */
+	double step_from[NUM_CHANNELS];	/* Output at the moment of the last change */
+	uint64_t step_us[NUM_CHANNELS];
+	double step_tau[NUM_CHANNELS];
+	uint8_t avg_window;
+	uint16_t protection_low;
+	uint16_t protection_high;
+	uint8_t hiccup_interval;
+	uint8_t hiccup_retries;
+	uint8_t rx_mode;
+	uint8_t restore_mask;		/* Kept only, there is no flash to restore from */
+	uint16_t settle_13v;
+	uint16_t settle_18v;
+	uint16_t settle_tolerance;
+	uint64_t tx_busy_until;
+	uint8_t scope_channels;
+	uint32_t scope_rate;
+	uint16_t scope_seq;
+	uint64_t scope_next_us;		/* Time of the next block end */
+	uint32_t noise;
+};
+
+static int emu_fds[2] = { -1, -1 };
+static pthread_t emu_thread;
+static uint64_t emu_start_ns;
+
+static struct emu_device dev;
+static struct emu_event pending[EMU_PENDING_EVENTS];
+
+/* Incoming data, may contain a few frames */
+static uint8_t emu_rx[512];
+static size_t emu_rx_len;
+
+/* Device time, us since start */
+static uint64_t emu_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec - emu_start_ns) / 1000;
+}
+
+static void put_be32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val >> 24;
+	buf[1] = val >> 16;
+	buf[2] = val >> 8;
+	buf[3] = val;
+}
+
+static void emu_write(const uint8_t *buf, size_t len)
+{
+	/* Host is reading all the time, short writes are not expected on the local socket */
+	if (write(emu_fds[1], buf, len) != (ssize_t) len) {
+		return;
+	}
+}
+
+static void emu_send_frame(uint8_t op, uint8_t cmd, uint8_t a1, uint8_t a2)
+{
+	uint8_t frame[USB_PACKET_LEN];
+
+	frame[0] = DS_HEADER_MAGIC1;
+	frame[1] = DS_HEADER_MAGIC2;
+	frame[2] = op;
+	frame[3] = cmd;
+	frame[4] = a1;
+	frame[5] = a2;
+	frame[6] = crc8(frame, USB_PACKET_LEN - 1);
+
+	emu_write(frame, USB_PACKET_LEN);
+}
+
+static void emu_send_event(const struct emu_event *ev)
+{
+	uint8_t frame[DS_EXT_FRAME_LEN(DS_EXT_MAX_PAYLOAD)];
+	size_t len = DS_EXT_FRAME_LEN(ev->len);
+
+	frame[0] = DS_HEADER_MAGIC1;
+	frame[1] = DS_HEADER_MAGIC2;
+	frame[2] = DS_EVENT;
+	frame[3] = ev->id;
+	frame[4] = ev->len;
+	memcpy(frame + DS_EXT_HEADER_LEN, ev->data, ev->len);
+	frame[len - 1] = crc8(frame, len - 1);
+
+	emu_write(frame, len);
+}
+
+/* Queue the event, it's dropped if there is no space like on the full firmware TX ring */
+static void emu_queue_event(uint64_t due_us, uint8_t id, const uint8_t *data, uint8_t len)
+{
+	int i;
+
+	for (i = 0; i < EMU_PENDING_EVENTS; ++i) {
+		if (!pending[i].used) {
+			pending[i].used = 1;
+			pending[i].due_us = due_us;
+			pending[i].id = id;
+			pending[i].len = len;
+			memcpy(pending[i].data, data, len);
+			return;
+		}
+	}
+}
+
+/* Send all the due events in time order, returns time to the next one, us or -1 */
+static int64_t emu_flush_events(void)
+{
+	uint64_t now = emu_now_us();
+	int64_t next = -1;
+	int i, first;
+
+	do {
+		first = -1;
+
+		for (i = 0; i < EMU_PENDING_EVENTS; ++i) {
+			if (pending[i].used && pending[i].due_us <= now
+					&& (first < 0 || pending[i].due_us < pending[first].due_us)) {
+				first = i;
+			}
+		}
+
+		if (first >= 0) {
+			emu_send_event(&pending[first]);
+			pending[first].used = 0;
+		}
+	} while (first >= 0);
+
+	for (i = 0; i < EMU_PENDING_EVENTS; ++i) {
+		if (pending[i].used && (next < 0 || (int64_t) (pending[i].due_us - now) < next)) {
+			next = pending[i].due_us - now;
+		}
+	}
+
+	return next;
+}
+
+/* Settle target level of the channel output */
+static uint16_t emu_target_level(uint8_t channel)
+{
+	if (!dev.ps_enabled) {
+		return 0;
+	}
+
+	return dev.voltage[channel] == DS_OUT_VOLTAGE_MODE_18V ? dev.settle_18v : dev.settle_13v;
+}
+
+/* Instant output of the channel step model, 0.1 mV of the ADC input */
+static double emu_output_at(uint8_t channel, uint64_t t_us)
+{
+	double dt;
+
+	if (!dev.step_tau[channel] || t_us <= dev.step_us[channel]) {
+		return dev.step_tau[channel] ? dev.step_from[channel] : dev.level[channel];
+	}
+
+	dt = (double) (t_us - dev.step_us[channel]);
+
+	return dev.level[channel] + (dev.step_from[channel] - dev.level[channel]) * exp(-dt / dev.step_tau[channel]);
+}
+
+/* Output of the channel is changed, model the step and queue the switch complete event */
+static void emu_output_changed(uint8_t channel)
+{
+	uint64_t now = emu_now_us();
+	uint16_t target = emu_target_level(channel);
+	double step = fabs((double) target - dev.level[channel]);
+	double tau = (target > dev.level[channel]) ? EMU_TAU_RISE_US : EMU_TAU_FALL_US;
+	uint64_t enter_us = EMU_SETTLE_BLOCK_US;
+	uint8_t data[DS_EVENT_SWITCH_DONE_LEN];
+
+	if (!target) {
+		tau = EMU_TAU_PS_OFF_US;
+	}
+
+	dev.step_from[channel] = emu_output_at(channel, now);
+	dev.step_us[channel] = now;
+	dev.step_tau[channel] = tau;
+
+	if (step > dev.settle_tolerance && dev.settle_tolerance) {
+		enter_us = (uint64_t) (tau * log(step / dev.settle_tolerance));
+		enter_us = (enter_us / EMU_SETTLE_BLOCK_US + 1) * EMU_SETTLE_BLOCK_US;
+	}
+
+	data[0] = channel + 1;
+	data[1] = DS_SETTLE_OK;
+	data[2] = !dev.ps_enabled ? 0 : dev.voltage[channel];
+	put_be32(data + 3, now);
+
+	if (enter_us + EMU_SETTLE_HOLD_US > EMU_SETTLE_TIMEOUT_US) {
+		data[1] = DS_SETTLE_TIMEOUT;
+		enter_us = EMU_SETTLE_TIMEOUT_US;
+	}
+
+	put_be32(data + 7, enter_us);
+	data[11] = target >> 8;
+	data[12] = target;
+
+	dev.level[channel] = target;
+
+	emu_queue_event(now + enter_us + (data[1] == DS_SETTLE_OK ? EMU_SETTLE_HOLD_US : 0),
+					DS_EVENT_SWITCH_DONE, data, DS_EVENT_SWITCH_DONE_LEN);
+}
+
+/* One ADC conversion: output, tone square wave and the uniform ripple noise */
+static uint16_t emu_adc_code(uint8_t channel, double t_us)
+{
+	double v = emu_output_at(channel, (uint64_t) t_us);
+	int code;
+
+	if (v > 0) {
+		if (dev.tone[channel]) {
+			v += (fmod(t_us / 1e6 * EMU_TONE_HZ, 1.0) < 0.5) ? EMU_TONE_AMPLITUDE : -EMU_TONE_AMPLITUDE;
+		}
+
+		dev.noise = dev.noise * 1103515245 + 12345;
+		v += ((double) ((dev.noise >> 16) & 0x7FFF) / 0x7FFF - 0.5) * EMU_RIPPLE_RMS * 3.46;
+	}
+
+	code = (int) (v * (EMU_ADC_MAX_CODE + 1) / EMU_ADC_FULL_SCALE + 0.5);
+
+	if (code < 0) {
+		code = 0;
+	} else if (code > EMU_ADC_MAX_CODE) {
+		code = EMU_ADC_MAX_CODE;
+	}
+
+	return code;
+}
+
+static uint8_t *emu_pack_pair(uint8_t *out, uint16_t first, uint16_t second)
+{
+	out[0] = first >> 4;
+	out[1] = ((first & 0xF) << 4) | ((second >> 8) & 0xF);
+	out[2] = second;
+
+	return out + 3;
+}
+
+/* Block period, us, at the actual rate */
+static double emu_scope_block_us(void)
+{
+	return DS_SCOPE_BLOCK_SAMPLES * 1000000.0 / dev.scope_rate;
+}
+
+/* Send all the due scope blocks, returns time to the next one, us or -1 */
+static int64_t emu_scope_poll(void)
+{
+	struct emu_event ev;
+	uint64_t now = emu_now_us();
+	double block_us, t_us;
+	uint16_t s[DS_SCOPE_BLOCK_SAMPLES * NUM_CHANNELS];
+	uint8_t *out;
+	int i, n;
+
+	if (!dev.scope_channels) {
+		return -1;
+	}
+
+	block_us = emu_scope_block_us();
+
+	/* Host was not reading, the firmware ring is overflowed */
+	while (now > dev.scope_next_us + block_us * EMU_SCOPE_RING_BLOCKS) {
+		dev.scope_next_us += block_us;
+		dev.scope_seq++;
+	}
+
+	while (dev.scope_next_us <= now) {
+		ev.id = DS_EVENT_SCOPE_BLOCK;
+		ev.data[0] = dev.scope_seq >> 8;
+		ev.data[1] = dev.scope_seq;
+		ev.data[2] = dev.scope_channels;
+		put_be32(ev.data + 3, dev.scope_next_us);
+		out = ev.data + DS_EVENT_SCOPE_HEADER_LEN;
+
+		for (i = 0, n = 0; i < DS_SCOPE_BLOCK_SAMPLES; ++i) {
+			t_us = dev.scope_next_us - (DS_SCOPE_BLOCK_SAMPLES - 1 - i) * block_us / DS_SCOPE_BLOCK_SAMPLES;
+
+			if (dev.scope_channels & DS_SCOPE_CH1) {
+				s[n++] = emu_adc_code(0, t_us);
+			}
+
+			if (dev.scope_channels & DS_SCOPE_CH2) {
+				s[n++] = emu_adc_code(1, t_us);
+			}
+		}
+
+		for (i = 0; i < n; i += 2) {
+			out = emu_pack_pair(out, s[i], s[i + 1]);
+		}
+
+		ev.len = out - ev.data;
+		emu_send_event(&ev);
+
+		dev.scope_next_us += block_us;
+		dev.scope_seq++;
+	}
+
+	return dev.scope_next_us - now;
+}
+
+/* Start or stop the scope, the rate is rounded like by the firmware timer */
+static uint8_t emu_scope_control(const uint8_t *payload, uint8_t len)
+{
+	uint32_t rate;
+	uint32_t period;
+
+	if (len && !payload[0]) {
+		dev.scope_channels = 0;
+		return 0;
+	}
+
+	if (len < 5 || (payload[0] & ~(DS_SCOPE_CH1 | DS_SCOPE_CH2))) {
+		return DS_NAK_INVALID;
+	}
+
+	rate = ((uint32_t) payload[1] << 24) | ((uint32_t) payload[2] << 16) | (payload[3] << 8) | payload[4];
+
+	if (rate < DS_SCOPE_RATE_MIN_HZ || rate > DS_SCOPE_RATE_MAX_HZ) {
+		return DS_NAK_INVALID;
+	}
+
+	period = (DS_SCOPE_TIMER_CLOCK_HZ + rate / 2) / rate;
+
+	dev.scope_channels = payload[0];
+	dev.scope_rate = DS_SCOPE_TIMER_CLOCK_HZ / period;
+	dev.scope_seq = 0;
+	dev.scope_next_us = emu_now_us() + emu_scope_block_us();
+
+	return 0;
+}
+
+/* DiSEqC transmitter is busy until the end of the message */
+static uint8_t emu_tx_start(uint8_t channel, uint64_t duration_us, uint8_t *nak)
+{
+	uint64_t now = emu_now_us();
+	uint8_t data[DS_EVENT_DISEQC_TX_DONE_LEN];
+
+	if (channel != 1 && channel != 2) {
+		*nak = DS_NAK_INVALID;
+		return 0;
+	}
+
+	if (dev.tx_busy_until > now) {
+		*nak = DS_NAK_BUSY;
+		return 0;
+	}
+
+	dev.tx_busy_until = now + duration_us;
+
+	data[0] = channel;
+	put_be32(data + 1, dev.tx_busy_until);
+	emu_queue_event(dev.tx_busy_until, DS_EVENT_DISEQC_TX_DONE, data, DS_EVENT_DISEQC_TX_DONE_LEN);
+
+	return 1;
+}
+
+/* Message line time: 9 bits per byte and the gaps around */
+static uint64_t emu_msg_time(uint8_t len)
+{
+	return (uint64_t) len * 9 * EMU_DISEQC_BIT_US + 2 * EMU_DISEQC_GAP_US;
+}
+
+static uint8_t emu_voltage_valid(uint8_t voltage)
+{
+	return voltage == DS_OUT_VOLTAGE_MODE_13V || voltage == DS_OUT_VOLTAGE_MODE_18V;
+}
+
+static uint8_t emu_tone_valid(uint8_t tone)
+{
+	return tone == DS_OUT_TONE_SIGNAL_ENABLED || tone == DS_OUT_TONE_SIGNAL_DISABLED;
+}
+
+static void emu_set_ps(uint8_t enabled)
+{
+	dev.ps_enabled = enabled;
+	emu_output_changed(0);
+	emu_output_changed(1);
+}
+
+static void emu_handle_write(const uint8_t *frame)
+{
+	uint8_t a1 = frame[4];
+	uint16_t val = (frame[4] << 8) | frame[5];
+
+	switch (frame[3]) {
+		case POWER_SUPPLY_CONTROL:
+			emu_set_ps(a1 == POWER_SUPPLY_ENABLED);
+			break;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH1:
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH2:
+			if (emu_voltage_valid(a1)) {
+				dev.voltage[frame[3] == DS_CMD_TYPE_OUT_VOLTAGE_CH1 ? 0 : 1] = a1;
+				emu_output_changed(frame[3] == DS_CMD_TYPE_OUT_VOLTAGE_CH1 ? 0 : 1);
+			}
+			break;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1:
+			dev.tone[0] = (a1 == DS_OUT_TONE_SIGNAL_ENABLED);
+			break;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2:
+			dev.tone[1] = (a1 == DS_OUT_TONE_SIGNAL_ENABLED);
+			break;
+
+		case DS_CMD_ADC_AVG_WINDOW:
+			if (a1 >= 4 && a1 <= 12) {
+				dev.avg_window = a1;
+			}
+			break;
+
+		case DS_CMD_PROTECTION_LOW:
+			dev.protection_low = val;
+			break;
+
+		case DS_CMD_PROTECTION_HIGH:
+			dev.protection_high = val;
+			break;
+
+		case DS_CMD_PROTECTION_HICCUP:
+			dev.hiccup_interval = frame[4];
+			dev.hiccup_retries = frame[5];
+			break;
+
+		case DS_CMD_SETTLE_TARGET_13V:
+			dev.settle_13v = val;
+			break;
+
+		case DS_CMD_SETTLE_TARGET_18V:
+			dev.settle_18v = val;
+			break;
+
+		case DS_CMD_SETTLE_TOLERANCE:
+			dev.settle_tolerance = val;
+			break;
+
+		case DS_CMD_DISEQC_RX_MODE:
+			dev.rx_mode = a1;
+			break;
+
+		case DS_CMD_STATE_RESTORE:
+			dev.restore_mask = a1 & DS_RESTORE_ALL;
+			break;
+
+		default:
+			break;
+	}
+
+	emu_send_frame(DS_CMD_WRITE, frame[3], 0xFF, 0xFF);
+}
+
+/* Tone detector of the firmware: fundamental of the square wave, peak-to-peak */
+/* Not measurable when the tone is aliased close to DC or to the Nyquist frequency */
+static uint16_t emu_tone_level(uint8_t channel)
+{
+	double rate = dev.scope_channels ? dev.scope_rate : 1e6 / EMU_ADC_SAMPLE_US;
+	double alias = fmod(EMU_TONE_HZ / rate, 1.0);
+
+	if (alias > 0.5) {
+		alias = 1.0 - alias;
+	}
+
+	if (alias < 1.0 / 64 || alias > 0.5 - 1.0 / 64) {
+		return DS_TONE_LEVEL_INVALID;
+	}
+
+	if (!dev.level[channel] || !dev.tone[channel]) {
+		return 0;
+	}
+
+	return (uint16_t) (4 / M_PI * 2 * EMU_TONE_AMPLITUDE + 0.5);
+}
+
+static void emu_handle_read(const uint8_t *frame)
+{
+	uint16_t res = 0;
+	uint8_t ch = 0;
+
+	switch (frame[3]) {
+		case POWER_SUPPLY_CONTROL:
+			res = (dev.ps_enabled ? POWER_SUPPLY_ENABLED : POWER_SUPPLY_DISABLED) << 8;
+			break;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH1:
+			res = dev.voltage[0] << 8;
+			break;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH2:
+			res = dev.voltage[1] << 8;
+			break;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1:
+			res = (dev.tone[0] ? DS_OUT_TONE_SIGNAL_ENABLED : DS_OUT_TONE_SIGNAL_DISABLED) << 8;
+			break;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2:
+			res = (dev.tone[1] ? DS_OUT_TONE_SIGNAL_ENABLED : DS_OUT_TONE_SIGNAL_DISABLED) << 8;
+			break;
+
+		case DS_CMD_READ_REAL_VOLTAGE_CH2:
+			ch = 1;
+			/* fall through */
+		case DS_CMD_READ_REAL_VOLTAGE_CH1:
+			res = dev.level[ch] / 10;
+			break;
+
+		case DS_CMD_READ_AVG_VOLTAGE_CH2:
+			ch = 1;
+			/* fall through */
+		case DS_CMD_READ_AVG_VOLTAGE_CH1:
+			res = dev.level[ch];
+			break;
+
+		case DS_CMD_READ_STATS_CH2:
+			ch = 1;
+			/* fall through */
+		case DS_CMD_READ_STATS_CH1:
+			if (frame[4] == DS_STATS_RMS) {
+				res = dev.level[ch] ? EMU_RIPPLE_RMS : 0;
+			} else if (frame[4] == DS_STATS_MIN) {
+				res = dev.level[ch] > EMU_RIPPLE_RMS * 3 ? dev.level[ch] - EMU_RIPPLE_RMS * 3 : 0;
+			} else if (frame[4] == DS_STATS_MAX) {
+				res = dev.level[ch] ? dev.level[ch] + EMU_RIPPLE_RMS * 3 : 0;
+			} else {
+				res = dev.level[ch];
+			}
+			break;
+
+		case DS_CMD_READ_BOOT_TIME:
+			res = frame[4] < DS_BOOT_STAGE_COUNT ? emu_boot_time[frame[4]] : DS_BOOT_TIME_NOT_REACHED;
+			break;
+
+		case DS_CMD_READ_TONE_LEVEL_CH2:
+			ch = 1;
+			/* fall through */
+		case DS_CMD_READ_TONE_LEVEL_CH1:
+			res = emu_tone_level(ch);
+			break;
+
+		case DS_CMD_READ_SAMPLE_COUNTER:
+			res = emu_now_us() / ((uint64_t) EMU_ADC_SAMPLE_US << dev.avg_window);
+			break;
+
+		case DS_CMD_ADC_AVG_WINDOW:
+			res = dev.avg_window << 8;
+			break;
+
+		case DS_CMD_PROTECTION_LOW:
+			res = dev.protection_low;
+			break;
+
+		case DS_CMD_PROTECTION_HIGH:
+			res = dev.protection_high;
+			break;
+
+		case DS_CMD_PROTECTION_HICCUP:
+			res = (dev.hiccup_interval << 8) | dev.hiccup_retries;
+			break;
+
+		case DS_CMD_PROTECTION_STATUS:
+			res = (dev.ps_enabled && (dev.protection_low || dev.protection_high)) ? DS_PROTECTION_ARMED << 8 : 0;
+			break;
+
+		case DS_CMD_SETTLE_TARGET_13V:
+			res = dev.settle_13v;
+			break;
+
+		case DS_CMD_SETTLE_TARGET_18V:
+			res = dev.settle_18v;
+			break;
+
+		case DS_CMD_SETTLE_TOLERANCE:
+			res = dev.settle_tolerance;
+			break;
+
+		case DS_CMD_DISEQC_RX_MODE:
+			res = dev.rx_mode << 8;
+			break;
+
+		case DS_CMD_STATE_RESTORE:
+			res = dev.restore_mask << 8;
+			break;
+
+		default:
+			/* Firmware doesn't respond to the unknown reads */
+			return;
+	}
+
+	emu_send_frame(DS_RESPONSE, frame[3], res >> 8, res);
+}
+
+/* Returns 0 or DS_NAK_* code */
+static uint8_t emu_handle_write_ext(uint8_t id, const uint8_t *payload, uint8_t len)
+{
+	uint8_t data[DS_EVENT_UNICABLE_DONE_LEN];
+	uint8_t nak = 0;
+	uint64_t frame_time;
+	int i;
+
+	switch (id) {
+		case DS_EXT_CMD_DISEQC_SEND:
+			if (len < 2 || len > 7) {
+				return DS_NAK_INVALID;
+			}
+
+			emu_tx_start(payload[0], emu_msg_time(len - 1), &nak);
+			return nak;
+
+		case DS_EXT_CMD_DISEQC_SEQUENCE:
+			if (len < 4 || len > 10 || (payload[1] && !emu_voltage_valid(payload[1]))) {
+				return DS_NAK_INVALID;
+			}
+
+			if (!emu_tx_start(payload[0], emu_msg_time(len - 4) + 2 * EMU_DISEQC_GAP_US, &nak)) {
+				return nak;
+			}
+
+			if (payload[1]) {
+				dev.voltage[payload[0] - 1] = payload[1];
+				emu_output_changed(payload[0] - 1);
+			}
+
+			dev.tone[payload[0] - 1] = (payload[3] == DS_OUT_TONE_SIGNAL_ENABLED);
+			return 0;
+
+		case DS_EXT_CMD_TONE_GATE:
+			if (len < 3) {
+				return DS_NAK_INVALID;
+			}
+
+			emu_tx_start(payload[0], (uint64_t) ((payload[1] << 8) | payload[2]) * EMU_TONE_GATE_UNIT_US, &nak);
+			return nak;
+
+		case DS_EXT_CMD_UNICABLE:
+			if (len < 3 || len > 8 || payload[1] > DS_UNICABLE_MAX_REPEATS) {
+				return DS_NAK_INVALID;
+			}
+
+			frame_time = emu_msg_time(len - 2);
+
+			if (!emu_tx_start(payload[0], frame_time * (payload[1] + 1), &nak)) {
+				return nak;
+			}
+
+			data[0] = payload[0];
+			put_be32(data + 1, dev.tx_busy_until);
+			data[5] = DS_UNICABLE_OK;
+			data[6] = payload[1] + 1;
+			data[7] = 0;
+			emu_queue_event(dev.tx_busy_until, DS_EVENT_UNICABLE_DONE, data, DS_EVENT_UNICABLE_DONE_LEN);
+			return 0;
+
+		case DS_EXT_CMD_SCOPE:
+			return emu_scope_control(payload, len);
+
+		case DS_EXT_CMD_APPLY_STATE:
+			if (len < DS_APPLY_STATE_LEN
+					|| (payload[0] != POWER_SUPPLY_ENABLED && payload[0] != POWER_SUPPLY_DISABLED)) {
+				return DS_NAK_INVALID;
+			}
+
+			for (i = 1; i < DS_APPLY_STATE_LEN; i += 2) {
+				if (!emu_voltage_valid(payload[i]) || !emu_tone_valid(payload[i + 1])) {
+					return DS_NAK_INVALID;
+				}
+			}
+
+			dev.voltage[0] = payload[1];
+			dev.tone[0] = (payload[2] == DS_OUT_TONE_SIGNAL_ENABLED);
+			dev.voltage[1] = payload[3];
+			dev.tone[1] = (payload[4] == DS_OUT_TONE_SIGNAL_ENABLED);
+			emu_set_ps(payload[0] == POWER_SUPPLY_ENABLED);
+			return 0;
+
+		default:
+			return DS_NAK_INVALID;
+	}
+}
+
+/* Handle all complete frames, broken ones are skipped byte by byte like in the firmware */
+static void emu_process_rx(void)
+{
+	size_t frame_len;
+	uint8_t nak;
+
+	while (emu_rx_len >= USB_PACKET_LEN - 1) {
+		if (emu_rx[0] != DS_HEADER_MAGIC1 || emu_rx[1] != DS_HEADER_MAGIC2) {
+			memmove(emu_rx, emu_rx + 1, --emu_rx_len);
+			continue;
+		}
+
+		frame_len = (emu_rx[2] == DS_CMD_WRITE_EXT) ? DS_EXT_FRAME_LEN(emu_rx[4]) : USB_PACKET_LEN;
+
+		if (emu_rx[2] == DS_CMD_WRITE_EXT && emu_rx[4] > DS_EXT_MAX_PAYLOAD) {
+			memmove(emu_rx, emu_rx + 1, --emu_rx_len);
+			continue;
+		}
+
+		if (emu_rx_len < frame_len) {
+			return;
+		}
+
+		if (emu_rx[frame_len - 1] != crc8(emu_rx, frame_len - 1)) {
+			memmove(emu_rx, emu_rx + 1, --emu_rx_len);
+			continue;
+		}
+
+		switch (emu_rx[2]) {
+			case DS_CMD_WRITE:
+				emu_handle_write(emu_rx);
+				break;
+
+			case DS_CMD_READ:
+				emu_handle_read(emu_rx);
+				break;
+
+			case DS_CMD_WRITE_EXT:
+				nak = emu_handle_write_ext(emu_rx[3], emu_rx + DS_EXT_HEADER_LEN, emu_rx[4]);
+				emu_send_frame(DS_CMD_WRITE_EXT, emu_rx[3], nak ? nak : 0xFF, nak ? 0 : 0xFF);
+				break;
+
+			default:
+				break;
+		}
+
+		emu_rx_len -= frame_len;
+		memmove(emu_rx, emu_rx + frame_len, emu_rx_len);
+	}
+}
+
+static void *emulator_thread_fn(void *arg)
+{
+	struct pollfd fds[1];
+	struct timespec ts, *tsp;
+	int64_t next_us, scope_us;
+	ssize_t ret;
+
+	fds[0].fd = emu_fds[1];
+	fds[0].events = POLLIN;
+
+	while (1) {
+		next_us = emu_flush_events();
+		scope_us = emu_scope_poll();
+		tsp = NULL;
+
+		if (scope_us >= 0 && (next_us < 0 || scope_us < next_us)) {
+			next_us = scope_us;
+		}
+
+		if (next_us >= 0) {
+			ts.tv_sec = next_us / 1000000;
+			ts.tv_nsec = (next_us % 1000000) * 1000;
+			tsp = &ts;
+		}
+
+		ret = ppoll(fds, 1, tsp, NULL);
+
+		if (ret < 0 && errno != EINTR) {
+			break;
+		}
+
+		if (ret <= 0) {
+			continue;
+		}
+
+		ret = read(emu_fds[1], emu_rx + emu_rx_len, sizeof(emu_rx) - emu_rx_len);
+
+		/* Host side is closed */
+		if (ret <= 0) {
+			break;
+		}
+
+		emu_rx_len += ret;
+		emu_process_rx();
+	}
+
+	return NULL;
+}
+
+int emulator_start(void)
+{
+	struct timespec ts;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, emu_fds) != 0) {
+		return -errno;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	emu_start_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	/* Power-on state of the firmware */
+	memset(&dev, 0, sizeof(dev));
+	memset(pending, 0, sizeof(pending));
+	dev.voltage[0] = dev.voltage[1] = DS_OUT_VOLTAGE_MODE_13V;
+	dev.avg_window = EMU_ADC_AVG_WINDOW;
+	dev.rx_mode = DS_DISEQC_RX_MODE_OFF;
+	dev.settle_13v = EMU_SETTLE_TARGET_13V;
+	dev.settle_18v = EMU_SETTLE_TARGET_18V;
+	dev.settle_tolerance = EMU_SETTLE_TOLERANCE;
+	emu_rx_len = 0;
+
+	if (pthread_create(&emu_thread, NULL, emulator_thread_fn, NULL) != 0) {
+		close(emu_fds[0]);
+		close(emu_fds[1]);
+		errno = EAGAIN;
+		return -errno;
+	}
+
+	return emu_fds[0];
+}
+
+void emulator_stop(void)
+{
+	if (emu_fds[0] < 0) {
+		return;
+	}
+
+	/* Emulator thread sees the end of the stream */
+	shutdown(emu_fds[0], SHUT_RDWR);
+	pthread_join(emu_thread, NULL);
+
+	close(emu_fds[0]);
+	close(emu_fds[1]);
+	emu_fds[0] = emu_fds[1] = -1;
+}
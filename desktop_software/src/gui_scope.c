@@ -0,0 +1,294 @@
+/*
+   gui_scope.c
+    - Oscilloscope window of the streamed output voltages
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Redraw is driven by the frame clock, so it runs at the display rate and never
+ queues up. Every frame takes the latest window of the samples from the ring
+ and decimates it to the min/max envelope of the pixel columns, so the cost
+ depends on the timebase and the width only, not on the stream rate.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include "gui_scope.h"
+#include "scope_stream.h"
+#include "scope_dsp.h"
+#include "device_communicator.h"
+
+/* Samples of the one window, the longest timebase at the max rate */
+#define SCOPE_VIEW_MAX_SAMPLES (SCOPE_RING_LEN / 2)
+#define SCOPE_VIEW_MAX_COLUMNS 4096
+
+#define SCOPE_GRID_X 10
+#define SCOPE_GRID_Y 8
+
+/* Smallest vertical span, so the ripple of the flat output is still visible */
+#define SCOPE_MIN_SPAN_V 0.2f
+
+/* Status label update, frames */
+#define SCOPE_STATUS_PERIOD 15
+
+#define SCOPE_DEFAULT_TIMEBASE 1
+
+static const int timebases_ms[] = { 5, 20, 100, 500, 1000 };
+static const char *timebase_names[] = { "5 ms", "20 ms", "100 ms", "500 ms", "1 s" };
+
+struct gui_scope {
+	GtkWidget *window;
+	GtkWidget *area;
+	GtkLabel *status_label;
+	GtkComboBoxText *timebase;
+	GtkToggleButton *button;
+	int frames;
+};
+
+static struct gui_scope scope = { 0 };
+
+static float view[SCOPE_RING_CHANNELS][SCOPE_VIEW_MAX_SAMPLES];
+static float env_min[SCOPE_RING_CHANNELS][SCOPE_VIEW_MAX_COLUMNS];
+static float env_max[SCOPE_RING_CHANNELS][SCOPE_VIEW_MAX_COLUMNS];
+
+/* Trace colors of the channels */
+static const double trace_rgb[SCOPE_RING_CHANNELS][3] = {
+	{ 1.0, 0.85, 0.2 },
+	{ 0.3, 0.85, 1.0 }
+};
+
+static void draw_grid(cairo_t *cr, int width, int height)
+{
+	int i;
+
+	cairo_set_source_rgb(cr, 0.25, 0.25, 0.25);
+	cairo_set_line_width(cr, 1.0);
+
+	for (i = 1; i < SCOPE_GRID_X; ++i) {
+		cairo_move_to(cr, (int) (width * i / SCOPE_GRID_X) + 0.5, 0);
+		cairo_line_to(cr, (int) (width * i / SCOPE_GRID_X) + 0.5, height);
+	}
+
+	for (i = 1; i < SCOPE_GRID_Y; ++i) {
+		cairo_move_to(cr, 0, (int) (height * i / SCOPE_GRID_Y) + 0.5);
+		cairo_line_to(cr, width, (int) (height * i / SCOPE_GRID_Y) + 0.5);
+	}
+
+	cairo_stroke(cr);
+}
+
+/* Envelope of the channel, every column is connected to the previous one */
+static void draw_trace(cairo_t *cr, int ch, int columns, int height, float lo, float span)
+{
+	float top, bottom;
+	int c;
+
+	cairo_set_source_rgb(cr, trace_rgb[ch][0], trace_rgb[ch][1], trace_rgb[ch][2]);
+
+	for (c = 0; c < columns; ++c) {
+		top = env_max[ch][c];
+		bottom = env_min[ch][c];
+
+		if (c && env_min[ch][c - 1] > top) {
+			top = env_min[ch][c - 1];
+		}
+
+		if (c && env_max[ch][c - 1] < bottom) {
+			bottom = env_max[ch][c - 1];
+		}
+
+		cairo_move_to(cr, c + 0.5, height - (top - lo) / span * height - 0.5);
+		cairo_line_to(cr, c + 0.5, height - (bottom - lo) / span * height + 0.5);
+	}
+
+	cairo_stroke(cr);
+}
+
+static gboolean scope_draw(GtkWidget *widget, cairo_t *cr, gpointer arg)
+{
+	struct scope_stream_stats stats;
+	int width = gtk_widget_get_allocated_width(widget);
+	int height = gtk_widget_get_allocated_height(widget);
+	int tb = gtk_combo_box_get_active(GTK_COMBO_BOX(scope.timebase));
+	float lo = 0, hi = 0, span, mid;
+	int columns = width < SCOPE_VIEW_MAX_COLUMNS ? width : SCOPE_VIEW_MAX_COLUMNS;
+	size_t n;
+	int ch, c;
+	char str[64];
+
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_paint(cr);
+
+	draw_grid(cr, width, height);
+
+	scope_stream_get_stats(&stats);
+
+	if (tb < 0) {
+		tb = SCOPE_DEFAULT_TIMEBASE;
+	}
+
+	n = (size_t) timebases_ms[tb] * stats.rate / 1000;
+
+	if (n > SCOPE_VIEW_MAX_SAMPLES) {
+		n = SCOPE_VIEW_MAX_SAMPLES;
+	}
+
+	n = scope_ring_latest(scope_stream_ring(), view[0], view[1], n);
+
+	if (!n || columns <= 0) {
+		return FALSE;
+	}
+
+	for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+		scope_decimate_minmax(view[ch], n, env_min[ch], env_max[ch], columns);
+	}
+
+	/* Autoscale to the both traces */
+	lo = env_min[0][0];
+	hi = env_max[0][0];
+
+	for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+		for (c = 0; c < columns; ++c) {
+			lo = env_min[ch][c] < lo ? env_min[ch][c] : lo;
+			hi = env_max[ch][c] > hi ? env_max[ch][c] : hi;
+		}
+	}
+
+	span = (hi - lo) * 1.2f;
+
+	if (span < SCOPE_MIN_SPAN_V) {
+		span = SCOPE_MIN_SPAN_V;
+	}
+
+	mid = (hi + lo) / 2;
+	lo = mid - span / 2;
+
+	cairo_set_line_width(cr, 1.0);
+
+	for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+		draw_trace(cr, ch, columns, height, lo, span);
+	}
+
+	cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+	cairo_set_font_size(cr, 11);
+
+	snprintf(str, sizeof(str), "%.2f V", lo + span);
+	cairo_move_to(cr, 4, 12);
+	cairo_show_text(cr, str);
+
+	snprintf(str, sizeof(str), "%.2f V, %.0f mV/div, %.1f ms/div", lo, span * 1000 / SCOPE_GRID_Y,
+				(double) timebases_ms[tb] / SCOPE_GRID_X);
+	cairo_move_to(cr, 4, height - 4);
+	cairo_show_text(cr, str);
+
+	return FALSE;
+}
+
+/* Frame clock callback, once per display refresh */
+static gboolean scope_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer arg)
+{
+	struct scope_stream_stats stats;
+	char str[128];
+
+	gtk_widget_queue_draw(widget);
+
+	if (scope.frames++ % SCOPE_STATUS_PERIOD == 0) {
+		scope_stream_get_stats(&stats);
+		snprintf(str, sizeof(str), "%u Hz, %llu blocks, %llu lost, %s", stats.rate,
+					(unsigned long long) stats.blocks, (unsigned long long) stats.lost_blocks,
+					scope_dsp_kernels());
+		gtk_label_set_text(scope.status_label, str);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void scope_window_destroy(GtkWidget *widget, gpointer arg)
+{
+	scope.window = NULL;
+
+	scope_stream_stop();
+
+	if (scope.button) {
+		gtk_toggle_button_set_active(scope.button, FALSE);
+	}
+}
+
+int gui_scope_open(GtkWindow *parent, GtkToggleButton *button)
+{
+	GtkWidget *vbox, *hbox;
+	int ret;
+	int i;
+
+	if (scope.window) {
+		gtk_window_present(GTK_WINDOW(scope.window));
+		return 0;
+	}
+
+	ret = scope_stream_start(HW_SCOPE_BOTH, HW_SCOPE_RATE_MAX);
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	scope.button = button;
+	scope.frames = 0;
+
+	scope.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title(GTK_WINDOW(scope.window), "Output voltages");
+	gtk_window_set_transient_for(GTK_WINDOW(scope.window), parent);
+	gtk_window_set_default_size(GTK_WINDOW(scope.window), 640, 360);
+
+	vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+	gtk_container_set_border_width(GTK_CONTAINER(vbox), 6);
+
+	scope.timebase = GTK_COMBO_BOX_TEXT(gtk_combo_box_text_new());
+
+	for (i = 0; i < (int) (sizeof(timebases_ms) / sizeof(timebases_ms[0])); ++i) {
+		gtk_combo_box_text_append_text(scope.timebase, timebase_names[i]);
+	}
+
+	gtk_combo_box_set_active(GTK_COMBO_BOX(scope.timebase), SCOPE_DEFAULT_TIMEBASE);
+
+	scope.status_label = GTK_LABEL(gtk_label_new(NULL));
+
+	gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(scope.timebase), FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(scope.status_label), FALSE, FALSE, 0);
+
+	scope.area = gtk_drawing_area_new();
+	gtk_widget_set_size_request(scope.area, 320, 180);
+
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), scope.area, TRUE, TRUE, 0);
+	gtk_container_add(GTK_CONTAINER(scope.window), vbox);
+
+	g_signal_connect(scope.area, "draw", G_CALLBACK(scope_draw), NULL);
+	g_signal_connect(scope.window, "destroy", G_CALLBACK(scope_window_destroy), NULL);
+	gtk_widget_add_tick_callback(scope.area, scope_tick, NULL, NULL);
+
+	gtk_widget_show_all(scope.window);
+
+	return 0;
+}
+
+void gui_scope_close(void)
+{
+	if (scope.window) {
+		gtk_widget_destroy(scope.window);
+	}
+}
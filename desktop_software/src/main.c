@@ -27,6 +27,7 @@
 #include "gui_state.h"
 #include "port_utils.h"
 #include "device_communicator.h"
+#include "gui_scope.h"
 
 /* */
 
@@ -56,6 +57,7 @@ static void set_ui_state_connected(struct lnb_ctrl_gui *gui)
 {
 	gtk_widget_set_sensitive(gui->button_serial_connect, FALSE);
 	gtk_widget_set_sensitive(gui->button_serial_disconnect, TRUE);
+	gtk_widget_set_sensitive(gui->scope_button, TRUE);
 
 	gtk_label_set_markup(GTK_LABEL(gui->connection_status_label), HW_CONNECTED_LABEL);
 
@@ -174,6 +176,7 @@ static void set_ui_state_disconnected(struct lnb_ctrl_gui *gui)
 {
 	gtk_widget_set_sensitive(gui->button_serial_disconnect, FALSE);
 	gtk_widget_set_sensitive(gui->button_serial_connect, TRUE);
+	gtk_widget_set_sensitive(gui->scope_button, FALSE);
 
 	gtk_label_set_markup(gui->connection_status_label, HW_DISCONNECTED_LABEL);
 
@@ -224,6 +227,7 @@ static void disconnect_from_the_hardware()
 {
 	int ret;
 
+	gui_scope_close();
 	hardware_stop_reader_thread();
 
 	ret = hardware_disconnect();
@@ -380,9 +384,26 @@ static void ch2_bh_select(GtkButton *button, void *arg)
 	}
 }
 
+/* Oscilloscope button toggled */
+static void scope_button_toggled(GtkToggleButton *button, void *arg)
+{
+	struct lnb_ctrl_gui *gui = (struct lnb_ctrl_gui *) arg;
+
+	if (!gtk_toggle_button_get_active(button)) {
+		gui_scope_close();
+		return;
+	}
+
+	if (gui_scope_open(GTK_WINDOW(gui->main_window), button) < 0) {
+		gtk_toggle_button_set_active(button, FALSE);
+		show_error(UI_STR_ERROR_GENERIC, UI_STR_SCOPE_FAIL);
+	}
+}
+
 /* Release all resources on window close */
 static void on_window_main_destroy()
 {
+	gui_scope_close();
 	hardware_stop_reader_thread();
 	hardware_disconnect();
 	gtk_main_quit();
@@ -452,6 +473,7 @@ int main(int argc, char *argv[])
 	ctrl_gui.ch2_polarity_sw_hl = GTK_WIDGET(gtk_builder_get_object(builder, "pol_ch2_hl"));
 	ctrl_gui.ch2_band_sw_low = GTK_WIDGET(gtk_builder_get_object(builder, "tone_ch2_low"));
 	ctrl_gui.ch2_band_sw_high = GTK_WIDGET(gtk_builder_get_object(builder, "tone_ch2_high"));
+	ctrl_gui.scope_button = GTK_WIDGET(gtk_builder_get_object(builder, "scope_button"));
 
 	/* Aux init */
 	init_serial_devices_list(ctrl_gui.serial_dev_path_selector);
@@ -475,6 +497,8 @@ int main(int argc, char *argv[])
 	g_signal_connect(GTK_TOGGLE_BUTTON(ctrl_gui.ch2_band_sw_low), "toggled", G_CALLBACK(ch2_bl_select), &ctrl_gui);
 	g_signal_connect(GTK_TOGGLE_BUTTON(ctrl_gui.ch2_band_sw_high), "toggled", G_CALLBACK(ch2_bh_select), &ctrl_gui);
 
+	g_signal_connect(GTK_TOGGLE_BUTTON(ctrl_gui.scope_button), "toggled", G_CALLBACK(scope_button_toggled), &ctrl_gui);
+
 	/* Set HW callbacks and data */
 	hardware_set_reader_cb(on_hardware_update_cb, &ctrl_gui);
 	hardware_set_error_cb(on_hardware_error_cb, &ctrl_gui);
@@ -26,6 +26,16 @@
 #include <stdio.h>
 #include <errno.h>
 #include "device_communicator.h"
+#include "cli_watch.h"
+#include "cli_bench.h"
+#include "cli_events.h"
+#include "cli_positioner.h"
+#include "cli_schedule.h"
+#include "cli_scope.h"
+#include "cli_spectrum.h"
+#include "ripple_spectrum.h"
+#include "positioner.h"
+#include "unicable.h"
 
 /* Just a simple layer between cli arguments and required actions */
 typedef enum user_cmd {
@@ -39,8 +49,93 @@ typedef enum user_cmd {
 	USER_CMD_HORIZONTAL_POL,
 	USER_CMD_LEFT_POL,
 	USER_CMD_GET_DATA,
+	USER_CMD_WATCH,
+	USER_CMD_BENCH,
+	USER_CMD_SET_AVG_WINDOW,
+	USER_CMD_RIPPLE,
+	USER_CMD_PROTECT,
+	USER_CMD_EVENTS,
+	USER_CMD_DISEQC,
+	USER_CMD_DISEQC_RX_MODE,
+	USER_CMD_SEQUENCE,
+	USER_CMD_TONE_GATE,
+	USER_CMD_POSITIONER,
+	USER_CMD_UNICABLE,
+	USER_CMD_SCHEDULE,
+	USER_CMD_APPLY_STATE,
+	USER_CMD_SETTLE_LEVELS,
+	USER_CMD_SWITCH_BENCH,
+	USER_CMD_SCOPE,
+	USER_CMD_SPECTRUM,
+	USER_CMD_RESTORE,
+	USER_CMD_BOOT_TIME,
 } user_cmd_t;
 
+/* Output protection options */
+struct protect_params {
+	float low;
+	float high;
+	int hiccup_ms;
+	int hiccup_retries;
+};
+
+/* Output voltage settle detection */
+struct settle_params {
+	float target_13v;
+	float target_18v;
+	float tolerance;
+	int wait;		/* Wait for the settled outputs after the switch */
+};
+
+/* Device reports the not settled output after 500 ms */
+#define SETTLE_DONE_TIMEOUT_MS 2000
+
+/* Unicable user band and the channel change */
+struct unicable_params {
+	struct unicable_config cfg;
+	int configured;
+	double if_mhz;		/* 0 - no channel change */
+	uint8_t bank;
+	uint8_t repeats;
+};
+
+/* DiSEqC message to send */
+struct diseqc_params {
+	uint8_t msg[HW_DISEQC_MAX_MSG_LEN];
+	int len;
+	int rx_mode;	/* HW_DISEQC_RX_MODE_* */
+
+	/* Switch sequence */
+	uint8_t polarity;	/* POLARITY_* or 0 - unchanged */
+	uint8_t burst;		/* HW_TONE_BURST_* */
+	uint8_t band;		/* BAND_* */
+
+	float gate_ms;
+};
+
+/* Message with the tone gaps is ~115 ms long at most */
+#define DISEQC_DONE_TIMEOUT_MS 1000
+
+/* Up to 8 frames with the random delays and the busy line backoffs */
+#define UNICABLE_DONE_TIMEOUT_MS 5000
+
+/* Settings of the command modes, collected from the cli options */
+struct cmd_options {
+	struct watch_params watch;
+	int bench_iterations;
+	int avg_window;		/* log2 of the samples count */
+	int restore_mask;	/* HW_RESTORE_* fields to display */
+	struct protect_params protect;
+	struct diseqc_params diseqc;
+	struct positioner_params positioner;
+	struct unicable_params unicable;
+	struct schedule_params schedule;
+	struct hardware_state apply;
+	struct settle_params settle;
+	struct scope_params scope;
+	struct spectrum_params spectrum;
+};
+
 /* List of cli options */
 static struct option cmd_long_options[] =
 {
@@ -55,6 +150,40 @@ static struct option cmd_long_options[] =
 	{ "horizontal_pol", no_argument, 0, 'z' },
 	{ "left_pol", no_argument, 0, 'l' },
 	{ "get", no_argument, 0, 'g' },
+	{ "watch", required_argument, 0, 'W' },
+	{ "format", required_argument, 0, 'F' },
+	{ "fields", required_argument, 0, 'S' },
+	{ "bench", optional_argument, 0, 'B' },
+	{ "avg_window", required_argument, 0, 'A' },
+	{ "ripple", no_argument, 0, 'R' },
+	{ "protect", required_argument, 0, 'P' },
+	{ "hiccup", required_argument, 0, 'H' },
+	{ "events", no_argument, 0, 'E' },
+	{ "diseqc", required_argument, 0, 'D' },
+	{ "diseqc_rx", required_argument, 0, 'X' },
+	{ "sequence", required_argument, 0, 'Q' },
+	{ "tone_gate", required_argument, 0, 'T' },
+	{ "positioner", required_argument, 0, 'M' },
+	{ "site", required_argument, 0, 'L' },
+	{ "motor_speed", required_argument, 0, 'V' },
+	{ "no_wait", no_argument, 0, 'N' },
+	{ "unicable", required_argument, 0, 'U' },
+	{ "tune", required_argument, 0, 'Y' },
+	{ "pin", required_argument, 0, 'K' },
+	{ "repeats", required_argument, 0, 'Z' },
+	{ "schedule", required_argument, 0, 'I' },
+	{ "schedule_delay", required_argument, 0, 'J' },
+	{ "schedule_repeat", required_argument, 0, 'O' },
+	{ "apply", required_argument, 0, 'a' },
+	{ "settle", no_argument, 0, 'G' },
+	{ "settle_levels", required_argument, 0, 'C' },
+	{ "switch_bench", optional_argument, 0, 'k' },
+	{ "scope", required_argument, 0, 's' },
+	{ "columns", required_argument, 0, 'n' },
+	{ "spectrum", optional_argument, 0, 'x' },
+	{ "ripple_alert", required_argument, 0, 'y' },
+	{ "restore", required_argument, 0, 'e' },
+	{ "boot_time", no_argument, 0, 't' },
 	{ "help", no_argument, 0, 'h' },
     { 0, 0, 0, 0 }
 };
@@ -74,18 +203,216 @@ static int show_help()
 	printf("\t--horizontal_pol - Select Horizontal polarization\n");
 	printf("\t--left_pol - Select Left polarization\n");
 	printf("\t--get - Read the current state of the hardware\n");
+	printf("\t--watch=<rate> - Continuously stream the hardware state, <rate> samples per second (0 - as fast as possible)\n");
+	printf("\t--format=<csv|json> - Output format of the 'watch' stream, optional. Default value is csv\n");
+	printf("\t--fields=<list> - Comma separated fields of the 'watch' stream: ps,voltages,polarity,band,\n"
+			"\t\ttone (measured 22KHz tone, V peak-to-peak) or all. Default value is all\n");
+	printf("\t--bench[=<count>] - Measure latency and request rate of the controller link, <count> requests per test, up to %d.\n"
+			"\t\tDefault value is %d. With 'tune' <count> channel changes are measured, %d if <count> is over %d\n",
+			BENCH_MAX_ITERATIONS, BENCH_DEFAULT_ITERATIONS,
+			BENCH_CHANNEL_CHANGE_DEFAULT_ITERATIONS, BENCH_CHANNEL_CHANGE_MAX_ITERATIONS);
+	printf("\t--avg_window=<%d-%d> - Set the output voltage averaging window of the controller, 2^N samples\n",
+			HW_ADC_AVG_WINDOW_MIN, HW_ADC_AVG_WINDOW_MAX);
+	printf("\t--ripple - Read the output voltages ripple statistics of the both channels\n");
+	printf("\t--protect=<low>:<high> - Switch off the power supply when any output voltage is out of the range, V. 0 - no limit\n");
+	printf("\t--hiccup=<ms>[:<count>] - Used with 'protect', re-enable the power supply after the fault with <ms> interval, optionally <count> times\n");
+	printf("\t--events - Show the device events (output faults, DiSEqC messages) until interrupted\n");
+	printf("\t--diseqc=<bytes> - Send DiSEqC 1.x message to the selected channel, up to %d comma separated hex bytes (for example: E0,10,38,F0)\n",
+			HW_DISEQC_MAX_MSG_LEN);
+	printf("\t--diseqc_rx=<off|reply|monitor> - DiSEqC receiver mode: off (default), replies to our messages or all messages on the bus, shown by 'events'\n");
+	printf("\t--sequence=<13|18|keep>:<none|A|B>:<low|high> - Switch the selected channel: voltage, optional 'diseqc' message, tone burst and band, timed by the controller\n");
+	printf("\t--tone_gate=<ms> - Enable 22KHz tone of the selected channel for the exact time, 0.1 ms resolution\n");
+	printf("\t--positioner=<cmd> - DiSEqC 1.2 positioner on the selected channel: usals:<sat lon>, angle:<deg>, goto:<n>, store:<n>,\n"
+			"\t\tdrive:<east|west>[:<seconds or -steps>], halt, limit:<east|west|off>. Moves are waited by the motor model\n");
+	printf("\t--site=<lat>:<lon> - Site coordinates for USALS, for example: 50.45N:30.52E\n");
+	printf("\t--motor_speed=<deg/s> - Positioner speed for the arrival estimation, optional. Default is %.1f (13V) and %.1f (18V)\n",
+			POSITIONER_DEFAULT_SPEED_13V, POSITIONER_DEFAULT_SPEED_18V);
+	printf("\t--no_wait - Don't wait for the positioner arrival\n");
+	printf("\t--unicable=<en50494|en50607>:<ub>[:<MHz>] - Unicable user band of the selected channel, from 0. EN50494 requires the band frequency\n");
+	printf("\t--tune=<MHz>[:<bank>] - Unicable channel change to the tuner IF frequency, bank is 0-7 (EN50494) or 0-255 (EN50607). Default bank is 0.\n"
+			"\t\tWith 'bench' the channel change latency is measured\n");
+	printf("\t--pin=<0-255> - Unicable PIN, optional\n");
+	printf("\t--repeats=<0-%d> - Repeat the channel change after the random delays, against the collisions with other receivers. Default value is %d\n",
+			HW_UNICABLE_MAX_REPEATS, UNICABLE_DEFAULT_REPEATS);
+	printf("\t--schedule=<list> - Outputs changes timed by the controller, comma separated <ms>:<ps|1|2>:<on|off|13|18|low|high>,\n"
+			"\t\tup to %d entries. For example: 0:1:18,0:2:18,20:1:high. Execution times are reported by the controller\n",
+			HW_SCHEDULE_MAX_ENTRIES);
+	printf("\t--schedule_delay=<ms> - Start of the schedule from now, optional. Default value is %.0f\n",
+			SCHEDULE_DEFAULT_DELAY_MS);
+	printf("\t--schedule_repeat=<runs>:<ms> - Run the schedule <runs> times with the period of the controller clock\n");
+	printf("\t--apply=<on|off>:<13|18>:<low|high>:<13|18>:<low|high> - Power supply and both channels outputs,\n"
+			"\t\tswitched together by the controller\n");
+	printf("\t--settle - Used with 'power', polarization and 'apply', wait until the outputs are settled and show the settle time\n");
+	printf("\t--settle_levels=<13v>:<18v>:<tolerance> - Real output levels of the board and the settled output tolerance, V\n");
+	printf("\t--switch_bench[=<cycles>] - Switch every output through all the transitions and show the ACK and settled latency\n"
+			"\t\thistograms, default is %d cycles, up to %d. Outputs are changed! Use --port=%s to measure the host stack alone\n",
+			BENCH_SWITCH_DEFAULT_ITERATIONS, BENCH_SWITCH_MAX_ITERATIONS, HW_EMULATOR_PORT);
+	printf("\t--scope=<rate>[:<seconds>] - Stream the raw output voltages of the selected channel or the both, %d - %d samples\n"
+			"\t\tper second, until interrupted or for <seconds>. Output is in the 'format', lost samples are reported at the end\n",
+			HW_SCOPE_RATE_MIN, HW_SCOPE_RATE_MAX);
+	printf("\t--columns=<n> - Used with 'scope', print %d times per second the min/max envelope of the samples in <n> columns\n",
+			SCOPE_FRAME_RATE);
+	printf("\t--spectrum[=<seconds>] - Ripple spectrum of the selected channel or the both, streamed at %d Hz: ripple RMS without DC and\n"
+			"\t\tthe 22KHz tone, the tone amplitude and the strongest converter components, reported every second in the 'format'\n",
+			HW_SCOPE_RATE_MAX);
+	printf("\t--ripple_alert=<mV>[:<ratio>] - Used with 'spectrum', alert when the ripple RMS is above <mV> (0 - no limit) or grows\n"
+			"\t\t<ratio> times over the baseline learned in the first seconds (0 - off). Default ratio is %.1f\n",
+			RIPPLE_DEFAULT_DEGRADE_RATIO);
+	printf("\t--restore=<list> - Outputs restored by the controller after the reset, comma separated: ps,ch1_polarity,ch1_band,\n"
+			"\t\tch2_polarity,ch2_band, outputs (all but ps), all or none (default). Saved 2 s after the last change\n");
+	printf("\t--boot_time - Show the controller boot stages times since the last reset\n");
 	printf("\t--help - Show this help and exit\n");
 	printf("\nLive long and prosper\n");
 
 	return 0;
 }
 
+/* Boot stages, cumulative time and the stage duration */
+static void display_boot_times()
+{
+	static const char *names[HW_BOOT_STAGE_COUNT] = {
+		"System clock",
+		"Outputs restored",
+		"USB started",
+		"Peripherals",
+		"Ready",
+		"USB configured by the host"
+	};
+
+	struct hardware_boot_times times;
+	float prev = 0;
+	int i;
+
+	if (hardware_read_boot_times(&times) < 0) {
+		printf("Couldn't read the boot times, error: %s\n", hardware_get_last_error_desc());
+		return;
+	}
+
+	printf("\nController boot stages, from the firmware start:\n");
+
+	for (i = 0; i < HW_BOOT_STAGE_COUNT; ++i) {
+		if (times.stage_ms[i] == HW_BOOT_TIME_NOT_REACHED) {
+			printf(" %-27s not reached\n", names[i]);
+		} else if (times.saturated[i]) {
+			printf(" %-27s > %7.2f ms\n", names[i], times.stage_ms[i]);
+		} else {
+			printf(" %-27s %9.2f ms (+%.2f ms)\n", names[i], times.stage_ms[i], times.stage_ms[i] - prev);
+			prev = times.stage_ms[i];
+		}
+	}
+
+	printf("\n");
+}
+
+/* Decimal iterations count within 1 - max */
+static int parse_iterations(const char *str, int max, int *iterations)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(str, &end, 10);
+
+	if (end == str || *end != '\0' || errno == ERANGE || v < 1 || v > max) {
+		return -1;
+	}
+
+	*iterations = (int) v;
+
+	return 0;
+}
+
+/* Comma separated restore fields to HW_RESTORE_* mask, -1 on error */
+static int parse_restore_fields(const char *str)
+{
+	static const struct {
+		const char *name;
+		int mask;
+	} names[] = {
+		{ "none", 0 },
+		{ "ps", HW_RESTORE_PS },
+		{ "ch1_polarity", HW_RESTORE_CH1_POLARITY },
+		{ "ch1_band", HW_RESTORE_CH1_BAND },
+		{ "ch2_polarity", HW_RESTORE_CH2_POLARITY },
+		{ "ch2_band", HW_RESTORE_CH2_BAND },
+		{ "outputs", HW_RESTORE_OUTPUTS },
+		{ "all", HW_RESTORE_ALL }
+	};
+
+	int mask = 0;
+	const char *end;
+	size_t len, i;
+
+	while (*str) {
+		end = strchr(str, ',');
+		len = end ? (size_t) (end - str) : strlen(str);
+
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+			if (len == strlen(names[i].name) && !strncmp(str, names[i].name, len)) {
+				break;
+			}
+		}
+
+		if (i == sizeof(names) / sizeof(names[0])) {
+			return -1;
+		}
+
+		mask |= names[i].mask;
+		str += len;
+
+		if (*str == ',') {
+			str++;
+		}
+	}
+
+	return mask;
+}
+
+/* Set the restore mask and show what the controller has accepted */
+static void display_restore(int mask)
+{
+	uint8_t dev_mask;
+
+	printf("Setting the outputs restored after the reset\n");
+
+	if (hardware_set_restore_mask(mask) < 0 || hardware_get_restore_mask(&dev_mask) < 0) {
+		printf("Failed, error: %s\n", hardware_get_last_error_desc());
+		return;
+	}
+
+	if (!dev_mask) {
+		printf("Nothing is restored, the controller starts with the power supply off, 13V and no tone\n");
+		return;
+	}
+
+	printf("Restored:%s%s%s%s%s\n",
+			(dev_mask & HW_RESTORE_PS) ? " power supply" : "",
+			(dev_mask & HW_RESTORE_CH1_POLARITY) ? " ch1 polarity" : "",
+			(dev_mask & HW_RESTORE_CH1_BAND) ? " ch1 band" : "",
+			(dev_mask & HW_RESTORE_CH2_POLARITY) ? " ch2 polarity" : "",
+			(dev_mask & HW_RESTORE_CH2_BAND) ? " ch2 band" : "");
+}
+
+/* Measured tone against the selected band */
+static void display_tone_level(uint8_t channel, int ps_enabled, int band_low, float level)
+{
+	int present = level >= HW_TONE_PRESENT_MIN_V;
+
+	if (level < 0) {
+		printf("Channel %d 22KHz tone: can't be measured at the current ADC sample rate\n", channel);
+		return;
+	}
+
+	printf("Channel %d 22KHz tone: %.2f V p-p, %s%s\n", channel, level, present ? "present" : "absent",
+			(ps_enabled && present == band_low) ? " - DOESN'T MATCH THE BAND" : "");
+}
+
 static void display_hw_state()
 {
 	struct hardware_state hw_state;
 	char volt_str[8];
 
-	if (hardware_read_full_state(&hw_state) < 0) {
+	if (hardware_read_state(&hw_state, HW_STATE_FIELD_ALL | HW_STATE_FIELD_TONE) < 0) {
 		printf("Couldn't read the full hardware state, error: %s\n", hardware_get_last_error_desc());
 		return;
 	}
@@ -112,16 +439,343 @@ static void display_hw_state()
 	printf("Channel 2 band: %s\n", hw_state.ch2_band_low
 										? "LOW (No 22KHz tone)" : "HIGH (22KHz tone)");
 
+	display_tone_level(LNB_CHANNEL_1, hw_state.ps_enabled, hw_state.ch1_band_low, hw_state.ch1_tone_level);
+	display_tone_level(LNB_CHANNEL_2, hw_state.ps_enabled, hw_state.ch2_band_low, hw_state.ch2_tone_level);
+
 	printf("-------------------------------------------\n\n");
 }
 
+static void display_ripple_stats()
+{
+	struct voltage_stats stats;
+	uint8_t channel;
+
+	printf("\nOutput voltages over the last 204.8 ms:\n");
+
+	for (channel = LNB_CHANNEL_1; channel <= LNB_CHANNEL_2; ++channel) {
+		if (hardware_read_voltage_stats(channel, &stats) < 0) {
+			printf("Couldn't read channel %d statistics, error: %s\n", channel, hardware_get_last_error_desc());
+			return;
+		}
+
+		printf(" Channel %d: min %2.2f V, max %2.2f V, mean %2.2f V, ripple %.1f mV RMS, %.1f mV p-p\n",
+				channel, stats.min, stats.max, stats.mean, stats.rms * 1000.0f,
+				(stats.max - stats.min) * 1000.0f);
+	}
+
+	printf("\n");
+}
+
+/* Parse comma separated hex bytes */
+static int parse_diseqc_msg(const char *str, struct diseqc_params *diseqc)
+{
+	unsigned long val;
+	char *end;
+
+	diseqc->len = 0;
+
+	while (*str) {
+		val = strtoul(str, &end, 16);
+
+		if (end == str || val > 0xFF || diseqc->len >= HW_DISEQC_MAX_MSG_LEN) {
+			return -1;
+		}
+
+		diseqc->msg[diseqc->len++] = val;
+
+		if (*end == ',') {
+			end++;
+		} else if (*end) {
+			return -1;
+		}
+
+		str = end;
+	}
+
+	return diseqc->len ? 0 : -1;
+}
+
+/* Wait until the device reports the end of the transmission */
+/* and the slave reply if it's requested */
+static void wait_diseqc_done(int reply_expected)
+{
+	struct hardware_event ev;
+	uint64_t deadline_ns = hardware_monotonic_ns() + DISEQC_DONE_TIMEOUT_MS * 1000000ULL;
+	uint64_t now_ns;
+	int sent = 0;
+	int ret;
+
+	/* Other events don't shorten the wait, the deadline is fixed */
+	while ((now_ns = hardware_monotonic_ns()) < deadline_ns) {
+		ret = hardware_wait_event(&ev, (deadline_ns - now_ns + 999999ULL) / 1000000ULL);
+
+		if (ret == -ETIMEDOUT || ret == -EAGAIN || ret == -EINTR) {
+			continue;
+		}
+
+		if (ret != 0) {
+			break;
+		}
+
+		print_event(&ev);
+
+		if (ev.id == HW_EVENT_DISEQC_TX_DONE) {
+			sent = 1;
+		}
+
+		if (sent && (!reply_expected || ev.id == HW_EVENT_DISEQC_RX)) {
+			return;
+		}
+	}
+
+	printf(sent ? "No reply from the slave\n" : "Transmission is not confirmed by the device\n");
+}
+
+/* Framing byte 0xE2/0xE3 requests the reply from the slave */
+static int diseqc_reply_expected(const struct diseqc_params *diseqc)
+{
+	return diseqc->len && (diseqc->msg[0] & 0xFC) == 0xE0 && (diseqc->msg[0] & 0x02);
+}
+
+/* Send the message and wait until the device reports it */
+static void send_diseqc_msg(uint8_t channel, const struct diseqc_params *diseqc)
+{
+	if (hardware_diseqc_send(channel, diseqc->msg, diseqc->len) < 0) {
+		printf("Failed, error: %s\n", hardware_get_last_error_desc());
+		return;
+	}
+
+	wait_diseqc_done(diseqc_reply_expected(diseqc));
+}
+
+static void run_diseqc_sequence(uint8_t channel, const struct diseqc_params *diseqc)
+{
+	if (hardware_diseqc_sequence(channel, diseqc->polarity, diseqc->msg, diseqc->len,
+									diseqc->burst, diseqc->band) < 0) {
+		printf("Failed, error: %s\n", hardware_get_last_error_desc());
+		return;
+	}
+
+	wait_diseqc_done(diseqc_reply_expected(diseqc));
+}
+
+static void run_tone_gate(uint8_t channel, const struct diseqc_params *diseqc)
+{
+	if (hardware_tone_gate(channel, (int) (diseqc->gate_ms * 1000.0f)) < 0) {
+		printf("Failed, error: %s\n", hardware_get_last_error_desc());
+		return;
+	}
+
+	wait_diseqc_done(0);
+}
+
+/* Parse "<13|18|keep>:<none|A|B>:<low|high>" */
+static int parse_sequence(const char *str, struct diseqc_params *diseqc)
+{
+	char voltage[8], burst[8], band[8];
+
+	if (sscanf(str, "%7[^:]:%7[^:]:%7s", voltage, burst, band) != 3) {
+		return -1;
+	}
+
+	if (!strcmp(voltage, "13")) {
+		diseqc->polarity = POLARITY_VERTICAL_RIGHT;
+	} else if (!strcmp(voltage, "18")) {
+		diseqc->polarity = POLARITY_HORIZONTAL_LEFT;
+	} else if (!strcmp(voltage, "keep")) {
+		diseqc->polarity = 0;
+	} else {
+		return -1;
+	}
+
+	if (!strcmp(burst, "none")) {
+		diseqc->burst = HW_TONE_BURST_NONE;
+	} else if (!strcmp(burst, "A") || !strcmp(burst, "a")) {
+		diseqc->burst = HW_TONE_BURST_A;
+	} else if (!strcmp(burst, "B") || !strcmp(burst, "b")) {
+		diseqc->burst = HW_TONE_BURST_B;
+	} else {
+		return -1;
+	}
+
+	if (!strcmp(band, "low")) {
+		diseqc->band = BAND_LOW;
+	} else if (!strcmp(band, "high")) {
+		diseqc->band = BAND_HIGH;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* <en50494|en50607>:<ub>[:<ub MHz>] */
+static int parse_unicable(const char *str, struct unicable_params *unicable)
+{
+	const char *arg = strchr(str, ':');
+	char *end;
+	long ub;
+
+	if (!arg) {
+		return -1;
+	}
+
+	if (!strncmp(str, "en50494", arg - str)) {
+		unicable->cfg.standard = UNICABLE_EN50494;
+	} else if (!strncmp(str, "en50607", arg - str)) {
+		unicable->cfg.standard = UNICABLE_EN50607;
+	} else {
+		return -1;
+	}
+
+	ub = strtol(arg + 1, &end, 10);
+
+	if (end == arg + 1 || ub < 0 || ub > 31) {
+		return -1;
+	}
+
+	unicable->cfg.ub = ub;
+
+	if (*end == ':') {
+		unicable->cfg.ub_freq_mhz = atof(end + 1);
+	} else if (*end != '\0') {
+		return -1;
+	}
+
+	/* User band frequency is a part of the tuning word */
+	if (unicable->cfg.standard == UNICABLE_EN50494 && unicable->cfg.ub_freq_mhz <= 0) {
+		return -1;
+	}
+
+	unicable->configured = 1;
+
+	return 0;
+}
+
+/* <IF MHz>[:<bank>] */
+static int parse_tune(const char *str, struct unicable_params *unicable)
+{
+	char *end;
+	long bank = 0;
+
+	unicable->if_mhz = strtod(str, &end);
+
+	if (end == str || unicable->if_mhz <= 0) {
+		return -1;
+	}
+
+	if (*end == ':') {
+		bank = strtol(end + 1, &end, 10);
+	}
+
+	if (*end != '\0' || bank < 0 || bank > 255) {
+		return -1;
+	}
+
+	unicable->bank = bank;
+
+	return 0;
+}
+
+/* One ':' separated field of the apply option, returns 1 - first value, 0 - second, -1 - invalid */
+static int parse_apply_field(const char **str, const char *first, const char *second)
+{
+	size_t len = strcspn(*str, ":");
+	int ret = -1;
+
+	if (len == strlen(first) && !strncmp(*str, first, len)) {
+		ret = 1;
+	} else if (len == strlen(second) && !strncmp(*str, second, len)) {
+		ret = 0;
+	}
+
+	*str += len;
+
+	if (**str == ':') {
+		(*str)++;
+	}
+
+	return ret;
+}
+
+/* <on|off>:<13|18>:<low|high>:<13|18>:<low|high> */
+static int parse_apply(const char *str, struct hardware_state *hw_state)
+{
+	int ps = parse_apply_field(&str, "on", "off");
+	int ch1_vr = parse_apply_field(&str, "13", "18");
+	int ch1_low = parse_apply_field(&str, "low", "high");
+	int ch2_vr = parse_apply_field(&str, "13", "18");
+	int ch2_low = parse_apply_field(&str, "low", "high");
+
+	if (ps < 0 || ch1_vr < 0 || ch1_low < 0 || ch2_vr < 0 || ch2_low < 0 || *str != '\0') {
+		return -1;
+	}
+
+	hw_state->ps_enabled = ps;
+	hw_state->ch1_polarity_vr = ch1_vr;
+	hw_state->ch1_band_low = ch1_low;
+	hw_state->ch2_polarity_vr = ch2_vr;
+	hw_state->ch2_band_low = ch2_low;
+
+	return 0;
+}
+
+/* Channel change and the device report */
+static void run_channel_change(uint8_t channel, const struct unicable_params *unicable)
+{
+	struct hardware_unicable_done done;
+
+	if (hardware_unicable_channel_change(channel, &unicable->cfg, unicable->if_mhz,
+											unicable->bank, unicable->repeats) < 0) {
+		printf("Failed, error: %s\n", hardware_get_last_error_desc());
+		return;
+	}
+
+	if (hardware_unicable_wait(channel, &done, UNICABLE_DONE_TIMEOUT_MS) < 0) {
+		printf("Channel change is not confirmed by the device\n");
+		return;
+	}
+
+	if (done.status == HW_UNICABLE_BUS_BUSY) {
+		printf("Line is busy, the command is not sent after %d backoffs\n", done.backoffs);
+		return;
+	}
+
+	printf("Done, %d frames sent, %d backoffs on the busy line\n", done.sent, done.backoffs);
+}
+
+/* Switch complete events of the changed outputs */
+static void wait_settled(int count)
+{
+	struct hardware_switch_done done;
+
+	while (count-- > 0) {
+		if (hardware_wait_switch_done(0, &done, SETTLE_DONE_TIMEOUT_MS) < 0) {
+			printf("Switch is not reported, error: %s\n", hardware_get_last_error_desc());
+			return;
+		}
+
+		if (done.status == HW_SETTLE_TIMEOUT) {
+			printf("Channel %d output is not settled in %.1f ms, %.2f V\n",
+					done.channel, done.settle_us / 1000.0, done.voltage);
+		} else {
+			printf("Channel %d output is settled in %.1f ms, %.2f V\n",
+					done.channel, done.settle_us / 1000.0, done.voltage);
+		}
+	}
+}
+
 static inline int verify_ch_num(const uint8_t chnum)
 {
 	return (chnum == 1 || chnum == 2);
 }
 
-int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd)
+int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd, struct cmd_options *opts)
 {
+	int switched = 0;
+	int ret = 0;
+	int disconnect_ret;
+
 	if (hardware_connect(port) < 0) {
 		printf("Failed to open serial device %s, error: %s\n", port, hardware_get_last_error_desc());
 		return EFAULT;
@@ -132,6 +786,8 @@ int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd)
 			printf("Switching the power supply ON\n");
 			if (hardware_set_ps_state(ENABLE) < 0) {
 				printf("Failed, error: %s\n", hardware_get_last_error_desc());
+			} else {
+				switched = 2;
 			}
 			break;
 
@@ -139,7 +795,9 @@ int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd)
 			if (printf("Switching the power supply OFF\n") < 0) {
 				printf("Failed, error: %s\n", hardware_get_last_error_desc());
 			}
-			hardware_set_ps_state(DISABLE);
+			if (hardware_set_ps_state(DISABLE) == 0) {
+				switched = 2;
+			}
 			break;
 
 		case USER_CMD_TONE_ON:
@@ -170,6 +828,8 @@ int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd)
 				printf("Setting channel %d Vertical/Right polarization\n", channel);
 				if (hardware_set_channel_polarity(channel, POLARITY_VERTICAL_RIGHT) < 0) {
 					printf("Failed, error: %s\n", hardware_get_last_error_desc());
+				} else {
+					switched = 1;
 				}
 			} else {
 				printf("Unknown channel %d\n", channel);
@@ -182,6 +842,8 @@ int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd)
 				printf("Setting channel %d Horizontal/Left polarization\n", channel);
 				if (hardware_set_channel_polarity(channel, POLARITY_HORIZONTAL_LEFT) < 0) {
 					printf("Failed, error: %s\n", hardware_get_last_error_desc());
+				} else {
+					switched = 1;
 				}
 			} else {
 				printf("Unknown channel %d\n", channel);
@@ -192,11 +854,172 @@ int do_cmd(char *port, uint32_t baud, const uint8_t channel, user_cmd_t cmd)
 			display_hw_state();
 			break;
 
+		case USER_CMD_WATCH:
+			ret = watch_hw_state(&opts->watch);
+			break;
+
+		case USER_CMD_BENCH:
+			bench_link(opts->bench_iterations);
+
+			if (opts->unicable.configured && opts->unicable.if_mhz > 0 && verify_ch_num(channel)) {
+				uint8_t msg[HW_DISEQC_MAX_MSG_LEN];
+				int len = unicable_channel_change_msg(&opts->unicable.cfg, opts->unicable.if_mhz, opts->unicable.bank, msg);
+
+				if (len < 0) {
+					printf("Invalid Unicable channel change parameters\n");
+				} else {
+					bench_channel_change(opts->bench_iterations, channel, msg, len);
+				}
+			}
+			break;
+
+		case USER_CMD_SWITCH_BENCH:
+			bench_switch(opts->bench_iterations);
+			break;
+
+		case USER_CMD_SCOPE:
+			if (channel && !verify_ch_num(channel)) {
+				printf("Unknown channel %d\n", channel);
+				break;
+			}
+
+			opts->scope.channels = !channel ? HW_SCOPE_BOTH : (channel == 1 ? HW_SCOPE_CH1 : HW_SCOPE_CH2);
+			opts->scope.format = opts->watch.format;
+			scope_dump(&opts->scope);
+			break;
+
+		case USER_CMD_SPECTRUM:
+			if (channel && !verify_ch_num(channel)) {
+				printf("Unknown channel %d\n", channel);
+				break;
+			}
+
+			opts->spectrum.channels = !channel ? HW_SCOPE_BOTH : (channel == 1 ? HW_SCOPE_CH1 : HW_SCOPE_CH2);
+			opts->spectrum.format = opts->watch.format;
+			spectrum_run(&opts->spectrum);
+			break;
+
+		case USER_CMD_SETTLE_LEVELS:
+			printf("Setting settle detection levels %2.2f and %2.2f V, tolerance %2.2f V\n",
+					opts->settle.target_13v, opts->settle.target_18v, opts->settle.tolerance);
+			if (hardware_set_settle_detection(opts->settle.target_13v, opts->settle.target_18v, opts->settle.tolerance) < 0) {
+				printf("Failed, error: %s\n", hardware_get_last_error_desc());
+			}
+			break;
+
+		case USER_CMD_PROTECT:
+			printf("Setting output protection range %2.2f - %2.2f V\n", opts->protect.low, opts->protect.high);
+			if (hardware_set_protection(opts->protect.low, opts->protect.high) < 0
+					|| hardware_set_protection_hiccup(opts->protect.hiccup_ms, opts->protect.hiccup_retries) < 0) {
+				printf("Failed, error: %s\n", hardware_get_last_error_desc());
+			}
+			break;
+
+		case USER_CMD_EVENTS:
+			monitor_events();
+			break;
+
+		case USER_CMD_DISEQC:
+			if (verify_ch_num(channel)) {
+				printf("Sending DiSEqC message to channel %d\n", channel);
+				send_diseqc_msg(channel, &opts->diseqc);
+			} else {
+				printf("Unknown channel %d\n", channel);
+			}
+			break;
+
+		case USER_CMD_SEQUENCE:
+			if (verify_ch_num(channel)) {
+				printf("Running switch sequence on channel %d\n", channel);
+				run_diseqc_sequence(channel, &opts->diseqc);
+			} else {
+				printf("Unknown channel %d\n", channel);
+			}
+			break;
+
+		case USER_CMD_TONE_GATE:
+			if (verify_ch_num(channel)) {
+				printf("Enabling channel %d 22KHz tone for %.1f ms\n", channel, opts->diseqc.gate_ms);
+				run_tone_gate(channel, &opts->diseqc);
+			} else {
+				printf("Unknown channel %d\n", channel);
+			}
+			break;
+
+		case USER_CMD_POSITIONER:
+			if (verify_ch_num(channel)) {
+				positioner_cmd(channel, &opts->positioner);
+			} else {
+				printf("Unknown channel %d\n", channel);
+			}
+			break;
+
+		case USER_CMD_UNICABLE:
+			if (!verify_ch_num(channel)) {
+				printf("Unknown channel %d\n", channel);
+			} else if (!opts->unicable.configured) {
+				printf("Unicable user band is not set, see 'unicable' option\n");
+			} else {
+				printf("Channel %d Unicable channel change to IF %.1f MHz, user band %d, bank %d\n",
+						channel, opts->unicable.if_mhz, opts->unicable.cfg.ub, opts->unicable.bank);
+				run_channel_change(channel, &opts->unicable);
+			}
+			break;
+
+		case USER_CMD_SCHEDULE:
+			schedule_run(&opts->schedule);
+			break;
+
+		case USER_CMD_APPLY_STATE:
+			printf("Applying power supply %s, channel 1 %sV %s band, channel 2 %sV %s band\n",
+					opts->apply.ps_enabled ? "ON" : "OFF",
+					opts->apply.ch1_polarity_vr ? "13" : "18", opts->apply.ch1_band_low ? "low" : "high",
+					opts->apply.ch2_polarity_vr ? "13" : "18", opts->apply.ch2_band_low ? "low" : "high");
+			if (hardware_write_full_state(&opts->apply) < 0) {
+				printf("Failed, error: %s\n", hardware_get_last_error_desc());
+			} else {
+				switched = 2;
+			}
+			break;
+
+		case USER_CMD_DISEQC_RX_MODE:
+			printf("Setting DiSEqC receiver mode %d\n", opts->diseqc.rx_mode);
+			if (hardware_set_diseqc_rx_mode(opts->diseqc.rx_mode) < 0) {
+				printf("Failed, error: %s\n", hardware_get_last_error_desc());
+			}
+			break;
+
+		case USER_CMD_RIPPLE:
+			display_ripple_stats();
+			break;
+
+		case USER_CMD_BOOT_TIME:
+			display_boot_times();
+			break;
+
+		case USER_CMD_RESTORE:
+			display_restore(opts->restore_mask);
+			break;
+
+		case USER_CMD_SET_AVG_WINDOW:
+			printf("Setting voltage averaging window to %d samples\n", 1 << opts->avg_window);
+			if (hardware_set_adc_avg_window(opts->avg_window) < 0) {
+				printf("Failed, error: %s\n", hardware_get_last_error_desc());
+			}
+			break;
+
 		default:
 			break;
 	}
 
-	return hardware_disconnect();
+	if (opts->settle.wait && switched) {
+		wait_settled(switched);
+	}
+
+	/* Hardware is closed anyway, the command error is reported first */
+	disconnect_ret = hardware_disconnect();
+
+	return ret ? ret : disconnect_ret;
 }
 
 int main(int argc, char *argv[])
@@ -210,10 +1033,33 @@ int main(int argc, char *argv[])
 
 	user_cmd_t ucmd = USER_CMD_NO_CMD;
 
+	struct cmd_options opts = {
+		.watch = {
+			.rate = 1.0f,
+			.format = WATCH_FORMAT_CSV,
+			.fields = HW_STATE_FIELD_ALL
+		},
+		.bench_iterations = BENCH_DEFAULT_ITERATIONS,
+		.schedule = {
+			.delay_ms = SCHEDULE_DEFAULT_DELAY_MS,
+			.runs = 1
+		},
+		.unicable = {
+			.cfg.pin = UNICABLE_NO_PIN,
+			.repeats = UNICABLE_DEFAULT_REPEATS
+		},
+		.scope = {
+			.rate = SCOPE_DEFAULT_RATE
+		},
+		.spectrum = {
+			.degrade_ratio = RIPPLE_DEFAULT_DEGRADE_RATIO
+		}
+	};
+
 	while (1) {
 		option_index = 0;
 
-		c = getopt_long(argc, argv, "p:b:c:w:ofvzgh", cmd_long_options, &option_index);
+		c = getopt_long(argc, argv, "p:b:c:w:ofvzghW:F:S:B::A:RP:H:ED:X:Q:T:M:L:V:NU:Y:K:Z:I:J:O:a:GC:k::s:n:x::y:e:t", cmd_long_options, &option_index);
 
 		if (c == -1) {
 			break;
@@ -269,6 +1115,323 @@ int main(int argc, char *argv[])
 				ucmd = USER_CMD_GET_DATA;
 				break;
 
+			case 'W':
+				ucmd = USER_CMD_WATCH;
+				opts.watch.rate = atof(optarg);
+
+				if (opts.watch.rate < 0) {
+					fprintf(stderr, "Invalid watch rate %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'F':
+				opts.watch.format = watch_parse_format(optarg);
+
+				if (opts.watch.format < 0) {
+					fprintf(stderr, "Unknown output format %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'S':
+				opts.watch.fields = watch_parse_fields(optarg);
+
+				if (opts.watch.fields < 0) {
+					fprintf(stderr, "Invalid fields list %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'B':
+				ucmd = USER_CMD_BENCH;
+
+				if (optarg && parse_iterations(optarg, BENCH_MAX_ITERATIONS, &opts.bench_iterations) != 0) {
+					fprintf(stderr, "Invalid number of requests %s, must be 1 - %d\n", optarg, BENCH_MAX_ITERATIONS);
+					return -1;
+				}
+
+				break;
+
+			case 'A':
+				ucmd = USER_CMD_SET_AVG_WINDOW;
+				opts.avg_window = atoi(optarg);
+
+				if (opts.avg_window < HW_ADC_AVG_WINDOW_MIN || opts.avg_window > HW_ADC_AVG_WINDOW_MAX) {
+					fprintf(stderr, "Invalid averaging window %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'R':
+				ucmd = USER_CMD_RIPPLE;
+				break;
+
+			case 'P':
+				ucmd = USER_CMD_PROTECT;
+
+				if (sscanf(optarg, "%f:%f", &opts.protect.low, &opts.protect.high) != 2
+						|| opts.protect.low < 0 || opts.protect.high < 0) {
+					fprintf(stderr, "Invalid protection range %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'H':
+				if (sscanf(optarg, "%d:%d", &opts.protect.hiccup_ms, &opts.protect.hiccup_retries) < 1
+						|| opts.protect.hiccup_ms < 0 || opts.protect.hiccup_retries < 0) {
+					fprintf(stderr, "Invalid hiccup parameters %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'E':
+				ucmd = USER_CMD_EVENTS;
+				break;
+
+			case 'D':
+				/* Message may be a part of the switch sequence */
+				if (ucmd != USER_CMD_SEQUENCE) {
+					ucmd = USER_CMD_DISEQC;
+				}
+
+				if (parse_diseqc_msg(optarg, &opts.diseqc) != 0) {
+					fprintf(stderr, "Invalid DiSEqC message %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 't':
+				ucmd = USER_CMD_BOOT_TIME;
+				break;
+
+			case 'e':
+				ucmd = USER_CMD_RESTORE;
+				opts.restore_mask = parse_restore_fields(optarg);
+
+				if (opts.restore_mask < 0) {
+					fprintf(stderr, "Invalid restore fields list %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'X':
+				ucmd = USER_CMD_DISEQC_RX_MODE;
+
+				if (!strcmp(optarg, "off")) {
+					opts.diseqc.rx_mode = HW_DISEQC_RX_MODE_OFF;
+				} else if (!strcmp(optarg, "reply")) {
+					opts.diseqc.rx_mode = HW_DISEQC_RX_MODE_REPLY;
+				} else if (!strcmp(optarg, "monitor")) {
+					opts.diseqc.rx_mode = HW_DISEQC_RX_MODE_MONITOR;
+				} else {
+					fprintf(stderr, "Unknown DiSEqC receiver mode %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'Q':
+				ucmd = USER_CMD_SEQUENCE;
+
+				if (parse_sequence(optarg, &opts.diseqc) != 0) {
+					fprintf(stderr, "Invalid switch sequence %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'T':
+				ucmd = USER_CMD_TONE_GATE;
+				opts.diseqc.gate_ms = atof(optarg);
+
+				if (opts.diseqc.gate_ms <= 0) {
+					fprintf(stderr, "Invalid tone gate duration %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'M':
+				ucmd = USER_CMD_POSITIONER;
+				opts.positioner.cmd = optarg;
+				break;
+
+			case 'L':
+				if (positioner_parse_site(optarg, &opts.positioner) != 0) {
+					fprintf(stderr, "Invalid site coordinates %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'V':
+				opts.positioner.speed = atof(optarg);
+
+				if (opts.positioner.speed <= 0) {
+					fprintf(stderr, "Invalid motor speed %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'N':
+				opts.positioner.no_wait = 1;
+				break;
+
+			case 'U':
+				if (parse_unicable(optarg, &opts.unicable) != 0) {
+					fprintf(stderr, "Invalid Unicable user band %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'Y':
+				if (ucmd != USER_CMD_BENCH) {
+					ucmd = USER_CMD_UNICABLE;
+				}
+
+				if (parse_tune(optarg, &opts.unicable) != 0) {
+					fprintf(stderr, "Invalid channel change %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'K':
+				opts.unicable.cfg.pin = atoi(optarg);
+
+				if (opts.unicable.cfg.pin < 0 || opts.unicable.cfg.pin > 255) {
+					fprintf(stderr, "Invalid Unicable PIN %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'Z':
+				opts.unicable.repeats = atoi(optarg);
+
+				if (atoi(optarg) < 0 || atoi(optarg) > HW_UNICABLE_MAX_REPEATS) {
+					fprintf(stderr, "Invalid number of repeats %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'I':
+				ucmd = USER_CMD_SCHEDULE;
+
+				if (schedule_parse(optarg, &opts.schedule) < 0) {
+					fprintf(stderr, "Invalid schedule %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'J':
+				opts.schedule.delay_ms = atof(optarg);
+
+				if (opts.schedule.delay_ms < 0) {
+					fprintf(stderr, "Invalid schedule delay %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'O':
+				if (schedule_parse_repeat(optarg, &opts.schedule) != 0) {
+					fprintf(stderr, "Invalid schedule repeat %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'a':
+				ucmd = USER_CMD_APPLY_STATE;
+
+				if (parse_apply(optarg, &opts.apply) != 0) {
+					fprintf(stderr, "Invalid outputs state %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'k':
+				ucmd = USER_CMD_SWITCH_BENCH;
+				opts.bench_iterations = BENCH_SWITCH_DEFAULT_ITERATIONS;
+
+				if (optarg && parse_iterations(optarg, BENCH_SWITCH_MAX_ITERATIONS, &opts.bench_iterations) != 0) {
+					fprintf(stderr, "Invalid number of cycles %s, must be 1 - %d\n", optarg, BENCH_SWITCH_MAX_ITERATIONS);
+					return -1;
+				}
+
+				break;
+
+			case 'G':
+				opts.settle.wait = 1;
+				break;
+
+			case 'C':
+				ucmd = USER_CMD_SETTLE_LEVELS;
+
+				if (sscanf(optarg, "%f:%f:%f", &opts.settle.target_13v, &opts.settle.target_18v, &opts.settle.tolerance) != 3
+						|| opts.settle.target_13v <= 0 || opts.settle.target_18v <= 0 || opts.settle.tolerance <= 0) {
+					fprintf(stderr, "Invalid settle levels %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 's':
+				ucmd = USER_CMD_SCOPE;
+
+				if (sscanf(optarg, "%u:%f", &opts.scope.rate, &opts.scope.seconds) < 1
+						|| opts.scope.rate < HW_SCOPE_RATE_MIN || opts.scope.rate > HW_SCOPE_RATE_MAX || opts.scope.seconds < 0) {
+					fprintf(stderr, "Invalid scope rate %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'n':
+				opts.scope.columns = atoi(optarg);
+
+				if (opts.scope.columns <= 0) {
+					fprintf(stderr, "Invalid number of the columns %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'x':
+				ucmd = USER_CMD_SPECTRUM;
+				opts.spectrum.seconds = optarg ? atof(optarg) : 0;
+
+				if (opts.spectrum.seconds < 0) {
+					fprintf(stderr, "Invalid spectrum duration %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
+			case 'y':
+				if (sscanf(optarg, "%f:%f", &opts.spectrum.limit_mv, &opts.spectrum.degrade_ratio) < 1
+						|| opts.spectrum.limit_mv < 0 || opts.spectrum.degrade_ratio < 0) {
+					fprintf(stderr, "Invalid ripple alert %s\n", optarg);
+					return -1;
+				}
+
+				break;
+
 			case 'h':
 				return show_help();
 
@@ -282,6 +1445,6 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	return do_cmd(port, baud, channel, ucmd);
+	return do_cmd(port, baud, channel, ucmd, &opts);
 }
 
@@ -110,7 +110,7 @@ int open_serial_dev(const char* dev, uint32_t baud, int non_block)
 		return -errno;
 	}
 
-	printf("Open %s and set baud rate = %d\n", dev, baud);
+	fprintf(stderr, "Open %s and set baud rate = %d\n", dev, baud);
 
 	serial_fd = open(dev, O_RDWR | O_NOCTTY);
 
@@ -125,7 +125,7 @@ int open_serial_dev(const char* dev, uint32_t baud, int non_block)
 		fcntl(serial_fd, F_SETFL, fd_flags | O_NONBLOCK);
 	}
 
-	printf("Device %s successfully opened and initialized, descriptor = %i\n"
+	fprintf(stderr, "Device %s successfully opened and initialized, descriptor = %i\n"
 			, dev, serial_fd);
 
 	return serial_fd;
@@ -134,7 +134,7 @@ int open_serial_dev(const char* dev, uint32_t baud, int non_block)
 /* */
 int close_serial_dev(int fd)
 {
-	printf("Close device, descriptor %i\n", fd);
+	fprintf(stderr, "Close device, descriptor %i\n", fd);
 	return close(fd);
 }
 
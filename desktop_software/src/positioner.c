@@ -0,0 +1,298 @@
+/*
+   positioner.c
+	- DiSEqC 1.2 and USALS dish positioner control
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "positioner.h"
+#include "device_communicator.h"
+
+/* DiSEqC 1.2 positioner commands */
+#define DISEQC_FRAMING_CMD		0xE0
+#define DISEQC_ADDR_POSITIONER	0x31
+
+#define DISEQC_CMD_HALT			0x60
+#define DISEQC_CMD_LIMITS_OFF	0x63
+#define DISEQC_CMD_LIMIT_EAST	0x66
+#define DISEQC_CMD_LIMIT_WEST	0x67
+#define DISEQC_CMD_DRIVE_EAST	0x68
+#define DISEQC_CMD_DRIVE_WEST	0x69
+#define DISEQC_CMD_STORE_NN		0x6A
+#define DISEQC_CMD_GOTO_NN		0x6B
+#define DISEQC_CMD_GOTO_X		0x6E
+
+/* GotoX direction nibble */
+#define DISEQC_GOTO_X_EAST		0xE0
+#define DISEQC_GOTO_X_WEST		0xD0
+
+/* Equatorial radius of the Earth and geostationary orbit radius, km */
+#define EARTH_RADIUS_KM		6378.137
+#define GEO_ORBIT_RADIUS_KM	42164.17
+
+/* Previous message may still be in transmission */
+#define POSITIONER_BUSY_RETRY_NS	10000000ULL
+#define POSITIONER_BUSY_TIMEOUT_NS	1000000000ULL
+
+#define DEG_TO_RAD (M_PI / 180.0)
+
+static void sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+
+	nanosleep(&ts, NULL);
+}
+
+/* Send the positioner command, wait for the transmitter if it's busy */
+static int positioner_send(const struct positioner *pos, uint8_t cmd, const uint8_t *args, uint8_t args_len)
+{
+	uint8_t msg[HW_DISEQC_MAX_MSG_LEN];
+	uint64_t start_ns = hardware_monotonic_ns();
+	int ret;
+
+	msg[0] = DISEQC_FRAMING_CMD;
+	msg[1] = DISEQC_ADDR_POSITIONER;
+	msg[2] = cmd;
+	memcpy(msg + 3, args, args_len);
+
+	while ((ret = hardware_diseqc_send(pos->channel, msg, args_len + 3)) == -EBUSY
+				&& hardware_monotonic_ns() - start_ns < POSITIONER_BUSY_TIMEOUT_NS) {
+		sleep_ns(POSITIONER_BUSY_RETRY_NS);
+	}
+
+	return ret;
+}
+
+/* Motor is faster on 18V */
+static float positioner_speed(const struct positioner *pos)
+{
+	struct hardware_state hw_state;
+	int high;
+
+	if (hardware_read_state(&hw_state, HW_STATE_FIELD_POLARITY) != 0) {
+		return pos->speed_13v;
+	}
+
+	high = (pos->channel == LNB_CHANNEL_1) ? !hw_state.ch1_polarity_vr : !hw_state.ch2_polarity_vr;
+
+	return high ? pos->speed_18v : pos->speed_13v;
+}
+
+/* Estimate the move time, unknown positions give the worst case */
+static void positioner_start_move(struct positioner *pos, int target_known, double target)
+{
+	double distance = 2.0 * pos->max_angle;
+
+	pos->eta_worst_case = !(pos->angle_known && target_known);
+
+	if (!pos->eta_worst_case) {
+		distance = fabs(target - pos->angle);
+	}
+
+	pos->eta_ns = hardware_monotonic_ns()
+					+ (uint64_t) ((distance / positioner_speed(pos) + pos->start_delay) * 1e9);
+
+	pos->angle_known = target_known;
+	pos->angle = target;
+}
+
+void positioner_init(struct positioner *pos, uint8_t channel, double site_lat, double site_lon)
+{
+	memset(pos, 0, sizeof(*pos));
+
+	pos->channel = channel;
+	pos->site_lat = site_lat;
+	pos->site_lon = site_lon;
+	pos->speed_13v = POSITIONER_DEFAULT_SPEED_13V;
+	pos->speed_18v = POSITIONER_DEFAULT_SPEED_18V;
+	pos->start_delay = 0.5f;
+	pos->max_angle = POSITIONER_DEFAULT_MAX_ANGLE;
+}
+
+/* Polar mount rotation angle: the direction to the satellite from the site, */
+/* projected to the equatorial plane. Earth is a sphere here, the error is tiny */
+double positioner_usals_angle(double site_lat, double site_lon, double sat_lon)
+{
+	double lat = site_lat * DEG_TO_RAD;
+	double dlon = (sat_lon - site_lon) * DEG_TO_RAD;
+
+	return atan2(GEO_ORBIT_RADIUS_KM * sin(dlon),
+				GEO_ORBIT_RADIUS_KM * cos(dlon) - EARTH_RADIUS_KM * cos(lat)) / DEG_TO_RAD;
+}
+
+int hardware_positioner_goto_sat(struct positioner *pos, double sat_lon)
+{
+	return hardware_positioner_goto_angle(pos,
+				positioner_usals_angle(pos->site_lat, pos->site_lon, sat_lon));
+}
+
+/* GotoX angle: direction nibble, then 16 deg, 1 deg and 1/16 deg nibbles */
+int hardware_positioner_goto_angle(struct positioner *pos, double angle)
+{
+	uint16_t units = (uint16_t) lround(fabs(angle) * 16.0);
+	uint8_t args[2];
+	int ret;
+
+	if (fabs(angle) > pos->max_angle) {
+		errno = ERANGE;
+		return -errno;
+	}
+
+	args[0] = (angle < 0 ? DISEQC_GOTO_X_WEST : DISEQC_GOTO_X_EAST) | ((units >> 8) & 0x0F);
+	args[1] = units & 0xFF;
+
+	ret = positioner_send(pos, DISEQC_CMD_GOTO_X, args, sizeof(args));
+
+	if (ret == 0) {
+		positioner_start_move(pos, 1, units / 16.0 * (angle < 0 ? -1.0 : 1.0));
+	}
+
+	return ret;
+}
+
+int hardware_positioner_goto_nn(struct positioner *pos, uint8_t nn)
+{
+	int ret = positioner_send(pos, DISEQC_CMD_GOTO_NN, &nn, 1);
+
+	if (ret == 0) {
+		/* Position 0 is the reference */
+		positioner_start_move(pos, !nn || pos->stored_known[nn], nn ? pos->stored_angle[nn] : 0.0);
+	}
+
+	return ret;
+}
+
+int hardware_positioner_store_nn(struct positioner *pos, uint8_t nn)
+{
+	int ret;
+
+	if (!nn) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	ret = positioner_send(pos, DISEQC_CMD_STORE_NN, &nn, 1);
+
+	if (ret == 0) {
+		pos->stored_known[nn] = pos->angle_known;
+		pos->stored_angle[nn] = pos->angle;
+	}
+
+	return ret;
+}
+
+int hardware_positioner_drive(struct positioner *pos, int direction, int amount)
+{
+	uint8_t cmd = (direction == POSITIONER_EAST ? DISEQC_CMD_DRIVE_EAST : DISEQC_CMD_DRIVE_WEST);
+	uint8_t arg;
+	int ret;
+
+	/* Positive - timeout in seconds, negative - steps */
+	if (amount > 127 || amount < -128) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	arg = (uint8_t) amount;
+
+	ret = positioner_send(pos, cmd, &arg, 1);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (amount > 0) {
+		pos->eta_ns = hardware_monotonic_ns() + (uint64_t) amount * 1000000000ULL;
+	} else if (amount < 0) {
+		pos->eta_ns = hardware_monotonic_ns() + (uint64_t) (pos->start_delay * 1e9);
+	} else {
+		pos->eta_ns = UINT64_MAX;
+	}
+
+	pos->eta_worst_case = 0;
+	pos->angle_known = 0;
+
+	return 0;
+}
+
+int hardware_positioner_halt(struct positioner *pos)
+{
+	int ret = positioner_send(pos, DISEQC_CMD_HALT, NULL, 0);
+
+	if (ret == 0) {
+		pos->eta_ns = hardware_monotonic_ns();
+		pos->eta_worst_case = 0;
+		pos->angle_known = 0;
+	}
+
+	return ret;
+}
+
+int hardware_positioner_set_limit(struct positioner *pos, int limit)
+{
+	switch (limit) {
+		case POSITIONER_LIMIT_EAST:
+			return positioner_send(pos, DISEQC_CMD_LIMIT_EAST, NULL, 0);
+
+		case POSITIONER_LIMIT_WEST:
+			return positioner_send(pos, DISEQC_CMD_LIMIT_WEST, NULL, 0);
+
+		case POSITIONER_LIMITS_OFF:
+			return positioner_send(pos, DISEQC_CMD_LIMITS_OFF, NULL, 0);
+
+		default:
+			errno = EINVAL;
+			return -errno;
+	}
+}
+
+float hardware_positioner_eta(const struct positioner *pos)
+{
+	uint64_t now_ns = hardware_monotonic_ns();
+
+	if (pos->eta_ns == UINT64_MAX) {
+		return -1.0f;
+	}
+
+	return pos->eta_ns > now_ns ? (pos->eta_ns - now_ns) / 1e9f : 0.0f;
+}
+
+int hardware_positioner_wait(const struct positioner *pos, int timeout_ms)
+{
+	uint64_t now_ns = hardware_monotonic_ns();
+
+	if (pos->eta_ns <= now_ns) {
+		return 0;
+	}
+
+	if (pos->eta_ns == UINT64_MAX || pos->eta_ns - now_ns > (uint64_t) timeout_ms * 1000000ULL) {
+		sleep_ns((uint64_t) timeout_ms * 1000000ULL);
+		errno = ETIMEDOUT;
+		return -errno;
+	}
+
+	sleep_ns(pos->eta_ns - now_ns);
+
+	return 0;
+}
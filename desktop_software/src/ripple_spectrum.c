@@ -0,0 +1,359 @@
+/*
+   ripple_spectrum.c
+    - Ripple spectrum analyser of the streamed output voltages
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ The MT3608 switches at 1.2 MHz, far above the Nyquist frequency of the stream, so
+ its harmonics are seen folded, together with the low frequency ripple of the
+ pulse skipping at the light load. The strongest of them are reported as they are
+ seen. The ripple RMS is taken from the spectrum without DC and the 22KHz tone
+ with its harmonics (folded as well), so the tone doesn't hide the converter
+ noise of the channel.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <errno.h>
+#include "ripple_spectrum.h"
+
+/* Hann main lobe is +-2 bins, one more for the frequency between the bins */
+#define RIPPLE_LOBE_BINS 3
+
+/* Bins below this are the DC and the slow drift, not the ripple */
+#define RIPPLE_DC_BINS 3
+
+/* Baseline is learned with the powered output only */
+#define RIPPLE_OUTPUT_MIN_V 10.0f
+
+/* Baseline below the resolution of the ADC is not usable for the ratio */
+#define RIPPLE_BASELINE_FLOOR_V 0.001f
+
+static void reset_window(struct ripple_spectrum *rs)
+{
+	int ch;
+
+	for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+		memset(rs->power_sum[ch], 0, (rs->fft.size / 2 + 1) * sizeof(double));
+		rs->min[ch] = FLT_MAX;
+		rs->max[ch] = -FLT_MAX;
+		rs->sum[ch] = 0;
+	}
+
+	rs->frames = 0;
+	rs->count = 0;
+}
+
+/* Bin of the frequency folded into 0..rate/2 */
+static size_t alias_bin(float freq, uint32_t rate, size_t size)
+{
+	freq = fmodf(freq, rate);
+
+	if (freq > rate / 2.0f) {
+		freq = rate - freq;
+	}
+
+	return (size_t) (freq * size / rate + 0.5f);
+}
+
+int ripple_spectrum_init(struct ripple_spectrum *rs, uint32_t rate, float limit_v, float degrade_ratio)
+{
+	size_t bins;
+	int ch, h;
+	int ret;
+
+	memset(rs, 0, sizeof(*rs));
+
+	if (!rate) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	ret = scope_fft_init(&rs->fft, RIPPLE_FFT_LOG2);
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	bins = rs->fft.size / 2 + 1;
+
+	for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+		rs->frame[ch] = malloc(rs->fft.size * sizeof(float));
+		rs->power[ch] = malloc(bins * sizeof(float));
+		rs->power_sum[ch] = malloc(bins * sizeof(double));
+
+		if (!rs->frame[ch] || !rs->power[ch] || !rs->power_sum[ch]) {
+			ripple_spectrum_free(rs);
+			errno = ENOMEM;
+			return -errno;
+		}
+	}
+
+	rs->rate = rate;
+
+	for (h = 0; h < RIPPLE_TONE_HARMONICS; ++h) {
+		rs->tone_bin[h] = alias_bin(RIPPLE_TONE_HZ * (h + 1), rate, rs->fft.size);
+	}
+
+	rs->limit_v = limit_v;
+	rs->degrade_ratio = degrade_ratio;
+
+	reset_window(rs);
+
+	return 0;
+}
+
+void ripple_spectrum_free(struct ripple_spectrum *rs)
+{
+	int ch;
+
+	for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+		free(rs->frame[ch]);
+		free(rs->power[ch]);
+		free(rs->power_sum[ch]);
+	}
+
+	scope_fft_free(&rs->fft);
+	memset(rs, 0, sizeof(*rs));
+}
+
+/* Transform of the full frame, the second half is kept for the next one */
+static void process_frame(struct ripple_spectrum *rs)
+{
+	size_t bins = rs->fft.size / 2 + 1, half = rs->fft.size / 2, k;
+	int ch;
+
+	scope_fft_power2(&rs->fft, rs->frame[0], rs->frame[1], rs->power[0], rs->power[1]);
+
+	for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+		for (k = 0; k < bins; ++k) {
+			rs->power_sum[ch][k] += rs->power[ch][k];
+		}
+
+		memmove(rs->frame[ch], rs->frame[ch] + half, half * sizeof(float));
+	}
+
+	rs->fill = half;
+	rs->frames++;
+}
+
+void ripple_spectrum_feed(struct ripple_spectrum *rs, const float *ch1, const float *ch2, size_t n)
+{
+	const float *in[RIPPLE_CHANNELS] = { ch1, ch2 };
+	size_t i, take, off = 0;
+	int ch;
+
+	for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+		for (i = 0; i < n; ++i) {
+			rs->min[ch] = in[ch][i] < rs->min[ch] ? in[ch][i] : rs->min[ch];
+			rs->max[ch] = in[ch][i] > rs->max[ch] ? in[ch][i] : rs->max[ch];
+			rs->sum[ch] += in[ch][i];
+		}
+	}
+
+	rs->count += n;
+
+	while (off < n) {
+		take = rs->fft.size - rs->fill;
+
+		if (take > n - off) {
+			take = n - off;
+		}
+
+		for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+			memcpy(rs->frame[ch] + rs->fill, in[ch] + off, take * sizeof(float));
+		}
+
+		rs->fill += take;
+		off += take;
+
+		if (rs->fill == rs->fft.size) {
+			process_frame(rs);
+		}
+	}
+}
+
+/* Power weighted frequency of the bin and its neighbours */
+static float bin_freq(const float *p, size_t k, size_t bins, float df)
+{
+	float lo = k ? p[k - 1] : 0;
+	float hi = k + 1 < bins ? p[k + 1] : 0;
+	float total = lo + p[k] + hi;
+
+	if (total <= 0) {
+		return k * df;
+	}
+
+	return (k + (hi - lo) / total) * df;
+}
+
+/* Power of the component around the bin, main lobe of the window */
+static float lobe_power(const float *p, size_t k, size_t bins)
+{
+	size_t from = k > RIPPLE_LOBE_BINS - 1 ? k - (RIPPLE_LOBE_BINS - 1) : 0;
+	size_t to = k + RIPPLE_LOBE_BINS - 1 < bins ? k + RIPPLE_LOBE_BINS - 1 : bins - 1;
+	float sum = 0;
+
+	for (; from <= to; ++from) {
+		sum += p[from];
+	}
+
+	return sum;
+}
+
+/* Bin belongs to the main lobe of any tone harmonic */
+static int is_tone_bin(const struct ripple_spectrum *rs, size_t k)
+{
+	int h;
+
+	for (h = 0; h < RIPPLE_TONE_HARMONICS; ++h) {
+		if ((k > rs->tone_bin[h] ? k - rs->tone_bin[h] : rs->tone_bin[h] - k) <= RIPPLE_LOBE_BINS) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Strongest local maxima outside of the DC and tone, sorted */
+static int find_peaks(const struct ripple_spectrum *rs, const float *p, size_t bins, float df,
+						struct ripple_peak *peak)
+{
+	float best[RIPPLE_PEAKS];
+	size_t k;
+	int n = 0, i, j;
+
+	for (k = RIPPLE_DC_BINS + 1; k + 1 < bins; ++k) {
+		if (is_tone_bin(rs, k)) {
+			continue;
+		}
+
+		if (p[k] <= p[k - 1] || p[k] < p[k + 1]) {
+			continue;
+		}
+
+		i = 0;
+
+		while (i < n && best[i] >= p[k]) {
+			i++;
+		}
+
+		if (i >= RIPPLE_PEAKS) {
+			continue;
+		}
+
+		if (n < RIPPLE_PEAKS) {
+			n++;
+		}
+
+		for (j = n - 1; j > i; --j) {
+			best[j] = best[j - 1];
+			peak[j] = peak[j - 1];
+		}
+
+		best[i] = p[k];
+		peak[i].freq_hz = bin_freq(p, k, bins, df);
+		peak[i].amplitude_v = sqrtf(2 * (p[k - 1] + p[k] + p[k + 1]));
+	}
+
+	return n;
+}
+
+static void channel_report(struct ripple_spectrum *rs, int ch, struct ripple_report *rep)
+{
+	size_t bins = rs->fft.size / 2 + 1, k, tone_bin, from, to;
+	float df = (float) rs->rate / rs->fft.size;
+	float *p = rs->power[ch];
+	float ac = 0;
+
+	for (k = 0; k < bins; ++k) {
+		p[k] = rs->power_sum[ch][k] / rs->frames;
+	}
+
+	/* Fundamental is measured at the strongest bin of its lobe */
+	k = rs->tone_bin[0];
+	from = k > RIPPLE_LOBE_BINS ? k - RIPPLE_LOBE_BINS : 0;
+	to = k + RIPPLE_LOBE_BINS < bins ? k + RIPPLE_LOBE_BINS : bins - 1;
+
+	for (tone_bin = from; from <= to; ++from) {
+		if (p[from] > p[tone_bin]) {
+			tone_bin = from;
+		}
+	}
+
+	rep->tone_freq_hz = bin_freq(p, tone_bin, bins, df);
+	rep->tone_v = sqrtf(2 * lobe_power(p, tone_bin, bins));
+
+	for (k = RIPPLE_DC_BINS; k < bins; ++k) {
+		if (!is_tone_bin(rs, k)) {
+			ac += p[k];
+		}
+	}
+
+	rep->rms_v = sqrtf(ac);
+	rep->peaks = find_peaks(rs, p, bins, df, rep->peak);
+
+	rep->mean_v = rs->count ? rs->sum[ch] / rs->count : 0;
+	rep->pp_v = rs->count ? rs->max[ch] - rs->min[ch] : 0;
+
+	rep->alert = 0;
+
+	if (rs->limit_v > 0 && rep->rms_v > rs->limit_v) {
+		rep->alert |= RIPPLE_ALERT_LIMIT;
+	}
+
+	if (rs->baseline_reports[ch] >= RIPPLE_BASELINE_REPORTS) {
+		rep->baseline_rms_v = rs->baseline_sum[ch] / RIPPLE_BASELINE_REPORTS;
+
+		if (rep->baseline_rms_v < RIPPLE_BASELINE_FLOOR_V) {
+			rep->baseline_rms_v = RIPPLE_BASELINE_FLOOR_V;
+		}
+
+		if (rs->degrade_ratio > 0 && rep->mean_v >= RIPPLE_OUTPUT_MIN_V
+				&& rep->rms_v > rep->baseline_rms_v * rs->degrade_ratio) {
+			rep->alert |= RIPPLE_ALERT_DEGRADED;
+		}
+	} else {
+		rep->baseline_rms_v = 0;
+
+		if (rep->mean_v >= RIPPLE_OUTPUT_MIN_V) {
+			rs->baseline_sum[ch] += rep->rms_v;
+			rs->baseline_reports[ch]++;
+		}
+	}
+}
+
+int ripple_spectrum_report(struct ripple_spectrum *rs, struct ripple_report report[RIPPLE_CHANNELS])
+{
+	int ch;
+
+	if (!rs->frames) {
+		errno = EAGAIN;
+		return -errno;
+	}
+
+	for (ch = 0; ch < RIPPLE_CHANNELS; ++ch) {
+		channel_report(rs, ch, &report[ch]);
+	}
+
+	reset_window(rs);
+
+	return 0;
+}
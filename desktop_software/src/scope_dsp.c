@@ -0,0 +1,278 @@
+/*
+   scope_dsp.c
+    - Vectorised kernels for the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ SSE2 is the baseline of x86-64 and NEON of the arm64, so the kernels are selected
+ at the build time without any extra flags. Other targets use the scalar code.
+ Every kernel finishes the tail which doesn't fill the vector with the scalar loop.
+ */
+
+#include "scope_dsp.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCOPE_DSP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCOPE_DSP_NEON
+#endif
+
+/* Scalar min/max of the range, also the tail of the vector kernels */
+static void minmax_scalar(const float *in, size_t n, float *min, float *max)
+{
+	float lo = *min, hi = *max;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (in[i] < lo) {
+			lo = in[i];
+		}
+
+		if (in[i] > hi) {
+			hi = in[i];
+		}
+	}
+
+	*min = lo;
+	*max = hi;
+}
+
+/* Scalar butterflies, also the tail of the vector kernels */
+static void butterflies_scalar(float *ur, float *ui, float *vr, float *vi, const float *wr, const float *wi, size_t n)
+{
+	float tr, ti;
+	size_t j;
+
+	for (j = 0; j < n; ++j) {
+		tr = vr[j] * wr[j] - vi[j] * wi[j];
+		ti = vr[j] * wi[j] + vi[j] * wr[j];
+
+		vr[j] = ur[j] - tr;
+		vi[j] = ui[j] - ti;
+		ur[j] += tr;
+		ui[j] += ti;
+	}
+}
+
+#if defined(SCOPE_DSP_SSE2)
+
+/* 8 codes per iteration: zero extend to 32 bit, convert and scale */
+void scope_codes_to_volts(const uint16_t *codes, float *volts, size_t n, float scale)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 k = _mm_set1_ps(scale);
+	__m128i x;
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		x = _mm_loadu_si128((const __m128i *) (codes + i));
+		_mm_storeu_ps(volts + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero)), k));
+		_mm_storeu_ps(volts + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(x, zero)), k));
+	}
+
+	for (; i < n; ++i) {
+		volts[i] = codes[i] * scale;
+	}
+}
+
+static void minmax_range(const float *in, size_t n, float *min, float *max)
+{
+	float lanes[4];
+	__m128 lo, hi, x;
+	size_t i = 0;
+
+	*min = *max = in[0];
+
+	if (n >= 4) {
+		lo = hi = _mm_loadu_ps(in);
+
+		for (i = 4; i + 4 <= n; i += 4) {
+			x = _mm_loadu_ps(in + i);
+			lo = _mm_min_ps(lo, x);
+			hi = _mm_max_ps(hi, x);
+		}
+
+		_mm_storeu_ps(lanes, lo);
+		minmax_scalar(lanes, 4, min, max);
+		_mm_storeu_ps(lanes, hi);
+		minmax_scalar(lanes, 4, min, max);
+	}
+
+	minmax_scalar(in + i, n - i, min, max);
+}
+
+/* 4 butterflies per iteration */
+void scope_butterflies(float *ur, float *ui, float *vr, float *vi, const float *wr, const float *wi, size_t n)
+{
+	__m128 ar, ai, br, bi, cr, ci, tr, ti;
+	size_t j = 0;
+
+	for (; j + 4 <= n; j += 4) {
+		br = _mm_loadu_ps(vr + j);
+		bi = _mm_loadu_ps(vi + j);
+		cr = _mm_loadu_ps(wr + j);
+		ci = _mm_loadu_ps(wi + j);
+
+		tr = _mm_sub_ps(_mm_mul_ps(br, cr), _mm_mul_ps(bi, ci));
+		ti = _mm_add_ps(_mm_mul_ps(br, ci), _mm_mul_ps(bi, cr));
+
+		ar = _mm_loadu_ps(ur + j);
+		ai = _mm_loadu_ps(ui + j);
+
+		_mm_storeu_ps(vr + j, _mm_sub_ps(ar, tr));
+		_mm_storeu_ps(vi + j, _mm_sub_ps(ai, ti));
+		_mm_storeu_ps(ur + j, _mm_add_ps(ar, tr));
+		_mm_storeu_ps(ui + j, _mm_add_ps(ai, ti));
+	}
+
+	butterflies_scalar(ur + j, ui + j, vr + j, vi + j, wr + j, wi + j, n - j);
+}
+
+const char *scope_dsp_kernels(void)
+{
+	return "sse2";
+}
+
+#elif defined(SCOPE_DSP_NEON)
+
+void scope_codes_to_volts(const uint16_t *codes, float *volts, size_t n, float scale)
+{
+	uint16x8_t x;
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		x = vld1q_u16(codes + i);
+		vst1q_f32(volts + i, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(x))), scale));
+		vst1q_f32(volts + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(x))), scale));
+	}
+
+	for (; i < n; ++i) {
+		volts[i] = codes[i] * scale;
+	}
+}
+
+static void minmax_range(const float *in, size_t n, float *min, float *max)
+{
+	float lanes[4];
+	float32x4_t lo, hi, x;
+	size_t i = 0;
+
+	*min = *max = in[0];
+
+	if (n >= 4) {
+		lo = hi = vld1q_f32(in);
+
+		for (i = 4; i + 4 <= n; i += 4) {
+			x = vld1q_f32(in + i);
+			lo = vminq_f32(lo, x);
+			hi = vmaxq_f32(hi, x);
+		}
+
+		vst1q_f32(lanes, lo);
+		minmax_scalar(lanes, 4, min, max);
+		vst1q_f32(lanes, hi);
+		minmax_scalar(lanes, 4, min, max);
+	}
+
+	minmax_scalar(in + i, n - i, min, max);
+}
+
+void scope_butterflies(float *ur, float *ui, float *vr, float *vi, const float *wr, const float *wi, size_t n)
+{
+	float32x4_t ar, ai, br, bi, cr, ci, tr, ti;
+	size_t j = 0;
+
+	for (; j + 4 <= n; j += 4) {
+		br = vld1q_f32(vr + j);
+		bi = vld1q_f32(vi + j);
+		cr = vld1q_f32(wr + j);
+		ci = vld1q_f32(wi + j);
+
+		tr = vmlsq_f32(vmulq_f32(br, cr), bi, ci);
+		ti = vmlaq_f32(vmulq_f32(br, ci), bi, cr);
+
+		ar = vld1q_f32(ur + j);
+		ai = vld1q_f32(ui + j);
+
+		vst1q_f32(vr + j, vsubq_f32(ar, tr));
+		vst1q_f32(vi + j, vsubq_f32(ai, ti));
+		vst1q_f32(ur + j, vaddq_f32(ar, tr));
+		vst1q_f32(ui + j, vaddq_f32(ai, ti));
+	}
+
+	butterflies_scalar(ur + j, ui + j, vr + j, vi + j, wr + j, wi + j, n - j);
+}
+
+const char *scope_dsp_kernels(void)
+{
+	return "neon";
+}
+
+#else
+
+void scope_codes_to_volts(const uint16_t *codes, float *volts, size_t n, float scale)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		volts[i] = codes[i] * scale;
+	}
+}
+
+static void minmax_range(const float *in, size_t n, float *min, float *max)
+{
+	*min = *max = in[0];
+
+	minmax_scalar(in, n, min, max);
+}
+
+void scope_butterflies(float *ur, float *ui, float *vr, float *vi, const float *wr, const float *wi, size_t n)
+{
+	butterflies_scalar(ur, ui, vr, vi, wr, wi, n);
+}
+
+const char *scope_dsp_kernels(void)
+{
+	return "scalar";
+}
+
+#endif
+
+/* Column boundaries are rounded, so every sample goes to exactly one column */
+void scope_decimate_minmax(const float *in, size_t n, float *min, float *max, int columns)
+{
+	size_t start, end;
+	int c;
+
+	if (!n) {
+		return;
+	}
+
+	for (c = 0; c < columns; ++c) {
+		start = (size_t) ((uint64_t) c * n / columns);
+		end = (size_t) ((uint64_t) (c + 1) * n / columns);
+
+		if (end <= start) {
+			end = start + 1;
+		}
+
+		minmax_range(in + start, end - start, &min[c], &max[c]);
+	}
+}
@@ -0,0 +1,172 @@
+/*
+   scope_fft.c
+    - Windowed FFT of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Iterative radix-2 decimation in time. Data are in the split complex format and the
+ twiddles of every stage are stored contiguously, so the stages from the 8 points
+ are done by the vector butterflies of the scope_dsp. First two stages have the
+ trivial twiddles (1 and -j) and are done inline.
+
+ Signals are real, so two of them are packed into the real and imaginary parts of
+ the one transform and separated after it: X[k] = (Z[k] + Z*[N - k]) / 2 and
+ Y[k] = (Z[k] - Z*[N - k]) / 2j. This halves the cost of the two channels.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include "scope_fft.h"
+#include "scope_dsp.h"
+
+int scope_fft_init(struct scope_fft *fft, int log2_size)
+{
+	size_t n, i, half, j;
+	uint32_t r;
+	int b;
+
+	memset(fft, 0, sizeof(*fft));
+
+	if (log2_size < SCOPE_FFT_LOG2_MIN || log2_size > SCOPE_FFT_LOG2_MAX) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	n = (size_t) 1 << log2_size;
+
+	fft->size = n;
+	fft->window = malloc(n * sizeof(float));
+	fft->tw_re = malloc(n * sizeof(float));
+	fft->tw_im = malloc(n * sizeof(float));
+	fft->bitrev = malloc(n * sizeof(uint32_t));
+	fft->re = malloc(n * sizeof(float));
+	fft->im = malloc(n * sizeof(float));
+
+	if (!fft->window || !fft->tw_re || !fft->tw_im || !fft->bitrev || !fft->re || !fft->im) {
+		scope_fft_free(fft);
+		errno = ENOMEM;
+		return -errno;
+	}
+
+	for (i = 0; i < n; ++i) {
+		fft->window[i] = 0.5f - 0.5f * cosf(2.0f * (float) M_PI * i / n);
+		fft->window_power += fft->window[i] * fft->window[i];
+
+		for (r = 0, b = 0; b < log2_size; ++b) {
+			r |= ((i >> b) & 1) << (log2_size - 1 - b);
+		}
+
+		fft->bitrev[i] = r;
+	}
+
+	/* Stage with the 2 * half points uses the table at half - 1 */
+	for (half = 1; half < n; half <<= 1) {
+		for (j = 0; j < half; ++j) {
+			fft->tw_re[half - 1 + j] = cos(-M_PI * j / half);
+			fft->tw_im[half - 1 + j] = sin(-M_PI * j / half);
+		}
+	}
+
+	return 0;
+}
+
+void scope_fft_free(struct scope_fft *fft)
+{
+	free(fft->window);
+	free(fft->tw_re);
+	free(fft->tw_im);
+	free(fft->bitrev);
+	free(fft->re);
+	free(fft->im);
+
+	memset(fft, 0, sizeof(*fft));
+}
+
+/* In place transform of the bit reversed re/im */
+static void fft_run(struct scope_fft *fft)
+{
+	float *re = fft->re, *im = fft->im;
+	size_t n = fft->size, half, i;
+	float ar, ai, br, bi, cr, ci, dr, di;
+
+	/* Stages of the 2 and 4 points together */
+	for (i = 0; i < n; i += 4) {
+		ar = re[i] + re[i + 1];
+		ai = im[i] + im[i + 1];
+		br = re[i] - re[i + 1];
+		bi = im[i] - im[i + 1];
+		cr = re[i + 2] + re[i + 3];
+		ci = im[i + 2] + im[i + 3];
+		dr = re[i + 2] - re[i + 3];
+		di = im[i + 2] - im[i + 3];
+
+		re[i] = ar + cr;
+		im[i] = ai + ci;
+		re[i + 2] = ar - cr;
+		im[i + 2] = ai - ci;
+
+		/* d * -j */
+		re[i + 1] = br + di;
+		im[i + 1] = bi - dr;
+		re[i + 3] = br - di;
+		im[i + 3] = bi + dr;
+	}
+
+	for (half = 4; half < n; half <<= 1) {
+		for (i = 0; i < n; i += 2 * half) {
+			scope_butterflies(re + i, im + i, re + i + half, im + i + half,
+								fft->tw_re + half - 1, fft->tw_im + half - 1, half);
+		}
+	}
+}
+
+void scope_fft_power2(struct scope_fft *fft, const float *a, const float *b, float *pa, float *pb)
+{
+	size_t n = fft->size, i, k, m;
+	float xr, xi, yr, yi, scale;
+
+	for (i = 0; i < n; ++i) {
+		fft->re[fft->bitrev[i]] = a[i] * fft->window[i];
+		fft->im[fft->bitrev[i]] = b[i] * fft->window[i];
+	}
+
+	fft_run(fft);
+
+	/* Parseval with the window: mean square = sum(|X|^2) / (N * sum(w^2)), two-sided */
+	scale = 1.0f / (n * fft->window_power);
+
+	for (k = 0; k <= n / 2; ++k) {
+		m = (n - k) & (n - 1);
+
+		xr = (fft->re[k] + fft->re[m]) * 0.5f;
+		xi = (fft->im[k] - fft->im[m]) * 0.5f;
+		yr = (fft->im[k] + fft->im[m]) * 0.5f;
+		yi = (fft->re[m] - fft->re[k]) * 0.5f;
+
+		pa[k] = (xr * xr + xi * xi) * scale;
+		pb[k] = (yr * yr + yi * yi) * scale;
+
+		/* Negative frequencies are folded */
+		if (k && k < n / 2) {
+			pa[k] *= 2;
+			pb[k] *= 2;
+		}
+	}
+}
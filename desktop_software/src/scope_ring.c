@@ -0,0 +1,173 @@
+/*
+   scope_ring.c
+    - Lock-free ring of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Head is the only shared variable. Producer writes the samples and then publishes
+ them with the release store of the head. Reader takes the head with acquire, copies
+ the samples and checks the head again: everything older than head - SCOPE_RING_LEN
+ could be overwritten during the copy and is dropped.
+ */
+
+#include <string.h>
+#include "scope_ring.h"
+
+#define SCOPE_RING_MASK (SCOPE_RING_LEN - 1)
+
+void scope_ring_reset(struct scope_ring *ring)
+{
+	atomic_store_explicit(&ring->head, 0, memory_order_release);
+}
+
+/* Copy in two parts around the end of the ring */
+static void copy_in(float *dst, const float *src, uint64_t pos, size_t n)
+{
+	size_t idx = pos & SCOPE_RING_MASK;
+	size_t first = SCOPE_RING_LEN - idx;
+
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(dst + idx, src, first * sizeof(float));
+	memcpy(dst, src + first, (n - first) * sizeof(float));
+}
+
+static void copy_out(float *dst, const float *src, uint64_t pos, size_t n)
+{
+	size_t idx = pos & SCOPE_RING_MASK;
+	size_t first = SCOPE_RING_LEN - idx;
+
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(dst, src + idx, first * sizeof(float));
+	memcpy(dst + first, src, (n - first) * sizeof(float));
+}
+
+void scope_ring_push(struct scope_ring *ring, const float *ch1, const float *ch2, size_t n)
+{
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	/* Only the last SCOPE_RING_LEN samples survive anyway */
+	if (n > SCOPE_RING_LEN) {
+		ch1 += n - SCOPE_RING_LEN;
+		ch2 += n - SCOPE_RING_LEN;
+		head += n - SCOPE_RING_LEN;
+		n = SCOPE_RING_LEN;
+	}
+
+	copy_in(ring->data[0], ch1, head, n);
+	copy_in(ring->data[1], ch2, head, n);
+
+	atomic_store_explicit(&ring->head, head + n, memory_order_release);
+}
+
+uint64_t scope_ring_head(struct scope_ring *ring)
+{
+	return atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+/* Samples before the returned position may be overwritten by now */
+/* Fence keeps the copy made before from moving after the head load */
+static uint64_t oldest_valid(struct scope_ring *ring)
+{
+	uint64_t head;
+
+	atomic_thread_fence(memory_order_acquire);
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	return head > SCOPE_RING_LEN ? head - SCOPE_RING_LEN : 0;
+}
+
+size_t scope_ring_read(struct scope_ring *ring, uint64_t *tail, float *ch1, float *ch2,
+						size_t max, uint64_t *lost)
+{
+	uint64_t head = scope_ring_head(ring);
+	uint64_t oldest = head > SCOPE_RING_LEN ? head - SCOPE_RING_LEN : 0;
+	uint64_t valid;
+	size_t n, skip;
+
+	if (*tail < oldest) {
+		*lost += oldest - *tail;
+		*tail = oldest;
+	}
+
+	n = head - *tail;
+
+	if (n > max) {
+		n = max;
+	}
+
+	copy_out(ch1, ring->data[0], *tail, n);
+	copy_out(ch2, ring->data[1], *tail, n);
+
+	/* Producer could wrap over the beginning of the copy */
+	valid = oldest_valid(ring);
+
+	if (valid > *tail) {
+		skip = valid - *tail;
+
+		if (skip > n) {
+			skip = n;
+		}
+
+		*lost += skip;
+		n -= skip;
+		memmove(ch1, ch1 + skip, n * sizeof(float));
+		memmove(ch2, ch2 + skip, n * sizeof(float));
+		*tail += skip;
+	}
+
+	*tail += n;
+
+	return n;
+}
+
+size_t scope_ring_latest(struct scope_ring *ring, float *ch1, float *ch2, size_t n)
+{
+	uint64_t head, start;
+	int retry;
+
+	if (n > SCOPE_RING_LEN / 2) {
+		n = SCOPE_RING_LEN / 2;
+	}
+
+	/* Window is a half of the ring at most, so it's overwritten during the copy */
+	/* only if the reader was preempted for a long time */
+	for (retry = 0; retry < 3; ++retry) {
+		head = scope_ring_head(ring);
+
+		if (n > head) {
+			n = head;
+		}
+
+		start = head - n;
+
+		copy_out(ch1, ring->data[0], start, n);
+		copy_out(ch2, ring->data[1], start, n);
+
+		if (oldest_valid(ring) <= start) {
+			return n;
+		}
+	}
+
+	return 0;
+}
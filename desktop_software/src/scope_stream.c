@@ -0,0 +1,191 @@
+/*
+   scope_stream.c
+    - Reception of the streamed ADC samples
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Receiver thread drains the device event queue, so the whole batch of the queued
+ blocks is converted to volts with a single vectorised call and published to the ring
+ at once. Readers (the scope window, the CLI dump) never block the receiver.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include "scope_stream.h"
+#include "scope_dsp.h"
+#include "device_communicator.h"
+
+/* Up to the host event queue length with some margin */
+#define SCOPE_BATCH_BLOCKS 64
+#define SCOPE_BATCH_SAMPLES (SCOPE_BATCH_BLOCKS * HW_SCOPE_BLOCK_SAMPLES)
+
+/* Short wait, so other threads get the device lock between the blocks */
+#define SCOPE_WAIT_MS 20
+
+static struct scope_ring ring;
+
+static pthread_t stream_thread;
+static volatile int stream_running = 0;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct scope_stream_stats stats;
+
+/* Raw codes of the batch, both channels */
+static uint16_t batch_codes[SCOPE_RING_CHANNELS][SCOPE_BATCH_SAMPLES];
+static float batch_volts[SCOPE_RING_CHANNELS][SCOPE_BATCH_SAMPLES];
+
+/* Append the block to the batch, returns 1 if it's a scope block */
+static int batch_add(const struct hardware_event *ev, size_t *count, int *last_seq, uint64_t *lost)
+{
+	struct hardware_scope_block blk;
+	int ch;
+
+	if (hardware_parse_scope_block(ev, &blk) != 0) {
+		return 0;
+	}
+
+	if (*last_seq >= 0) {
+		*lost += (uint16_t) (blk.seq - *last_seq - 1);
+	}
+
+	*last_seq = blk.seq;
+
+	for (ch = 0; ch < SCOPE_RING_CHANNELS; ++ch) {
+		if (blk.channels & (1 << ch)) {
+			memcpy(&batch_codes[ch][*count], blk.samples[ch], blk.count * sizeof(uint16_t));
+		} else {
+			memset(&batch_codes[ch][*count], 0, blk.count * sizeof(uint16_t));
+		}
+	}
+
+	*count += blk.count;
+
+	return 1;
+}
+
+static void *stream_thread_fn(void *arg)
+{
+	struct hardware_event ev;
+	float scale = hardware_scope_volts_per_code();
+	uint64_t blocks, lost;
+	int last_seq = -1;
+	size_t count;
+	int ret;
+
+	while (stream_running) {
+		count = 0;
+		blocks = 0;
+		lost = 0;
+
+		/* The first block is waited, the rest are taken while they are queued */
+		ret = hardware_wait_event(&ev, SCOPE_WAIT_MS);
+
+		while (ret == 0) {
+			blocks += batch_add(&ev, &count, &last_seq, &lost);
+
+			if (count + HW_SCOPE_BLOCK_SAMPLES > SCOPE_BATCH_SAMPLES) {
+				break;
+			}
+
+			ret = hardware_wait_event(&ev, 0);
+		}
+
+		if (ret != 0 && ret != -ETIMEDOUT && ret != -EAGAIN && ret != -EINTR) {
+			break;
+		}
+
+		if (!count) {
+			continue;
+		}
+
+		scope_codes_to_volts(batch_codes[0], batch_volts[0], count, scale);
+		scope_codes_to_volts(batch_codes[1], batch_volts[1], count, scale);
+		scope_ring_push(&ring, batch_volts[0], batch_volts[1], count);
+
+		pthread_mutex_lock(&stats_lock);
+		stats.blocks += blocks;
+		stats.lost_blocks += lost;
+		pthread_mutex_unlock(&stats_lock);
+	}
+
+	return NULL;
+}
+
+int scope_stream_start(uint8_t channels, uint32_t rate_hz)
+{
+	int rate;
+
+	if (stream_running) {
+		scope_stream_stop();
+	}
+
+	rate = hardware_scope_start(channels, rate_hz);
+
+	if (rate < 0) {
+		return rate;
+	}
+
+	scope_ring_reset(&ring);
+
+	pthread_mutex_lock(&stats_lock);
+	memset(&stats, 0, sizeof(stats));
+	stats.channels = channels;
+	stats.rate = rate;
+	pthread_mutex_unlock(&stats_lock);
+
+	stream_running = 1;
+
+	if (pthread_create(&stream_thread, NULL, stream_thread_fn, NULL) != 0) {
+		stream_running = 0;
+		hardware_scope_stop();
+		errno = EAGAIN;
+		return -errno;
+	}
+
+	return rate;
+}
+
+int scope_stream_stop(void)
+{
+	if (!stream_running) {
+		return 0;
+	}
+
+	stream_running = 0;
+	pthread_join(stream_thread, NULL);
+
+	return hardware_scope_stop();
+}
+
+int scope_stream_running(void)
+{
+	return stream_running;
+}
+
+struct scope_ring *scope_stream_ring(void)
+{
+	return &ring;
+}
+
+void scope_stream_get_stats(struct scope_stream_stats *out)
+{
+	pthread_mutex_lock(&stats_lock);
+	*out = stats;
+	pthread_mutex_unlock(&stats_lock);
+}
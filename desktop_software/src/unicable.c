@@ -0,0 +1,152 @@
+/*
+   unicable.c
+    - Unicable (EN50494) and JESS (EN50607) single cable distribution commands
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ EN50494, ODU_ChannelChange:       E0 10 5A d1 d2, with PIN: E0 10 5C d1 d2 pin
+	d1 = UB (3 bits) | bank (3 bits) | T[9:8], d2 = T[7:0]
+	T = round((IF + UB frequency) / 4) - 350, 4 MHz steps
+
+ EN50607, ODU_Channel_change:      70 d1 d2 d3, with PIN: 71 d1 d2 d3 pin
+	d1 = UB (5 bits) | T[10:8], d2 = T[7:0], d3 = bank
+	T = round(IF) - 100, 1 MHz steps
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include "unicable.h"
+#include "device_communicator.h"
+
+#define EN50494_FRAMING		0xE0
+#define EN50494_ADDR		0x10
+#define EN50494_CMD_CHANGE	0x5A
+#define EN50494_CMD_CHANGE_PIN	0x5C
+
+#define EN50494_MAX_UB		7
+#define EN50494_MAX_BANK	7
+#define EN50494_MAX_T		1023
+
+#define EN50607_CMD_CHANGE	0x70
+#define EN50607_CMD_CHANGE_PIN	0x71
+
+#define EN50607_MAX_UB		31
+#define EN50607_MAX_T		2047
+
+int unicable_channel_change_msg(const struct unicable_config *cfg, double if_mhz, uint8_t bank,
+								uint8_t *msg)
+{
+	int t;
+
+	if (if_mhz < UNICABLE_IF_MIN_MHZ || if_mhz > UNICABLE_IF_MAX_MHZ || cfg->pin > 255) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	if (cfg->standard == UNICABLE_EN50494) {
+		t = (int) lround((if_mhz + cfg->ub_freq_mhz) / 4.0) - 350;
+
+		if (cfg->ub > EN50494_MAX_UB || bank > EN50494_MAX_BANK || t < 0 || t > EN50494_MAX_T) {
+			errno = EINVAL;
+			return -errno;
+		}
+
+		msg[0] = EN50494_FRAMING;
+		msg[1] = EN50494_ADDR;
+		msg[2] = (cfg->pin == UNICABLE_NO_PIN) ? EN50494_CMD_CHANGE : EN50494_CMD_CHANGE_PIN;
+		msg[3] = (cfg->ub << 5) | (bank << 2) | (t >> 8);
+		msg[4] = t & 0xFF;
+
+		if (cfg->pin == UNICABLE_NO_PIN) {
+			return 5;
+		}
+
+		msg[5] = cfg->pin;
+
+		return 6;
+	}
+
+	if (cfg->standard == UNICABLE_EN50607) {
+		t = (int) lround(if_mhz) - 100;
+
+		if (cfg->ub > EN50607_MAX_UB || t < 0 || t > EN50607_MAX_T) {
+			errno = EINVAL;
+			return -errno;
+		}
+
+		msg[0] = (cfg->pin == UNICABLE_NO_PIN) ? EN50607_CMD_CHANGE : EN50607_CMD_CHANGE_PIN;
+		msg[1] = (cfg->ub << 3) | (t >> 8);
+		msg[2] = t & 0xFF;
+		msg[3] = bank;
+
+		if (cfg->pin == UNICABLE_NO_PIN) {
+			return 4;
+		}
+
+		msg[4] = cfg->pin;
+
+		return 5;
+	}
+
+	errno = EINVAL;
+	return -errno;
+}
+
+int hardware_unicable_channel_change(uint8_t channel, const struct unicable_config *cfg,
+										double if_mhz, uint8_t bank, uint8_t repeats)
+{
+	uint8_t msg[HW_DISEQC_MAX_MSG_LEN];
+	int len = unicable_channel_change_msg(cfg, if_mhz, bank, msg);
+
+	if (len < 0) {
+		return len;
+	}
+
+	return hardware_unicable_send(channel, msg, len, repeats);
+}
+
+int hardware_unicable_wait(uint8_t channel, struct hardware_unicable_done *done, int timeout_ms)
+{
+	struct hardware_event ev;
+	uint64_t deadline_ns = hardware_monotonic_ns() + (uint64_t) timeout_ms * 1000000ULL;
+	uint64_t now_ns;
+	int ret;
+
+	/* Other events don't shorten the wait, the deadline is fixed */
+	while ((now_ns = hardware_monotonic_ns()) < deadline_ns) {
+		ret = hardware_wait_event(&ev, (deadline_ns - now_ns + 999999ULL) / 1000000ULL);
+
+		if (ret == -ETIMEDOUT || ret == -EAGAIN || ret == -EINTR) {
+			continue;
+		}
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		if (ev.id == HW_EVENT_UNICABLE_DONE && hardware_parse_unicable_done_event(&ev, done) == 0
+				&& done->channel == channel) {
+			return 0;
+		}
+	}
+
+	errno = ETIMEDOUT;
+	return -errno;
+}
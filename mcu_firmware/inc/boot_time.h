@@ -0,0 +1,46 @@
+/*
+   boot_time.h
+    - Boot stages timestamps with the DWT cycle counter
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef BOOT_TIME_H
+#define BOOT_TIME_H
+
+#include <stdint.h>
+
+/* Boot stages, the time is from the main() entry to the end of the stage */
+#define BOOT_STAGE_CLOCKS			0	/* HAL and 48 MHz system clock */
+#define BOOT_STAGE_OUTPUTS			1	/* LEDs, time base, outputs state restored */
+#define BOOT_STAGE_USB_START		2	/* USB device is started, enumeration goes in background */
+#define BOOT_STAGE_PERIPHERALS		3	/* DiSEqC, Unicable, scheduler, ADC calibration, settle */
+#define BOOT_STAGE_READY			4	/* Main loop is entered, commands are processed */
+#define BOOT_STAGE_USB_CONFIGURED	5	/* Host has configured the device */
+#define BOOT_STAGE_COUNT			6
+
+#define BOOT_TIME_NOT_REACHED		0xFFFFFFFF
+
+/* Start the cycle counter, the first call of main() */
+void boot_time_start(void);
+
+/* End of the stage, only the first one is recorded. Can be called from the interrupt */
+void boot_time_mark(uint8_t stage);
+
+/* Microseconds from the main() entry or BOOT_TIME_NOT_REACHED */
+uint32_t boot_time_get_us(uint8_t stage);
+
+#endif
@@ -23,11 +23,15 @@
 
 #include <stdint.h>
 
+/* TIM2 ticks of the 22KHz tone period, 24 MHz / 1086 = 22.1 KHz */
+#define TONE_TIMER_PERIOD 1086
+
 void init_diseqc(void);
 
 /* PS API */
 void diseqc_set_ps_mode(uint8_t enabled);
 uint8_t diseqc_get_ps_mode(void);
+void diseqc_ps_emergency_off(void);
 
 /* CH1 API */
 void diseq_set_ch1_tone_signal_mode(uint8_t enabled);
@@ -41,4 +45,12 @@ uint8_t diseq_get_ch2_tone_signal_mode(void);
 void diseqc_set_ch2_out_voltage(uint8_t voltage_val);
 uint8_t diseqc_get_ch2_out_voltage(void);
 
+/* Whole outputs state at once, applied at the 22KHz timer update */
+/* ps_enabled and tones are 0/1, voltages are OUT_VOLTAGE_MODE_* values */
+void diseqc_apply_state(uint8_t ps_enabled, uint8_t ch1_voltage, uint8_t ch1_tone,
+						uint8_t ch2_voltage, uint8_t ch2_tone);
+
+/* TIM2 update interrupt callback, see stm32f1xx_it.c */
+void diseqc_apply_state_cb(void);
+
 #endif
@@ -0,0 +1,48 @@
+/*
+   diseqc_rx.h
+    - DiSEqC 2.x replies receiver and bus monitor
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef DISEQC_RX_H
+#define DISEQC_RX_H
+
+#include <stdint.h>
+
+/* Receiver modes */
+#define DISEQC_RX_OFF		0x0	/* Default */
+#define DISEQC_RX_REPLY		0x1	/* Only the replies to our own messages */
+#define DISEQC_RX_MONITOR	0x2	/* Everything on the bus */
+
+/* Longest reported message */
+#define DISEQC_RX_MAX_MSG_LEN 8
+
+/* Requires systime, TIM1 is shared */
+void init_diseqc_rx(void);
+
+void diseqc_rx_set_mode(uint8_t mode);
+uint8_t diseqc_rx_get_mode(void);
+
+/* Tone of another master was seen on the line within the last quiet_us */
+/* Unknown (0) if the receiver is off or our own continuous tone is on */
+uint8_t diseqc_rx_line_busy(uint8_t channel, uint32_t quiet_us);
+
+/* Main loop: decode the captured edges and report the messages */
+/* Must be called at least every 10 ms, the capture ring holds ~11 ms of tone */
+void diseqc_rx_poll(void);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+   diseqc_tx.h
+    - DiSEqC 1.x messages transmitter
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef DISEQC_TX_H
+#define DISEQC_TX_H
+
+#include <stdint.h>
+
+#define DISEQC_TX_CHANNEL_1 0x1
+#define DISEQC_TX_CHANNEL_2 0x2
+
+#define DISEQC_MAX_MSG_LEN 6
+
+/* Slave must start the reply within 150 ms after the command */
+#define DISEQC_REPLY_WINDOW_US 150000
+
+/* Tone burst (mini DiSEqC) */
+#define DISEQC_BURST_NONE	0x0
+#define DISEQC_BURST_A		0x1	/* Satellite A, unmodulated */
+#define DISEQC_BURST_B		0x2	/* Satellite B, modulated */
+
+/* Transmitter status codes */
+#define DISEQC_TX_OK		0x0
+#define DISEQC_TX_BUSY		0x1
+#define DISEQC_TX_INVALID	0x2
+
+void init_diseqc_tx(void);
+
+/* Start the message transmission, returns DISEQC_TX_* status */
+/* Continuous tone of the channel is paused for the transmission */
+uint8_t diseqc_tx_send(uint8_t channel, const uint8_t *msg, uint8_t len);
+
+/* Full switch sequence, all steps are timed by the transmitter: */
+/* voltage change, 15 ms, message, 15 ms, tone burst, 15 ms, final tone state */
+/* voltage - DS_OUT_VOLTAGE_MODE_* or 0 (unchanged), message is optional (len 0) */
+uint8_t diseqc_tx_sequence(uint8_t channel, uint8_t voltage, const uint8_t *msg, uint8_t len,
+							uint8_t burst, uint8_t tone);
+
+/* Unicable (EN50494/EN50607) ODU frame: 18V, 5 ms, message, 2 ms, previous voltage */
+/* Voltage is changed only if the line is at 13V, both changes are monitored by settle */
+uint8_t diseqc_tx_odu(uint8_t channel, const uint8_t *msg, uint8_t len);
+
+/* Tone on for the exact duration, 0.1 ms units */
+uint8_t diseqc_tx_tone_gate(uint8_t channel, uint16_t duration);
+
+/* Channel line is owned by the transmitter: message or the reply window */
+/* Tone of the master is kept off until the reply window is over */
+uint8_t diseqc_tx_active(uint8_t channel);
+
+/* Message is being sent right now */
+uint8_t diseqc_tx_sending(uint8_t channel);
+
+/* Main loop: restore the tone and report the completed transmissions */
+void diseqc_tx_poll(void);
+
+/* DMA and TIM4 interrupts callbacks, see stm32f1xx_it.c */
+void diseqc_tx_dma_complete_cb(void);
+void diseqc_tx_gate_complete_cb(void);
+
+#endif
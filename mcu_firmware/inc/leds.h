@@ -21,6 +21,8 @@
 #ifndef LEDS_H
 #define LEDS_H
 
+#include <stdint.h>
+
 void init_leds(void);
 
 void led13v_ch1_on(void);
@@ -41,6 +43,16 @@ void led22khz_ch2_tone_off(void);
 void system_led_on(void);
 void system_led_off(void);
 
+/* Non-blocking System LED patterns, driven by leds_poll() */
+void system_led_flash(void);
+void system_led_err_blink(uint8_t num);
+void leds_poll(void);
+
+/* Start the boot pattern, it runs in the background from the SysTick interrupt */
+/* Channel LEDs show the outputs state when it's over */
 void boot_blink(void);
 
+/* SysTick interrupt callback, see stm32f1xx_it.c */
+void leds_systick_cb(void);
+
 #endif
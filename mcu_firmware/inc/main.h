@@ -36,6 +36,7 @@ extern "C" {
 #include "stm32f1xx_ll_pwr.h"
 #include "stm32f1xx_ll_dma.h"
 #include "stm32f1xx_ll_tim.h"
+#include "stm32f1xx_ll_adc.h"
 #include "stm32f1xx.h"
 #include "stm32f1xx_ll_gpio.h"
 
@@ -0,0 +1,48 @@
+/*
+   protection.h
+    - LNB outputs fault protection
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef PROTECTION_H
+#define PROTECTION_H
+
+#include <stdint.h>
+
+/* Thresholds are 0.1 mV of the ADC input, 0 - disabled */
+void protection_set_low_threshold(uint16_t value);
+uint16_t protection_get_low_threshold(void);
+void protection_set_high_threshold(uint16_t value);
+uint16_t protection_get_high_threshold(void);
+
+/* Hiccup mode, interval in 100 ms units (0 - disabled), max_retries 0 - unlimited */
+void protection_set_hiccup(uint8_t interval, uint8_t max_retries);
+void protection_get_hiccup(uint8_t *interval, uint8_t *max_retries);
+
+/* Power supply is switched by the host */
+void protection_ps_changed(uint8_t enabled);
+
+/* DS_PROTECTION_* flags and number of the retries */
+uint8_t protection_get_status(uint8_t *retries);
+
+/* Watchdog is armed or waits for the blanking time */
+uint8_t protection_active(void);
+
+/* Main loop: send fault events, run the hiccup retries */
+void protection_poll(void);
+
+#endif
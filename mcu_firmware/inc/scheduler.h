@@ -0,0 +1,58 @@
+/*
+   scheduler.h
+    - Timed commands scheduler
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#define SCHEDULER_MAX_ENTRIES 64
+
+/* Status codes */
+#define SCHEDULER_OK		0x0
+#define SCHEDULER_BUSY		0x1
+#define SCHEDULER_INVALID	0x2
+
+/* Start time modes */
+#define SCHEDULER_START_DELAY		0x0	/* Microseconds from now */
+#define SCHEDULER_START_ABSOLUTE	0x1	/* Device time, us */
+
+/* Requires systime, TIM1 is shared */
+void init_scheduler(void);
+
+/* Append the entry, offset is us from the start, not less than the previous one */
+/* cmd and arg are the regular write command, outputs control only */
+uint8_t scheduler_add(uint32_t offset, uint8_t cmd, uint8_t arg);
+
+uint8_t scheduler_start(uint8_t mode, uint32_t time);
+
+/* Stop and drop all the entries */
+void scheduler_clear(void);
+
+/* Started and not all the entries are executed */
+uint8_t scheduler_active(void);
+
+/* Main loop: report the executed entries */
+void scheduler_poll(void);
+
+/* TIM1 compare interrupt callback, see stm32f1xx_it.c */
+void scheduler_compare_cb(void);
+
+#endif
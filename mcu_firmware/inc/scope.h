@@ -0,0 +1,52 @@
+/*
+   scope.h
+    - Raw ADC waveform streaming
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdint.h>
+
+/* Channels mask */
+#define SCOPE_CH1	0x1
+#define SCOPE_CH2	0x2
+#define SCOPE_BOTH	(SCOPE_CH1 | SCOPE_CH2)
+
+/* Sample rate limits, Hz */
+#define SCOPE_RATE_MIN	1000
+#define SCOPE_RATE_MAX	50000
+
+/* Status codes */
+#define SCOPE_OK		0x0
+#define SCOPE_INVALID	0x1
+
+/* Requires systime and voltage reader */
+/* Start streaming of the channels with the new sequence numbers, it's restarted if running */
+uint8_t scope_start(uint8_t channels, uint32_t rate_hz);
+
+/* Stop streaming and restore the normal ADC rate */
+void scope_stop(void);
+
+/* Streaming is running */
+uint8_t scope_active(void);
+
+/* Main loop: send the captured blocks */
+void scope_poll(void);
+
+#endif
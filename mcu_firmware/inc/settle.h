@@ -0,0 +1,52 @@
+/*
+   settle.h
+    - Output voltage settle detection and switch complete events
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef SETTLE_H
+#define SETTLE_H
+
+#include <stdint.h>
+
+/* Channels mask */
+#define SETTLE_CH1	0x1
+#define SETTLE_CH2	0x2
+#define SETTLE_BOTH	(SETTLE_CH1 | SETTLE_CH2)
+
+/* Requires systime and voltage reader */
+void init_settle(void);
+
+/* Levels and tolerance, 0.1 mV of the ADC input */
+void settle_set_target_13v(uint16_t value);
+uint16_t settle_get_target_13v(void);
+void settle_set_target_18v(uint16_t value);
+uint16_t settle_get_target_18v(void);
+void settle_set_tolerance(uint16_t value);
+uint16_t settle_get_tolerance(void);
+
+/* Output state of the channels is changed, start monitoring */
+/* Target is taken from the current state. Can be called from the interrupt */
+void settle_start(uint8_t channels);
+
+/* Monitoring is requested or running on any channel */
+uint8_t settle_active(void);
+
+/* Main loop: report the settled outputs */
+void settle_poll(void);
+
+#endif
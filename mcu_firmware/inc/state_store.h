@@ -0,0 +1,51 @@
+/*
+   state_store.h
+    - Outputs state in flash, restored on boot
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+#include <stdint.h>
+
+/* Outputs fields, the same bits are used for the saved state and the restore mask */
+/* They are DS_RESTORE_* of the protocol */
+#define STATE_STORE_PS			0x01
+#define STATE_STORE_CH1_18V		0x02
+#define STATE_STORE_CH1_TONE	0x04
+#define STATE_STORE_CH2_18V		0x08
+#define STATE_STORE_CH2_TONE	0x10
+#define STATE_STORE_ALL			0x1F
+
+/* Find the last saved record, must be called before init_diseqc() */
+void init_state_store(void);
+
+/* Saved outputs masked by the restore mask, 0 if nothing is saved */
+uint8_t state_store_get_restored(void);
+
+/* Fields restored on boot, nothing by default */
+/* Mask is saved together with the outputs on the next poll */
+void state_store_set_restore_mask(uint8_t mask);
+uint8_t state_store_get_restore_mask(void);
+
+/* Main loop: save the changed outputs when they are stable */
+/* Flash write stalls the CPU and all the interrupts for up to 20-40 ms, it's deferred */
+/* while DiSEqC TX, schedule, settle detection, scope or armed protection are active */
+void state_store_poll(void);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+   systime.h
+    - Microsecond system time base
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef SYSTIME_H
+#define SYSTIME_H
+
+#include <stdint.h>
+
+void init_systime(void);
+
+/* Microseconds since start, wraps every ~71 minutes */
+/* Safe to call from any context */
+uint32_t systime_us(void);
+
+/* TIM1 update interrupt callback, see stm32f1xx_it.c */
+void systime_overflow_cb(void);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+   unicable.h
+    - Unicable (EN50494/EN50607) ODU commands with the collision avoidance
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#ifndef UNICABLE_H
+#define UNICABLE_H
+
+#include <stdint.h>
+
+#define UNICABLE_MAX_REPEATS 7
+
+/* Requires systime, uses DiSEqC transmitter and receiver */
+void init_unicable(void);
+
+/* Queue the ODU command, sent when the line is free and repeated */
+/* repeats times after the random delays. Returns DISEQC_TX_* status */
+uint8_t unicable_send(uint8_t channel, const uint8_t *msg, uint8_t len, uint8_t repeats);
+
+/* Main loop: run the transmissions and report the completion */
+void unicable_poll(void);
+
+#endif
@@ -23,6 +23,18 @@
 
 #include <stdint.h>
 
-void handle_rx_data(uint8_t* buf, uint32_t *len);
+/* USB interrupt context: queue the received transfer */
+/* Returns 1 if there is a room for the next transfer */
+uint8_t handle_rx_data(uint8_t* buf, uint32_t *len);
+
+/* Main loop context: handle all queued commands */
+void process_rx_data(void);
+
+/* Main loop context: queue event frame, see usb_protocol_private.h */
+/* Returns 0 if there is no room right now, caller should try again later */
+uint8_t send_event(uint8_t id, const uint8_t *payload, uint8_t len);
+
+/* USB interrupt context: previous IN transfer is done, send queued responses */
+void handle_tx_complete(void);
 
 #endif
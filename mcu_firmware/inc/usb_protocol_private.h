@@ -40,17 +40,47 @@
 	----------------------------
 	| 6 |      | CRC8 Checksum |
     ----------------------------
+ Extended frame format (device events):
+	----------------------------
+	| 0 | 0xAE | Magic byte 1  |
+	----------------------------
+	| 1 | 0xAB | MAgic byte 2  |
+	----------------------------
+	| 2 | 0xE2 | DS_EVENT      |
+	|   | 0x03 | CMD WRITE EXT |
+	----------------------------
+	| 3 |      | EVENT/CMD ID  |
+	----------------------------
+	| 4 |      | PAYLOAD LEN   |
+	----------------------------
+	| 5 |      | PAYLOAD       |
+	| . |      | (up to 56)    |
+	----------------------------
+	| N |      | CRC8 Checksum |
+	----------------------------
+	Events are sent by the device at any time, between the responses.
+	Extended writes are acknowledged with the regular frame:
+	CMD WRITE EXT, CMD ID, 0xFF 0xFF on success or DS_NAK_* in ARG1.
+	Multi-byte values are big-endian.
  */
 
 #define USB_PACKET_LEN		0x7
 
+/* Extended frame header and payload limits */
+/* Full frame always fits a single USB packet */
+#define DS_EXT_HEADER_LEN	0x5
+#define DS_EXT_MAX_PAYLOAD	56
+#define DS_EXT_FRAME_LEN(payload_len) (DS_EXT_HEADER_LEN + (payload_len) + 1)
+
 /* Common protocol defines */
 #define DS_HEADER_MAGIC1	0xAE
 #define DS_HEADER_MAGIC2	0xAB
 
 #define DS_CMD_WRITE		0x01
 #define DS_CMD_READ			0x02
+#define DS_CMD_WRITE_EXT	0x03
 #define DS_RESPONSE			0xE1
+#define DS_EVENT			0xE2
 
 /* Common power supply control */
 #define POWER_SUPPLY_CONTROL	0xDD
@@ -67,13 +97,222 @@
 #define DS_CMD_READ_REAL_VOLTAGE_CH2	0xC1
 #define DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2	0x10
 
+/* Averaged output voltages, 0.1 mV of the ADC input, ARG1 - high byte, ARG2 - low byte */
+#define DS_CMD_READ_AVG_VOLTAGE_CH1		0xC2
+#define DS_CMD_READ_AVG_VOLTAGE_CH2		0xC3
+
+/* ADC averaging window, ARG1 - log2 of the samples count (4 - 12) */
+#define DS_CMD_ADC_AVG_WINDOW			0xC4
+
+/* Number of the completed averaged samples, low 16 bits, ARG1 - high byte, ARG2 - low byte */
+#define DS_CMD_READ_SAMPLE_COUNTER		0xC5
+
+/* Ripple statistics of the last 4096 samples (204.8 ms) window */
+/* Request ARG1 selects the value, response is 0.1 mV of the ADC input, ARG1 - high byte, ARG2 - low byte */
+/* STATS_MIN read takes a new window, so read it first */
+#define DS_CMD_READ_STATS_CH1			0xC6
+#define DS_CMD_READ_STATS_CH2			0xC7
+
+#define DS_STATS_MIN					0x00
+#define DS_STATS_MAX					0x01
+#define DS_STATS_MEAN					0x02
+#define DS_STATS_RMS					0x03
+
+/* Measured 22KHz tone, peak-to-peak of the fundamental over the last 2048 samples */
+/* Response is 0.1 mV of the ADC input, ARG1 - high byte, ARG2 - low byte */
+/* DS_TONE_LEVEL_INVALID - can't be measured at the current sample rate, see DS_EXT_CMD_SCOPE */
+#define DS_CMD_READ_TONE_LEVEL_CH1		0xC8
+#define DS_CMD_READ_TONE_LEVEL_CH2		0xC9
+
+#define DS_TONE_LEVEL_INVALID			0xFFFF
+
+/* Boot time, request ARG1 selects the stage, response is 10 us units from the firmware start */
+/* to the end of the stage, ARG1 - high byte, ARG2 - low byte. Saturated at DS_BOOT_TIME_MAX */
+#define DS_CMD_READ_BOOT_TIME			0xCA
+
+#define DS_BOOT_STAGE_CLOCKS			0x00	/* HAL and 48 MHz system clock */
+#define DS_BOOT_STAGE_OUTPUTS			0x01	/* Outputs state restored */
+#define DS_BOOT_STAGE_USB_START			0x02	/* USB device started */
+#define DS_BOOT_STAGE_PERIPHERALS		0x03	/* DiSEqC, scheduler, ADC and the other modules */
+#define DS_BOOT_STAGE_READY				0x04	/* Commands are processed */
+#define DS_BOOT_STAGE_USB_CONFIGURED	0x05	/* Host has configured the device */
+#define DS_BOOT_STAGE_COUNT				6
+
+#define DS_BOOT_TIME_UNIT_US			10
+#define DS_BOOT_TIME_MAX				0xFFFE
+#define DS_BOOT_TIME_NOT_REACHED		0xFFFF
+
+/* Output protection with the ADC analog watchdog */
+/* Thresholds are 0.1 mV of the ADC input, ARG1 - high byte, ARG2 - low byte, 0 - disabled */
+/* Protection is armed only when the power supply is enabled */
+#define DS_CMD_PROTECTION_LOW			0xA0
+#define DS_CMD_PROTECTION_HIGH			0xA1
+/* Hiccup mode, ARG1 - retry interval in 100 ms units (0 - disabled), ARG2 - max retries (0 - unlimited) */
+#define DS_CMD_PROTECTION_HICCUP		0xA2
+/* Read only, ARG1 - DS_PROTECTION_* flags, ARG2 - number of the retries after the last fault */
+#define DS_CMD_PROTECTION_STATUS		0xA3
+
+#define DS_PROTECTION_ARMED				0x01
+#define DS_PROTECTION_FAULT				0x02
+#define DS_PROTECTION_RETRY_PENDING		0x04
+
+/* Output voltage settle detection after the voltage or power supply change, see DS_EVENT_SWITCH_DONE */
+/* Levels are 0.1 mV of the ADC input, ARG1 - high byte, ARG2 - low byte */
+/* Output is settled when it stays within the tolerance of the target level for 2 ms */
+#define DS_CMD_SETTLE_TARGET_13V		0xA4
+#define DS_CMD_SETTLE_TARGET_18V		0xA5
+#define DS_CMD_SETTLE_TOLERANCE			0xA6
+
+/* DiSEqC receiver mode, ARG1 - DS_DISEQC_RX_MODE_* */
+#define DS_CMD_DISEQC_RX_MODE			0xD2
+
+#define DS_DISEQC_RX_MODE_OFF			0x00
+#define DS_DISEQC_RX_MODE_REPLY			0x01	/* Replies within 150 ms after our message */
+#define DS_DISEQC_RX_MODE_MONITOR		0x02	/* All messages on the bus */
+
+/* Outputs restored on boot from the state saved in flash, ARG1 - DS_RESTORE_* mask */
+/* Nothing is restored by default. State is saved 2 s after the last change of the masked fields */
+#define DS_CMD_STATE_RESTORE			0xD3
+
+#define DS_RESTORE_PS					0x01
+#define DS_RESTORE_CH1_VOLTAGE			0x02
+#define DS_RESTORE_CH1_TONE				0x04
+#define DS_RESTORE_CH2_VOLTAGE			0x08
+#define DS_RESTORE_CH2_TONE				0x10
+#define DS_RESTORE_ALL					0x1F
+
 /* Common voltage and tone defines */
 #define DS_OUT_VOLTAGE_MODE_13V		0x0D
 #define DS_OUT_VOLTAGE_MODE_18V		0x12
 #define DS_OUT_TONE_SIGNAL_ENABLED	0xEE
 #define DS_OUT_TONE_SIGNAL_DISABLED	0xED
 
-/* TODO: DISEqC 1.x commands */
+/* Device events */
+/* Output fault, power supply is switched off */
+/* Payload: timestamp, us (4), channel 1/2 (1), DS_FAULT_* (1), ADC input voltage, 0.1 mV (2), retry number (1) */
+#define DS_EVENT_FAULT					0x01
+#define DS_EVENT_FAULT_LEN				9
+
+#define DS_FAULT_UNDERVOLTAGE			0x01
+#define DS_FAULT_OVERVOLTAGE			0x02
+
+/* DiSEqC message, switch sequence or tone gate is completed, tone signal is restored */
+/* Payload: channel 1/2 (1), timestamp, us (4) */
+#define DS_EVENT_DISEQC_TX_DONE			0x02
+#define DS_EVENT_DISEQC_TX_DONE_LEN		5
+
+/* DiSEqC message is received */
+/* Payload: timestamp of the first bit, us (4), channel 1/2 (1), DS_DISEQC_RX_* flags (1), message bytes (1 - 8) */
+#define DS_EVENT_DISEQC_RX				0x03
+#define DS_EVENT_DISEQC_RX_HEADER_LEN	6
+
+#define DS_DISEQC_RX_PARITY_ERROR		0x01
+#define DS_DISEQC_RX_INCOMPLETE			0x02
+#define DS_DISEQC_RX_REPLY				0x04	/* Received in the reply window */
+#define DS_DISEQC_RX_OVERRUN			0x08	/* Previous message is lost */
+
+/* Unicable channel change is completed */
+/* Payload: channel 1/2 (1), timestamp of the last frame end, us (4), DS_UNICABLE_* status (1), */
+/* transmitted frames (1), backoffs on the busy line (1) */
+#define DS_EVENT_UNICABLE_DONE			0x04
+#define DS_EVENT_UNICABLE_DONE_LEN		8
+
+#define DS_UNICABLE_OK					0x00
+#define DS_UNICABLE_BUS_BUSY			0x01	/* Line is not free, nothing is sent */
+
+/* Scheduled command is executed */
+/* Payload: entry index (1), command (1), argument (1), planned time, us (4), actual time, us (4) */
+#define DS_EVENT_SCHEDULE_EXEC			0x05
+#define DS_EVENT_SCHEDULE_EXEC_LEN		11
+
+/* Output voltage is settled after the host or schedule change of the voltage or power supply */
+/* Payload: channel 1/2 (1), DS_SETTLE_* status (1), DS_OUT_VOLTAGE_MODE_* target or 0 - power supply off (1), */
+/* timestamp of the change, us (4), settle time, us (4), last ADC input voltage, 0.1 mV (2) */
+#define DS_EVENT_SWITCH_DONE			0x06
+#define DS_EVENT_SWITCH_DONE_LEN		13
+
+#define DS_SETTLE_OK					0x00
+#define DS_SETTLE_TIMEOUT				0x01	/* Not settled within 500 ms */
+
+/* Raw ADC samples block of the scope mode, one per 16 samples of the channel */
+/* Payload: sequence number (2), DS_SCOPE_CH* mask (1), timestamp of the last sample, us (4), */
+/* 16 samples of the channel or 16 pairs of CH1, CH2 if both are enabled. Samples are 12 bit ADC codes */
+/* packed by two in 3 bytes: first[11:4], first[3:0] << 4 | second[11:8], second[7:0] */
+/* Sequence number is incremented for every block, a gap means the blocks lost on the full TX queue */
+#define DS_EVENT_SCOPE_BLOCK			0x07
+#define DS_EVENT_SCOPE_HEADER_LEN		7
+
+#define DS_SCOPE_BLOCK_SAMPLES			16
+
+/* Extended write commands */
+/* DiSEqC 1.x message, payload: channel 1/2 (1), message bytes (1 - 6) */
+/* Only one message at a time is transmitted, any channel */
+#define DS_EXT_CMD_DISEQC_SEND			0x01
+
+/* Switch sequence timed by the device: voltage change, 15 ms, message, 15 ms, tone burst, 15 ms, tone */
+/* Payload: channel 1/2 (1), DS_OUT_VOLTAGE_MODE_* or 0 - unchanged (1), DS_TONE_BURST_* (1), */
+/* DS_OUT_TONE_SIGNAL_* (1), optional DiSEqC message bytes (0 - 6) */
+#define DS_EXT_CMD_DISEQC_SEQUENCE		0x02
+
+#define DS_TONE_BURST_NONE				0x00
+#define DS_TONE_BURST_A					0x01
+#define DS_TONE_BURST_B					0x02
+
+/* Tone on for the exact time, payload: channel 1/2 (1), duration in 0.1 ms units (2) */
+#define DS_EXT_CMD_TONE_GATE			0x03
+
+/* Unicable (EN50494/EN50607) ODU command with the collision avoidance */
+/* Frame is 18V, 5 ms, message, 2 ms and the previous voltage. It's sent when the line is free */
+/* and repeated after the random delays. Completion is reported by DS_EVENT_UNICABLE_DONE */
+/* Payload: channel 1/2 (1), number of repeats 0 - 7 (1), message bytes (1 - 6) */
+#define DS_EXT_CMD_UNICABLE				0x04
+
+#define DS_UNICABLE_MAX_REPEATS			7
+
+/* Append the entries to the commands schedule, it's rejected while the schedule is running */
+/* Payload: 1 - 9 entries of: offset from the start, us (4), write command (1), ARG1 (1) */
+/* Only the outputs control commands: POWER_SUPPLY_CONTROL, DS_CMD_TYPE_OUT_* */
+/* Offsets must not decrease. The whole schedule is dropped on the invalid entry */
+#define DS_EXT_CMD_SCHEDULE_LOAD		0x05
+
+#define DS_SCHEDULE_ENTRY_LEN			6
+
+/* Start the loaded schedule, it can be started again after all the entries are reported */
+/* Payload: DS_SCHEDULE_START_* (1), time, us (4). Every entry is reported by DS_EVENT_SCHEDULE_EXEC */
+#define DS_EXT_CMD_SCHEDULE_START		0x06
+
+#define DS_SCHEDULE_START_DELAY			0x00	/* Delay from now */
+#define DS_SCHEDULE_START_ABSOLUTE		0x01	/* Device time, see the event timestamps */
+
+/* Stop and drop the schedule, no payload */
+#define DS_EXT_CMD_SCHEDULE_CLEAR		0x07
+
+/* Power supply and both channels outputs at once, switched together on the 22KHz period boundary */
+/* Payload: POWER_SUPPLY_* (1), channel 1 DS_OUT_VOLTAGE_MODE_* (1), channel 1 DS_OUT_TONE_SIGNAL_* (1), */
+/* channel 2 DS_OUT_VOLTAGE_MODE_* (1), channel 2 DS_OUT_TONE_SIGNAL_* (1) */
+#define DS_EXT_CMD_APPLY_STATE			0x08
+
+#define DS_APPLY_STATE_LEN				5
+
+/* Scope mode, raw ADC samples are streamed with DS_EVENT_SCOPE_BLOCK */
+/* Payload: DS_SCOPE_CH* mask, 0 - stop (1), sample rate, Hz (4) */
+/* Actual rate is DS_SCOPE_TIMER_CLOCK_HZ / round(DS_SCOPE_TIMER_CLOCK_HZ / rate), */
+/* the normal 20 KHz is restored on stop. Averaged readings and statistics windows */
+/* are counted in samples, so they are scaled with the rate while the scope is running */
+#define DS_EXT_CMD_SCOPE				0x09
+
+#define DS_SCOPE_CH1					0x01
+#define DS_SCOPE_CH2					0x02
+
+/* Both channels at 50 KHz are 3125 blocks or 190 KB/s, USB FS bulk sustains it with */
+/* the room for the responses and the other events */
+#define DS_SCOPE_RATE_MIN_HZ			1000
+#define DS_SCOPE_RATE_MAX_HZ			50000
+#define DS_SCOPE_TIMER_CLOCK_HZ			24000000
+
+/* Extended write NAK codes */
+#define DS_NAK_BUSY						0xEB
+#define DS_NAK_INVALID					0xEE
 
 /* */
 
@@ -107,6 +107,8 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
 
+void CDC_Resume_Receive_FS(void);
+
 /* USER CODE END EXPORTED_FUNCTIONS */
 
 /**
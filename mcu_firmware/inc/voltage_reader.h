@@ -1,6 +1,6 @@
 /*
    voltage_reader.h
-    - Simple output voltages reader with ADC1 and DMA
+    - Output voltages reader with ADC1 and ADC2, DMA and averaging
 
    Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
 
@@ -21,9 +21,82 @@
 #ifndef VOLTAGE_READER_H
 #define VOLTAGE_READER_H
 
+#include <stdint.h>
+
+/* Averaging window limits, log2 of the samples count per channel */
+/* Minimal window is a half of the DMA buffer (16 samples) */
+#define ADC_AVG_WINDOW_MIN		4
+#define ADC_AVG_WINDOW_MAX		12
+#define ADC_AVG_WINDOW_DEFAULT	8
+
+/* Conversions of the both channels are triggered by TIM3 with this rate */
+#define ADC_SAMPLE_RATE_HZ	20000
+
+/* Samples per channel in the half of the DMA buffer */
+#define ADC_BLOCK_SAMPLES	16
+
+/* Ripple statistics values */
+#define ADC_STATS_MIN	0x0
+#define ADC_STATS_MAX	0x1
+#define ADC_STATS_MEAN	0x2
+#define ADC_STATS_RMS	0x3
+
 void init_voltage_reader(void);
 
+/* Reads never block and return the last completed sample */
+/* CH1 read takes a new sample, the following CH2 read returns the pair of it */
+
+/* Averaged ADC input voltage, mV */
 uint16_t get_ch1_voltage(void);
 uint16_t get_ch2_voltage(void);
 
+/* Averaged ADC input voltage, 0.1 mV */
+uint16_t get_ch1_voltage_hires(void);
+uint16_t get_ch2_voltage_hires(void);
+
+/* Number of the completed samples (averaging windows) since start */
+uint32_t get_sample_counter(void);
+
+/* Ripple statistics of the last 4096 samples window, 0.1 mV */
+/* Channel is 0 or 1, stat is ADC_STATS_* */
+/* ADC_STATS_MIN takes a new window, others return values of the same window */
+uint16_t get_voltage_stats(uint8_t channel, uint8_t stat);
+
+/* Analog watchdog of the both channels, thresholds are 0.1 mV */
+/* Callback is called once from the ADC interrupt with 0-based channel and value, 0.1 mV */
+typedef void (*adc_watchdog_trip_cb)(uint8_t channel, uint16_t value);
+
+void adc_watchdog_arm(uint16_t low, uint16_t high, adc_watchdog_trip_cb trip_cb);
+void adc_watchdog_disarm(void);
+
+/* Block monitor, called from the DMA interrupt with the mean of every 16 samples (0.8 ms) */
+/* values are both channels ADC input voltages, 0.1 mV. NULL - disabled */
+typedef void (*adc_block_cb)(const uint16_t *values);
+
+void adc_block_monitor_set(adc_block_cb block_cb);
+
+/* Raw samples monitor, called from the DMA interrupt with every half of the buffer */
+/* data is ADC_BLOCK_SAMPLES pairs of the CH1 and CH2 12 bit codes, valid only during the call */
+typedef void (*adc_raw_cb)(const volatile uint16_t *data);
+
+void adc_raw_monitor_set(adc_raw_cb raw_cb);
+
+/* Conversions rate of the both channels, returns the actual one: 24 MHz / round(24 MHz / rate_hz) */
+/* Averaging, statistics and block monitor are counted in samples, so their time follows the rate */
+/* Both channels are converted simultaneously by ADC1 and ADC2: 71.5 + 12.5 cycles of 12 MHz */
+/* ADC clock is 7 us, so the rate must not exceed ~140 KHz */
+uint32_t adc_set_sample_rate(uint32_t rate_hz);
+
+/* 22KHz tone level of the channel, see get_tone_level() */
+#define ADC_TONE_LEVEL_INVALID	0xFFFF
+
+/* Peak-to-peak of the 22KHz fundamental over the last 2048 samples, 0.1 mV of the ADC input */
+/* Lock-in detection synchronous to the tone timer. Returns ADC_TONE_LEVEL_INVALID when the tone */
+/* is aliased too close to DC or to the Nyquist frequency at the current sample rate */
+uint16_t get_tone_level(uint8_t channel);
+
+/* Averaging window, applied on the next window boundary */
+void set_avg_window(uint8_t log2_samples);
+uint8_t get_avg_window(void);
+
 #endif
@@ -0,0 +1,73 @@
+/*
+   boot_time.c
+    - Boot stages timestamps with the DWT cycle counter
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ DWT cycle counter runs from the main() entry, the time before it (startup code) is not
+ counted. CPU runs from the 8 MHz HSI until the PLL is selected at the end of the clocks
+ stage, so this stage is counted at the HSI rate and the others at SystemCoreClock.
+ All the stages after the clocks one are computed from the constants, so the mark is
+ safe in the interrupts. Counter wraps in 89 s at 48 MHz, the late USB configuration
+ stage is valid only within this time.
+ */
+
+#include "stm32f1xx_hal.h"
+#include "boot_time.h"
+
+static volatile uint32_t stage_us[BOOT_STAGE_COUNT];
+
+/* End of the clocks stage */
+static uint32_t base_cycles = 0;
+static uint32_t base_us = 0;
+
+void boot_time_start(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < BOOT_STAGE_COUNT; ++i) {
+		stage_us[i] = BOOT_TIME_NOT_REACHED;
+	}
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void boot_time_mark(uint8_t stage)
+{
+	uint32_t cycles = DWT->CYCCNT;
+
+	if (stage >= BOOT_STAGE_COUNT || stage_us[stage] != BOOT_TIME_NOT_REACHED) {
+		return;
+	}
+
+	if (stage == BOOT_STAGE_CLOCKS) {
+		base_cycles = cycles;
+		base_us = cycles / (HSI_VALUE / 1000000);
+		stage_us[stage] = base_us;
+		return;
+	}
+
+	stage_us[stage] = base_us + (cycles - base_cycles) / (SystemCoreClock / 1000000);
+}
+
+uint32_t boot_time_get_us(uint8_t stage)
+{
+	return stage < BOOT_STAGE_COUNT ? stage_us[stage] : BOOT_TIME_NOT_REACHED;
+}
@@ -24,8 +24,11 @@
 #include "stm32f1xx_ll_gpio.h"
 #include "stm32f1xx_ll_tim.h"
 #include "diseqc.h"
+#include "diseqc_tx.h"
 #include "leds.h"
+#include "systime.h"
 #include "device_state.h"
+#include "state_store.h"
 
 #define OUT_VOLTAGE_MODE_13V	0x0D /* 13v is Vertical/Right */
 #define OUT_VOLTAGE_MODE_18V	0x12 /* 18v is Horizontal/Left */
@@ -39,10 +42,41 @@
 #define PS_CTRL_PIN LL_GPIO_PIN_4
 #define PS_CTRL_PORT GPIOA
 
+/* BSRR bits of the LL pin */
+#define GPIO_BSRR_SET(pin)		(((pin) >> GPIO_PIN_MASK_POS) & 0xFFFFU)
+#define GPIO_BSRR_RESET(pin)	(GPIO_BSRR_SET(pin) << 16)
+
+/* Update is every 45 us, this is just a guard against the stopped timer */
+#define APPLY_STATE_TIMEOUT_US 200
+
+/* Outputs state prepared for the TIM2 update interrupt */
+static volatile uint8_t apply_pending = 0;
+static uint32_t apply_gpiob_bsrr;
+static uint32_t apply_gpioa_bsrr;
+static uint32_t apply_ccer_set;
+static uint32_t apply_ccer_mask;
+
 /* Storage for the current device configuration */
 /* Useful for the control and possible reconnects of the desktop soft */
 static struct controller_state ctrl_state_storage;
 
+/* Setters are called from the main loop and from the scheduler and DiSEqC TX interrupts */
+/* State storage bitfields, LEDs and TIM2 CCER are read-modify-write, so the interrupts */
+/* are masked for the update, it's a few dozens of cycles */
+static uint32_t state_lock(void)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+
+	return primask;
+}
+
+static void state_unlock(uint32_t primask)
+{
+	__set_PRIMASK(primask);
+}
+
 /* Init TIM2 for 22KHz square wave */
 /* This timer is used for the both channels */
 static void init_22KHz_timer(void)
@@ -58,7 +92,7 @@ static void init_22KHz_timer(void)
 	/* Configuration of the timer and channels  */
 	TIM_InitStruct.Prescaler = 0;
 	TIM_InitStruct.CounterMode = LL_TIM_COUNTERMODE_UP;
-	TIM_InitStruct.Autoreload = 1085;
+	TIM_InitStruct.Autoreload = TONE_TIMER_PERIOD - 1;
 	TIM_InitStruct.ClockDivision = LL_TIM_CLOCKDIVISION_DIV1;
 	LL_TIM_Init(TIM2, &TIM_InitStruct);
 	LL_TIM_DisableARRPreload(TIM2);
@@ -86,7 +120,9 @@ static void init_22KHz_timer(void)
 	GPIO_InitStruct.OutputType = LL_GPIO_OUTPUT_PUSHPULL;
 	LL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
-	LL_TIM_EnableIT_UPDATE(TIM2);
+	/* Update interrupt is enabled only to apply the outputs state */
+	NVIC_SetPriority(TIM2_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+	NVIC_EnableIRQ(TIM2_IRQn);
 
 	LL_TIM_EnableCounter(TIM2);
 }
@@ -131,15 +167,28 @@ static void init_diseqc_gpio(void)
 /* Set channel 1 22KHz tone mode (enabled/disabled) */
 void diseq_set_ch1_tone_signal_mode(uint8_t enabled)
 {
+	uint32_t primask = state_lock();
+
+	/* Line is busy with the DiSEqC message, new mode is applied after it */
+	uint8_t tx_active = diseqc_tx_active(DISEQC_TX_CHANNEL_1);
+
 	if (enabled) {
-		LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH1);
+		if (!tx_active) {
+			LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH1);
+		}
+
 		led22khz_ch1_tone_on();
 		ctrl_state_storage.ch1_tone_enabled = 1;
 	} else {
-		LL_TIM_CC_DisableChannel(TIM2, LL_TIM_CHANNEL_CH1);
+		if (!tx_active) {
+			LL_TIM_CC_DisableChannel(TIM2, LL_TIM_CHANNEL_CH1);
+		}
+
 		led22khz_ch1_tone_off();
 		ctrl_state_storage.ch1_tone_enabled = 0;
 	}
+
+	state_unlock(primask);
 }
 
 /* Get the current saved state of the Channel 1 tone mode */
@@ -151,15 +200,28 @@ uint8_t diseq_get_ch1_tone_signal_mode(void)
 /* Set channel 2 22KHz tone mode (enabled/disabled) */
 void diseq_set_ch2_tone_signal_mode(uint8_t enabled)
 {
+	uint32_t primask = state_lock();
+
+	/* Line is busy with the DiSEqC message, new mode is applied after it */
+	uint8_t tx_active = diseqc_tx_active(DISEQC_TX_CHANNEL_2);
+
 	if (enabled) {
-		LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH2);
+		if (!tx_active) {
+			LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH2);
+		}
+
 		led22khz_ch2_tone_on();
 		ctrl_state_storage.ch2_tone_enabled = 1;
 	} else {
-		LL_TIM_CC_DisableChannel(TIM2, LL_TIM_CHANNEL_CH2);
+		if (!tx_active) {
+			LL_TIM_CC_DisableChannel(TIM2, LL_TIM_CHANNEL_CH2);
+		}
+
 		led22khz_ch2_tone_off();
 		ctrl_state_storage.ch2_tone_enabled = 0;
 	}
+
+	state_unlock(primask);
 }
 
 /* Get the current saved state of the Channel 2 tone mode */
@@ -171,6 +233,8 @@ uint8_t diseq_get_ch2_tone_signal_mode(void)
 /* Set power supply mode (enabled/disabled) */
 void diseqc_set_ps_mode(uint8_t enabled)
 {
+	uint32_t primask = state_lock();
+
 	if (enabled) {
 		LL_GPIO_SetOutputPin(PS_CTRL_PORT, PS_CTRL_PIN);
 		ctrl_state_storage.ps_enabled = 1;
@@ -178,6 +242,16 @@ void diseqc_set_ps_mode(uint8_t enabled)
 		LL_GPIO_ResetOutputPin(PS_CTRL_PORT, PS_CTRL_PIN);
 		ctrl_state_storage.ps_enabled = 0;
 	}
+
+	state_unlock(primask);
+}
+
+/* Switch off the power supply immediately */
+/* Called from the interrupt, so the state storage is not touched here */
+/* Main loop must call diseqc_set_ps_mode() after that */
+void diseqc_ps_emergency_off(void)
+{
+	LL_GPIO_ResetOutputPin(PS_CTRL_PORT, PS_CTRL_PIN);
 }
 
 /* Get the current saved state of the power supply */
@@ -189,6 +263,8 @@ uint8_t diseqc_get_ps_mode(void)
 /* Set the channel 1 output voltage (13v/18v) */
 void diseqc_set_ch1_out_voltage(uint8_t voltage_val)
 {
+	uint32_t primask = state_lock();
+
 	if (voltage_val == OUT_VOLTAGE_MODE_13V) {
 		LL_GPIO_SetOutputPin(CH1_VOLTAGE_CTRL_PORT, CH1_VOLTAGE_CTRL_PIN);
 		led18v_ch1_off();
@@ -200,6 +276,8 @@ void diseqc_set_ch1_out_voltage(uint8_t voltage_val)
 		led18v_ch1_on();
 		ctrl_state_storage.ch1_out_voltage_high = 1;
 	}
+
+	state_unlock(primask);
 }
 
 /* Get the current output voltage state of the channel 1 */
@@ -211,6 +289,8 @@ uint8_t diseqc_get_ch1_out_voltage(void)
 /* Set the channel 2 output voltage (13v/18v) */
 void diseqc_set_ch2_out_voltage(uint8_t voltage_val)
 {
+	uint32_t primask = state_lock();
+
 	if (voltage_val == OUT_VOLTAGE_MODE_13V) {
 		LL_GPIO_SetOutputPin(CH2_VOLTAGE_CTRL_PORT, CH2_VOLTAGE_CTRL_PIN);
 		led18v_ch2_off();
@@ -222,6 +302,8 @@ void diseqc_set_ch2_out_voltage(uint8_t voltage_val)
 		led18v_ch2_on();
 		ctrl_state_storage.ch2_out_voltage_high = 1;
 	}
+
+	state_unlock(primask);
 }
 
 /* Get the current output voltage state of the channel 2 */
@@ -230,6 +312,99 @@ uint8_t diseqc_get_ch2_out_voltage(void)
 	return ctrl_state_storage.ch2_out_voltage_high;
 }
 
+/* Prepare all the registers values, so the interrupt only writes them */
+void diseqc_apply_state(uint8_t ps_enabled, uint8_t ch1_voltage, uint8_t ch1_tone,
+						uint8_t ch2_voltage, uint8_t ch2_tone)
+{
+	uint32_t start = systime_us();
+
+	/* Voltage control pin is high for 13v */
+	apply_gpiob_bsrr = (ch1_voltage == OUT_VOLTAGE_MODE_13V)
+							? GPIO_BSRR_SET(CH1_VOLTAGE_CTRL_PIN)
+							: GPIO_BSRR_RESET(CH1_VOLTAGE_CTRL_PIN);
+
+	apply_gpiob_bsrr |= (ch2_voltage == OUT_VOLTAGE_MODE_13V)
+							? GPIO_BSRR_SET(CH2_VOLTAGE_CTRL_PIN)
+							: GPIO_BSRR_RESET(CH2_VOLTAGE_CTRL_PIN);
+
+	apply_gpioa_bsrr = ps_enabled ? GPIO_BSRR_SET(PS_CTRL_PIN) : GPIO_BSRR_RESET(PS_CTRL_PIN);
+
+	/* Tone of the channel with DiSEqC transmission is applied by the transmitter */
+	apply_ccer_mask = 0;
+	apply_ccer_set = 0;
+
+	if (!diseqc_tx_active(DISEQC_TX_CHANNEL_1)) {
+		apply_ccer_mask |= TIM_CCER_CC1E;
+		apply_ccer_set |= ch1_tone ? TIM_CCER_CC1E : 0;
+	}
+
+	if (!diseqc_tx_active(DISEQC_TX_CHANNEL_2)) {
+		apply_ccer_mask |= TIM_CCER_CC2E;
+		apply_ccer_set |= ch2_tone ? TIM_CCER_CC2E : 0;
+	}
+
+	apply_pending = 1;
+	LL_TIM_ClearFlag_UPDATE(TIM2);
+	LL_TIM_EnableIT_UPDATE(TIM2);
+
+	while (apply_pending && systime_us() - start < APPLY_STATE_TIMEOUT_US) {
+	}
+
+	/* Timer is not running, apply right now */
+	if (apply_pending) {
+		diseqc_apply_state_cb();
+	}
+
+	/* Outputs are already in the new state, the setters write the same values */
+	/* and update the storage and the LEDs */
+	diseqc_set_ps_mode(ps_enabled);
+	diseqc_set_ch1_out_voltage(ch1_voltage);
+	diseqc_set_ch2_out_voltage(ch2_voltage);
+	diseq_set_ch1_tone_signal_mode(ch1_tone);
+	diseq_set_ch2_tone_signal_mode(ch2_tone);
+}
+
+void diseqc_apply_state_cb(void)
+{
+	LL_TIM_DisableIT_UPDATE(TIM2);
+
+	if (!apply_pending) {
+		return;
+	}
+
+	/* Both channels voltages are one write, the power supply is on the other port */
+	WRITE_REG(CH1_VOLTAGE_CTRL_PORT->BSRR, apply_gpiob_bsrr);
+	WRITE_REG(PS_CTRL_PORT->BSRR, apply_gpioa_bsrr);
+	MODIFY_REG(TIM2->CCER, apply_ccer_mask, apply_ccer_set);
+
+	apply_pending = 0;
+}
+
+/* Saved outputs, only the fields enabled by the restore mask are set */
+static void restore_outputs(uint8_t outputs)
+{
+	if (outputs & STATE_STORE_CH1_18V) {
+		diseqc_set_ch1_out_voltage(OUT_VOLTAGE_MODE_18V);
+	}
+
+	if (outputs & STATE_STORE_CH2_18V) {
+		diseqc_set_ch2_out_voltage(OUT_VOLTAGE_MODE_18V);
+	}
+
+	if (outputs & STATE_STORE_CH1_TONE) {
+		diseq_set_ch1_tone_signal_mode(1);
+	}
+
+	if (outputs & STATE_STORE_CH2_TONE) {
+		diseq_set_ch2_tone_signal_mode(1);
+	}
+
+	/* Power supply is the last, the outputs are already configured */
+	if (outputs & STATE_STORE_PS) {
+		diseqc_set_ps_mode(1);
+	}
+}
+
 /* Entry point of the module */
 void init_diseqc(void)
 {
@@ -256,4 +431,7 @@ void init_diseqc(void)
 
 	led18v_ch2_off();
 	led13v_ch2_on();
+
+	/* State before the reset, see init_state_store() */
+	restore_outputs(state_store_get_restored());
 }
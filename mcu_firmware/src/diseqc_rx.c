@@ -0,0 +1,380 @@
+/*
+   diseqc_rx.c
+    - DiSEqC 2.x replies receiver and bus monitor
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ 22 kHz signal of the channel line is converted to the logic level
+ by the external comparator (tone detector) and connected to:
+	PA8 - TIM1_CH1, channel 1
+	PA9 - TIM1_CH2, channel 2
+
+ Every rising edge is captured by TIM1, which is also the 1 MHz system time,
+ and the capture value is written by DMA into the ring. No interrupts are used.
+
+ Main loop groups the edges into the tone pulses and decodes the pulse length:
+	~1.0 ms - '0', ~0.5 ms - '1'
+ 9 bits (8 data MSB first and odd parity) make a byte,
+ silence longer than two bit periods ends the message.
+ */
+
+#include <string.h>
+#include "stm32f1xx_ll_bus.h"
+#include "stm32f1xx_ll_gpio.h"
+#include "stm32f1xx_ll_tim.h"
+#include "stm32f1xx_ll_dma.h"
+#include "diseqc.h"
+#include "diseqc_rx.h"
+#include "diseqc_tx.h"
+#include "systime.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+/* 256 edges is ~11.6 ms of the continuous tone */
+#define DISEQC_RX_RING_LEN 256
+
+/* 22 kHz period, with margin for the edges lost by the detector */
+#define DISEQC_RX_TONE_PERIOD_US	45
+#define DISEQC_RX_EDGE_GAP_US		100
+
+/* Pulse length limits, nominal 0.5 and 1.0 ms, +-0.2 ms tolerance */
+#define DISEQC_RX_PULSE_MIN_US		250
+#define DISEQC_RX_BIT_SPLIT_US		750
+#define DISEQC_RX_PULSE_MAX_US		1250
+
+/* Two bit periods of silence */
+#define DISEQC_RX_FRAME_GAP_US		3000
+
+#define DISEQC_RX_BITS_PER_BYTE 9
+
+struct rx_channel {
+	uint16_t ring[DISEQC_RX_RING_LEN];
+	uint32_t dma_channel;
+	uint8_t id;	/* DISEQC_TX_CHANNEL_* */
+	uint16_t tail;
+
+	/* Any foreign edge, used for the bus collision avoidance */
+	uint8_t activity_seen;
+	uint32_t last_activity;
+
+	/* Current tone pulse */
+	uint8_t in_pulse;
+	uint32_t pulse_start;
+	uint32_t last_edge;
+
+	/* Current message */
+	uint32_t msg_start;
+	uint32_t msg_last;
+	uint16_t shift;
+	uint8_t bits;
+	uint8_t len;
+	uint8_t flags;
+	uint8_t data[DISEQC_RX_MAX_MSG_LEN];
+
+	/* Reply window after our own message */
+	uint8_t was_sending;
+	uint8_t reply_window;
+	uint32_t reply_until;
+};
+
+static struct rx_channel rx_channels[2];
+static uint8_t rx_mode = DISEQC_RX_OFF;
+
+/* Message is lost because TX queue was full */
+static uint8_t rx_overrun = 0;
+
+static void rx_msg_reset(struct rx_channel *rx)
+{
+	rx->shift = 0;
+	rx->bits = 0;
+	rx->len = 0;
+	rx->flags = 0;
+}
+
+static void rx_msg_end(struct rx_channel *rx)
+{
+	uint8_t event[DS_EVENT_DISEQC_RX_HEADER_LEN + DISEQC_RX_MAX_MSG_LEN];
+
+	if (rx->bits) {
+		rx->flags |= DS_DISEQC_RX_INCOMPLETE;
+	}
+
+	if (!rx->len || (rx_mode == DISEQC_RX_REPLY && !(rx->flags & DS_DISEQC_RX_REPLY))) {
+		rx_msg_reset(rx);
+		return;
+	}
+
+	if (rx_overrun) {
+		rx->flags |= DS_DISEQC_RX_OVERRUN;
+	}
+
+	event[0] = rx->msg_start >> 24;
+	event[1] = rx->msg_start >> 16;
+	event[2] = rx->msg_start >> 8;
+	event[3] = rx->msg_start;
+	event[4] = rx->id;
+	event[5] = rx->flags;
+	memcpy(event + DS_EVENT_DISEQC_RX_HEADER_LEN, rx->data, rx->len);
+
+	rx_overrun = !send_event(DS_EVENT_DISEQC_RX, event, DS_EVENT_DISEQC_RX_HEADER_LEN + rx->len);
+
+	rx_msg_reset(rx);
+}
+
+static void rx_pulse_end(struct rx_channel *rx)
+{
+	uint32_t duration = rx->last_edge - rx->pulse_start + DISEQC_RX_TONE_PERIOD_US;
+	uint8_t ones, i;
+
+	rx->in_pulse = 0;
+
+	/* Noise */
+	if (duration < DISEQC_RX_PULSE_MIN_US) {
+		return;
+	}
+
+	/* Continuous tone or tone burst, not a message */
+	if (duration > DISEQC_RX_PULSE_MAX_US) {
+		if (rx->len || rx->bits) {
+			rx->flags |= DS_DISEQC_RX_INCOMPLETE;
+			rx_msg_end(rx);
+		}
+
+		rx_msg_reset(rx);
+		return;
+	}
+
+	if (!rx->len && !rx->bits) {
+		rx->msg_start = rx->pulse_start;
+
+		if (rx->reply_window) {
+			rx->flags |= DS_DISEQC_RX_REPLY;
+		}
+	}
+
+	rx->msg_last = rx->last_edge;
+	rx->shift = (rx->shift << 1) | (duration < DISEQC_RX_BIT_SPLIT_US);
+
+	if (++rx->bits < DISEQC_RX_BITS_PER_BYTE) {
+		return;
+	}
+
+	/* Data and parity bits together must have odd number of ones */
+	for (i = 0, ones = 0; i < DISEQC_RX_BITS_PER_BYTE; ++i) {
+		ones += (rx->shift >> i) & 0x1;
+	}
+
+	if (!(ones & 0x1)) {
+		rx->flags |= DS_DISEQC_RX_PARITY_ERROR;
+	}
+
+	if (rx->len < DISEQC_RX_MAX_MSG_LEN) {
+		rx->data[rx->len++] = rx->shift >> 1;
+	} else {
+		rx->flags |= DS_DISEQC_RX_INCOMPLETE;
+	}
+
+	rx->shift = 0;
+	rx->bits = 0;
+}
+
+static void rx_edge(struct rx_channel *rx, uint32_t ts)
+{
+	if (rx->in_pulse) {
+		if (ts - rx->last_edge <= DISEQC_RX_EDGE_GAP_US) {
+			rx->last_edge = ts;
+			return;
+		}
+
+		rx_pulse_end(rx);
+	}
+
+	if ((rx->len || rx->bits) && ts - rx->msg_last > DISEQC_RX_FRAME_GAP_US) {
+		rx_msg_end(rx);
+	}
+
+	rx->in_pulse = 1;
+	rx->pulse_start = ts;
+	rx->last_edge = ts;
+}
+
+static void rx_channel_poll(struct rx_channel *rx)
+{
+	uint16_t head = DISEQC_RX_RING_LEN - LL_DMA_GetDataLength(DMA1, rx->dma_channel);
+	uint32_t now = systime_us();
+	uint8_t sending = diseqc_tx_sending(rx->id);
+	uint16_t capture;
+
+	if (head >= DISEQC_RX_RING_LEN) {
+		head = 0;
+	}
+
+	if (rx->was_sending && !sending) {
+		rx->reply_window = 1;
+		rx->reply_until = now + DISEQC_REPLY_WINDOW_US;
+	}
+
+	rx->was_sending = sending;
+
+	if (!sending && rx->tail != head) {
+		rx->activity_seen = 1;
+		rx->last_activity = now;
+	}
+
+	/* Our own message is captured too, skip it */
+	if (sending || (rx_mode == DISEQC_RX_REPLY && !rx->reply_window)) {
+		rx->tail = head;
+		rx->in_pulse = 0;
+		rx_msg_reset(rx);
+		return;
+	}
+
+	/* Captures are older than now, but no more than the 16 bit timer period */
+	while (rx->tail != head) {
+		capture = rx->ring[rx->tail];
+		rx->tail = (rx->tail + 1) % DISEQC_RX_RING_LEN;
+
+		rx_edge(rx, now - (uint16_t) ((uint16_t) now - capture));
+	}
+
+	if (rx->in_pulse && now - rx->last_edge > DISEQC_RX_EDGE_GAP_US) {
+		rx_pulse_end(rx);
+	}
+
+	if (!rx->in_pulse && (rx->len || rx->bits) && now - rx->msg_last > DISEQC_RX_FRAME_GAP_US) {
+		rx_msg_end(rx);
+	}
+
+	/* Reply has started in the window, let it finish */
+	if (rx->reply_window && (int32_t) (now - rx->reply_until) > 0 && !rx->in_pulse
+			&& !rx->len && !rx->bits) {
+		rx->reply_window = 0;
+	}
+}
+
+static void init_capture_dma(struct rx_channel *rx, uint32_t periph_addr)
+{
+	LL_DMA_SetDataTransferDirection(DMA1, rx->dma_channel, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+	LL_DMA_SetChannelPriorityLevel(DMA1, rx->dma_channel, LL_DMA_PRIORITY_MEDIUM);
+	LL_DMA_SetMode(DMA1, rx->dma_channel, LL_DMA_MODE_CIRCULAR);
+	LL_DMA_SetPeriphIncMode(DMA1, rx->dma_channel, LL_DMA_PERIPH_NOINCREMENT);
+	LL_DMA_SetMemoryIncMode(DMA1, rx->dma_channel, LL_DMA_MEMORY_INCREMENT);
+	LL_DMA_SetPeriphSize(DMA1, rx->dma_channel, LL_DMA_PDATAALIGN_HALFWORD);
+	LL_DMA_SetMemorySize(DMA1, rx->dma_channel, LL_DMA_MDATAALIGN_HALFWORD);
+	LL_DMA_ConfigAddresses(DMA1, rx->dma_channel, periph_addr, (uint32_t) rx->ring,
+							LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+	LL_DMA_SetDataLength(DMA1, rx->dma_channel, DISEQC_RX_RING_LEN);
+}
+
+void init_diseqc_rx(void)
+{
+	LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_GPIOA);
+	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+
+	/* Tone detector is optional, pull-down keeps the unconnected inputs quiet */
+	GPIO_InitStruct.Pin = LL_GPIO_PIN_8 | LL_GPIO_PIN_9;
+	GPIO_InitStruct.Mode = LL_GPIO_MODE_INPUT;
+	GPIO_InitStruct.Pull = LL_GPIO_PULL_DOWN;
+	LL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+	/* Rising edge capture, filtered against the comparator chatter */
+	LL_TIM_IC_SetActiveInput(TIM1, LL_TIM_CHANNEL_CH1, LL_TIM_ACTIVEINPUT_DIRECTTI);
+	LL_TIM_IC_SetPrescaler(TIM1, LL_TIM_CHANNEL_CH1, LL_TIM_ICPSC_DIV1);
+	LL_TIM_IC_SetFilter(TIM1, LL_TIM_CHANNEL_CH1, LL_TIM_IC_FILTER_FDIV1_N8);
+	LL_TIM_IC_SetPolarity(TIM1, LL_TIM_CHANNEL_CH1, LL_TIM_IC_POLARITY_RISING);
+
+	LL_TIM_IC_SetActiveInput(TIM1, LL_TIM_CHANNEL_CH2, LL_TIM_ACTIVEINPUT_DIRECTTI);
+	LL_TIM_IC_SetPrescaler(TIM1, LL_TIM_CHANNEL_CH2, LL_TIM_ICPSC_DIV1);
+	LL_TIM_IC_SetFilter(TIM1, LL_TIM_CHANNEL_CH2, LL_TIM_IC_FILTER_FDIV1_N8);
+	LL_TIM_IC_SetPolarity(TIM1, LL_TIM_CHANNEL_CH2, LL_TIM_IC_POLARITY_RISING);
+
+	/* TIM1_CH1 and TIM1_CH2 DMA requests are connected to the DMA1 channels 2 and 3 */
+	rx_channels[0].id = DISEQC_TX_CHANNEL_1;
+	rx_channels[0].dma_channel = LL_DMA_CHANNEL_2;
+	init_capture_dma(&rx_channels[0], (uint32_t) &TIM1->CCR1);
+
+	rx_channels[1].id = DISEQC_TX_CHANNEL_2;
+	rx_channels[1].dma_channel = LL_DMA_CHANNEL_3;
+	init_capture_dma(&rx_channels[1], (uint32_t) &TIM1->CCR2);
+
+	LL_TIM_EnableDMAReq_CC1(TIM1);
+	LL_TIM_EnableDMAReq_CC2(TIM1);
+
+	/* Receiver is enabled by the host, only if the tone detector is installed */
+	diseqc_rx_set_mode(DISEQC_RX_OFF);
+}
+
+void diseqc_rx_set_mode(uint8_t mode)
+{
+	uint8_t i;
+
+	if (mode > DISEQC_RX_MONITOR) {
+		return;
+	}
+
+	rx_mode = mode;
+
+	for (i = 0; i < 2; ++i) {
+		LL_TIM_CC_DisableChannel(TIM1, i ? LL_TIM_CHANNEL_CH2 : LL_TIM_CHANNEL_CH1);
+		LL_DMA_DisableChannel(DMA1, rx_channels[i].dma_channel);
+
+		rx_channels[i].tail = 0;
+		rx_channels[i].in_pulse = 0;
+		rx_msg_reset(&rx_channels[i]);
+
+		if (mode == DISEQC_RX_OFF) {
+			continue;
+		}
+
+		/* Restart the ring from the beginning */
+		LL_DMA_SetDataLength(DMA1, rx_channels[i].dma_channel, DISEQC_RX_RING_LEN);
+		LL_DMA_EnableChannel(DMA1, rx_channels[i].dma_channel);
+		LL_TIM_CC_EnableChannel(TIM1, i ? LL_TIM_CHANNEL_CH2 : LL_TIM_CHANNEL_CH1);
+	}
+}
+
+uint8_t diseqc_rx_get_mode(void)
+{
+	return rx_mode;
+}
+
+uint8_t diseqc_rx_line_busy(uint8_t channel, uint32_t quiet_us)
+{
+	struct rx_channel *rx = &rx_channels[channel == DISEQC_TX_CHANNEL_1 ? 0 : 1];
+	uint8_t tone_on = (channel == DISEQC_TX_CHANNEL_1)
+						? diseq_get_ch1_tone_signal_mode()
+						: diseq_get_ch2_tone_signal_mode();
+
+	if (rx_mode == DISEQC_RX_OFF || tone_on || !rx->activity_seen) {
+		return 0;
+	}
+
+	return systime_us() - rx->last_activity < quiet_us;
+}
+
+void diseqc_rx_poll(void)
+{
+	if (rx_mode == DISEQC_RX_OFF) {
+		return;
+	}
+
+	rx_channel_poll(&rx_channels[0]);
+	rx_channel_poll(&rx_channels[1]);
+}
@@ -0,0 +1,564 @@
+/*
+   diseqc_tx.c
+    - DiSEqC 1.x messages transmitter with TIM4 and DMA
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ DiSEqC bit is 1.5 ms long, 33 cycles of 22 kHz:
+	'0' - 1.0 ms of tone, 0.5 ms of silence
+	'1' - 0.5 ms of tone, 1.0 ms of silence
+ Every byte is sent MSB first and followed by the odd parity bit.
+
+ The whole message is prepared as a list of 0.5 ms slots, every slot is a TIM2 compare value:
+ DISEQC_TONE_CCR for the tone and 0 for the silence.
+ TIM4 update event every 0.5 ms triggers DMA, which writes the next slot to the TIM2 CCRx.
+ CCRx is preloaded, so the tone is switched on the 22 kHz period boundary.
+ DMA completes with the write of the last slot, so one silent slot is appended: its write
+ marks the end of the previous slot and the transmission is finished 0.5 ms later.
+
+ The same slots are used for the switch sequence, every step is timed by the DMA:
+	voltage change, 15 ms, [DiSEqC message, 15 ms], [tone burst, 15 ms], final tone state
+ Tone burst A is 12.5 ms of the continuous tone, burst B is nine '1' bits.
+
+ Unicable ODU commands are signalled with 18V, the voltage is raised before the message
+ and restored by the main loop after it:
+	18V, 5 ms, message, 2 ms, previous voltage
+
+ Timed tone gate doesn't need the slots, TIM4 runs in the one-pulse mode
+ and the tone is switched off by its update interrupt.
+ The final line state is applied in the interrupt in the both cases.
+ */
+
+#include <string.h>
+#include "stm32f1xx_ll_bus.h"
+#include "stm32f1xx_ll_tim.h"
+#include "stm32f1xx_ll_dma.h"
+#include "diseqc.h"
+#include "diseqc_tx.h"
+#include "settle.h"
+#include "systime.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+/* TIM2 compare value of the 22 kHz tone, see diseqc.c */
+#define DISEQC_TONE_CCR 600
+
+/* 24 MHz timer clock / 24 = 1 MHz, 500 ticks = 0.5 ms slot */
+#define DISEQC_SLOT_TIMER_PSC (24 - 1)
+#define DISEQC_SLOT_TIMER_ARR (500 - 1)
+
+/* 24 MHz timer clock / 2400 = 10 kHz, tone gate unit is 0.1 ms */
+#define DISEQC_GATE_TIMER_PSC (2400 - 1)
+
+#define DISEQC_SLOTS_PER_BIT 3
+#define DISEQC_SLOTS_PER_BYTE (9 * DISEQC_SLOTS_PER_BIT)
+
+/* Continuous tone must be off for 15 ms before and after the message */
+/* The same delay is required after the voltage change and the tone burst */
+#define DISEQC_TONE_GAP_SLOTS 30
+
+/* Terminating slot, see tx_start() */
+#define DISEQC_END_SLOTS 1
+
+/* Tone burst A, 12.5 ms */
+#define DISEQC_BURST_A_SLOTS 25
+#define DISEQC_BURST_B_BITS 9
+
+/* Unicable: 4 - 22 ms of 18V before the message, at least 2 ms after it */
+#define DISEQC_ODU_SETTLE_SLOTS 10
+#define DISEQC_ODU_TAIL_SLOTS 4
+
+/* Longest switch sequence: gap, message, gap, burst B, gap and the terminating slot */
+#define DISEQC_TX_MAX_SLOTS (3 * DISEQC_TONE_GAP_SLOTS + DISEQC_MAX_MSG_LEN * DISEQC_SLOTS_PER_BYTE \
+								+ DISEQC_BURST_B_BITS * DISEQC_SLOTS_PER_BIT + DISEQC_END_SLOTS)
+
+static uint16_t slots[DISEQC_TX_MAX_SLOTS];
+static uint16_t slots_len = 0;
+
+/* Framing byte: master command, reply is required */
+#define DISEQC_FRAMING_MASK		0xFC
+#define DISEQC_FRAMING_MASTER	0xE0
+#define DISEQC_FRAMING_REPLY	0x02
+
+/* Channel in transmission, 0 - idle */
+static volatile uint8_t tx_channel = 0;
+static uint8_t tx_reply_expected = 0;
+
+/* Line is kept silent after the message while the slave may reply */
+static uint8_t hold_channel = 0;
+static uint32_t hold_until;
+static volatile uint8_t tx_done = 0;
+static volatile uint32_t tx_done_time;
+
+/* Voltage to restore after the Unicable frame, 0 - none */
+static uint8_t odu_voltage = 0;
+
+/* Completion event is not sent yet */
+static uint8_t event_pending = 0;
+static uint8_t event[DS_EVENT_DISEQC_TX_DONE_LEN];
+
+static void put_slots(uint16_t value, uint16_t count)
+{
+	while (count-- && slots_len < DISEQC_TX_MAX_SLOTS) {
+		slots[slots_len++] = value;
+	}
+}
+
+static void put_bit(uint8_t bit)
+{
+	put_slots(DISEQC_TONE_CCR, bit ? 1 : 2);
+	put_slots(0, bit ? 2 : 1);
+}
+
+/* 8 bits MSB first and odd parity */
+static void put_byte(uint8_t byte)
+{
+	uint8_t ones = 0;
+	int8_t i;
+
+	for (i = 7; i >= 0; --i) {
+		put_bit((byte >> i) & 0x1);
+		ones += (byte >> i) & 0x1;
+	}
+
+	put_bit(!(ones & 0x1));
+}
+
+static uint8_t channel_tone_mode(uint8_t channel)
+{
+	return (channel == DISEQC_TX_CHANNEL_1)
+				? diseq_get_ch1_tone_signal_mode()
+				: diseq_get_ch2_tone_signal_mode();
+}
+
+static uint8_t reply_expected(const uint8_t *msg, uint8_t len)
+{
+	return len && (msg[0] & DISEQC_FRAMING_MASK) == DISEQC_FRAMING_MASTER
+				&& (msg[0] & DISEQC_FRAMING_REPLY);
+}
+
+/* Put the line to the configured tone mode right now, called from the interrupt */
+/* Storage and LEDs are updated later by release_line() */
+static void apply_line_tone(uint8_t channel)
+{
+	if (channel == DISEQC_TX_CHANNEL_1) {
+		LL_TIM_OC_SetCompareCH1(TIM2, DISEQC_TONE_CCR);
+
+		if (diseq_get_ch1_tone_signal_mode()) {
+			LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH1);
+		} else {
+			LL_TIM_CC_DisableChannel(TIM2, LL_TIM_CHANNEL_CH1);
+		}
+	} else {
+		LL_TIM_OC_SetCompareCH2(TIM2, DISEQC_TONE_CCR);
+
+		if (diseq_get_ch2_tone_signal_mode()) {
+			LL_TIM_CC_EnableChannel(TIM2, LL_TIM_CHANNEL_CH2);
+		} else {
+			LL_TIM_CC_DisableChannel(TIM2, LL_TIM_CHANNEL_CH2);
+		}
+	}
+}
+
+/* Give the line back to the tone control */
+static void release_line(uint8_t channel)
+{
+	if (channel == DISEQC_TX_CHANNEL_1) {
+		LL_TIM_OC_SetCompareCH1(TIM2, DISEQC_TONE_CCR);
+		diseq_set_ch1_tone_signal_mode(diseq_get_ch1_tone_signal_mode());
+	} else {
+		LL_TIM_OC_SetCompareCH2(TIM2, DISEQC_TONE_CCR);
+		diseq_set_ch2_tone_signal_mode(diseq_get_ch2_tone_signal_mode());
+	}
+}
+
+/* Voltage change is reported by the switch complete event, as the host command */
+static void set_channel_voltage(uint8_t channel, uint8_t voltage)
+{
+	if (channel == DISEQC_TX_CHANNEL_1) {
+		diseqc_set_ch1_out_voltage(voltage);
+		settle_start(SETTLE_CH1);
+	} else {
+		diseqc_set_ch2_out_voltage(voltage);
+		settle_start(SETTLE_CH2);
+	}
+}
+
+/* Run the prepared slots on the channel line */
+static void tx_start(uint8_t channel)
+{
+	uint32_t ch = (channel == DISEQC_TX_CHANNEL_1) ? LL_TIM_CHANNEL_CH1 : LL_TIM_CHANNEL_CH2;
+	uint32_t ccr_addr = (channel == DISEQC_TX_CHANNEL_1) ? (uint32_t) &TIM2->CCR1 : (uint32_t) &TIM2->CCR2;
+
+	tx_channel = channel;
+	tx_done = 0;
+
+	/* Last slot lasts the full 0.5 ms until the terminating slot is written */
+	put_slots(0, DISEQC_END_SLOTS);
+
+	/* Timer may be left in the tone gate mode */
+	LL_TIM_DisableIT_UPDATE(TIM4);
+	LL_TIM_SetOnePulseMode(TIM4, LL_TIM_ONEPULSEMODE_REPETITIVE);
+	LL_TIM_SetPrescaler(TIM4, DISEQC_SLOT_TIMER_PSC);
+	LL_TIM_SetAutoReload(TIM4, DISEQC_SLOT_TIMER_ARR);
+	LL_TIM_GenerateEvent_UPDATE(TIM4);
+	LL_TIM_EnableDMAReq_UPDATE(TIM4);
+
+	/* Silence, line is controlled by the compare value from now */
+	if (channel == DISEQC_TX_CHANNEL_1) {
+		LL_TIM_OC_SetCompareCH1(TIM2, 0);
+	} else {
+		LL_TIM_OC_SetCompareCH2(TIM2, 0);
+	}
+
+	LL_TIM_CC_EnableChannel(TIM2, ch);
+
+	LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_7);
+	LL_DMA_ConfigAddresses(DMA1, LL_DMA_CHANNEL_7, (uint32_t) slots, ccr_addr,
+							LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+	LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_7, slots_len);
+	LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_7);
+
+	/* First slot is written after 0.5 ms */
+	LL_TIM_SetCounter(TIM4, 0);
+	LL_TIM_ClearFlag_UPDATE(TIM4);
+	LL_TIM_EnableCounter(TIM4);
+}
+
+void init_diseqc_tx(void)
+{
+	LL_TIM_InitTypeDef TIM_InitStruct = {0};
+
+	LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_TIM4);
+	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+
+	/* Slot timer */
+	TIM_InitStruct.Prescaler = DISEQC_SLOT_TIMER_PSC;
+	TIM_InitStruct.CounterMode = LL_TIM_COUNTERMODE_UP;
+	TIM_InitStruct.Autoreload = DISEQC_SLOT_TIMER_ARR;
+	TIM_InitStruct.ClockDivision = LL_TIM_CLOCKDIVISION_DIV1;
+	LL_TIM_Init(TIM4, &TIM_InitStruct);
+	LL_TIM_SetClockSource(TIM4, LL_TIM_CLOCKSOURCE_INTERNAL);
+	/* Prescaler is reloaded by software update event, it must not start the DMA */
+	LL_TIM_DisableDMAReq_UPDATE(TIM4);
+
+	/* TIM4_UP DMA request is connected to the DMA1 channel 7 */
+	LL_DMA_SetDataTransferDirection(DMA1, LL_DMA_CHANNEL_7, LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+	LL_DMA_SetChannelPriorityLevel(DMA1, LL_DMA_CHANNEL_7, LL_DMA_PRIORITY_VERYHIGH);
+	LL_DMA_SetMode(DMA1, LL_DMA_CHANNEL_7, LL_DMA_MODE_NORMAL);
+	LL_DMA_SetPeriphIncMode(DMA1, LL_DMA_CHANNEL_7, LL_DMA_PERIPH_NOINCREMENT);
+	LL_DMA_SetMemoryIncMode(DMA1, LL_DMA_CHANNEL_7, LL_DMA_MEMORY_INCREMENT);
+	LL_DMA_SetPeriphSize(DMA1, LL_DMA_CHANNEL_7, LL_DMA_PDATAALIGN_HALFWORD);
+	LL_DMA_SetMemorySize(DMA1, LL_DMA_CHANNEL_7, LL_DMA_MDATAALIGN_HALFWORD);
+	LL_DMA_EnableIT_TC(DMA1, LL_DMA_CHANNEL_7);
+
+	NVIC_SetPriority(DMA1_Channel7_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+	NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+	/* Tone gate end */
+	NVIC_SetPriority(TIM4_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+	NVIC_EnableIRQ(TIM4_IRQn);
+}
+
+/* Common checks, returns DISEQC_TX_OK if the engine can be started */
+static uint8_t tx_prepare(uint8_t channel)
+{
+	uint8_t channel_held = hold_channel;
+
+	if (channel != DISEQC_TX_CHANNEL_1 && channel != DISEQC_TX_CHANNEL_2) {
+		return DISEQC_TX_INVALID;
+	}
+
+	/* Previous transmission is not finished or not reported yet */
+	if (tx_channel || event_pending) {
+		return DISEQC_TX_BUSY;
+	}
+
+	/* Reply is not received in time, new transmission goes anyway */
+	if (channel_held) {
+		hold_channel = 0;
+		release_line(channel_held);
+	}
+
+	return DISEQC_TX_OK;
+}
+
+uint8_t diseqc_tx_send(uint8_t channel, const uint8_t *msg, uint8_t len)
+{
+	uint8_t tone_on;
+	uint8_t status;
+	uint8_t i;
+
+	if (!len || len > DISEQC_MAX_MSG_LEN) {
+		return DISEQC_TX_INVALID;
+	}
+
+	status = tx_prepare(channel);
+
+	if (status != DISEQC_TX_OK) {
+		return status;
+	}
+
+	tone_on = channel_tone_mode(channel);
+	tx_reply_expected = reply_expected(msg, len);
+
+	slots_len = 0;
+
+	if (tone_on) {
+		put_slots(0, DISEQC_TONE_GAP_SLOTS);
+	}
+
+	for (i = 0; i < len; ++i) {
+		put_byte(msg[i]);
+	}
+
+	if (tone_on) {
+		put_slots(0, DISEQC_TONE_GAP_SLOTS);
+	}
+
+	tx_start(channel);
+
+	return DISEQC_TX_OK;
+}
+
+uint8_t diseqc_tx_sequence(uint8_t channel, uint8_t voltage, const uint8_t *msg, uint8_t len,
+							uint8_t burst, uint8_t tone)
+{
+	uint8_t status;
+	uint8_t i;
+
+	if (len > DISEQC_MAX_MSG_LEN || burst > DISEQC_BURST_B) {
+		return DISEQC_TX_INVALID;
+	}
+
+	status = tx_prepare(channel);
+
+	if (status != DISEQC_TX_OK) {
+		return status;
+	}
+
+	tx_reply_expected = reply_expected(msg, len);
+
+	slots_len = 0;
+
+	/* Voltage settle time, tone is off */
+	put_slots(0, DISEQC_TONE_GAP_SLOTS);
+
+	if (len) {
+		for (i = 0; i < len; ++i) {
+			put_byte(msg[i]);
+		}
+
+		put_slots(0, DISEQC_TONE_GAP_SLOTS);
+	}
+
+	if (burst == DISEQC_BURST_A) {
+		put_slots(DISEQC_TONE_CCR, DISEQC_BURST_A_SLOTS);
+	} else if (burst == DISEQC_BURST_B) {
+		for (i = 0; i < DISEQC_BURST_B_BITS; ++i) {
+			put_bit(1);
+		}
+	}
+
+	if (burst != DISEQC_BURST_NONE) {
+		put_slots(0, DISEQC_TONE_GAP_SLOTS);
+	}
+
+	/* Line is silent and owned by the transmitter from now, */
+	/* so the new tone mode is only saved and applied at the end */
+	tx_start(channel);
+
+	if (voltage) {
+		set_channel_voltage(channel, voltage);
+	}
+
+	if (channel == DISEQC_TX_CHANNEL_1) {
+		diseq_set_ch1_tone_signal_mode(tone);
+	} else {
+		diseq_set_ch2_tone_signal_mode(tone);
+	}
+
+	return DISEQC_TX_OK;
+}
+
+uint8_t diseqc_tx_odu(uint8_t channel, const uint8_t *msg, uint8_t len)
+{
+	uint8_t high;
+	uint8_t status;
+	uint8_t i;
+
+	if (!len || len > DISEQC_MAX_MSG_LEN) {
+		return DISEQC_TX_INVALID;
+	}
+
+	status = tx_prepare(channel);
+
+	if (status != DISEQC_TX_OK) {
+		return status;
+	}
+
+	high = (channel == DISEQC_TX_CHANNEL_1)
+				? diseqc_get_ch1_out_voltage()
+				: diseqc_get_ch2_out_voltage();
+
+	/* ODU commands have no reply */
+	tx_reply_expected = 0;
+
+	slots_len = 0;
+
+	put_slots(0, DISEQC_ODU_SETTLE_SLOTS);
+
+	for (i = 0; i < len; ++i) {
+		put_byte(msg[i]);
+	}
+
+	put_slots(0, DISEQC_ODU_TAIL_SLOTS);
+
+	tx_start(channel);
+
+	/* Settle time is counted from here, the first slot is silent anyway */
+	/* Line which is already at 18V is not switched, nothing to restore */
+	if (!high) {
+		odu_voltage = DS_OUT_VOLTAGE_MODE_13V;
+		set_channel_voltage(channel, DS_OUT_VOLTAGE_MODE_18V);
+	}
+
+	return DISEQC_TX_OK;
+}
+
+uint8_t diseqc_tx_tone_gate(uint8_t channel, uint16_t duration)
+{
+	uint32_t ch = (channel == DISEQC_TX_CHANNEL_1) ? LL_TIM_CHANNEL_CH1 : LL_TIM_CHANNEL_CH2;
+	uint8_t status;
+
+	if (!duration) {
+		return DISEQC_TX_INVALID;
+	}
+
+	status = tx_prepare(channel);
+
+	if (status != DISEQC_TX_OK) {
+		return status;
+	}
+
+	/* Continuous tone is already on */
+	if (channel_tone_mode(channel)) {
+		return DISEQC_TX_INVALID;
+	}
+
+	tx_channel = channel;
+	tx_done = 0;
+	tx_reply_expected = 0;
+
+	LL_TIM_DisableDMAReq_UPDATE(TIM4);
+	LL_TIM_SetPrescaler(TIM4, DISEQC_GATE_TIMER_PSC);
+	LL_TIM_SetAutoReload(TIM4, duration - 1);
+	LL_TIM_SetOnePulseMode(TIM4, LL_TIM_ONEPULSEMODE_SINGLE);
+	LL_TIM_GenerateEvent_UPDATE(TIM4);
+	LL_TIM_ClearFlag_UPDATE(TIM4);
+	LL_TIM_EnableIT_UPDATE(TIM4);
+
+	/* Compare value is already the tone one, see release_line() */
+	LL_TIM_CC_EnableChannel(TIM2, ch);
+	LL_TIM_EnableCounter(TIM4);
+
+	return DISEQC_TX_OK;
+}
+
+uint8_t diseqc_tx_active(uint8_t channel)
+{
+	return tx_channel == channel || hold_channel == channel;
+}
+
+uint8_t diseqc_tx_sending(uint8_t channel)
+{
+	return tx_channel == channel;
+}
+
+/* Transmission is over, called from the interrupt */
+static void tx_finish(void)
+{
+	/* Line is kept silent for the reply */
+	if (!tx_reply_expected) {
+		apply_line_tone(tx_channel);
+	}
+
+	tx_done_time = systime_us();
+	tx_done = 1;
+}
+
+/* Terminating slot is written, the last one is over, stop the slot timer */
+void diseqc_tx_dma_complete_cb(void)
+{
+	LL_TIM_DisableCounter(TIM4);
+	LL_TIM_DisableDMAReq_UPDATE(TIM4);
+	LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_7);
+
+	tx_finish();
+}
+
+/* Tone gate is over, timer is already stopped by the one-pulse mode */
+void diseqc_tx_gate_complete_cb(void)
+{
+	LL_TIM_DisableIT_UPDATE(TIM4);
+
+	tx_finish();
+}
+
+void diseqc_tx_poll(void)
+{
+	uint8_t channel = tx_channel;
+	uint32_t ts;
+
+	if (tx_done) {
+		tx_done = 0;
+		tx_channel = 0;
+
+		if (tx_reply_expected) {
+			hold_channel = channel;
+			hold_until = tx_done_time + DISEQC_REPLY_WINDOW_US;
+		} else {
+			release_line(channel);
+		}
+
+		if (odu_voltage) {
+			set_channel_voltage(channel, odu_voltage);
+			odu_voltage = 0;
+		}
+
+		ts = tx_done_time;
+
+		event[0] = channel;
+		event[1] = ts >> 24;
+		event[2] = ts >> 16;
+		event[3] = ts >> 8;
+		event[4] = ts;
+		event_pending = 1;
+	}
+
+	if (hold_channel && (int32_t) (systime_us() - hold_until) >= 0) {
+		channel = hold_channel;
+		hold_channel = 0;
+		release_line(channel);
+	}
+
+	/* Try again on the next poll if TX queue is full */
+	if (event_pending && send_event(DS_EVENT_DISEQC_TX_DONE, event, DS_EVENT_DISEQC_TX_DONE_LEN)) {
+		event_pending = 0;
+	}
+}
@@ -21,6 +21,8 @@
 #include "stm32f1xx_ll_gpio.h"
 #include "stm32f1xx_ll_utils.h"
 #include "stm32f1xx_ll_bus.h"
+#include "stm32f1xx_hal.h"
+#include "leds.h"
 
 /* Define LEDs ports and pins */
 #define LED3_CH1 LL_GPIO_PIN_1
@@ -61,6 +63,45 @@
 #define SYS_LED_ON()  LL_GPIO_ResetOutputPin(LED_SYS_BLUE_GPIO_Port, LED_SYS_BLUE);
 /* */
 
+/* System LED timings, ms */
+#define SYS_LED_FLASH_TIME 100
+#define SYS_LED_ERR_BLINK_TIME 50
+
+/* System LED pattern state, see leds_poll() */
+static uint32_t sys_led_deadline = 0;
+static uint8_t sys_led_active = 0;
+static uint8_t sys_led_err_toggles = 0;
+
+/* Channel LEDs, in the order of the boot pattern */
+#define LED_13V_CH1		0
+#define LED_18V_CH1		1
+#define LED_TONE_CH1	2
+#define LED_13V_CH2		3
+#define LED_18V_CH2		4
+#define LED_TONE_CH2	5
+#define LED_COUNT		6
+
+static GPIO_TypeDef * const led_ports[LED_COUNT] = {
+	LED1_CH1_GPIO_Port, LED2_CH1_GPIO_Port, LED3_CH1_GPIO_Port,
+	LED1_CH2_GPIO_Port, LED2_CH2_GPIO_Port, LED3_CH2_GPIO_Port
+};
+
+static const uint32_t led_pins[LED_COUNT] = {
+	LED1_CH1, LED2_CH1, LED3_CH1,
+	LED1_CH2, LED2_CH2, LED3_CH2
+};
+
+/* Boot pattern: all LEDs are on after init_leds() and switched off one by one */
+/* It runs from the SysTick interrupt, so the boot is not delayed */
+#define BOOT_BLINK_START_MS	100
+#define BOOT_BLINK_STEP_MS	60
+
+static volatile uint8_t boot_blink_active = 0;
+static uint16_t boot_blink_ms = 0;
+
+/* State of the channel LEDs set by the outputs, shown after the boot pattern */
+static volatile uint8_t leds_state[LED_COUNT];
+
 void init_leds(void)
 {
 	LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
@@ -131,64 +172,84 @@ void init_leds(void)
 	LL_GPIO_Init(LED1_CH2_GPIO_Port, &GPIO_InitStruct);
 }
 
+/* LEDs are active low */
+static void led_write(uint8_t led, uint8_t on)
+{
+	if (on) {
+		LL_GPIO_ResetOutputPin(led_ports[led], led_pins[led]);
+	} else {
+		LL_GPIO_SetOutputPin(led_ports[led], led_pins[led]);
+	}
+}
+
+/* State is stored before the check, so the end of the boot pattern can't miss it */
+static void led_set(uint8_t led, uint8_t on)
+{
+	leds_state[led] = on;
+
+	if (!boot_blink_active) {
+		led_write(led, on);
+	}
+}
+
 void led13v_ch1_on(void)
 {
-	LED1_CH1_ON();
+	led_set(LED_13V_CH1, 1);
 }
 
 void led13v_ch1_off(void)
 {
-	LED1_CH1_OFF();
+	led_set(LED_13V_CH1, 0);
 }
 
 void led13v_ch2_on(void)
 {
-	LED1_CH2_ON();
+	led_set(LED_13V_CH2, 1);
 }
 
 void led13v_ch2_off(void)
 {
-	LED1_CH2_OFF();
+	led_set(LED_13V_CH2, 0);
 }
 
 void led18v_ch1_on(void)
 {
-	LED2_CH1_ON();
+	led_set(LED_18V_CH1, 1);
 }
 
 void led18v_ch1_off(void)
 {
-	LED2_CH1_OFF();
+	led_set(LED_18V_CH1, 0);
 }
 
 void led18v_ch2_on(void)
 {
-	LED2_CH2_ON();
+	led_set(LED_18V_CH2, 1);
 }
 
 void led18v_ch2_off(void)
 {
-	LED2_CH2_OFF();
+	led_set(LED_18V_CH2, 0);
 }
 
 void led22khz_ch1_tone_on(void)
 {
-	LED3_CH1_ON();
+	led_set(LED_TONE_CH1, 1);
 }
 
 void led22khz_ch1_tone_off(void)
 {
-	LED3_CH1_OFF();
+	led_set(LED_TONE_CH1, 0);
 }
 
 void led22khz_ch2_tone_on(void)
 {
-	LED3_CH2_ON();
+	led_set(LED_TONE_CH2, 1);
 }
 
 void led22khz_ch2_tone_off(void)
 {
-	LED3_CH2_OFF();
+	led_set(LED_TONE_CH2, 0);
 }
 
 void system_led_on(void)
@@ -201,22 +262,96 @@ void system_led_off(void)
 	SYS_LED_OFF();
 }
 
-/* Just a funky blink */
+/* Turn on the System LED, it will be turned off by leds_poll() */
+void system_led_flash(void)
+{
+	/* Error blinking has a priority */
+	if (sys_led_err_toggles) {
+		return;
+	}
+
+	SYS_LED_ON();
+
+	sys_led_active = 1;
+	sys_led_deadline = HAL_GetTick() + SYS_LED_FLASH_TIME;
+}
+
+/* Blink the System LED num times to indicate errors */
+void system_led_err_blink(uint8_t num)
+{
+	if (sys_led_err_toggles || !num) {
+		return;
+	}
+
+	SYS_LED_ON();
+
+	sys_led_active = 1;
+	sys_led_err_toggles = num * 2 - 1;
+	sys_led_deadline = HAL_GetTick() + SYS_LED_ERR_BLINK_TIME;
+}
+
+/* Main loop handler of the System LED patterns */
+void leds_poll(void)
+{
+	if (!sys_led_active || (int32_t) (HAL_GetTick() - sys_led_deadline) < 0) {
+		return;
+	}
+
+	if (!sys_led_err_toggles) {
+		SYS_LED_OFF();
+		sys_led_active = 0;
+		return;
+	}
+
+	/* Odd number of toggles left means LED is on now */
+	if (sys_led_err_toggles & 1) {
+		SYS_LED_OFF();
+	} else {
+		SYS_LED_ON();
+	}
+
+	sys_led_err_toggles--;
+	sys_led_deadline += SYS_LED_ERR_BLINK_TIME;
+}
+
+/* Just a funky blink, see leds_systick_cb() */
 void boot_blink(void)
 {
-	LL_mDelay(100);
-	LED1_CH1_OFF();
-	LL_mDelay(60);
-	LED2_CH1_OFF();
-	LL_mDelay(60);
-	LED3_CH1_OFF();
-	LL_mDelay(60);
-	LED1_CH2_OFF();
-	LL_mDelay(60);
-	LED2_CH2_OFF();
-	LL_mDelay(60);
-	LED3_CH2_OFF();
-	LL_mDelay(60);
-	SYS_LED_OFF();
+	boot_blink_ms = 0;
+	boot_blink_active = 1;
 }
 
+/* SysTick interrupt callback, every 1 ms
+    see stm32f1xx_it.c
+ */
+void leds_systick_cb(void)
+{
+	uint8_t step, led;
+
+	if (!boot_blink_active) {
+		return;
+	}
+
+	if (++boot_blink_ms < BOOT_BLINK_START_MS || (boot_blink_ms - BOOT_BLINK_START_MS) % BOOT_BLINK_STEP_MS) {
+		return;
+	}
+
+	step = (boot_blink_ms - BOOT_BLINK_START_MS) / BOOT_BLINK_STEP_MS;
+
+	if (step < LED_COUNT) {
+		led_write(step, 0);
+		return;
+	}
+
+	/* Pattern is over, show the outputs state */
+	boot_blink_active = 0;
+
+	for (led = 0; led < LED_COUNT; ++led) {
+		led_write(led, leds_state[led]);
+	}
+
+	/* System LED may be flashed already by the main loop */
+	if (!sys_led_active) {
+		SYS_LED_OFF();
+	}
+}
@@ -24,34 +24,96 @@
 #include "leds.h"
 #include "diseqc.h"
 #include "voltage_reader.h"
+#include "usb_protocol.h"
+#include "systime.h"
+#include "protection.h"
+#include "diseqc_tx.h"
+#include "diseqc_rx.h"
+#include "unicable.h"
+#include "scheduler.h"
+#include "settle.h"
+#include "scope.h"
+#include "state_store.h"
+#include "boot_time.h"
 
 void configure_system_clocks(void);
 
 int main(void)
 {
+	/* Boot stages are reported with DS_CMD_READ_BOOT_TIME */
+	boot_time_start();
+
 	/* Reset of all peripherals, Initializes the Flash interface and the Systick. */
 	/* Required by USB driver */
 	HAL_Init();
 
 	configure_system_clocks();
+	boot_time_mark(BOOT_STAGE_CLOCKS);
 
-	/* Initialize all  peripherals */
+	/* Boot pattern runs in the background, nothing waits for it */
 	init_leds();
 	boot_blink();
+
+	/* Outputs are restored first, so the receivers get the power as soon as possible */
+	init_systime();
+	init_state_store();
 	init_diseqc();
-	init_voltage_reader();
+	boot_time_mark(BOOT_STAGE_OUTPUTS);
 
+	/* Enumeration takes a while, it goes on while the rest is initialized */
+	/* Commands are only queued by the USB interrupt and processed in the main loop */
 	MX_USB_DEVICE_Init();
+	boot_time_mark(BOOT_STAGE_USB_START);
+
+	/* Initialize all the other peripherals */
+	init_diseqc_tx();
+	init_diseqc_rx();
+	init_unicable();
+	init_scheduler();
+	init_voltage_reader();
+	init_settle();
+
+	/* Restored power supply is protected as the host switched one, the ADC is running now */
+	protection_ps_changed(diseqc_get_ps_mode());
+	boot_time_mark(BOOT_STAGE_PERIPHERALS);
 
-	/* Turn on the System LED */
+	/* Flash the System LED */
 	/* This will means that FW is started properly */
-	system_led_on();
+	system_led_flash();
+
+	boot_time_mark(BOOT_STAGE_READY);
 
 	while (1) {
-		/* Just turn on the System LED in cycle */
-		/* This LED is activated from the different parts of the FW */
-		LL_mDelay(100);
-		system_led_off();
+		/* Handle all commands received by the USB interrupt */
+		process_rx_data();
+
+		/* Report output faults and run the hiccup retries */
+		protection_poll();
+
+		/* Restore the tone after DiSEqC message and report it */
+		diseqc_tx_poll();
+
+		/* Decode DiSEqC replies and monitored messages */
+		diseqc_rx_poll();
+
+		/* Unicable commands, after the receiver has seen the line */
+		unicable_poll();
+
+		/* Report the executed scheduled commands */
+		scheduler_poll();
+
+		/* Report the settled outputs after the voltage changes */
+		settle_poll();
+
+		/* Stream the raw ADC blocks in the scope mode */
+		scope_poll();
+
+		/* Save the outputs state for the restore on boot */
+		state_store_poll();
+
+		/* System LED is activated from the different parts of the FW */
+		/* Turn it off and run the blink patterns */
+		leds_poll();
 	}
 
 	return 0;
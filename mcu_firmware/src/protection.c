@@ -0,0 +1,238 @@
+/*
+   protection.c
+    - LNB outputs fault protection with the ADC analog watchdog
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ Shorted coax pulls the output voltage down, so overcurrent is seen as undervoltage.
+ The watchdog interrupt switches the power supply off within a few microseconds,
+ everything else (state, event, retry) is done in the main loop.
+ The board has no separate channel switches, so the whole power supply is switched off.
+ */
+
+#include "stm32f1xx_hal.h"
+#include "protection.h"
+#include "voltage_reader.h"
+#include "diseqc.h"
+#include "systime.h"
+#include "leds.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+/* Outputs need some time to rise after the power supply is enabled */
+#define PROTECTION_BLANKING_MS 50
+
+#define PROTECTION_HICCUP_UNIT_MS 100
+
+/* Thresholds, 0.1 mV */
+static uint16_t threshold_low = 0;
+static uint16_t threshold_high = 0;
+
+static uint8_t hiccup_interval = 0;
+static uint8_t hiccup_max_retries = 0;
+
+/* Main loop state */
+static uint8_t arm_pending = 0;
+static uint32_t arm_tick = 0;
+static uint8_t armed = 0;
+static uint8_t fault_latched = 0;
+static uint8_t retry_pending = 0;
+static uint32_t retry_tick = 0;
+static uint8_t retries = 0;
+
+/* Fault info from the interrupt */
+static volatile uint8_t fault_pending = 0;
+static volatile uint32_t fault_time;
+static volatile uint8_t fault_channel;
+static volatile uint16_t fault_value;
+
+/* Event is not sent yet */
+static uint8_t event_pending = 0;
+static uint8_t event[DS_EVENT_FAULT_LEN];
+
+/* ADC interrupt context */
+static void protection_trip(uint8_t channel, uint16_t value)
+{
+	diseqc_ps_emergency_off();
+
+	fault_time = systime_us();
+	fault_channel = channel;
+	fault_value = value;
+	fault_pending = 1;
+}
+
+static uint8_t protection_enabled(void)
+{
+	return threshold_low || threshold_high;
+}
+
+static void protection_arm(void)
+{
+	adc_watchdog_arm(threshold_low, threshold_high ? threshold_high : 0xFFFF, protection_trip);
+	armed = 1;
+}
+
+static void protection_disarm(void)
+{
+	adc_watchdog_disarm();
+	armed = 0;
+	arm_pending = 0;
+}
+
+/* Arm the watchdog after the blanking time */
+static void protection_schedule_arm(void)
+{
+	protection_disarm();
+
+	if (protection_enabled() && diseqc_get_ps_mode()) {
+		arm_pending = 1;
+		arm_tick = HAL_GetTick();
+	}
+}
+
+void protection_set_low_threshold(uint16_t value)
+{
+	threshold_low = value;
+	protection_schedule_arm();
+}
+
+uint16_t protection_get_low_threshold(void)
+{
+	return threshold_low;
+}
+
+void protection_set_high_threshold(uint16_t value)
+{
+	threshold_high = value;
+	protection_schedule_arm();
+}
+
+uint16_t protection_get_high_threshold(void)
+{
+	return threshold_high;
+}
+
+void protection_set_hiccup(uint8_t interval, uint8_t max_retries)
+{
+	hiccup_interval = interval;
+	hiccup_max_retries = max_retries;
+
+	if (!interval) {
+		retry_pending = 0;
+	}
+}
+
+void protection_get_hiccup(uint8_t *interval, uint8_t *max_retries)
+{
+	*interval = hiccup_interval;
+	*max_retries = hiccup_max_retries;
+}
+
+/* Host command resets the fault state */
+void protection_ps_changed(uint8_t enabled)
+{
+	fault_latched = 0;
+	retry_pending = 0;
+	retries = 0;
+
+	protection_schedule_arm();
+}
+
+uint8_t protection_get_status(uint8_t *retries_num)
+{
+	uint8_t flags = 0;
+
+	if (armed) {
+		flags |= DS_PROTECTION_ARMED;
+	}
+
+	if (fault_latched) {
+		flags |= DS_PROTECTION_FAULT;
+	}
+
+	if (retry_pending) {
+		flags |= DS_PROTECTION_RETRY_PENDING;
+	}
+
+	*retries_num = retries;
+
+	return flags;
+}
+
+uint8_t protection_active(void)
+{
+	return armed || arm_pending;
+}
+
+/* Handle the fault reported by the interrupt */
+static void handle_fault(void)
+{
+	uint32_t ts = fault_time;
+	uint16_t value = fault_value;
+
+	fault_pending = 0;
+	armed = 0;
+	fault_latched = 1;
+
+	/* Update the state storage and LEDs */
+	diseqc_set_ps_mode(0);
+	system_led_err_blink(5);
+
+	event[0] = ts >> 24;
+	event[1] = ts >> 16;
+	event[2] = ts >> 8;
+	event[3] = ts;
+	event[4] = fault_channel + 1;
+	event[5] = (threshold_low && value <= threshold_low) ? DS_FAULT_UNDERVOLTAGE : DS_FAULT_OVERVOLTAGE;
+	event[6] = value >> 8;
+	event[7] = value;
+	event[8] = retries;
+	event_pending = 1;
+
+	if (hiccup_interval && (!hiccup_max_retries || retries < hiccup_max_retries)) {
+		retry_pending = 1;
+		retry_tick = HAL_GetTick();
+	}
+}
+
+void protection_poll(void)
+{
+	uint32_t now = HAL_GetTick();
+
+	if (fault_pending) {
+		handle_fault();
+	}
+
+	/* Try again on the next poll if TX queue is full */
+	if (event_pending && send_event(DS_EVENT_FAULT, event, DS_EVENT_FAULT_LEN)) {
+		event_pending = 0;
+	}
+
+	if (arm_pending && (now - arm_tick) >= PROTECTION_BLANKING_MS) {
+		arm_pending = 0;
+		protection_arm();
+	}
+
+	if (retry_pending && (now - retry_tick) >= (uint32_t) hiccup_interval * PROTECTION_HICCUP_UNIT_MS) {
+		retry_pending = 0;
+		retries++;
+
+		diseqc_set_ps_mode(1);
+		protection_schedule_arm();
+	}
+}
@@ -0,0 +1,279 @@
+/*
+   scheduler.c
+    - Timed commands scheduler
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ Host loads the list of the (offset, command) entries and starts it,
+ every command is executed at start + offset of the device time.
+
+ TIM1 is the 1 MHz system time, its CH3 compare is set to the low 16 bits
+ of the next entry time. Compare interrupt executes all the entries which are due,
+ the full 32 bit time is checked, so the far entries just skip the timer periods.
+ Actual execution time is taken right before the output change and reported
+ to the host by the main loop.
+
+ Only the outputs control commands are accepted, they are short and safe
+ for the interrupt context, the outputs setters mask the interrupts for their
+ state update, so the main loop changes are not torn by this one. Protection is notified about the power supply
+ change by the main loop.
+ */
+
+#include "stm32f1xx_ll_tim.h"
+#include "diseqc.h"
+#include "protection.h"
+#include "scheduler.h"
+#include "settle.h"
+#include "systime.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+/* Entry is executed right away if it's due in less than this time */
+#define SCHEDULER_MIN_LEAD_US 2
+
+struct sched_entry {
+	uint32_t offset;
+	uint8_t cmd;
+	uint8_t arg;
+	uint32_t actual;
+};
+
+static struct sched_entry entries[SCHEDULER_MAX_ENTRIES];
+static uint8_t entries_count = 0;
+
+static volatile uint8_t running = 0;
+static uint32_t start_time;
+
+/* Executed by the interrupt, processed by the main loop and reported */
+static volatile uint8_t exec_idx = 0;
+static uint8_t handled_idx = 0;
+static uint8_t report_idx = 0;
+
+static uint8_t entry_valid(uint8_t cmd, uint8_t arg)
+{
+	switch (cmd) {
+		case POWER_SUPPLY_CONTROL:
+			return arg == POWER_SUPPLY_ENABLED || arg == POWER_SUPPLY_DISABLED;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH1:
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH2:
+			return arg == DS_OUT_VOLTAGE_MODE_13V || arg == DS_OUT_VOLTAGE_MODE_18V;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1:
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2:
+			return arg == DS_OUT_TONE_SIGNAL_ENABLED || arg == DS_OUT_TONE_SIGNAL_DISABLED;
+
+		default:
+			return 0;
+	}
+}
+
+/* Called from the interrupt */
+static void entry_exec(const struct sched_entry *entry)
+{
+	switch (entry->cmd) {
+		case POWER_SUPPLY_CONTROL:
+			diseqc_set_ps_mode(entry->arg == POWER_SUPPLY_ENABLED);
+			settle_start(SETTLE_BOTH);
+			break;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH1:
+			diseqc_set_ch1_out_voltage(entry->arg);
+			settle_start(SETTLE_CH1);
+			break;
+
+		case DS_CMD_TYPE_OUT_VOLTAGE_CH2:
+			diseqc_set_ch2_out_voltage(entry->arg);
+			settle_start(SETTLE_CH2);
+			break;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1:
+			diseq_set_ch1_tone_signal_mode(entry->arg == DS_OUT_TONE_SIGNAL_ENABLED);
+			break;
+
+		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2:
+			diseq_set_ch2_tone_signal_mode(entry->arg == DS_OUT_TONE_SIGNAL_ENABLED);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* Set the compare to the next entry, or stop */
+static void arm_next(void)
+{
+	uint32_t due;
+
+	if (exec_idx >= entries_count) {
+		LL_TIM_DisableIT_CC3(TIM1);
+		running = 0;
+		return;
+	}
+
+	due = start_time + entries[exec_idx].offset;
+
+	LL_TIM_OC_SetCompareCH3(TIM1, (uint16_t) due);
+	LL_TIM_ClearFlag_CC3(TIM1);
+
+	/* Compare value may be already passed */
+	if ((int32_t) (due - systime_us()) < SCHEDULER_MIN_LEAD_US) {
+		LL_TIM_GenerateEvent_CC3(TIM1);
+	}
+}
+
+void init_scheduler(void)
+{
+	/* Compare only, no output pin */
+	LL_TIM_OC_SetMode(TIM1, LL_TIM_CHANNEL_CH3, LL_TIM_OCMODE_FROZEN);
+	LL_TIM_OC_DisablePreload(TIM1, LL_TIM_CHANNEL_CH3);
+	LL_TIM_DisableIT_CC3(TIM1);
+
+	NVIC_SetPriority(TIM1_CC_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+	NVIC_EnableIRQ(TIM1_CC_IRQn);
+}
+
+uint8_t scheduler_add(uint32_t offset, uint8_t cmd, uint8_t arg)
+{
+	if (running) {
+		return SCHEDULER_BUSY;
+	}
+
+	if (entries_count >= SCHEDULER_MAX_ENTRIES || !entry_valid(cmd, arg)) {
+		return SCHEDULER_INVALID;
+	}
+
+	/* Entries are executed in order */
+	if (entries_count && offset < entries[entries_count - 1].offset) {
+		return SCHEDULER_INVALID;
+	}
+
+	entries[entries_count].offset = offset;
+	entries[entries_count].cmd = cmd;
+	entries[entries_count].arg = arg;
+	entries_count++;
+
+	return SCHEDULER_OK;
+}
+
+uint8_t scheduler_start(uint8_t mode, uint32_t time)
+{
+	if (running || report_idx < exec_idx) {
+		return SCHEDULER_BUSY;
+	}
+
+	if (!entries_count || mode > SCHEDULER_START_ABSOLUTE) {
+		return SCHEDULER_INVALID;
+	}
+
+	start_time = (mode == SCHEDULER_START_DELAY) ? systime_us() + time : time;
+
+	exec_idx = 0;
+	handled_idx = 0;
+	report_idx = 0;
+	running = 1;
+
+	NVIC_DisableIRQ(TIM1_CC_IRQn);
+	arm_next();
+	LL_TIM_EnableIT_CC3(TIM1);
+	NVIC_EnableIRQ(TIM1_CC_IRQn);
+
+	return SCHEDULER_OK;
+}
+
+void scheduler_clear(void)
+{
+	NVIC_DisableIRQ(TIM1_CC_IRQn);
+	LL_TIM_DisableIT_CC3(TIM1);
+	running = 0;
+	NVIC_EnableIRQ(TIM1_CC_IRQn);
+
+	entries_count = 0;
+	exec_idx = 0;
+	handled_idx = 0;
+	report_idx = 0;
+}
+
+uint8_t scheduler_active(void)
+{
+	return running && exec_idx < entries_count;
+}
+
+void scheduler_compare_cb(void)
+{
+	uint32_t now;
+
+	if (!running) {
+		return;
+	}
+
+	/* Entries with the same time are applied together */
+	while (exec_idx < entries_count) {
+		now = systime_us();
+
+		if ((int32_t) (start_time + entries[exec_idx].offset - now) >= SCHEDULER_MIN_LEAD_US) {
+			break;
+		}
+
+		entries[exec_idx].actual = now;
+		entry_exec(&entries[exec_idx]);
+		exec_idx++;
+	}
+
+	arm_next();
+}
+
+void scheduler_poll(void)
+{
+	uint8_t executed = exec_idx;
+	uint8_t event[DS_EVENT_SCHEDULE_EXEC_LEN];
+	const struct sched_entry *entry;
+	uint32_t planned;
+
+	while (handled_idx < executed) {
+		entry = &entries[handled_idx++];
+
+		if (entry->cmd == POWER_SUPPLY_CONTROL) {
+			protection_ps_changed(entry->arg == POWER_SUPPLY_ENABLED);
+		}
+	}
+
+	while (report_idx < executed) {
+		entry = &entries[report_idx];
+		planned = start_time + entry->offset;
+
+		event[0] = report_idx;
+		event[1] = entry->cmd;
+		event[2] = entry->arg;
+		event[3] = planned >> 24;
+		event[4] = planned >> 16;
+		event[5] = planned >> 8;
+		event[6] = planned;
+		event[7] = entry->actual >> 24;
+		event[8] = entry->actual >> 16;
+		event[9] = entry->actual >> 8;
+		event[10] = entry->actual;
+
+		/* Try again on the next poll if TX queue is full */
+		if (!send_event(DS_EVENT_SCHEDULE_EXEC, event, DS_EVENT_SCHEDULE_EXEC_LEN)) {
+			break;
+		}
+
+		report_idx++;
+	}
+}
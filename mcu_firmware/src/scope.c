@@ -0,0 +1,174 @@
+/*
+   scope.c
+    - Raw ADC waveform streaming
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ Every half of the ADC DMA buffer is copied by the DMA interrupt to the blocks ring,
+ while the other half is being filled. Main loop packs the blocks to the events.
+ Sequence number is taken for every half, so the block dropped on the full ring
+ (USB is slower than the ADC) is seen by the host as a gap.
+ */
+
+#include "stm32f1xx_hal.h"
+#include "scope.h"
+#include "voltage_reader.h"
+#include "systime.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+#define NUM_CHANNELS 2
+
+/* 8 blocks are 6.4 ms at the normal rate, 2.5 ms at the max one */
+#define SCOPE_RING_BLOCKS 8
+
+struct scope_block {
+	uint16_t seq;
+	uint32_t timestamp;
+	uint16_t samples[ADC_BLOCK_SAMPLES * NUM_CHANNELS];
+};
+
+/* Single producer (DMA interrupt) single consumer (main loop) ring */
+static struct scope_block ring[SCOPE_RING_BLOCKS];
+static volatile uint8_t ring_head = 0;
+static volatile uint8_t ring_tail = 0;
+
+/* Used only in the DMA interrupt while running */
+static uint16_t block_seq = 0;
+
+static uint8_t scope_channels = 0;
+
+/* DMA interrupt context */
+static void scope_raw_cb(const volatile uint16_t *data)
+{
+	uint8_t head = ring_head;
+	uint8_t next = (head + 1) % SCOPE_RING_BLOCKS;
+	struct scope_block *blk = &ring[head];
+	uint8_t i;
+
+	if (next != ring_tail) {
+		blk->seq = block_seq;
+		blk->timestamp = systime_us();
+
+		for (i = 0; i < ADC_BLOCK_SAMPLES * NUM_CHANNELS; ++i) {
+			blk->samples[i] = data[i];
+		}
+
+		/* Publish the block only after it is written */
+		__DMB();
+		ring_head = next;
+	}
+
+	block_seq++;
+}
+
+uint8_t scope_start(uint8_t channels, uint32_t rate_hz)
+{
+	if (!channels || (channels & ~SCOPE_BOTH)) {
+		return SCOPE_INVALID;
+	}
+
+	if (rate_hz < SCOPE_RATE_MIN || rate_hz > SCOPE_RATE_MAX) {
+		return SCOPE_INVALID;
+	}
+
+	/* Interrupt doesn't touch the ring after this point */
+	adc_raw_monitor_set(NULL);
+
+	ring_head = ring_tail = 0;
+	block_seq = 0;
+	scope_channels = channels;
+
+	adc_set_sample_rate(rate_hz);
+	adc_raw_monitor_set(scope_raw_cb);
+
+	return SCOPE_OK;
+}
+
+void scope_stop(void)
+{
+	adc_raw_monitor_set(NULL);
+	adc_set_sample_rate(ADC_SAMPLE_RATE_HZ);
+
+	scope_channels = 0;
+	ring_tail = ring_head;
+}
+
+uint8_t scope_active(void)
+{
+	return scope_channels != 0;
+}
+
+/* Two 12 bit values to 3 bytes */
+static uint8_t *pack_pair(uint8_t *out, uint16_t first, uint16_t second)
+{
+	out[0] = first >> 4;
+	out[1] = ((first & 0xF) << 4) | ((second >> 8) & 0xF);
+	out[2] = second;
+
+	return out + 3;
+}
+
+/* Selected channels of the block, interleaved pairs are kept as is */
+static uint8_t pack_block(const struct scope_block *blk, uint8_t *payload)
+{
+	uint8_t *out = payload + DS_EVENT_SCOPE_HEADER_LEN;
+	const uint16_t *s = blk->samples;
+	uint8_t i;
+
+	payload[0] = blk->seq >> 8;
+	payload[1] = blk->seq;
+	payload[2] = scope_channels;
+	payload[3] = blk->timestamp >> 24;
+	payload[4] = blk->timestamp >> 16;
+	payload[5] = blk->timestamp >> 8;
+	payload[6] = blk->timestamp;
+
+	if (scope_channels == SCOPE_BOTH) {
+		for (i = 0; i < ADC_BLOCK_SAMPLES * NUM_CHANNELS; i += 2) {
+			out = pack_pair(out, s[i], s[i + 1]);
+		}
+	} else {
+		/* CH2 is the odd samples */
+		s += (scope_channels == SCOPE_CH2);
+
+		for (i = 0; i < ADC_BLOCK_SAMPLES * NUM_CHANNELS; i += 4) {
+			out = pack_pair(out, s[i], s[i + 2]);
+		}
+	}
+
+	return out - payload;
+}
+
+void scope_poll(void)
+{
+	uint8_t payload[DS_EXT_MAX_PAYLOAD];
+	uint8_t tail;
+	uint8_t len;
+
+	while ((tail = ring_tail) != ring_head) {
+		len = pack_block(&ring[tail], payload);
+
+		/* TX queue is full, interrupt drops the blocks until there is a room */
+		if (!send_event(DS_EVENT_SCOPE_BLOCK, payload, len)) {
+			return;
+		}
+
+		ring_tail = (tail + 1) % SCOPE_RING_BLOCKS;
+	}
+}
@@ -0,0 +1,254 @@
+/*
+   settle.c
+    - Output voltage settle detection and switch complete events
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ LM317 output and the LNB input capacitors need some time to reach the new level.
+ After the change every 0.8 ms block mean of the ADC is compared with the target
+ level of the channel, output is settled when it stays in the tolerance band for
+ SETTLE_HOLD_US. Settle time is from the change to the band entry, so the resolution
+ is one block. Detection runs in the DMA interrupt, events are sent from the main loop.
+ */
+
+#include "stm32f1xx_hal.h"
+#include "settle.h"
+#include "diseqc.h"
+#include "voltage_reader.h"
+#include "systime.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+#define NUM_CHANNELS 2
+
+#define SETTLE_HOLD_US		2000
+#define SETTLE_TIMEOUT_US	500000
+
+/* Defaults are nominal outputs with the 6.58 divider, tolerance is 0.5 V of the output */
+#define SETTLE_DEFAULT_TARGET_13V	19757
+#define SETTLE_DEFAULT_TARGET_18V	27356
+#define SETTLE_DEFAULT_TOLERANCE	760
+
+struct settle_channel {
+	/* Request from settle_start() */
+	volatile uint8_t start_req;
+	volatile uint32_t start_req_time;
+	volatile uint8_t start_req_target;
+
+	/* Detector, used only in the DMA interrupt */
+	uint8_t active;
+	uint8_t target;
+	uint16_t band_low;
+	uint16_t band_high;
+	uint8_t in_band;
+	uint32_t start_time;
+	uint32_t enter_time;
+
+	/* Result, it's not overwritten until the event is sent */
+	volatile uint8_t done;
+	uint8_t status;
+	uint8_t res_target;
+	uint32_t res_start_time;
+	uint32_t res_settle_us;
+	uint16_t res_value;
+};
+
+static struct settle_channel channels_state[NUM_CHANNELS];
+
+static uint16_t target_13v = SETTLE_DEFAULT_TARGET_13V;
+static uint16_t target_18v = SETTLE_DEFAULT_TARGET_18V;
+static uint16_t tolerance = SETTLE_DEFAULT_TOLERANCE;
+
+void settle_set_target_13v(uint16_t value)
+{
+	target_13v = value;
+}
+
+uint16_t settle_get_target_13v(void)
+{
+	return target_13v;
+}
+
+void settle_set_target_18v(uint16_t value)
+{
+	target_18v = value;
+}
+
+uint16_t settle_get_target_18v(void)
+{
+	return target_18v;
+}
+
+void settle_set_tolerance(uint16_t value)
+{
+	tolerance = value;
+}
+
+uint16_t settle_get_tolerance(void)
+{
+	return tolerance;
+}
+
+void settle_start(uint8_t channels)
+{
+	uint32_t now = systime_us();
+	uint8_t ps = diseqc_get_ps_mode();
+	uint8_t high[NUM_CHANNELS];
+	uint8_t i;
+
+	high[0] = diseqc_get_ch1_out_voltage();
+	high[1] = diseqc_get_ch2_out_voltage();
+
+	for (i = 0; i < NUM_CHANNELS; ++i) {
+		if (!(channels & (1 << i))) {
+			continue;
+		}
+
+		channels_state[i].start_req_time = now;
+		channels_state[i].start_req_target = !ps ? 0
+								: (high[i] ? DS_OUT_VOLTAGE_MODE_18V : DS_OUT_VOLTAGE_MODE_13V);
+
+		/* Flag is the last, the interrupt takes the complete request */
+		__DMB();
+		channels_state[i].start_req = 1;
+	}
+}
+
+/* Band of the target, power supply off is just below the tolerance */
+static void detector_start(struct settle_channel *ch)
+{
+	uint16_t level = 0;
+
+	ch->start_req = 0;
+	ch->start_time = ch->start_req_time;
+	ch->target = ch->start_req_target;
+
+	if (ch->target == DS_OUT_VOLTAGE_MODE_13V) {
+		level = target_13v;
+	} else if (ch->target == DS_OUT_VOLTAGE_MODE_18V) {
+		level = target_18v;
+	}
+
+	ch->band_low = level > tolerance ? level - tolerance : 0;
+	ch->band_high = (0xFFFF - level) > tolerance ? level + tolerance : 0xFFFF;
+	ch->in_band = 0;
+	ch->active = 1;
+}
+
+static void detector_finish(struct settle_channel *ch, uint8_t status, uint32_t settle_us, uint16_t value)
+{
+	ch->status = status;
+	ch->res_target = ch->target;
+	ch->res_start_time = ch->start_time;
+	ch->res_settle_us = settle_us;
+	ch->res_value = value;
+	ch->active = 0;
+
+	__DMB();
+	ch->done = 1;
+}
+
+/* DMA interrupt context */
+static void settle_block_cb(const uint16_t *values)
+{
+	uint32_t now = systime_us();
+	struct settle_channel *ch;
+	uint8_t i;
+
+	for (i = 0; i < NUM_CHANNELS; ++i) {
+		ch = &channels_state[i];
+
+		if (ch->start_req) {
+			detector_start(ch);
+		}
+
+		/* Previous result is still not sent, keep watching */
+		if (!ch->active || ch->done) {
+			continue;
+		}
+
+		if (values[i] >= ch->band_low && values[i] <= ch->band_high) {
+			if (!ch->in_band) {
+				ch->in_band = 1;
+				ch->enter_time = now;
+			}
+
+			if (now - ch->enter_time >= SETTLE_HOLD_US) {
+				detector_finish(ch, DS_SETTLE_OK, ch->enter_time - ch->start_time, values[i]);
+			}
+		} else {
+			ch->in_band = 0;
+
+			if (now - ch->start_time >= SETTLE_TIMEOUT_US) {
+				detector_finish(ch, DS_SETTLE_TIMEOUT, now - ch->start_time, values[i]);
+			}
+		}
+	}
+}
+
+void init_settle(void)
+{
+	adc_block_monitor_set(settle_block_cb);
+}
+
+uint8_t settle_active(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < NUM_CHANNELS; ++i) {
+		if (channels_state[i].start_req || channels_state[i].active) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void settle_poll(void)
+{
+	uint8_t event[DS_EVENT_SWITCH_DONE_LEN];
+	struct settle_channel *ch;
+	uint8_t i;
+
+	for (i = 0; i < NUM_CHANNELS; ++i) {
+		ch = &channels_state[i];
+
+		if (!ch->done) {
+			continue;
+		}
+
+		event[0] = i + 1;
+		event[1] = ch->status;
+		event[2] = ch->res_target;
+		event[3] = ch->res_start_time >> 24;
+		event[4] = ch->res_start_time >> 16;
+		event[5] = ch->res_start_time >> 8;
+		event[6] = ch->res_start_time;
+		event[7] = ch->res_settle_us >> 24;
+		event[8] = ch->res_settle_us >> 16;
+		event[9] = ch->res_settle_us >> 8;
+		event[10] = ch->res_settle_us;
+		event[11] = ch->res_value >> 8;
+		event[12] = ch->res_value;
+
+		/* Try again on the next poll if TX queue is full */
+		if (send_event(DS_EVENT_SWITCH_DONE, event, DS_EVENT_SWITCH_DONE_LEN)) {
+			ch->done = 0;
+		}
+	}
+}
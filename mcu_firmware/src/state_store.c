@@ -0,0 +1,262 @@
+/*
+   state_store.c
+    - Outputs state in flash, restored on boot
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ Outputs state is saved in the last two flash pages, excluded from the FLASH region
+ of the linker script. Records are appended to the active page, the other page is erased
+ only when it's full, so every page is erased once per 128 writes and the last record
+ is always in flash during the erase. Interrupted write fails the CRC and is skipped.
+ Flash erase and program stall the CPU and every interrupt for up to 20-40 ms, the code
+ and the vector table are in the same flash. So the state is written lazily, after it's
+ stable for STORE_WRITE_DELAY_US, and only when nothing depends on the interrupt timing:
+ no DiSEqC transmission, no running schedule, no settle detection and scope streaming,
+ protection watchdog is not armed. With the protection enabled the power supply state is
+ saved only when it's off, the stall would delay the emergency switch off.
+ Nothing is written while the restore mask is 0.
+ */
+
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "state_store.h"
+#include "diseqc.h"
+#include "diseqc_tx.h"
+#include "protection.h"
+#include "scheduler.h"
+#include "settle.h"
+#include "scope.h"
+#include "systime.h"
+#include "crc8.h"
+
+#define STORE_PAGES			2
+#define STORE_PAGE_SIZE		1024
+#define STORE_NO_PAGE		0xFF
+
+#define STORE_RECORD_VERSION	0x01
+#define STORE_SEQ_EMPTY			0xFFFFFFFF
+
+#define STORE_WRITE_DELAY_US	2000000
+
+/* One record is one double word program */
+struct store_record {
+	uint32_t seq;
+	uint8_t restore_mask;
+	uint8_t outputs;
+	uint8_t version;
+	uint8_t crc;
+};
+
+#define STORE_SLOTS (STORE_PAGE_SIZE / sizeof(struct store_record))
+
+/* See STM32F103C8Tx_FLASH.ld */
+extern uint32_t _state_store_start;
+
+/* Last valid record and the place for the next one */
+static uint8_t active_page = STORE_NO_PAGE;
+static uint16_t next_slot = STORE_SLOTS;
+static uint32_t last_seq = 0;
+static uint8_t saved_mask = 0;
+static uint8_t saved_outputs = 0;
+
+static uint8_t restore_mask = 0;
+
+/* Changed state, waiting to be stable */
+static uint8_t pending = 0;
+static uint8_t pending_mask;
+static uint8_t pending_outputs;
+static uint32_t pending_time;
+
+static uint32_t record_address(uint8_t page, uint16_t slot)
+{
+	return (uint32_t) &_state_store_start + page * STORE_PAGE_SIZE + slot * sizeof(struct store_record);
+}
+
+static const struct store_record *record_at(uint8_t page, uint16_t slot)
+{
+	return (const struct store_record *) record_address(page, slot);
+}
+
+static uint8_t record_empty(const struct store_record *rec)
+{
+	const uint32_t *words = (const uint32_t *) rec;
+
+	return words[0] == 0xFFFFFFFF && words[1] == 0xFFFFFFFF;
+}
+
+static uint8_t record_valid(const struct store_record *rec)
+{
+	return rec->seq != STORE_SEQ_EMPTY && rec->version == STORE_RECORD_VERSION
+			&& rec->crc == crc8((uint8_t *) rec, sizeof(struct store_record) - 1);
+}
+
+/* Current outputs from the controller state storage */
+static uint8_t current_outputs(void)
+{
+	uint8_t outputs = 0;
+
+	outputs |= diseqc_get_ps_mode() ? STATE_STORE_PS : 0;
+	outputs |= diseqc_get_ch1_out_voltage() ? STATE_STORE_CH1_18V : 0;
+	outputs |= diseq_get_ch1_tone_signal_mode() ? STATE_STORE_CH1_TONE : 0;
+	outputs |= diseqc_get_ch2_out_voltage() ? STATE_STORE_CH2_18V : 0;
+	outputs |= diseq_get_ch2_tone_signal_mode() ? STATE_STORE_CH2_TONE : 0;
+
+	return outputs;
+}
+
+/* Nothing is stalled by the flash write */
+static uint8_t write_allowed(void)
+{
+	if (diseqc_tx_active(DISEQC_TX_CHANNEL_1) || diseqc_tx_active(DISEQC_TX_CHANNEL_2)) {
+		return 0;
+	}
+
+	return !protection_active() && !scheduler_active() && !settle_active() && !scope_active();
+}
+
+/* Append the record, the other page is erased when the active one is full */
+static uint8_t write_record(uint8_t mask, uint8_t outputs)
+{
+	struct store_record rec;
+	FLASH_EraseInitTypeDef erase = {0};
+	uint32_t page_error;
+	uint64_t data;
+	uint8_t page = active_page;
+	uint16_t slot = next_slot;
+	HAL_StatusTypeDef res = HAL_OK;
+
+	rec.seq = last_seq + 1;
+	rec.restore_mask = mask;
+	rec.outputs = outputs;
+	rec.version = STORE_RECORD_VERSION;
+	rec.crc = crc8((uint8_t *) &rec, sizeof(struct store_record) - 1);
+
+	memcpy(&data, &rec, sizeof(data));
+
+	HAL_FLASH_Unlock();
+
+	if (page == STORE_NO_PAGE || slot >= STORE_SLOTS) {
+		page = (page == 0) ? 1 : 0;
+		slot = 0;
+
+		erase.TypeErase = FLASH_TYPEERASE_PAGES;
+		erase.PageAddress = record_address(page, 0);
+		erase.NbPages = 1;
+
+		res = HAL_FLASHEx_Erase(&erase, &page_error);
+	}
+
+	if (res == HAL_OK) {
+		res = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, record_address(page, slot), data);
+	}
+
+	HAL_FLASH_Lock();
+
+	if (res != HAL_OK || memcmp(record_at(page, slot), &rec, sizeof(rec))) {
+		/* Damaged slot, the next write starts on the other page */
+		/* The active page and its last record are kept */
+		next_slot = STORE_SLOTS;
+		return 0;
+	}
+
+	active_page = page;
+	next_slot = slot + 1;
+	last_seq = rec.seq;
+	saved_mask = mask;
+	saved_outputs = outputs;
+
+	return 1;
+}
+
+/* Module entry point */
+void init_state_store(void)
+{
+	const struct store_record *rec;
+	uint16_t used[STORE_PAGES];
+	uint16_t slot;
+	uint8_t page;
+
+	for (page = 0; page < STORE_PAGES; ++page) {
+		for (slot = 0; slot < STORE_SLOTS; ++slot) {
+			rec = record_at(page, slot);
+
+			if (record_empty(rec)) {
+				break;
+			}
+
+			if (record_valid(rec) && (active_page == STORE_NO_PAGE || rec->seq > last_seq)) {
+				active_page = page;
+				last_seq = rec->seq;
+				saved_mask = rec->restore_mask & STATE_STORE_ALL;
+				saved_outputs = rec->outputs & saved_mask;
+			}
+		}
+
+		used[page] = slot;
+	}
+
+	next_slot = (active_page == STORE_NO_PAGE) ? STORE_SLOTS : used[active_page];
+	restore_mask = saved_mask;
+}
+
+uint8_t state_store_get_restored(void)
+{
+	return saved_outputs & saved_mask;
+}
+
+void state_store_set_restore_mask(uint8_t mask)
+{
+	restore_mask = mask & STATE_STORE_ALL;
+}
+
+uint8_t state_store_get_restore_mask(void)
+{
+	return restore_mask;
+}
+
+/* Main loop */
+void state_store_poll(void)
+{
+	/* Only the restored fields are saved, so the other changes don't wear the flash */
+	uint8_t outputs = current_outputs() & restore_mask;
+
+	if (restore_mask == saved_mask && outputs == saved_outputs) {
+		pending = 0;
+		return;
+	}
+
+	if (!pending || restore_mask != pending_mask || outputs != pending_outputs) {
+		pending = 1;
+		pending_mask = restore_mask;
+		pending_outputs = outputs;
+		pending_time = systime_us();
+		return;
+	}
+
+	if (systime_us() - pending_time < STORE_WRITE_DELAY_US) {
+		return;
+	}
+
+	if (!write_allowed()) {
+		return;
+	}
+
+	/* Failed write is repeated after the delay */
+	write_record(restore_mask, outputs);
+	pending = 0;
+}
@@ -92,12 +92,15 @@ void PendSV_Handler(void)
 {
 }
 
+void leds_systick_cb(void);
+
 /**
   * @brief This function handles System tick timer.
   */
 void SysTick_Handler(void)
 {
   HAL_IncTick();
+  leds_systick_cb();
 }
 
 /******************************************************************************/
@@ -115,17 +118,24 @@ void USB_LP_CAN1_RX0_IRQHandler(void)
   HAL_PCD_IRQHandler(&hpcd_USB_FS);
 }
 
+void dma_half_transfer_cb(void);
 void dma_transfer_complete_cb(void);
 
 void DMA1_Channel1_IRQHandler(void)
 {
+  /* Check whether DMA half transfer caused the DMA interruption */
+  if(LL_DMA_IsActiveFlag_HT1(DMA1) == 1)
+  {
+    LL_DMA_ClearFlag_HT1(DMA1);
+    /* First half of the buffer is ready */
+    dma_half_transfer_cb();
+  }
+
   /* Check whether DMA transfer complete caused the DMA interruption */
   if(LL_DMA_IsActiveFlag_TC1(DMA1) == 1)
   {
-    /* Clear flag DMA global interrupt */
-    /* (global interrupt flag: half transfer and transfer complete flags) */
-    LL_DMA_ClearFlag_GI1(DMA1);
-    /* Call interruption treatment function */
+    LL_DMA_ClearFlag_TC1(DMA1);
+    /* Second half of the buffer is ready */
     dma_transfer_complete_cb();
   }
   
@@ -137,3 +147,90 @@ void DMA1_Channel1_IRQHandler(void)
   }
 }
 
+
+void diseqc_tx_dma_complete_cb(void);
+
+void DMA1_Channel7_IRQHandler(void)
+{
+  /* Check whether DMA transfer complete caused the DMA interruption */
+  if(LL_DMA_IsActiveFlag_TC7(DMA1) == 1)
+  {
+    LL_DMA_ClearFlag_TC7(DMA1);
+    /* Last DiSEqC slot is written to the timer */
+    diseqc_tx_dma_complete_cb();
+  }
+
+  /* Check whether DMA transfer error caused the DMA interruption */
+  if(LL_DMA_IsActiveFlag_TE7(DMA1) == 1)
+  {
+    LL_DMA_ClearFlag_TE7(DMA1);
+  }
+}
+
+void diseqc_tx_gate_complete_cb(void);
+
+void TIM4_IRQHandler(void)
+{
+  if(LL_TIM_IsActiveFlag_UPDATE(TIM4) == 1)
+  {
+    LL_TIM_ClearFlag_UPDATE(TIM4);
+    /* One-pulse tone gate is over */
+    diseqc_tx_gate_complete_cb();
+  }
+}
+
+void systime_overflow_cb(void);
+
+void TIM1_UP_IRQHandler(void)
+{
+  if(LL_TIM_IsActiveFlag_UPDATE(TIM1) == 1)
+  {
+    LL_TIM_ClearFlag_UPDATE(TIM1);
+    /* Count the microsecond timer overflows */
+    systime_overflow_cb();
+  }
+}
+
+void diseqc_apply_state_cb(void);
+
+void TIM2_IRQHandler(void)
+{
+  if(LL_TIM_IsActiveFlag_UPDATE(TIM2) == 1)
+  {
+    LL_TIM_ClearFlag_UPDATE(TIM2);
+    /* New outputs state on the 22KHz period boundary */
+    diseqc_apply_state_cb();
+  }
+}
+
+void scheduler_compare_cb(void);
+
+void TIM1_CC_IRQHandler(void)
+{
+  if(LL_TIM_IsActiveFlag_CC3(TIM1) == 1)
+  {
+    LL_TIM_ClearFlag_CC3(TIM1);
+    /* Next scheduled command may be due */
+    scheduler_compare_cb();
+  }
+}
+
+void adc_watchdog_cb(uint8_t channel);
+
+void ADC1_2_IRQHandler(void)
+{
+  /* Check whether analog watchdog caused the ADC interruption */
+  /* ADC1 watches channel 1, ADC2 - channel 2 */
+  if(LL_ADC_IsEnabledIT_AWD1(ADC1) && LL_ADC_IsActiveFlag_AWD1(ADC1) == 1)
+  {
+    LL_ADC_ClearFlag_AWD1(ADC1);
+    /* Output voltage is out of the allowed range */
+    adc_watchdog_cb(0);
+  }
+
+  if(LL_ADC_IsEnabledIT_AWD1(ADC2) && LL_ADC_IsActiveFlag_AWD1(ADC2) == 1)
+  {
+    LL_ADC_ClearFlag_AWD1(ADC2);
+    adc_watchdog_cb(1);
+  }
+}
@@ -0,0 +1,74 @@
+/*
+   systime.c
+    - Microsecond system time base with TIM1
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+#include "stm32f1xx_ll_bus.h"
+#include "stm32f1xx_ll_tim.h"
+#include "systime.h"
+
+/* 48 MHz timer clock / 48 = 1 MHz */
+#define SYSTIME_TIMER_PSC (48 - 1)
+
+/* TIM1 counter gives the low 16 bits, overflows are counted here */
+static volatile uint32_t systime_high = 0;
+
+void init_systime(void)
+{
+	LL_TIM_InitTypeDef TIM_InitStruct = {0};
+
+	LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_TIM1);
+
+	TIM_InitStruct.Prescaler = SYSTIME_TIMER_PSC;
+	TIM_InitStruct.CounterMode = LL_TIM_COUNTERMODE_UP;
+	TIM_InitStruct.Autoreload = 0xFFFF;
+	TIM_InitStruct.ClockDivision = LL_TIM_CLOCKDIVISION_DIV1;
+	TIM_InitStruct.RepetitionCounter = 0;
+	LL_TIM_Init(TIM1, &TIM_InitStruct);
+	LL_TIM_SetClockSource(TIM1, LL_TIM_CLOCKSOURCE_INTERNAL);
+
+	/* LL_TIM_Init generates update event to load the prescaler */
+	LL_TIM_ClearFlag_UPDATE(TIM1);
+	LL_TIM_EnableIT_UPDATE(TIM1);
+
+	NVIC_SetPriority(TIM1_UP_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+	NVIC_EnableIRQ(TIM1_UP_IRQn);
+
+	LL_TIM_EnableCounter(TIM1);
+}
+
+void systime_overflow_cb(void)
+{
+	systime_high++;
+}
+
+uint32_t systime_us(void)
+{
+	uint32_t high, low, pending;
+
+	do {
+		high = systime_high;
+		low = LL_TIM_GetCounter(TIM1);
+
+		/* Overflow is not counted yet if we are called with */
+		/* the same or higher priority than the TIM1 interrupt */
+		pending = (LL_TIM_IsActiveFlag_UPDATE(TIM1) && low < 0x8000);
+	} while (high != systime_high);
+
+	return ((high + pending) << 16) | low;
+}
@@ -0,0 +1,201 @@
+/*
+   unicable.c
+    - Unicable (EN50494/EN50607) ODU commands with the collision avoidance
+
+   Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  
+ */
+
+/*
+ All receivers of the single cable installation are sharing the same bus,
+ and there is no arbitration. The standards are suggesting:
+	- don't start the command while another one is on the line
+	- repeat the command after the random delay, so the collided
+	  commands of the different receivers are separated next time
+
+ Line activity is detected by the DiSEqC receiver (tone detector is required),
+ without it the command is sent immediately and only the repeats are randomised.
+ Random delays are seeded by the MCU unique ID, so the controllers on the same
+ cable are not using the same sequence.
+ */
+
+#include <string.h>
+#include "stm32f1xx_ll_utils.h"
+#include "diseqc_tx.h"
+#include "diseqc_rx.h"
+#include "unicable.h"
+#include "systime.h"
+#include "usb_protocol.h"
+#include "usb_protocol_private.h"
+
+/* Line must be silent for this time before the frame */
+#define UNICABLE_QUIET_US 5000
+
+/* Random delay before the next try on the busy line and before the repeat */
+#define UNICABLE_BACKOFF_MIN_US 10000
+#define UNICABLE_BACKOFF_SPAN_US 100000
+
+/* Give up if the line is still busy */
+#define UNICABLE_MAX_BACKOFFS 16
+
+/* Transmitter is busy with another message */
+#define UNICABLE_TX_WAIT_US 5000
+
+enum unicable_state {
+	UNICABLE_IDLE = 0,
+	UNICABLE_WAIT,
+	UNICABLE_SENDING,
+};
+
+static enum unicable_state state = UNICABLE_IDLE;
+
+static uint8_t uc_channel;
+static uint8_t uc_msg[DISEQC_MAX_MSG_LEN];
+static uint8_t uc_len;
+static uint8_t uc_repeats;
+static uint8_t uc_sent;
+static uint8_t uc_backoffs;
+static uint32_t next_try;
+static uint32_t last_done;
+
+/* Completion event is not sent yet */
+static uint8_t event_pending = 0;
+static uint8_t event[DS_EVENT_UNICABLE_DONE_LEN];
+
+static uint32_t rnd_state;
+
+/* xorshift32 */
+static uint32_t rnd_next(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+
+	return rnd_state;
+}
+
+static uint32_t backoff_us(void)
+{
+	return UNICABLE_BACKOFF_MIN_US + rnd_next() % UNICABLE_BACKOFF_SPAN_US;
+}
+
+static void unicable_finish(uint8_t status)
+{
+	event[0] = uc_channel;
+	event[1] = last_done >> 24;
+	event[2] = last_done >> 16;
+	event[3] = last_done >> 8;
+	event[4] = last_done;
+	event[5] = status;
+	event[6] = uc_sent;
+	event[7] = uc_backoffs;
+	event_pending = 1;
+
+	state = UNICABLE_IDLE;
+}
+
+void init_unicable(void)
+{
+	rnd_state = LL_GetUID_Word0() ^ LL_GetUID_Word1() ^ LL_GetUID_Word2() ^ systime_us();
+
+	/* Zero state is never left */
+	if (!rnd_state) {
+		rnd_state = 0x2545F491;
+	}
+}
+
+uint8_t unicable_send(uint8_t channel, const uint8_t *msg, uint8_t len, uint8_t repeats)
+{
+	if (channel != DISEQC_TX_CHANNEL_1 && channel != DISEQC_TX_CHANNEL_2) {
+		return DISEQC_TX_INVALID;
+	}
+
+	if (!len || len > DISEQC_MAX_MSG_LEN || repeats > UNICABLE_MAX_REPEATS) {
+		return DISEQC_TX_INVALID;
+	}
+
+	if (state != UNICABLE_IDLE || event_pending) {
+		return DISEQC_TX_BUSY;
+	}
+
+	uc_channel = channel;
+	memcpy(uc_msg, msg, len);
+	uc_len = len;
+	uc_repeats = repeats;
+	uc_sent = 0;
+	uc_backoffs = 0;
+	last_done = systime_us();
+
+	/* The first try is right now */
+	next_try = last_done;
+	state = UNICABLE_WAIT;
+
+	return DISEQC_TX_OK;
+}
+
+static void unicable_try(uint32_t now)
+{
+	uint8_t status;
+
+	if (diseqc_rx_line_busy(uc_channel, UNICABLE_QUIET_US)) {
+		if (++uc_backoffs > UNICABLE_MAX_BACKOFFS) {
+			unicable_finish(DS_UNICABLE_BUS_BUSY);
+			return;
+		}
+
+		next_try = now + backoff_us();
+		return;
+	}
+
+	status = diseqc_tx_odu(uc_channel, uc_msg, uc_len);
+
+	if (status == DISEQC_TX_BUSY) {
+		next_try = now + UNICABLE_TX_WAIT_US;
+		return;
+	}
+
+	/* Checked by unicable_send() */
+	if (status != DISEQC_TX_OK) {
+		unicable_finish(DS_UNICABLE_BUS_BUSY);
+		return;
+	}
+
+	state = UNICABLE_SENDING;
+}
+
+void unicable_poll(void)
+{
+	uint32_t now = systime_us();
+
+	if (state == UNICABLE_WAIT && (int32_t) (now - next_try) >= 0) {
+		unicable_try(now);
+	} else if (state == UNICABLE_SENDING && !diseqc_tx_active(uc_channel)) {
+		/* Voltage is restored by the transmitter poll */
+		last_done = now;
+		uc_sent++;
+
+		if (uc_sent > uc_repeats) {
+			unicable_finish(DS_UNICABLE_OK);
+		} else {
+			next_try = now + backoff_us();
+			state = UNICABLE_WAIT;
+		}
+	}
+
+	/* Try again on the next poll if TX queue is full */
+	if (event_pending && send_event(DS_EVENT_UNICABLE_DONE, event, DS_EVENT_UNICABLE_DONE_LEN)) {
+		event_pending = 0;
+	}
+}
@@ -18,6 +18,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  
  */
 
+#include <string.h>
 #include "usbd_cdc_if.h"
 #include "usb_protocol.h"
 #include "usb_protocol_private.h"
@@ -25,6 +26,53 @@
 #include "crc8.h"
 #include "diseqc.h"
 #include "voltage_reader.h"
+#include "protection.h"
+#include "diseqc_tx.h"
+#include "unicable.h"
+#include "scheduler.h"
+#include "settle.h"
+#include "scope.h"
+#include "diseqc_rx.h"
+#include "state_store.h"
+#include "boot_time.h"
+
+/* Number of the USB transfers which can be queued by the interrupt */
+#define RX_QUEUE_SLOTS 8
+
+struct rx_slot {
+	uint32_t len;
+	uint8_t data[CDC_DATA_FS_MAX_PACKET_SIZE];
+};
+
+/* Lock-free single producer (USB IRQ) single consumer (main loop) queue */
+/* Head is moved only by the interrupt, tail only by the main loop */
+static struct rx_slot rx_queue[RX_QUEUE_SLOTS];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+
+/* Outgoing responses ring, size must be 256 to use natural uint8_t wrap */
+/* Filled from the main loop, drained from the USB transmit complete callback */
+#define TX_RING_SIZE 256
+
+/* Whole frames per IN transfer, always less than max packet size */
+/* so the transfer is never terminated with ZLP */
+#define TX_PACKET_LEN ((CDC_DATA_FS_MAX_PACKET_SIZE / USB_PACKET_LEN) * USB_PACKET_LEN)
+
+/* Responses for the single received transfer, including incomplete frame from the previous one */
+/* Transfer may be filled with the shortest frames (extended with no payload, 6 bytes), */
+/* every frame is answered with the regular 7 bytes one */
+#define RX_MIN_FRAME_LEN DS_EXT_FRAME_LEN(0)
+#define TX_RESERVE_LEN (((CDC_DATA_FS_MAX_PACKET_SIZE + RX_MIN_FRAME_LEN - 1) / RX_MIN_FRAME_LEN) * USB_PACKET_LEN)
+
+static uint8_t tx_ring[TX_RING_SIZE];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+/* Data of the IN transfer in progress */
+static uint8_t tx_packet[TX_PACKET_LEN];
+
+/* Frame decoder state, see frame_decoder_feed() */
+static uint8_t frame_buf[DS_EXT_FRAME_LEN(DS_EXT_MAX_PAYLOAD)];
+static uint8_t frame_len = 0;
 
 /* Write CMD handler */
 static void handle_write_cmd(uint8_t *cmd, uint8_t *arg1, uint8_t *arg2)
@@ -33,10 +81,13 @@ static void handle_write_cmd(uint8_t *cmd, uint8_t *arg1, uint8_t *arg2)
 	switch (*cmd) {
 		case POWER_SUPPLY_CONTROL:
 			diseqc_set_ps_mode(*arg1 == POWER_SUPPLY_ENABLED);
+			protection_ps_changed(*arg1 == POWER_SUPPLY_ENABLED);
+			settle_start(SETTLE_BOTH);
 			break;
 
 		case DS_CMD_TYPE_OUT_VOLTAGE_CH1:
 			diseqc_set_ch1_out_voltage(*arg1);
+			settle_start(SETTLE_CH1);
 			break;
 
 		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH1:
@@ -45,22 +96,119 @@ static void handle_write_cmd(uint8_t *cmd, uint8_t *arg1, uint8_t *arg2)
 
 		case DS_CMD_TYPE_OUT_VOLTAGE_CH2:
 			diseqc_set_ch2_out_voltage(*arg1);
+			settle_start(SETTLE_CH2);
 			break;
 
 		case DS_CMD_TYPE_OUT_TONE_SIGNAL_CH2:
 			diseq_set_ch2_tone_signal_mode(*arg1 == DS_OUT_TONE_SIGNAL_ENABLED);
 			break;
 
+		case DS_CMD_ADC_AVG_WINDOW:
+			set_avg_window(*arg1);
+			break;
+
+		case DS_CMD_PROTECTION_LOW:
+			protection_set_low_threshold((*arg1 << 8) | *arg2);
+			break;
+
+		case DS_CMD_PROTECTION_HIGH:
+			protection_set_high_threshold((*arg1 << 8) | *arg2);
+			break;
+
+		case DS_CMD_PROTECTION_HICCUP:
+			protection_set_hiccup(*arg1, *arg2);
+			break;
+
+		case DS_CMD_SETTLE_TARGET_13V:
+			settle_set_target_13v((*arg1 << 8) | *arg2);
+			break;
+
+		case DS_CMD_SETTLE_TARGET_18V:
+			settle_set_target_18v((*arg1 << 8) | *arg2);
+			break;
+
+		case DS_CMD_SETTLE_TOLERANCE:
+			settle_set_tolerance((*arg1 << 8) | *arg2);
+			break;
+
+		case DS_CMD_DISEQC_RX_MODE:
+			diseqc_rx_set_mode(*arg1);
+			break;
+
+		case DS_CMD_STATE_RESTORE:
+			state_store_set_restore_mask(*arg1);
+			break;
+
 		default:
 			break;
 	}
 }
 
+/* Free space in the TX ring */
+static uint8_t tx_ring_free(void)
+{
+	return (uint8_t) (TX_RING_SIZE - 1 - (uint8_t) (tx_head - tx_tail));
+}
+
+/* Start the next IN transfer with as many queued frames as possible */
+/* Must be called with USB interrupt disabled or from the USB interrupt */
+static void tx_flush(void)
+{
+	uint8_t tail = tx_tail;
+	uint8_t n = tx_head - tail;
+	uint8_t i;
+
+	if (!n) {
+		return;
+	}
+
+	if (n > TX_PACKET_LEN) {
+		n = TX_PACKET_LEN;
+	}
+
+	for (i = 0; i < n; ++i) {
+		tx_packet[i] = tx_ring[(uint8_t) (tail + i)];
+	}
+
+	/* Busy endpoint will call us again on complete */
+	if (CDC_Transmit_FS(tx_packet, n) == USBD_OK) {
+		tx_tail = tail + n;
+	}
+}
+
+/* Main loop context: send queued data if endpoint is idle */
+static void tx_kick(void)
+{
+	if (tx_head == tx_tail) {
+		return;
+	}
+
+	NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+	tx_flush();
+	NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+}
+
+/* Queue one frame for transmission */
+/* Room is reserved by process_rx_data(), so responses are never dropped here */
+static void tx_enqueue(const uint8_t *buf, uint8_t len)
+{
+	uint8_t head = tx_head;
+	uint8_t i;
+
+	for (i = 0; i < len; ++i) {
+		tx_ring[(uint8_t) (head + i)] = buf[i];
+	}
+
+	/* Publish the data only after it is written */
+	__DMB();
+	tx_head = head + len;
+}
+
 /* Send response to the host */
 /* We use original CMD and prepared data arguments */
 static void send_response(uint8_t *cmd_orig, uint8_t *arg1, uint8_t *arg2)
 {
-	static uint8_t buf[USB_PACKET_LEN];
+	uint8_t buf[USB_PACKET_LEN];
 
 	buf[0] = DS_HEADER_MAGIC1;
 	buf[1] = DS_HEADER_MAGIC2;
@@ -70,15 +218,29 @@ static void send_response(uint8_t *cmd_orig, uint8_t *arg1, uint8_t *arg2)
 	buf[5] = *arg2;
 	buf[6] = crc8(buf, USB_PACKET_LEN - 1);
 
-	/* Call framework's transmit function */
-	CDC_Transmit_FS(buf, USB_PACKET_LEN /*sizeof(buf)*/);
+	tx_enqueue(buf, USB_PACKET_LEN);
+}
+
+/* Boot stage time in the protocol units */
+static uint16_t boot_time_units(uint8_t stage)
+{
+	uint32_t us = boot_time_get_us(stage);
+
+	if (us == BOOT_TIME_NOT_REACHED) {
+		return DS_BOOT_TIME_NOT_REACHED;
+	}
+
+	us /= DS_BOOT_TIME_UNIT_US;
+
+	return us > DS_BOOT_TIME_MAX ? DS_BOOT_TIME_MAX : us;
 }
 
 /* Read CMD handler */
-static void handle_read_cmd(uint8_t *cmd)
+static void handle_read_cmd(uint8_t *cmd, uint8_t *arg1)
 {
-	/* TMP voltage storage */
+	/* TMP voltage and counter storage */
 	uint16_t voltage; 
+	uint16_t counter;
 	/* We can respond with two BYTE arguments */
 	uint8_t res0 = 0, res1 = 0;
 
@@ -126,6 +288,103 @@ static void handle_read_cmd(uint8_t *cmd)
 			res1 = voltage;
 			break;
 
+		/* Read averaged voltage for the channel 1 with 0.1 mV resolution */
+		case DS_CMD_READ_AVG_VOLTAGE_CH1:
+			voltage = get_ch1_voltage_hires();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		/* Read averaged voltage for the channel 2 with 0.1 mV resolution */
+		case DS_CMD_READ_AVG_VOLTAGE_CH2:
+			voltage = get_ch2_voltage_hires();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		/* Read ripple statistics value selected by ARG1 */
+		case DS_CMD_READ_STATS_CH1:
+		case DS_CMD_READ_STATS_CH2:
+			voltage = get_voltage_stats(*cmd == DS_CMD_READ_STATS_CH1 ? 0 : 1, *arg1);
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		/* Read measured 22KHz tone level */
+		case DS_CMD_READ_TONE_LEVEL_CH1:
+		case DS_CMD_READ_TONE_LEVEL_CH2:
+			voltage = get_tone_level(*cmd == DS_CMD_READ_TONE_LEVEL_CH1 ? 0 : 1);
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		/* Return the end of the boot stage */
+		case DS_CMD_READ_BOOT_TIME:
+			counter = boot_time_units(*arg1);
+			res0 = counter >> 8;
+			res1 = counter;
+			break;
+
+		/* Return number of the completed averaged samples */
+		case DS_CMD_READ_SAMPLE_COUNTER:
+			counter = get_sample_counter();
+			res0 = counter >> 8;
+			res1 = counter;
+			break;
+
+		/* Return output protection configuration and state */
+		case DS_CMD_PROTECTION_LOW:
+			voltage = protection_get_low_threshold();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		case DS_CMD_PROTECTION_HIGH:
+			voltage = protection_get_high_threshold();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		case DS_CMD_PROTECTION_HICCUP:
+			protection_get_hiccup(&res0, &res1);
+			break;
+
+		/* Return voltage settle detection levels */
+		case DS_CMD_SETTLE_TARGET_13V:
+			voltage = settle_get_target_13v();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		case DS_CMD_SETTLE_TARGET_18V:
+			voltage = settle_get_target_18v();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		case DS_CMD_SETTLE_TOLERANCE:
+			voltage = settle_get_tolerance();
+			res0 = voltage >> 8;
+			res1 = voltage;
+			break;
+
+		case DS_CMD_PROTECTION_STATUS:
+			res0 = protection_get_status(&res1);
+			break;
+
+		case DS_CMD_DISEQC_RX_MODE:
+			res0 = diseqc_rx_get_mode();
+			break;
+
+		case DS_CMD_STATE_RESTORE:
+			res0 = state_store_get_restore_mask();
+			break;
+
+		/* Return current averaging window */
+		case DS_CMD_ADC_AVG_WINDOW:
+			res0 = get_avg_window();
+			break;
+
 		default:
 			return;
 	}
@@ -135,56 +394,381 @@ static void handle_read_cmd(uint8_t *cmd)
 }
 
 /* Simple respond on the Write commands */
-static void send_write_response(uint8_t* buf, uint32_t *len)
+static void send_write_response(uint8_t* buf)
 {
 	buf[4] = 0xFF;
 	buf[5] = 0xFF;
-	buf[6] = crc8(buf, *len - 1);
+	buf[6] = crc8(buf, USB_PACKET_LEN - 1);
 
-	CDC_Transmit_FS(buf, *len);
+	tx_enqueue(buf, USB_PACKET_LEN);
 }
 
-/* We can blink the System LED to indicate RX errors */
-void err_blink(uint8_t num)
+/* Map transmitter status to the NAK code */
+static uint8_t diseqc_tx_nak(uint8_t status)
 {
-	while (num--) {
-		system_led_on();
-		LL_mDelay(50);
-		system_led_off();
-		LL_mDelay(50);
+	if (status == DISEQC_TX_BUSY) {
+		return DS_NAK_BUSY;
 	}
+
+	return status == DISEQC_TX_OK ? 0 : DS_NAK_INVALID;
 }
 
-/* Callback function for the usbd_cdc_if.c:CDC_Receive_FS */
-void handle_rx_data(uint8_t* buf, uint32_t *len)
+/* Map scheduler status to the NAK code */
+static uint8_t scheduler_nak(uint8_t status)
 {
-	/* Vasic check of the data */
-	if (*len != USB_PACKET_LEN) {
-		return;
+	if (status == SCHEDULER_BUSY) {
+		return DS_NAK_BUSY;
 	}
 
-	/* Verify header magic numbers */
-	if (buf[0] != DS_HEADER_MAGIC1 || buf[1] != DS_HEADER_MAGIC2) {
-		err_blink(3);
-		return;
+	return status == SCHEDULER_OK ? 0 : DS_NAK_INVALID;
+}
+
+/* Append the schedule entries, all or nothing */
+static uint8_t schedule_load(const uint8_t *payload, uint8_t len)
+{
+	uint8_t status = SCHEDULER_OK;
+	uint32_t offset;
+	uint8_t i;
+
+	if (!len || len % DS_SCHEDULE_ENTRY_LEN) {
+		return DS_NAK_INVALID;
 	}
 
-	/* Verify packet CRC8 checksum */
-	if (buf[6] != crc8(buf, *len - 1)) {
-		err_blink(4);
-		return;
+	for (i = 0; i < len && status == SCHEDULER_OK; i += DS_SCHEDULE_ENTRY_LEN) {
+		offset = ((uint32_t) payload[i] << 24) | ((uint32_t) payload[i + 1] << 16)
+					| (payload[i + 2] << 8) | payload[i + 3];
+		status = scheduler_add(offset, payload[i + 4], payload[i + 5]);
 	}
 
+	if (status == SCHEDULER_INVALID) {
+		scheduler_clear();
+	}
+
+	return scheduler_nak(status);
+}
+
+/* Whole outputs state, nothing is changed on the invalid value */
+static uint8_t apply_state(const uint8_t *payload, uint8_t len)
+{
+	uint8_t i;
+
+	if (len < DS_APPLY_STATE_LEN) {
+		return DS_NAK_INVALID;
+	}
+
+	if (payload[0] != POWER_SUPPLY_ENABLED && payload[0] != POWER_SUPPLY_DISABLED) {
+		return DS_NAK_INVALID;
+	}
+
+	for (i = 1; i < DS_APPLY_STATE_LEN; i += 2) {
+		if (payload[i] != DS_OUT_VOLTAGE_MODE_13V && payload[i] != DS_OUT_VOLTAGE_MODE_18V) {
+			return DS_NAK_INVALID;
+		}
+
+		if (payload[i + 1] != DS_OUT_TONE_SIGNAL_ENABLED && payload[i + 1] != DS_OUT_TONE_SIGNAL_DISABLED) {
+			return DS_NAK_INVALID;
+		}
+	}
+
+	diseqc_apply_state(payload[0] == POWER_SUPPLY_ENABLED,
+						payload[1], payload[2] == DS_OUT_TONE_SIGNAL_ENABLED,
+						payload[3], payload[4] == DS_OUT_TONE_SIGNAL_ENABLED);
+
+	protection_ps_changed(payload[0] == POWER_SUPPLY_ENABLED);
+	settle_start(SETTLE_BOTH);
+
+	return 0;
+}
+
+/* Start or stop the scope, rate is checked by the scope module */
+static uint8_t scope_control(const uint8_t *payload, uint8_t len)
+{
+	if (len && !payload[0]) {
+		scope_stop();
+		return 0;
+	}
+
+	if (len < 5) {
+		return DS_NAK_INVALID;
+	}
+
+	if (scope_start(payload[0], ((uint32_t) payload[1] << 24) | ((uint32_t) payload[2] << 16)
+						| (payload[3] << 8) | payload[4]) != SCOPE_OK) {
+		return DS_NAK_INVALID;
+	}
+
+	return 0;
+}
+
+/* Handle extended write command, returns 0 or DS_NAK_* code */
+static uint8_t handle_write_ext_cmd(uint8_t id, uint8_t *payload, uint8_t len)
+{
+	switch (id) {
+		case DS_EXT_CMD_DISEQC_SEND:
+			if (len < 2) {
+				return DS_NAK_INVALID;
+			}
+
+			return diseqc_tx_nak(diseqc_tx_send(payload[0], payload + 1, len - 1));
+
+		case DS_EXT_CMD_DISEQC_SEQUENCE:
+			if (len < 4) {
+				return DS_NAK_INVALID;
+			}
+
+			if (payload[1] && payload[1] != DS_OUT_VOLTAGE_MODE_13V && payload[1] != DS_OUT_VOLTAGE_MODE_18V) {
+				return DS_NAK_INVALID;
+			}
+
+			return diseqc_tx_nak(diseqc_tx_sequence(payload[0], payload[1], payload + 4, len - 4,
+											payload[2], payload[3] == DS_OUT_TONE_SIGNAL_ENABLED));
+
+		case DS_EXT_CMD_TONE_GATE:
+			if (len < 3) {
+				return DS_NAK_INVALID;
+			}
+
+			return diseqc_tx_nak(diseqc_tx_tone_gate(payload[0], (payload[1] << 8) | payload[2]));
+
+		case DS_EXT_CMD_UNICABLE:
+			if (len < 3) {
+				return DS_NAK_INVALID;
+			}
+
+			return diseqc_tx_nak(unicable_send(payload[0], payload + 2, len - 2, payload[1]));
+
+		case DS_EXT_CMD_SCHEDULE_LOAD:
+			return schedule_load(payload, len);
+
+		case DS_EXT_CMD_SCHEDULE_START:
+			if (len < 5) {
+				return DS_NAK_INVALID;
+			}
+
+			return scheduler_nak(scheduler_start(payload[0], ((uint32_t) payload[1] << 24)
+								| ((uint32_t) payload[2] << 16) | (payload[3] << 8) | payload[4]));
+
+		case DS_EXT_CMD_SCHEDULE_CLEAR:
+			scheduler_clear();
+			return 0;
+
+		case DS_EXT_CMD_APPLY_STATE:
+			return apply_state(payload, len);
+
+		case DS_EXT_CMD_SCOPE:
+			return scope_control(payload, len);
+
+		default:
+			return DS_NAK_INVALID;
+	}
+}
+
+/* Extended write acknowledge, regular frame with the command ID */
+static void send_write_ext_response(uint8_t* buf, uint8_t nak)
+{
+	buf[4] = nak ? nak : 0xFF;
+	buf[5] = nak ? 0x00 : 0xFF;
+	buf[6] = crc8(buf, USB_PACKET_LEN - 1);
+
+	tx_enqueue(buf, USB_PACKET_LEN);
+}
+
+/* Handle one complete and verified frame */
+static void handle_frame(uint8_t* buf)
+{
+	uint8_t nak;
+
 	/* Packet is correct! Let's turn on the System LED */
-	/* This LED will be turned off in main() */
-	system_led_on();
+	/* This LED will be turned off in leds_poll() */
+	system_led_flash();
 
 	/* Handle Read and Write commands */
 	if (buf[2] == DS_CMD_WRITE) {
 		handle_write_cmd(&(buf[3]), &(buf[4]), &(buf[5]));
-		send_write_response(buf, len);
+		send_write_response(buf);
 	} else if (buf[2] == DS_CMD_READ) {
-		handle_read_cmd(&(buf[3]));
+		handle_read_cmd(&(buf[3]), &(buf[4]));
+	} else if (buf[2] == DS_CMD_WRITE_EXT) {
+		nak = handle_write_ext_cmd(buf[3], &(buf[DS_EXT_HEADER_LEN]), buf[4]);
+		send_write_ext_response(buf, nak);
 	}
 }
 
+/* Full length of the frame currently collected in the decoder */
+/* Extended frame length is known only after the payload length byte */
+static uint8_t frame_expected_len(void)
+{
+	if (frame_len < 3 || frame_buf[2] != DS_CMD_WRITE_EXT) {
+		return USB_PACKET_LEN;
+	}
+
+	if (frame_len < DS_EXT_HEADER_LEN) {
+		return DS_EXT_FRAME_LEN(0);
+	}
+
+	return DS_EXT_FRAME_LEN(frame_buf[4]);
+}
+
+/* Check that decoder buffer starts like a valid frame */
+static uint8_t frame_prefix_valid(void)
+{
+	if (frame_buf[0] != DS_HEADER_MAGIC1) {
+		return 0;
+	}
+
+	if (frame_len >= 2 && frame_buf[1] != DS_HEADER_MAGIC2) {
+		return 0;
+	}
+
+	/* Payload must fit the decoder buffer */
+	if (frame_len >= DS_EXT_HEADER_LEN && frame_buf[2] == DS_CMD_WRITE_EXT
+			&& frame_buf[4] > DS_EXT_MAX_PAYLOAD) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Drop the broken frame start and look for the next magic bytes */
+/* within already received data */
+static void frame_resync(void)
+{
+	uint8_t i;
+
+	do {
+		for (i = 1; i < frame_len; ++i) {
+			if (frame_buf[i] == DS_HEADER_MAGIC1) {
+				break;
+			}
+		}
+
+		memmove(frame_buf, frame_buf + i, frame_len - i);
+		frame_len -= i;
+	} while (frame_len && !frame_prefix_valid());
+}
+
+/* Streaming frame decoder */
+/* Transfer may contain any number of frames, incomplete frame */
+/* is kept in the decoder and continued by the next transfer */
+static void frame_decoder_feed(uint8_t* data, uint32_t len)
+{
+	uint8_t expected;
+
+	while (len--) {
+		frame_buf[frame_len++] = *data++;
+
+		if (!frame_prefix_valid()) {
+			/* Garbage between frames */
+			system_led_err_blink(3);
+			frame_resync();
+			continue;
+		}
+
+		/* Data left after the resync may hold a shorter frame */
+		while (frame_len && frame_len >= (expected = frame_expected_len())) {
+			/* Verify packet CRC8 checksum */
+			if (frame_buf[expected - 1] != crc8(frame_buf, expected - 1)) {
+				system_led_err_blink(4);
+				frame_resync();
+				continue;
+			}
+
+			/* Frame is reused for the response, so length is taken before */
+			handle_frame(frame_buf);
+
+			frame_len -= expected;
+			memmove(frame_buf, frame_buf + expected, frame_len);
+
+			if (frame_len && !frame_prefix_valid()) {
+				frame_resync();
+			}
+		}
+	}
+}
+
+/* Callback function for the usbd_cdc_if.c:CDC_Receive_FS */
+/* Only copy the data here, all the processing is done in the main loop */
+uint8_t handle_rx_data(uint8_t* buf, uint32_t *len)
+{
+	uint8_t head = rx_head;
+	uint8_t next = (head + 1) % RX_QUEUE_SLOTS;
+	uint32_t n = *len;
+
+	/* USB reception is paused when the queue is full, should never happen */
+	if (next == rx_tail) {
+		return 0;
+	}
+
+	if (n > CDC_DATA_FS_MAX_PACKET_SIZE) {
+		n = CDC_DATA_FS_MAX_PACKET_SIZE;
+	}
+
+	memcpy(rx_queue[head].data, buf, n);
+	rx_queue[head].len = n;
+
+	/* Publish the slot only after the data is written */
+	__DMB();
+	rx_head = next;
+
+	/* Keep one slot free for the next transfer */
+	return ((next + 1) % RX_QUEUE_SLOTS) != rx_tail;
+}
+
+/* Called from the main loop */
+void process_rx_data(void)
+{
+	uint8_t tail;
+
+	while ((tail = rx_tail) != rx_head) {
+		/* Leave the data in the queue until the host takes the responses */
+		/* Reception is paused when the queue is full, so host is throttled */
+		if (tx_ring_free() < TX_RESERVE_LEN) {
+			break;
+		}
+
+		frame_decoder_feed(rx_queue[tail].data, rx_queue[tail].len);
+
+		rx_tail = (tail + 1) % RX_QUEUE_SLOTS;
+
+		/* There is a room now, continue reception if it was paused */
+		CDC_Resume_Receive_FS();
+	}
+
+	/* Normally the queue is drained by handle_tx_complete() */
+	/* but the first transfer after idle is started here */
+	tx_kick();
+}
+
+/* Send unsolicited event frame to the host */
+uint8_t send_event(uint8_t id, const uint8_t *payload, uint8_t len)
+{
+	uint8_t buf[DS_EXT_FRAME_LEN(DS_EXT_MAX_PAYLOAD)];
+
+	if (len > DS_EXT_MAX_PAYLOAD) {
+		return 0;
+	}
+
+	/* Responses have priority, event waits for the free room */
+	if (tx_ring_free() < DS_EXT_FRAME_LEN(len) + TX_RESERVE_LEN) {
+		return 0;
+	}
+
+	buf[0] = DS_HEADER_MAGIC1;
+	buf[1] = DS_HEADER_MAGIC2;
+	buf[2] = DS_EVENT;
+	buf[3] = id;
+	buf[4] = len;
+	memcpy(&buf[DS_EXT_HEADER_LEN], payload, len);
+	buf[DS_EXT_HEADER_LEN + len] = crc8(buf, DS_EXT_HEADER_LEN + len);
+
+	tx_enqueue(buf, DS_EXT_FRAME_LEN(len));
+	tx_kick();
+
+	return 1;
+}
+
+/* Callback function for the usbd_cdc_if.c:CDC_TransmitCplt_FS */
+void handle_tx_complete(void)
+{
+	tx_flush();
+}
@@ -25,6 +25,7 @@
 /* USER CODE BEGIN INCLUDE */
 
 #include "usb_protocol.h"
+#include "boot_time.h"
 
 /* USER CODE END INCLUDE */
 
@@ -102,6 +103,9 @@ uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
 
+/* Set when the protocol queue is full and OUT endpoint is NAKing */
+static volatile uint8_t rx_paused = 0;
+
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -132,6 +136,7 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -146,7 +151,8 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -160,6 +166,10 @@ static int8_t CDC_Init_FS(void)
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+
+  /* Host has selected the configuration, the device is ready */
+  boot_time_mark(BOOT_STAGE_USB_CONFIGURED);
+
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -265,7 +275,13 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  handle_rx_data(Buf, Len);
+  /* Data is copied to the protocol queue, buffer can be reused */
+  if (!handle_rx_data(Buf, Len)) {
+    /* No room for the next transfer, host will be NAKed */
+    /* till the main loop calls CDC_Resume_Receive_FS */
+    rx_paused = 1;
+    return (USBD_OK);
+  }
 
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
   USBD_CDC_ReceivePacket(&hUsbDeviceFS);
@@ -289,6 +305,9 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
   USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  if (hcdc == NULL){
+    return USBD_FAIL;
+  }
   if (hcdc->TxState != 0){
     return USBD_BUSY;
   }
@@ -300,6 +319,49 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         Data transmitted callback, IN endpoint is free again.
+  *         Next portion of the queued responses is sent from here.
+  *
+  * @param  Buf: Buffer of data that was transmitted
+  * @param  Len: Number of data transmitted (in bytes)
+  * @param  epnum: Endpoint number
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
+{
+  UNUSED(Buf);
+  UNUSED(Len);
+  UNUSED(epnum);
+
+  handle_tx_complete();
+
+  return (USBD_OK);
+}
+
+/**
+  * @brief  CDC_Resume_Receive_FS
+  *         Re-arm OUT endpoint reception paused by CDC_Receive_FS.
+  *         Called from the main loop when the protocol queue has a free room.
+  * @retval None
+  */
+void CDC_Resume_Receive_FS(void)
+{
+  if (!rx_paused) {
+    return;
+  }
+
+  /* Don't race with the USB interrupt */
+  NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+
+  rx_paused = 0;
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+
+  NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+}
+
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
@@ -1,6 +1,6 @@
 /*
    voltage_reader.c
-    - Simple output voltages reader with ADC1 and DMA
+    - Output voltages reader with ADC1 and ADC2, DMA and averaging
 
    Copyright 2020  Oleg Kutkov <contact@olegkutkov.me>
 
@@ -24,15 +24,147 @@
 #include "stm32f1xx_ll_gpio.h"
 #include "stm32f1xx_ll_adc.h"
 #include "stm32f1xx_ll_dma.h"
+#include "stm32f1xx_ll_rcc.h"
+#include "stm32f1xx_ll_tim.h"
+#include "voltage_reader.h"
+#include "diseqc.h"
 
 #define ADC_DELAY_ENABLE_CALIB_CPU_CYCLES \
 			(LL_ADC_DELAY_ENABLE_CALIB_ADC_CYCLES * 32)
 
 #define VDDA_APPLI ((uint32_t)3300)
-#define DATA_SIZE 2 /* 2 channels */
+#define NUM_CHANNELS 2
 
-static volatile uint16_t adc_data[DATA_SIZE] = {0, 0};
-static volatile uint8_t dma_transfer_complete = 0;
+/* TIM3 triggers conversion of the both channels */
+/* 24 MHz timer clock / 1200 = ADC_SAMPLE_RATE_HZ */
+#define ADC_TRIG_TIMER_CLOCK_HZ 24000000UL
+#define ADC_TRIG_TIMER_ARR (ADC_TRIG_TIMER_CLOCK_HZ / ADC_SAMPLE_RATE_HZ - 1)
+
+/* Ripple statistics window, 4096 samples = 204.8 ms */
+#define ADC_STATS_WINDOW_LOG2 12
+
+/* Circular DMA buffer, processed by halves */
+/* ADC1 and ADC2 results are packed in one word, CH1 in the low half */
+/* so the buffer is the same CH1, CH2 pairs for the processing */
+#define ADC_BUF_SAMPLES (ADC_BLOCK_SAMPLES * 2) /* per channel */
+#define DATA_SIZE (ADC_BUF_SAMPLES * NUM_CHANNELS) /* 12 bit results */
+
+/* Averaged value has 4 extra fractional bits */
+#define ADC_AVG_FRAC_BITS 4
+/* 0.1 mV units of the ADC input voltage */
+#define ADC_AVG_VOLTAGE_SCALE (VDDA_APPLI * 10)
+
+static volatile uint32_t adc_data[ADC_BUF_SAMPLES];
+
+/* Boxcar decimator state, used only in the DMA interrupt */
+static uint32_t acc[NUM_CHANNELS];
+static uint32_t acc_count = 0;
+static uint8_t window_log2 = ADC_AVG_WINDOW_DEFAULT;
+
+/* Window requested from the main loop, applied on the next window boundary */
+static volatile uint8_t window_log2_req = ADC_AVG_WINDOW_DEFAULT;
+
+/* Decimator output, 12.4 fixed point ADC codes */
+struct adc_sample {
+	uint16_t avg[NUM_CHANNELS];
+};
+
+/* Double buffer: interrupt writes results[(seq + 1) & 1] and then increments seq */
+/* so results[seq & 1] is always the last completed sample */
+static volatile struct adc_sample results[2];
+static volatile uint32_t sample_seq = 0;
+
+/* Main loop copy of the last sample, taken on the CH1 read */
+static struct adc_sample latched;
+static uint8_t ch2_latched = 0;
+
+/* Ripple statistics of the one channel */
+struct adc_stats {
+	uint32_t sum;
+	uint64_t sum_sq;
+	uint16_t min;
+	uint16_t max;
+};
+
+/* Statistics accumulator, used only in the DMA interrupt */
+static struct adc_stats stats_acc[NUM_CHANNELS];
+static uint32_t stats_count = 0;
+
+/* Completed windows, double buffered like the averaged samples */
+static volatile struct adc_stats stats_results[2][NUM_CHANNELS];
+static volatile uint32_t stats_seq = 0;
+
+/* Main loop copy, taken on the STATS_MIN read */
+static struct adc_stats stats_latched[NUM_CHANNELS];
+
+/* Analog watchdog trip handler, see adc_watchdog_arm() */
+static adc_watchdog_trip_cb watchdog_trip_cb = NULL;
+
+/* Block monitor, see adc_block_monitor_set() */
+static volatile adc_block_cb block_monitor_cb = NULL;
+
+/* Raw samples monitor, see adc_raw_monitor_set() */
+static volatile adc_raw_cb raw_monitor_cb = NULL;
+
+/*
+ Tone detector. TIM2 (tone) and TIM3 (sampling) run from the same 24 MHz clock, so the
+ phase of the tone at every sample is known exactly from the timer periods, whatever the
+ sample rate is. Samples are multiplied by the reference sine and cosine of this phase
+ (lock-in), the tone is found at its aliased frequency without any extra conversions.
+ */
+
+/* Tone detector window, 2048 samples = 102.4 ms */
+#define TONE_WINDOW_LOG2 11
+
+/* One period of the reference, Q14 */
+#define TONE_TABLE_LOG2 6
+#define TONE_TABLE_SIZE (1 << TONE_TABLE_LOG2)
+#define TONE_TABLE_Q 14
+
+/* Window sums are scaled down before the squaring, so it fits 64 bit */
+#define TONE_PRODUCT_SHIFT 12
+
+/* Window sums to the peak-to-peak of the fundamental, 12.4 fixed point */
+/* pp = 4 * |sum| / (N * 2^Q) */
+#define TONE_LEVEL_SHIFT (TONE_WINDOW_LOG2 + TONE_TABLE_Q - TONE_PRODUCT_SHIFT - 2 - ADC_AVG_FRAC_BITS)
+
+/* Aliased tone must be 1/64 of the sample rate away from DC and the Nyquist frequency */
+#define TONE_ALIAS_GUARD (1UL << 26)
+
+static const int16_t tone_table[TONE_TABLE_SIZE] = {
+	0, 1606, 3196, 4756, 6270, 7723, 9102, 10394,
+	11585, 12665, 13623, 14449, 15137, 15679, 16069, 16305,
+	16383, 16305, 16069, 15679, 15137, 14449, 13623, 12665,
+	11585, 10394, 9102, 7723, 6270, 4756, 3196, 1606,
+	0, -1606, -3196, -4756, -6270, -7723, -9102, -10394,
+	-11585, -12665, -13623, -14449, -15137, -15679, -16069, -16305,
+	-16384, -16305, -16069, -15679, -15137, -14449, -13623, -12665,
+	-11585, -10394, -9102, -7723, -6270, -4756, -3196, -1606
+};
+
+/* Lock-in sums of the one channel */
+struct tone_acc {
+	int64_t sum_i;
+	int64_t sum_q;
+	uint32_t sum;
+};
+
+/* Detector state, used only in the DMA interrupt */
+static struct tone_acc tone_acc[NUM_CHANNELS];
+static int32_t tone_ref_i = 0;
+static int32_t tone_ref_q = 0;
+static uint32_t tone_count = 0;
+static uint32_t tone_phase = 0;
+
+/* Tone phase increment per sample, 2^32 is the tone period */
+static volatile uint32_t tone_step = 0;
+static volatile uint8_t tone_valid = 0;
+static volatile uint8_t tone_restart = 1;
+
+static volatile uint16_t tone_level[NUM_CHANNELS] = { ADC_TONE_LEVEL_INVALID, ADC_TONE_LEVEL_INVALID };
+
+static uint16_t avg_to_hires(uint16_t avg);
+static uint32_t isqrt64(uint64_t v);
 
 /* */
 
@@ -41,42 +173,76 @@ static void init_adc(void)
 	LL_ADC_InitTypeDef ADC_InitStruct = {0};
 	LL_ADC_CommonInitTypeDef ADC_CommonInitStruct = {0};
 	LL_ADC_REG_InitTypeDef ADC_REG_InitStruct = {0};
+	LL_ADC_REG_InitTypeDef ADC2_REG_InitStruct = {0};
 
 	LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
 
+	/* ADC clock must not exceed 14 MHz, 48 MHz PCLK2 / 4 = 12 MHz */
+	LL_RCC_SetADCClockSource(LL_RCC_ADC_CLKSRC_PCLK2_DIV_4);
+
 	/* Peripheral clock enable */
 	LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_ADC1);
-  
+	LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_ADC2);
+
 	LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_GPIOA);
 
-	/* ADC1 GPIO Configuration  
+	/* ADC GPIO Configuration
 		PA2   ------> ADC1_IN2
-		PA3   ------> ADC1_IN3 
+		PA3   ------> ADC2_IN3
 	*/
 	GPIO_InitStruct.Pin = LL_GPIO_PIN_2|LL_GPIO_PIN_3;
 	GPIO_InitStruct.Mode = LL_GPIO_MODE_ANALOG;
 	LL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
-	/* Common config */
+	/* Common config, one channel per ADC */
 	ADC_InitStruct.DataAlignment = LL_ADC_DATA_ALIGN_RIGHT;
-	ADC_InitStruct.SequencersScanMode = LL_ADC_SEQ_SCAN_ENABLE;
+	ADC_InitStruct.SequencersScanMode = LL_ADC_SEQ_SCAN_DISABLE;
 	LL_ADC_Init(ADC1, &ADC_InitStruct);
-	ADC_CommonInitStruct.Multimode = LL_ADC_MULTI_INDEPENDENT;
+	LL_ADC_Init(ADC2, &ADC_InitStruct);
+
+	/* Regular simultaneous mode, both channels are sampled at the same instant */
+	ADC_CommonInitStruct.Multimode = LL_ADC_MULTI_DUAL_REG_SIMULT;
 	LL_ADC_CommonInit(__LL_ADC_COMMON_INSTANCE(ADC1), &ADC_CommonInitStruct);
-	ADC_REG_InitStruct.TriggerSource = LL_ADC_REG_TRIG_SOFTWARE;
-	ADC_REG_InitStruct.SequencerLength = LL_ADC_REG_SEQ_SCAN_ENABLE_2RANKS;
+
+	/* ADC1 is the master, started by TIM3, its DMA moves the both results */
+	ADC_REG_InitStruct.TriggerSource = LL_ADC_REG_TRIG_EXT_TIM3_TRGO;
+	ADC_REG_InitStruct.SequencerLength = LL_ADC_REG_SEQ_SCAN_DISABLE;
 	ADC_REG_InitStruct.SequencerDiscont = LL_ADC_REG_SEQ_DISCONT_DISABLE;
-	ADC_REG_InitStruct.ContinuousMode = LL_ADC_REG_CONV_CONTINUOUS;
+	ADC_REG_InitStruct.ContinuousMode = LL_ADC_REG_CONV_SINGLE;
 	ADC_REG_InitStruct.DMATransfer = LL_ADC_REG_DMA_TRANSFER_UNLIMITED;
 	LL_ADC_REG_Init(ADC1, &ADC_REG_InitStruct);
 
-	/* Configure Regular Channel */
+	/* ADC2 is the slave, software trigger prevents the spurious starts */
+	ADC2_REG_InitStruct.TriggerSource = LL_ADC_REG_TRIG_SOFTWARE;
+	ADC2_REG_InitStruct.SequencerLength = LL_ADC_REG_SEQ_SCAN_DISABLE;
+	ADC2_REG_InitStruct.SequencerDiscont = LL_ADC_REG_SEQ_DISCONT_DISABLE;
+	ADC2_REG_InitStruct.ContinuousMode = LL_ADC_REG_CONV_SINGLE;
+	ADC2_REG_InitStruct.DMATransfer = LL_ADC_REG_DMA_TRANSFER_NONE;
+	LL_ADC_REG_Init(ADC2, &ADC2_REG_InitStruct);
+
+	/* Configure Regular Channels, the same sampling time keeps them in sync */
 	LL_ADC_REG_SetSequencerRanks(ADC1, LL_ADC_REG_RANK_1, LL_ADC_CHANNEL_2);
 	LL_ADC_SetChannelSamplingTime(ADC1, LL_ADC_CHANNEL_2, LL_ADC_SAMPLINGTIME_71CYCLES_5);
 
-	/** Configure Regular Channel */
-	LL_ADC_REG_SetSequencerRanks(ADC1, LL_ADC_REG_RANK_2, LL_ADC_CHANNEL_3);
-	LL_ADC_SetChannelSamplingTime(ADC1, LL_ADC_CHANNEL_3, LL_ADC_SAMPLINGTIME_71CYCLES_5);
+	LL_ADC_REG_SetSequencerRanks(ADC2, LL_ADC_REG_RANK_1, LL_ADC_CHANNEL_3);
+	LL_ADC_SetChannelSamplingTime(ADC2, LL_ADC_CHANNEL_3, LL_ADC_SAMPLINGTIME_71CYCLES_5);
+}
+
+/* Sampling clock, TIM3 update event starts the conversion of the both channels */
+static void init_trigger_timer(void)
+{
+	LL_TIM_InitTypeDef TIM_InitStruct = {0};
+
+	LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_TIM3);
+
+	TIM_InitStruct.Prescaler = 0;
+	TIM_InitStruct.CounterMode = LL_TIM_COUNTERMODE_UP;
+	TIM_InitStruct.Autoreload = ADC_TRIG_TIMER_ARR;
+	TIM_InitStruct.ClockDivision = LL_TIM_CLOCKDIVISION_DIV1;
+	LL_TIM_Init(TIM3, &TIM_InitStruct);
+	LL_TIM_SetClockSource(TIM3, LL_TIM_CLOCKSOURCE_INTERNAL);
+	LL_TIM_SetTriggerOutput(TIM3, LL_TIM_TRGO_UPDATE);
+	LL_TIM_DisableMasterSlaveMode(TIM3);
 }
 
 static void init_dma(void)
@@ -94,28 +260,234 @@ static void init_dma(void)
 	LL_DMA_SetMode(DMA1, LL_DMA_CHANNEL_1, LL_DMA_MODE_CIRCULAR);
 	LL_DMA_SetPeriphIncMode(DMA1, LL_DMA_CHANNEL_1, LL_DMA_PERIPH_NOINCREMENT);
 	LL_DMA_SetMemoryIncMode(DMA1, LL_DMA_CHANNEL_1, LL_DMA_MEMORY_INCREMENT);
-	LL_DMA_SetPeriphSize(DMA1, LL_DMA_CHANNEL_1, LL_DMA_PDATAALIGN_HALFWORD);
-	LL_DMA_SetMemorySize(DMA1, LL_DMA_CHANNEL_1, LL_DMA_MDATAALIGN_HALFWORD);
+	LL_DMA_SetPeriphSize(DMA1, LL_DMA_CHANNEL_1, LL_DMA_PDATAALIGN_WORD);
+	LL_DMA_SetMemorySize(DMA1, LL_DMA_CHANNEL_1, LL_DMA_MDATAALIGN_WORD);
 
-	/* Set destination memory address */
-	LL_DMA_ConfigAddresses(DMA1, LL_DMA_CHANNEL_1, LL_ADC_DMA_GetRegAddr(ADC1, LL_ADC_DMA_REG_REGULAR_DATA)
+	/* Set destination memory address, ADC1 DR holds the both results in the dual mode */
+	LL_DMA_ConfigAddresses(DMA1, LL_DMA_CHANNEL_1, LL_ADC_DMA_GetRegAddr(ADC1, LL_ADC_DMA_REG_REGULAR_DATA_MULTI)
 								, (uint32_t)&adc_data, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);	
 
-	/* Set desitnation buffer size (num of the channels) */
-	LL_DMA_SetDataLength(DMA1,LL_DMA_CHANNEL_1, DATA_SIZE);	
+	/* Set desitnation buffer size (one word per samples pair) */
+	LL_DMA_SetDataLength(DMA1,LL_DMA_CHANNEL_1, ADC_BUF_SAMPLES);	
 
-	/* Enable DMA transfer complete interrupt */
+	/* Enable DMA half and full transfer complete interrupts */
+	LL_DMA_EnableIT_HT(DMA1, LL_DMA_CHANNEL_1);
 	LL_DMA_EnableIT_TC(DMA1, LL_DMA_CHANNEL_1);
 
 	LL_DMA_EnableChannel(DMA1,LL_DMA_CHANNEL_1);
 }
 
-/* DMA interrupt callback 
+/* Accumulate half of the DMA buffer into the decimator */
+/* Min, max, sum and sum of squares of the one channel */
+/* Half of the buffer is 16 samples, so the squares fit 32 bit */
+static uint32_t accumulate_channel(const volatile uint16_t *data, struct adc_stats *st)
+{
+	uint32_t sum = 0, sum_sq = 0;
+	uint16_t v;
+	uint8_t i;
+
+	for (i = 0; i < DATA_SIZE / 2; i += NUM_CHANNELS) {
+		v = data[i];
+
+		sum += v;
+		sum_sq += (uint32_t) v * v;
+
+		if (v < st->min) {
+			st->min = v;
+		}
+
+		if (v > st->max) {
+			st->max = v;
+		}
+	}
+
+	st->sum += sum;
+	st->sum_sq += sum_sq;
+
+	return sum;
+}
+
+/* Publish the statistics window and start a new one */
+static void publish_stats(void)
+{
+	volatile struct adc_stats *res = stats_results[(stats_seq + 1) & 1];
+	uint8_t ch;
+
+	for (ch = 0; ch < NUM_CHANNELS; ++ch) {
+		res[ch].sum = stats_acc[ch].sum;
+		res[ch].sum_sq = stats_acc[ch].sum_sq;
+		res[ch].min = stats_acc[ch].min;
+		res[ch].max = stats_acc[ch].max;
+
+		stats_acc[ch].sum = 0;
+		stats_acc[ch].sum_sq = 0;
+		stats_acc[ch].min = 0xFFFF;
+		stats_acc[ch].max = 0;
+	}
+
+	__DMB();
+	stats_seq++;
+
+	stats_count = 0;
+}
+
+/* Phase step of the new sampling period, TIM3 ticks. Window is restarted */
+static void tone_set_sample_period(uint32_t period)
+{
+	uint32_t step = (uint32_t) (((uint64_t) (period % TONE_TIMER_PERIOD) << 32) / TONE_TIMER_PERIOD);
+	uint32_t folded = (step <= 0x80000000UL) ? step : 0 - step;
+
+	tone_step = step;
+	tone_valid = (folded >= TONE_ALIAS_GUARD && 0x80000000UL - folded >= TONE_ALIAS_GUARD);
+	tone_restart = 1;
+}
+
+/* Level of the completed window: DC is removed with the sums of the references */
+static uint16_t tone_window_level(const struct tone_acc *acc)
+{
+	int64_t i = acc->sum_i - (((int64_t) acc->sum * tone_ref_i) >> TONE_WINDOW_LOG2);
+	int64_t q = acc->sum_q - (((int64_t) acc->sum * tone_ref_q) >> TONE_WINDOW_LOG2);
+	uint32_t pp;
+
+	i >>= TONE_PRODUCT_SHIFT;
+	q >>= TONE_PRODUCT_SHIFT;
+
+	pp = isqrt64((uint64_t) (i * i) + (uint64_t) (q * q)) >> TONE_LEVEL_SHIFT;
+
+	return avg_to_hires(pp > 0xFFFF ? 0xFFFF : pp);
+}
+
+/* Lock-in of the half buffer. Block sums fit 32 bit: 16 * 4095 * 2^14 < 2^31 */
+static void tone_accumulate(const volatile uint16_t *data)
+{
+	int32_t sum_i[NUM_CHANNELS] = { 0 };
+	int32_t sum_q[NUM_CHANNELS] = { 0 };
+	uint32_t sum[NUM_CHANNELS] = { 0 };
+	uint32_t phase, step = tone_step;
+	int32_t c, s;
+	uint16_t v;
+	uint8_t i, ch;
+
+	if (tone_restart) {
+		memset(tone_acc, 0, sizeof(tone_acc));
+		tone_ref_i = 0;
+		tone_ref_q = 0;
+		tone_count = 0;
+		tone_restart = 0;
+	}
+
+	phase = tone_phase;
+
+	for (i = 0; i < DATA_SIZE / 2; i += NUM_CHANNELS) {
+		s = tone_table[phase >> (32 - TONE_TABLE_LOG2)];
+		c = tone_table[((phase >> (32 - TONE_TABLE_LOG2)) + TONE_TABLE_SIZE / 4) & (TONE_TABLE_SIZE - 1)];
+
+		tone_ref_i += c;
+		tone_ref_q += s;
+
+		for (ch = 0; ch < NUM_CHANNELS; ++ch) {
+			v = data[i + ch];
+			sum_i[ch] += v * c;
+			sum_q[ch] += v * s;
+			sum[ch] += v;
+		}
+
+		phase += step;
+	}
+
+	tone_phase = phase;
+
+	for (ch = 0; ch < NUM_CHANNELS; ++ch) {
+		tone_acc[ch].sum_i += sum_i[ch];
+		tone_acc[ch].sum_q += sum_q[ch];
+		tone_acc[ch].sum += sum[ch];
+	}
+
+	tone_count += ADC_BUF_SAMPLES / 2;
+
+	if (tone_count < (1UL << TONE_WINDOW_LOG2)) {
+		return;
+	}
+
+	for (ch = 0; ch < NUM_CHANNELS; ++ch) {
+		tone_level[ch] = tone_valid ? tone_window_level(&tone_acc[ch]) : ADC_TONE_LEVEL_INVALID;
+	}
+
+	tone_restart = 1;
+}
+
+/* Sum of the half buffer samples to 0.1 mV, fits 32 bit */
+static uint16_t block_to_hires(uint32_t sum)
+{
+	return (sum * ADC_AVG_VOLTAGE_SCALE) / (__LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B) * (ADC_BUF_SAMPLES / 2));
+}
+
+/* Accumulate half of the DMA buffer into the decimator and statistics */
+static void process_samples(const volatile uint16_t *data)
+{
+	volatile struct adc_sample *res;
+	adc_block_cb block_cb = block_monitor_cb;
+	adc_raw_cb raw_cb = raw_monitor_cb;
+	uint32_t sum[NUM_CHANNELS];
+	uint16_t block[NUM_CHANNELS];
+
+	/* Half of the buffer is not overwritten until the next interrupt */
+	if (raw_cb) {
+		raw_cb(data);
+	}
+
+	sum[0] = accumulate_channel(&data[0], &stats_acc[0]);
+	sum[1] = accumulate_channel(&data[1], &stats_acc[1]);
+
+	tone_accumulate(data);
+
+	if (block_cb) {
+		block[0] = block_to_hires(sum[0]);
+		block[1] = block_to_hires(sum[1]);
+		block_cb(block);
+	}
+
+	acc[0] += sum[0];
+	acc[1] += sum[1];
+	acc_count += ADC_BUF_SAMPLES / 2;
+	stats_count += ADC_BUF_SAMPLES / 2;
+
+	if (stats_count >= (1UL << ADC_STATS_WINDOW_LOG2)) {
+		publish_stats();
+	}
+
+	/* Window is never shorter than a half of the buffer */
+	if (acc_count < (1UL << window_log2)) {
+		return;
+	}
+
+	res = &results[(sample_seq + 1) & 1];
+
+	res->avg[0] = acc[0] >> (window_log2 - ADC_AVG_FRAC_BITS);
+	res->avg[1] = acc[1] >> (window_log2 - ADC_AVG_FRAC_BITS);
+
+	/* Publish the sample only after it is written */
+	__DMB();
+	sample_seq++;
+
+	acc[0] = 0;
+	acc[1] = 0;
+	acc_count = 0;
+
+	window_log2 = window_log2_req;
+}
+
+/* DMA interrupt callbacks
     see stm32f1xx_it.c
  */
+void dma_half_transfer_cb(void)
+{
+	process_samples((const volatile uint16_t *) &adc_data[0]);
+}
+
 void dma_transfer_complete_cb(void)
 {
-	dma_transfer_complete = 1;
+	process_samples((const volatile uint16_t *) &adc_data[ADC_BUF_SAMPLES / 2]);
 }
 
 void adc_calibrate_and_run(void)
@@ -123,6 +495,7 @@ void adc_calibrate_and_run(void)
 	uint32_t wait_loop_index = ADC_DELAY_ENABLE_CALIB_CPU_CYCLES >> 1;
 
 	LL_ADC_Enable(ADC1);
+	LL_ADC_Enable(ADC2);
 
 	/* Give ADC some time to settle down */
 	while (!wait_loop_index) {
@@ -131,42 +504,316 @@ void adc_calibrate_and_run(void)
 
 	/* Run self-calibration */
 	LL_ADC_StartCalibration(ADC1);
+	LL_ADC_StartCalibration(ADC2);
 
 	/* Wait for self-calibration done */
-	while (LL_ADC_IsCalibrationOnGoing(ADC1)) {
+	while (LL_ADC_IsCalibrationOnGoing(ADC1) || LL_ADC_IsCalibrationOnGoing(ADC2)) {
 	}
 
-	/* Trigger conversion */
-	LL_ADC_REG_StartConversionSWStart(ADC1);
+	/* Conversions are started by the TIM3 update events, ADC2 follows ADC1 */
+	LL_ADC_REG_StartConversionExtTrig(ADC2, LL_ADC_REG_TRIG_EXT_RISING);
+	LL_ADC_REG_StartConversionExtTrig(ADC1, LL_ADC_REG_TRIG_EXT_RISING);
+	LL_TIM_EnableCounter(TIM3);
 }
 
 /* Module entry point */
 void init_voltage_reader(void)
 {
+	uint8_t ch;
+
+	for (ch = 0; ch < NUM_CHANNELS; ++ch) {
+		stats_acc[ch].min = 0xFFFF;
+	}
+
+	tone_set_sample_period(ADC_TRIG_TIMER_ARR + 1);
+
+	init_trigger_timer();
 	init_dma();
 	init_adc();
+
+	/* Analog watchdog interrupt, must be handled as fast as possible */
+	NVIC_SetPriority(ADC1_2_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+	NVIC_EnableIRQ(ADC1_2_IRQn);
+
 	adc_calibrate_and_run();
 }
 
-uint16_t get_ch1_voltage(void)
+/* Averaged value to mV */
+static uint16_t avg_to_mv(uint16_t avg)
 {
-	/* Wait for DMA data transfer complete */
-	while (!dma_transfer_complete) {
+	return ((uint32_t) avg * VDDA_APPLI) / (__LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B) << ADC_AVG_FRAC_BITS);
+}
+
+/* ADC code to 0.1 mV */
+static uint16_t code_to_hires(uint32_t code)
+{
+	return (code * ADC_AVG_VOLTAGE_SCALE) / __LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B);
+}
+
+/* Averaged value to 0.1 mV, 12.4 fixed point keeps 32 bit math */
+static uint16_t avg_to_hires(uint16_t avg)
+{
+	return ((uint32_t) avg * ADC_AVG_VOLTAGE_SCALE) / (__LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B) << ADC_AVG_FRAC_BITS);
+}
+
+/* Copy the last completed sample without blocking */
+/* Retry if DMA interrupt has published a new one during the copy */
+static void latch_sample(void)
+{
+	uint32_t seq;
+
+	do {
+		seq = sample_seq;
+		__DMB();
+		latched.avg[0] = results[seq & 1].avg[0];
+		latched.avg[1] = results[seq & 1].avg[1];
+		__DMB();
+	} while (seq != sample_seq);
+
+	ch2_latched = 1;
+}
+
+/* CH1 read takes a new sample, the next CH2 read returns the same one */
+/* So the host always gets a consistent pair with two requests */
+static uint16_t ch1_avg(void)
+{
+	latch_sample();
+
+	return latched.avg[0];
+}
+
+static uint16_t ch2_avg(void)
+{
+	if (!ch2_latched) {
+		latch_sample();
 	}
 
-	dma_transfer_complete = 0;
+	ch2_latched = 0;
 
-	return __LL_ADC_CALC_DATA_TO_VOLTAGE(VDDA_APPLI, adc_data[0], LL_ADC_RESOLUTION_12B);
+	return latched.avg[1];
+}
+
+uint16_t get_ch1_voltage(void)
+{
+	return avg_to_mv(ch1_avg());
 }
 
 uint16_t get_ch2_voltage(void)
 {
-	/* Wait for DMA data transfer complete */
-	while (!dma_transfer_complete) {
+	return avg_to_mv(ch2_avg());
+}
+
+uint16_t get_ch1_voltage_hires(void)
+{
+	return avg_to_hires(ch1_avg());
+}
+
+uint16_t get_ch2_voltage_hires(void)
+{
+	return avg_to_hires(ch2_avg());
+}
+
+void adc_block_monitor_set(adc_block_cb block_cb)
+{
+	block_monitor_cb = block_cb;
+}
+
+void adc_raw_monitor_set(adc_raw_cb raw_cb)
+{
+	raw_monitor_cb = raw_cb;
+}
+
+/* New period starts from the next update, the counter is restarted */
+/* so it never runs past the shorter period up to the 16 bit overflow */
+uint32_t adc_set_sample_rate(uint32_t rate_hz)
+{
+	uint32_t period = (ADC_TRIG_TIMER_CLOCK_HZ + rate_hz / 2) / rate_hz;
+
+	if (period < 2) {
+		period = 2;
+	} else if (period > 0x10000) {
+		period = 0x10000;
+	}
+
+	LL_TIM_SetAutoReload(TIM3, period - 1);
+	LL_TIM_SetCounter(TIM3, 0);
+
+	tone_set_sample_period(period);
+
+	return ADC_TRIG_TIMER_CLOCK_HZ / period;
+}
+
+uint16_t get_tone_level(uint8_t channel)
+{
+	return channel < NUM_CHANNELS ? tone_level[channel] : ADC_TONE_LEVEL_INVALID;
+}
+
+/* Number of the completed samples since start */
+uint32_t get_sample_counter(void)
+{
+	return sample_seq;
+}
+
+/* Set averaging window, 2^window_log2 samples per channel */
+void set_avg_window(uint8_t log2_samples)
+{
+	if (log2_samples < ADC_AVG_WINDOW_MIN) {
+		log2_samples = ADC_AVG_WINDOW_MIN;
+	} else if (log2_samples > ADC_AVG_WINDOW_MAX) {
+		log2_samples = ADC_AVG_WINDOW_MAX;
+	}
+
+	window_log2_req = log2_samples;
+}
+
+uint8_t get_avg_window(void)
+{
+	return window_log2_req;
+}
+
+/* 0.1 mV to ADC code */
+static uint16_t hires_to_code(uint16_t v)
+{
+	uint32_t code = ((uint32_t) v * __LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B)) / ADC_AVG_VOLTAGE_SCALE;
+
+	if (code > __LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B)) {
+		code = __LL_ADC_DIGITAL_SCALE(LL_ADC_RESOLUTION_12B);
+	}
+
+	return code;
+}
+
+/* Analog watchdog of the one ADC, it converts only its channel */
+static void watchdog_arm(ADC_TypeDef *adc, uint16_t low_code, uint16_t high_code)
+{
+	LL_ADC_SetAnalogWDThresholds(adc, LL_ADC_AWD_THRESHOLD_LOW, low_code);
+	LL_ADC_SetAnalogWDThresholds(adc, LL_ADC_AWD_THRESHOLD_HIGH, high_code);
+	LL_ADC_SetAnalogWDMonitChannels(adc, LL_ADC_AWD_ALL_CHANNELS_REG);
+
+	LL_ADC_ClearFlag_AWD1(adc);
+	LL_ADC_EnableIT_AWD1(adc);
+}
+
+/* Watch the both channels with the analog watchdogs of ADC1 and ADC2 */
+/* Thresholds are 0.1 mV, trip_cb is called from the ADC interrupt */
+void adc_watchdog_arm(uint16_t low, uint16_t high, adc_watchdog_trip_cb trip_cb)
+{
+	adc_watchdog_disarm();
+
+	watchdog_trip_cb = trip_cb;
+
+	watchdog_arm(ADC1, hires_to_code(low), hires_to_code(high));
+	watchdog_arm(ADC2, hires_to_code(low), hires_to_code(high));
+}
+
+void adc_watchdog_disarm(void)
+{
+	LL_ADC_DisableIT_AWD1(ADC1);
+	LL_ADC_DisableIT_AWD1(ADC2);
+	LL_ADC_SetAnalogWDMonitChannels(ADC1, LL_ADC_AWD_DISABLE);
+	LL_ADC_SetAnalogWDMonitChannels(ADC2, LL_ADC_AWD_DISABLE);
+}
+
+/* ADC interrupt callback, channel is 0-based (ADC1 or ADC2 watchdog)
+    see stm32f1xx_it.c
+ */
+void adc_watchdog_cb(uint8_t channel)
+{
+	uint16_t code = LL_ADC_REG_ReadConversionData12(channel ? ADC2 : ADC1);
+
+	/* One shot, must be armed again */
+	adc_watchdog_disarm();
+
+	if (watchdog_trip_cb) {
+		watchdog_trip_cb(channel, code_to_hires(code));
 	}
+}
 
-	dma_transfer_complete = 0;
+/* Integer square root */
+static uint32_t isqrt64(uint64_t v)
+{
+	uint64_t res = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > v) {
+		bit >>= 2;
+	}
 
-	return __LL_ADC_CALC_DATA_TO_VOLTAGE(VDDA_APPLI, adc_data[1], LL_ADC_RESOLUTION_12B);
+	while (bit) {
+		if (v >= res + bit) {
+			v -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return (uint32_t) res;
+}
+
+/* Copy the last completed statistics window */
+static void latch_stats(void)
+{
+	uint32_t seq;
+	uint8_t ch;
+
+	do {
+		seq = stats_seq;
+		__DMB();
+
+		for (ch = 0; ch < NUM_CHANNELS; ++ch) {
+			stats_latched[ch].sum = stats_results[seq & 1][ch].sum;
+			stats_latched[ch].sum_sq = stats_results[seq & 1][ch].sum_sq;
+			stats_latched[ch].min = stats_results[seq & 1][ch].min;
+			stats_latched[ch].max = stats_results[seq & 1][ch].max;
+		}
+
+		__DMB();
+	} while (seq != stats_seq);
 }
 
+/* Ripple statistics of the last window, 0.1 mV of the ADC input */
+/* STATS_MIN read takes a new window, other values are returned from the same one */
+uint16_t get_voltage_stats(uint8_t channel, uint8_t stat)
+{
+	const struct adc_stats *st;
+	uint64_t mean_sq, var;
+	uint32_t mean;
+
+	if (channel >= NUM_CHANNELS) {
+		return 0;
+	}
+
+	if (stat == ADC_STATS_MIN) {
+		latch_stats();
+	}
+
+	st = &stats_latched[channel];
+
+	switch (stat) {
+		case ADC_STATS_MIN:
+			return code_to_hires(st->min);
+
+		case ADC_STATS_MAX:
+			return code_to_hires(st->max);
+
+		case ADC_STATS_MEAN:
+			/* 12.4 fixed point */
+			mean = st->sum >> (ADC_STATS_WINDOW_LOG2 - ADC_AVG_FRAC_BITS);
+			return avg_to_hires(mean);
+
+		case ADC_STATS_RMS:
+			/* Variance = E[x^2] - E[x]^2, in 12.4 fixed point */
+			mean = st->sum >> (ADC_STATS_WINDOW_LOG2 - ADC_AVG_FRAC_BITS);
+			mean_sq = st->sum_sq << (2 * ADC_AVG_FRAC_BITS);
+			mean_sq >>= ADC_STATS_WINDOW_LOG2;
+			var = (uint64_t) mean * mean;
+			var = (mean_sq > var) ? mean_sq - var : 0;
+			return avg_to_hires(isqrt64(var));
+
+		default:
+			return 0;
+	}
+}